@@ -70,7 +70,7 @@ static void WriteHelp()
 	Console::WriteLine("Converts GIF, BMP and TGA files to optimized PNG files.");
 	Console::WriteLine("Optimizes and cleans PNG files.");
 	Console::WriteLine("");
-	Console::WriteLine("Usage:  pngoptimizercl (FILE [FILE2 [FILE3...]] | -file:\"yourfile.png\" | -stdio) [-recurs]");
+	Console::WriteLine("Usage:  pngoptimizercl (FILE [FILE2 [FILE3...]] | -file:\"yourfile.png\" | -stdio) [-recurs] [-jobs:N] [-order:size|name|none] [-prefetch:MiB] [-max-memory:MiB]");
 	POEngineSettings::WriteArgvUsage("  ");
 	Console::WriteLine("");
 	Console::WriteLine("-file option specifies a file pattern to match files to be read from and written to.");
@@ -78,6 +78,16 @@ static void WriteHelp()
 	Console::WriteLine("-stdio option specifies that the input will be read from stdin and the");
 	Console::WriteLine("       result will be written to stdout.");
 	Console::WriteLine("-recurs is valid only if the -file option is specified.");
+	Console::WriteLine("-jobs option specifies how many files are optimized at the same time.");
+	Console::WriteLine("      Default is 1. Messages are still written in the file order.");
+	Console::WriteLine("-order option specifies the order of the files: size for the biggest files first,");
+	Console::WriteLine("       name for the files sorted by path, none for the order of the directories (default).");
+	Console::WriteLine("       With size, jobs finish closer to each other.");
+	Console::WriteLine("-prefetch option specifies how many MiB can be used to read the next files in advance.");
+	Console::WriteLine("          Default is 0 (no prefetch). Useful with slow storage.");
+	Console::WriteLine("-max-memory option specifies how many MiB the images optimized at the same time can use.");
+	Console::WriteLine("            Default is 0 (no limit). An image too big for the limit is optimized alone,");
+	Console::WriteLine("            with a single compression trial.");
 	Console::WriteLine("");
 	Console::WriteLine("Values enclosed with [] are optional.");
 	Console::WriteLine("Chunk option meaning: R=Remove, K=Keep, F=Force. 0|1|2 can be used too.");
@@ -155,6 +165,57 @@ int main(int argc, char** argv)
 
 	engine.m_settings.LoadFromArgv(ap);
 
+	if( ap.HasFlag("jobs") )
+	{
+		int jobCount = ap.GetFlagInt("jobs");
+		if( jobCount < 1 )
+		{
+			Console::Stderr().WriteLine("Invalid job count: " + ap.GetFlagString("jobs"));
+			return 1;
+		}
+		engine.SetJobCount(jobCount);
+	}
+
+	if( ap.HasFlag("order") )
+	{
+		String order = ap.GetFlagString("order");
+		if( order == "size" )
+		{
+			engine.SetBatchOrder(POEngine::BO_Size);
+		}
+		else if( order == "name" )
+		{
+			engine.SetBatchOrder(POEngine::BO_Name);
+		}
+		else if( order != "none" )
+		{
+			Console::Stderr().WriteLine("Invalid order: " + order);
+			return 1;
+		}
+	}
+
+	if( ap.HasFlag("prefetch") )
+	{
+		int prefetchMiB = ap.GetFlagInt("prefetch");
+		if( prefetchMiB < 0 )
+		{
+			Console::Stderr().WriteLine("Invalid prefetch size: " + ap.GetFlagString("prefetch"));
+			return 1;
+		}
+		engine.SetPrefetchBudget(int64(prefetchMiB) * 1024 * 1024);
+	}
+
+	if( ap.HasFlag("max-memory") )
+	{
+		int maxMemoryMiB = ap.GetFlagInt("max-memory");
+		if( maxMemoryMiB < 0 )
+		{
+			Console::Stderr().WriteLine("Invalid memory size: " + ap.GetFlagString("max-memory"));
+			return 1;
+		}
+		engine.SetMemoryBudget(int64(maxMemoryMiB) * 1024 * 1024);
+	}
+
 	//////////////////////////////////////////////////////////////////
 	if( !argFilePaths.IsEmpty() )
 	{
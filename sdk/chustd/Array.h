@@ -168,6 +168,9 @@ public:
 	// Makes a copy of another array
 	Array<T>& operator = (const Array<T>& arr);
 
+	// Takes the elements of another array, which becomes empty
+	Array<T>& operator = (Array<T>&& arr);
+
 protected:
 	T*  m_paTs;      // 'T' buffer
 	int m_count;     // Number of elements in the array
@@ -292,7 +295,7 @@ void Array<T>::Swap(Array<T>& aFriend)
 
 	// Swap m_capacity
 	tmp = m_capacity;
-	m_capacity = aFriend;
+	m_capacity = aFriend.m_capacity;
 	aFriend.m_capacity = tmp;
 
 	// Swap buffers
@@ -350,6 +353,17 @@ Array<T>& Array<T>::operator = (const Array<T>& arr)
 	return *this;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+template <class T>
+Array<T>& Array<T>::operator = (Array<T>&& arr)
+{
+	if( this != &arr )
+	{
+		arr.MoveTo(*this);
+	}
+	return *this;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Adds an empty element at the end of the array
 // Returns the index of the added element, -1 upon error
@@ -10,26 +10,26 @@
 namespace chustd {\
 
 ///////////////////////////////////////////////////////////////////////////////
-// Increments an integer as an atomic operation
+// Increments an integer as an atomic operation, returns the new value
 ///////////////////////////////////////////////////////////////////////////////
 int32 Atomic::Increment(int32* pVal)
 {
 #if defined(_WIN32)
 	return ::InterlockedIncrement((LONG*)pVal);
 #elif defined(__GNUC__)
-	return __sync_fetch_and_add(pVal, 1);
+	return __sync_add_and_fetch(pVal, 1);
 #endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Increments an integer as an atomic operation
+// Decrements an integer as an atomic operation, returns the new value
 ///////////////////////////////////////////////////////////////////////////////
 int32 Atomic::Decrement(int32* pVal)
 {
 #if defined(_WIN32)
 	return ::InterlockedDecrement((LONG*)pVal);
 #elif defined(__GNUC__)
-	return __sync_fetch_and_sub(pVal, 1);
+	return __sync_sub_and_fetch(pVal, 1);
 #endif
 }
 
@@ -134,6 +134,14 @@ bool Bmp::LoadFromFile(IFile& file)
 		m_height = -m_height;
 	}
 
+	// The buffers of the decoding have rows of 4 bytes per pixel at most
+	int32 maxBufferSize = 0;
+	if( !ImageFormat::ComputeBufferSize(int64(m_width) * 4 + 4, m_height, maxBufferSize) )
+	{
+		m_lastError = imageTooBig;
+		return false;
+	}
+
 	if( bh.compression > compBitfields )
 	{
 		m_lastError = errUnsupportedCompressionFormat;
@@ -8,6 +8,7 @@
 #include "Buffer.h"
 
 #include "Atomic.h"
+#include "MemoryArena.h"
 
 using namespace chustd;
 
@@ -16,6 +17,7 @@ struct BufferData
 {
 	int32 refCount;
 	int32 size;      // Size of the data below
+	MemoryArena* pArena; // Where the struct was allocated, nullptr for the heap
 	uint8  bytes[8];
 
 	void Ref()
@@ -28,33 +30,46 @@ struct BufferData
 		int32 result = Atomic::Decrement(&refCount);
 		if( result == 0 )
 		{
-			Memory::Free(this);
+			Memory::Free(this, pArena);
 		}
 	}
 
-	static uint8* Alloc(int dataSize)
+	static uint8* Alloc(int dataSize, MemoryArena* pArena)
 	{
 		int allocSize = GetAllocSize(dataSize);
-		BufferData* pData = (BufferData*)Memory::Alloc(allocSize);
+		BufferData* pData = (BufferData*)Memory::Alloc(allocSize, pArena);
 		if( pData == nullptr )
 		{
 			return nullptr;
 		}
 		pData->refCount = 1;
 		pData->size = dataSize;
+		pData->pArena = pArena;
 		return pData->bytes;
 	}
 
 	static uint8* Realloc(BufferData* pData, int dataSize)
 	{
 		int allocSize = GetAllocSize(dataSize);
-		size_t capacity = Memory::GetSize(pData);
+		size_t capacity = Memory::GetSize(pData, pData->pArena);
 		if( size_t(allocSize) < capacity )
 		{
 			// No realloc needed
 			pData->size = dataSize;
 			return pData->bytes;
 		}
+		if( pData->pArena )
+		{
+			// An arena cannot grow a block in place
+			uint8* pBytes2 = Alloc(dataSize, pData->pArena);
+			if( pBytes2 )
+			{
+				memcpy(pBytes2, pData->bytes, pData->size);
+			}
+			// The caller forgets the old block in any case, it must not keep the arena busy
+			Memory::Free(pData, pData->pArena);
+			return pBytes2;
+		}
 		BufferData* pData2 = (BufferData*)realloc(pData, allocSize);
 		if( pData2 == nullptr )
 		{
@@ -66,12 +81,12 @@ struct BufferData
 
 	static BufferData* GetPtr(uint8* pBytes)
 	{
-		return (BufferData*)(pBytes - 8);
+		return (BufferData*)(pBytes - offsetof(BufferData, bytes));
 	}
 private:
 	static int GetAllocSize(int dataSize)
 	{
-		return (sizeof(BufferData) - 8) + ROUND64(dataSize);
+		return int(offsetof(BufferData, bytes)) + ROUND64(dataSize);
 	}
 };
 
@@ -96,6 +111,15 @@ Buffer::Buffer(const Buffer& buf)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Takes the content of buf, which becomes empty. The content is not shared, so the next
+// write does not need to copy it.
+Buffer::Buffer(Buffer&& buf)
+{
+	m_pBytes = buf.m_pBytes;
+	buf.m_pBytes = nullptr;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 Buffer::~Buffer()
 {
@@ -126,21 +150,58 @@ Buffer& Buffer::operator=(const Buffer& buf)
 	return *this;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+Buffer& Buffer::operator=(Buffer&& buf)
+{
+	if( this != &buf )
+	{
+		if( m_pBytes )
+		{
+			BufferData::GetPtr(m_pBytes)->Unref();
+		}
+		m_pBytes = buf.m_pBytes;
+		buf.m_pBytes = nullptr;
+	}
+	return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Buffer::Swap(Buffer& buf)
+{
+	uint8* pBytes = m_pBytes;
+	m_pBytes = buf.m_pBytes;
+	buf.m_pBytes = pBytes;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Sets the new size of the buffer.
 // Returns true upon success.
 bool Buffer::SetSize(int size)
+{
+	return SetSize(size, nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sets the new size of the buffer. An empty buffer takes its block from pArena, or from the
+// heap if nullptr. Otherwise the block is resized, or copied when shared, where it was
+// allocated.
+// Returns true upon success.
+bool Buffer::SetSize(int size, MemoryArena* pArena)
 {
 	if( size < 0 )
 	{
 		ASSERT(0);
 		return false;
 	}
+	if( size > MaxSize )
+	{
+		return false;
+	}
 	if( m_pBytes == nullptr )
 	{
 		if( size > 0 )
 		{
-			m_pBytes = BufferData::Alloc(size);
+			m_pBytes = BufferData::Alloc(size, pArena);
 		}
 	}
 	else
@@ -159,7 +220,7 @@ bool Buffer::SetSize(int size)
 			}
 			else
 			{
-				uint8* pBytes2 = BufferData::Alloc(size);
+				uint8* pBytes2 = BufferData::Alloc(size, pData->pArena);
 				if( pBytes2 )
 				{
 					int32 oldSize = pData->size;
@@ -16,8 +16,12 @@ namespace chustd {
 class Buffer
 {
 public:
+	// Biggest size SetSize accepts, the allocation adds a header and a rounding
+	enum { MaxSize = 0x7fffff00 };
+
 	int GetSize() const;
 	bool SetSize(int size);
+	bool SetSize(int size, MemoryArena* pArena);
 
 	bool EnsureCapacity(int capacity);
 
@@ -26,9 +30,14 @@ public:
 
 	Buffer();
 	Buffer(const Buffer&);
+	Buffer(Buffer&&);
 	~Buffer();
 
 	Buffer& operator=(const Buffer&);
+	Buffer& operator=(Buffer&&);
+
+	// Exchanges the content of two buffers, nothing is copied
+	void Swap(Buffer& buf);
 
 	bool IsEmpty() const { return GetSize() == 0; }
 	void Clear() { SetSize(0); }
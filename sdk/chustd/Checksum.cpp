@@ -0,0 +1,303 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "Checksum.h"
+#include "Memory.h"
+#include "System.h"
+
+// SSE2 is part of x64, and the default of VC++ for x86 since VS2012
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHUSTD_CHECKSUM_SSE2
+#include <emmintrin.h>
+#include <wmmintrin.h> // _mm_clmulepi64_si128
+#if defined(_MSC_VER)
+#define CHUSTD_TARGET_PCLMUL
+#else
+// The function can use PCLMULQDQ while the rest of the file is built for SSE2 only
+#define CHUSTD_TARGET_PCLMUL __attribute__((target("pclmul")))
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#define CHUSTD_CHECKSUM_ARMCRC
+#include <arm_acle.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+using namespace chustd;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// CRC-32
+
+// Table k holds the CRC of a byte followed by k zero bytes, so 8 bytes are processed with 8
+// independent lookups
+struct CrcTables
+{
+	uint32 t[8][256];
+
+	CrcTables()
+	{
+		for(uint32 n = 0; n < 256; ++n)
+		{
+			uint32 c = n;
+			for(int k = 0; k < 8; ++k)
+			{
+				c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+			}
+			t[0][n] = c;
+		}
+		for(uint32 n = 0; n < 256; ++n)
+		{
+			for(int k = 1; k < 8; ++k)
+			{
+				const uint32 c = t[k - 1][n];
+				t[k][n] = t[0][c & 0xff] ^ (c >> 8);
+			}
+		}
+	}
+};
+
+static inline uint32 Load32Le(const uint8* p)
+{
+	return uint32(p[0]) | (uint32(p[1]) << 8) | (uint32(p[2]) << 16) | (uint32(p[3]) << 24);
+}
+
+// The CRC register is not inverted here, Checksum::Crc32 does it
+static uint32 UpdateCrcTables(uint32 reg, const uint8* p, uint32 length)
+{
+	static const CrcTables s_tables;
+	const uint32 (*t)[256] = s_tables.t;
+
+	for(; length >= 8; length -= 8, p += 8)
+	{
+		const uint32 low = reg ^ Load32Le(p);
+		const uint32 high = Load32Le(p + 4);
+		reg = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+		    ^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+	}
+	for(; length > 0; --length, ++p)
+	{
+		reg = t[0][(reg ^ *p) & 0xff] ^ (reg >> 8);
+	}
+	return reg;
+}
+
+#if defined(CHUSTD_CHECKSUM_SSE2)
+static inline __m128i Set64(uint64 high, uint64 low)
+{
+	return _mm_set_epi32(int(high >> 32), int(high), int(low >> 32), int(low));
+}
+
+// Folds 64 bytes at once with the carry-less multiplication, then reduces the 128 bits left
+// to 32 bits (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ").
+// length is a multiple of 16, 64 at least.
+CHUSTD_TARGET_PCLMUL
+static uint32 UpdateCrcPclmul(uint32 reg, const uint8* p, uint32 length)
+{
+	// Powers of x modulo the polynomial, and the Barrett constants
+	const __m128i k1k2 = Set64(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = Set64(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = Set64(0, 0x0163cd6124);
+	const __m128i poly = Set64(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(reg)));
+	p += 64;
+	length -= 64;
+
+	for(; length >= 64; length -= 64, p += 64)
+	{
+		const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(p + 0x30)));
+	}
+
+	// Fold the 4 registers into one, then the 16 byte blocks left
+	__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	for(; length >= 16; length -= 16, p += 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)p)), x5);
+	}
+
+	// 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Second 32-bit lane, without _mm_extract_epi32 which needs SSE4.1
+	return uint32(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+#endif // CHUSTD_CHECKSUM_SSE2
+
+#if defined(CHUSTD_CHECKSUM_ARMCRC)
+static uint32 UpdateCrcArm(uint32 reg, const uint8* p, uint32 length)
+{
+	for(; length >= 8; length -= 8, p += 8)
+	{
+		uint64 value;
+		Memory::Copy(&value, p, 8);
+		reg = __crc32d(reg, value);
+	}
+	for(; length > 0; --length, ++p)
+	{
+		reg = __crc32b(reg, *p);
+	}
+	return reg;
+}
+#endif // CHUSTD_CHECKSUM_ARMCRC
+
+///////////////////////////////////////////////////////////////////////////////
+uint32 Checksum::Crc32(uint32 crc, const void* pBuffer, uint32 length)
+{
+	const uint8* p = static_cast<const uint8*>(pBuffer);
+	uint32 reg = ~crc;
+
+#if defined(CHUSTD_CHECKSUM_SSE2)
+	// Below 64 bytes, like the 4 byte chunk fields, the tables are faster
+	if( length >= 64 && System::HasCpuFeature(System::cpuPclmul) )
+	{
+		const uint32 foldLength = length & ~15u;
+		reg = UpdateCrcPclmul(reg, p, foldLength);
+		p += foldLength;
+		length -= foldLength;
+	}
+#elif defined(CHUSTD_CHECKSUM_ARMCRC)
+	reg = UpdateCrcArm(reg, p, length);
+	length = 0;
+#endif
+
+	reg = UpdateCrcTables(reg, p, length);
+	return ~reg;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Adler-32
+
+static const uint32 k_adlerBase = 65521;
+
+// Most bytes that can be summed before s2 may overflow 32 bits, the same as NMAX in zlib
+static const uint32 k_adlerBlockMax = 5552;
+
+#if defined(CHUSTD_CHECKSUM_SSE2)
+static inline uint32 SumLanes(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_srli_si128(v, 8));
+	v = _mm_add_epi32(v, _mm_srli_si128(v, 4));
+	return uint32(_mm_cvtsi128_si32(v));
+}
+
+// Sums 16 bytes at once. length is a multiple of 16.
+static void AddAdlerSse2(uint32& s1, uint32& s2, const uint8* p, uint32 length)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	// The first byte of 16 is added to s2 16 times, the last one once
+	const __m128i weightsLow = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i weightsHigh = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+
+	while( length > 0 )
+	{
+		const uint32 blockLength = (length < k_adlerBlockMax) ? length : (k_adlerBlockMax & ~15u);
+		const uint32 chunkCount = blockLength / 16;
+		length -= blockLength;
+
+		__m128i sums1 = zero;     // Sums of the bytes
+		__m128i prevSums1 = zero; // Sums of the bytes of the previous chunks, once per chunk
+		__m128i sums2 = zero;     // Weighted sums of the bytes in their chunk
+		for(uint32 i = 0; i < chunkCount; ++i, p += 16)
+		{
+			const __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+			prevSums1 = _mm_add_epi32(prevSums1, sums1);
+			sums1 = _mm_add_epi32(sums1, _mm_sad_epu8(bytes, zero));
+			sums2 = _mm_add_epi32(sums2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsLow));
+			sums2 = _mm_add_epi32(sums2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsHigh));
+		}
+
+		// Each byte of the block adds s1 to s2, then each chunk adds the previous ones 16 times
+		const uint64 newS2 = uint64(s2) + uint64(s1) * blockLength
+		                   + uint64(SumLanes(prevSums1)) * 16 + SumLanes(sums2);
+		s2 = uint32(newS2 % k_adlerBase);
+		s1 = (s1 + SumLanes(sums1)) % k_adlerBase;
+	}
+}
+#endif // CHUSTD_CHECKSUM_SSE2
+
+///////////////////////////////////////////////////////////////////////////////
+uint32 Checksum::Adler32(uint32 adler, const void* pBuffer, uint32 length)
+{
+	const uint8* p = static_cast<const uint8*>(pBuffer);
+	uint32 s1 = adler & 0xffff;
+	uint32 s2 = adler >> 16;
+
+#if defined(CHUSTD_CHECKSUM_SSE2)
+	if( length >= 16 && System::HasCpuFeature(System::cpuSse2) )
+	{
+		const uint32 simdLength = length & ~15u;
+		AddAdlerSse2(s1, s2, p, simdLength);
+		p += simdLength;
+		length -= simdLength;
+	}
+#endif
+
+	while( length > 0 )
+	{
+		const uint32 blockLength = (length < k_adlerBlockMax) ? length : k_adlerBlockMax;
+		length -= blockLength;
+		for(uint32 i = 0; i < blockLength; ++i, ++p)
+		{
+			s1 += *p;
+			s2 += s1;
+		}
+		s1 %= k_adlerBase;
+		s2 %= k_adlerBase;
+	}
+	return (s2 << 16) | s1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Entry points for the bundled zlib (adler32.c and crc32.c), in C
+extern "C" unsigned long chustd_crc32(unsigned long crc, const unsigned char* pBuffer, unsigned int length)
+{
+	return Checksum::Crc32(uint32(crc), pBuffer, length);
+}
+
+extern "C" unsigned long chustd_adler32(unsigned long adler, const unsigned char* pBuffer, unsigned int length)
+{
+	return Checksum::Adler32(uint32(adler), pBuffer, length);
+}
@@ -0,0 +1,36 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef CHUSTD_CHECKSUM_H
+#define CHUSTD_CHECKSUM_H
+
+namespace chustd {
+
+///////////////////////////////////////////////////////////////////////////////
+// CRC-32 of the PNG chunks and Adler-32 of the zlib streams.
+// The CRC-32 uses the carry-less multiplication (PCLMULQDQ) on x86 processors
+// having it, the CRC instructions on ARMv8 builds having them, and 8 lookup
+// tables otherwise. The Adler-32 sums 16 bytes at once with SSE2.
+// The bundled zlib calls these functions too.
+class Checksum
+{
+public:
+	// Updates a CRC-32, same as the zlib crc32() function
+	//
+	// [in] crc      CRC of the previous bytes, 0 to start
+	// [in] pBuffer  Bytes to add
+	// [in] length   Byte count
+	//
+	// Returns the CRC of the previous bytes followed by the buffer
+	static uint32 Crc32(uint32 crc, const void* pBuffer, uint32 length);
+
+	// Updates an Adler-32, same as the zlib adler32() function. Start with 1.
+	static uint32 Adler32(uint32 adler, const void* pBuffer, uint32 length);
+};
+
+} // namespace chustd
+
+#endif // ndef CHUSTD_CHECKSUM_H
@@ -7,6 +7,7 @@
 #include "stdafx.h"
 #include "DeflateCompressor.h"
 #include "Memory.h"
+#include "Checksum.h"
 
 #include "File.h"
 #include "StringBuilder.h"
@@ -62,3 +63,13 @@ uint32 DeflateCompressor::Bound(uint32 sourceLength)
 {
 	return deflateBound(nullptr, sourceLength);
 }
+
+uint32 DeflateCompressor::Adler32(uint32 adler, const uint8* pBuffer, uint32 length)
+{
+	return Checksum::Adler32(adler, pBuffer, length);
+}
+
+uint32 DeflateCompressor::Adler32Combine(uint32 adler1, uint32 adler2, uint32 length2)
+{
+	return static_cast<uint32>(adler32_combine(adler1, adler2, length2));
+}
@@ -27,6 +27,16 @@ enum DeflateStrategy
 	DF_STRATEGY_FIXED        = 4
 };
 
+// Lets the caller stop a compression that is not worth finishing
+class DeflateSizeLimit
+{
+public:
+	// Returns true if the compression should stop, size being the number of bytes written so far
+	virtual bool IsExceeded(uint32 size) = 0;
+
+	virtual ~DeflateSizeLimit() {}
+};
+
 class DeflateCompressor : public DeflateStream
 {
 public:
@@ -42,6 +52,14 @@ public:
 	
 	static uint32 Bound(uint32 sourceLength);
 
+	// Updates an Adler-32 checksum, as stored at the end of a zlib stream.
+	// The initial value is 1.
+	static uint32 Adler32(uint32 adler, const uint8* pBuffer, uint32 length);
+
+	// Computes the Adler-32 checksum of two concatenated buffers from the checksums
+	// of each buffer. length2 is the length of the second buffer.
+	static uint32 Adler32Combine(uint32 adler1, uint32 adler2, uint32 length2);
+
 	// Compresses the source buffer into the destination buffer. The level
 	// parameter has the same meaning as in deflateInit.  sourceLen is the byte
 	// length of the source buffer. Upon entry, destLen is the total size of the
@@ -52,6 +70,15 @@ public:
 	// memory, Z_BUF_ERROR if there was not enough room in the output buffer,
 	// Z_STREAM_ERROR if the level parameter is invalid.
 	static DeflateRet Compress(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen, int level);
+
+	// Same as Compress() but with an optimal parsing encoder instead of zlib: the matches
+	// are chosen with a cost model refined iterationCount times, the data is split in
+	// blocks and each block gets its own Huffman codes. The zlib stream is a few percents
+	// smaller, but the compression is about 50 times slower.
+	// pSizeLimit is checked after each block, the function returns DF_RET_BUF_ERROR if
+	// the limit is exceeded. Can be nullptr.
+	static DeflateRet CompressOptimal(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+		int iterationCount, DeflateSizeLimit* pSizeLimit);
 };
 
 } // namespace chustd
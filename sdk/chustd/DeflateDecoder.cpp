@@ -0,0 +1,781 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+// Deflate decoder for a whole zlib stream held in memory, writing straight into the
+// destination buffer. Compared to the streaming zlib inflate:
+// 1. The bit buffer has 64 bits and is refilled with 8 bytes at once, so a length
+//    and its distance are decoded without checking the input in between.
+// 2. A lookup in the literal/length table can give two literals at once.
+// 3. The matches are copied 8 bytes at once when the distance allows it.
+// The errors have no message: the callers run the streaming decoder to get it.
+
+#include "stdafx.h"
+#include "DeflateUncompressor.h"
+#include "Checksum.h"
+#include "Math.h"
+
+//////////////////////////////////////////////////////////////////////
+using namespace chustd;
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const int k_litLenCount = 288;
+const int k_distCount = 32;
+const int k_codeLengthCount = 19;
+const int k_maxCodeLength = 15;
+const int k_endOfBlock = 256;
+
+// Bits of the first lookup. The longer codes continue in a sub table.
+const int k_litLenTableBits = 11;
+const int k_distTableBits = 8;
+const int k_codeLengthTableBits = 7; // The code length codes have 7 bits at most
+
+// Each symbol starts one sub table at most
+const int k_litLenTableSize = (1 << k_litLenTableBits) + k_litLenCount * (1 << (k_maxCodeLength - k_litLenTableBits));
+const int k_distTableSize = (1 << k_distTableBits) + k_distCount * (1 << (k_maxCodeLength - k_distTableBits));
+
+const uint16 k_lengthBases[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const uint8 k_lengthExtraBits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const uint16 k_distBases[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const uint8 k_distExtraBits[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order of the code length code lengths in a dynamic block header
+const uint8 k_codeLengthOrder[k_codeLengthCount] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A table entry is a uint32:
+// bits 0-7   Bits of the code, consumed by the lookup
+// bits 8-11  Extra bits to read after the code, bits of the sub table index,
+//            or bits of the first literal of a pair
+// bits 12-15 Kind of entry
+// bits 16-31 Literal (a pair has the first one in bits 16-23), base of a length
+//            or of a distance, symbol of a code length code, or sub table offset
+enum EntryKind
+{
+	kindLiteral = 0,
+	kindLiteralPair,
+	kindBase,
+	kindEndOfBlock,
+	kindSubTable,
+	kindInvalid
+};
+
+enum TableType
+{
+	tableLitLen,
+	tableDist,
+	tableCodeLength
+};
+
+inline uint32 MakeEntry(uint32 kind, uint32 codeBits, uint32 extra, uint32 value)
+{
+	return codeBits | (extra << 8) | (kind << 12) | (value << 16);
+}
+
+inline uint32 GetCodeBits(uint32 entry) { return entry & 0xff; }
+inline uint32 GetExtra(uint32 entry)    { return (entry >> 8) & 0x0f; }
+inline uint32 GetKind(uint32 entry)     { return (entry >> 12) & 0x0f; }
+inline uint32 GetValue(uint32 entry)    { return entry >> 16; }
+
+// Gets the entry of a symbol, its code bits being added later
+uint32 GetSymbolEntry(TableType type, int symbol)
+{
+	if( type == tableCodeLength )
+	{
+		return MakeEntry(kindLiteral, 0, 0, symbol);
+	}
+	if( type == tableDist )
+	{
+		if( symbol < 30 )
+		{
+			return MakeEntry(kindBase, 0, k_distExtraBits[symbol], k_distBases[symbol]);
+		}
+		return MakeEntry(kindInvalid, 0, 0, 0);
+	}
+	if( symbol < k_endOfBlock )
+	{
+		return MakeEntry(kindLiteral, 0, 0, symbol);
+	}
+	if( symbol == k_endOfBlock )
+	{
+		return MakeEntry(kindEndOfBlock, 0, 0, 0);
+	}
+	const int index = symbol - (k_endOfBlock + 1);
+	if( index < 29 )
+	{
+		return MakeEntry(kindBase, 0, k_lengthExtraBits[index], k_lengthBases[index]);
+	}
+	return MakeEntry(kindInvalid, 0, 0, 0);
+}
+
+uint32 ReverseBits(uint32 code, int bitCount)
+{
+	uint32 reversed = 0;
+	for(int i = 0; i < bitCount; ++i)
+	{
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+	return reversed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Builds the lookup table of a canonical Huffman code. The entries of the codes longer than
+// tableBits point to a sub table indexed by the next bits.
+// Returns false if the code is over-subscribed, or incomplete with more than one code of
+// 1 bit, as zlib does. A code with no symbol gives a table of invalid entries.
+bool BuildTable(uint32* pTable, int tableBits, TableType type, const uint8* pLengths, int symbolCount)
+{
+	int counts[k_maxCodeLength + 1] = { 0 };
+	for(int i = 0; i < symbolCount; ++i)
+	{
+		counts[pLengths[i]]++;
+	}
+	counts[0] = 0;
+
+	int maxLength = 0;
+	int left = 1;
+	for(int length = 1; length <= k_maxCodeLength; ++length)
+	{
+		left = (left << 1) - counts[length];
+		if( left < 0 )
+		{
+			return false;
+		}
+		if( counts[length] > 0 )
+		{
+			maxLength = length;
+		}
+	}
+	if( left > 0 && (type == tableCodeLength || maxLength > 1) )
+	{
+		return false;
+	}
+
+	const uint32 invalid = MakeEntry(kindInvalid, 0, 0, 0);
+	const int mainSize = 1 << tableBits;
+	for(int i = 0; i < mainSize; ++i)
+	{
+		pTable[i] = invalid;
+	}
+
+	// Canonical codes, reversed as the bits are read from the lowest one
+	uint16 reversedCodes[k_litLenCount];
+	int nextCodes[k_maxCodeLength + 1];
+	nextCodes[1] = 0;
+	for(int length = 1; length < k_maxCodeLength; ++length)
+	{
+		nextCodes[length + 1] = (nextCodes[length] + counts[length]) << 1;
+	}
+
+	uint8 subTableBits[1 << k_litLenTableBits] = { 0 };
+	for(int symbol = 0; symbol < symbolCount; ++symbol)
+	{
+		const int length = pLengths[symbol];
+		if( length == 0 )
+		{
+			continue;
+		}
+		const uint32 reversed = ReverseBits(nextCodes[length]++, length);
+		reversedCodes[symbol] = uint16(reversed);
+
+		if( length <= tableBits )
+		{
+			const uint32 entry = GetSymbolEntry(type, symbol) | length;
+			for(int i = reversed; i < mainSize; i += (1 << length))
+			{
+				pTable[i] = entry;
+			}
+		}
+		else
+		{
+			uint8& bits = subTableBits[reversed & (mainSize - 1)];
+			bits = uint8(Math::Max(int(bits), length - tableBits));
+		}
+	}
+
+	if( maxLength > tableBits )
+	{
+		// Sub tables after the main table
+		int offset = mainSize;
+		for(int prefix = 0; prefix < mainSize; ++prefix)
+		{
+			const int bits = subTableBits[prefix];
+			if( bits > 0 )
+			{
+				pTable[prefix] = MakeEntry(kindSubTable, tableBits, bits, offset);
+				for(int i = 0; i < (1 << bits); ++i)
+				{
+					pTable[offset + i] = invalid;
+				}
+				offset += 1 << bits;
+			}
+		}
+
+		for(int symbol = 0; symbol < symbolCount; ++symbol)
+		{
+			const int length = pLengths[symbol];
+			if( length <= tableBits )
+			{
+				continue;
+			}
+			const uint32 reversed = reversedCodes[symbol];
+			const uint32 subTable = pTable[reversed & (mainSize - 1)];
+			const int subSize = 1 << GetExtra(subTable);
+			uint32* pSub = pTable + GetValue(subTable);
+			const uint32 entry = GetSymbolEntry(type, symbol) | (length - tableBits);
+			for(int i = reversed >> tableBits; i < subSize; i += (1 << (length - tableBits)))
+			{
+				pSub[i] = entry;
+			}
+		}
+	}
+
+	if( type == tableLitLen )
+	{
+		// Two literals whose codes fit in the lookup bits share an entry. The index of the
+		// second literal is smaller, so a decreasing loop reads it before its own update.
+		for(int i = mainSize - 1; i >= 0; --i)
+		{
+			const uint32 first = pTable[i];
+			const uint32 firstBits = GetCodeBits(first);
+			if( GetKind(first) != kindLiteral || int(firstBits) >= tableBits )
+			{
+				continue;
+			}
+			const uint32 second = pTable[i >> firstBits];
+			const uint32 totalBits = firstBits + GetCodeBits(second);
+			if( GetKind(second) == kindLiteral && int(totalBits) <= tableBits )
+			{
+				pTable[i] = MakeEntry(kindLiteralPair, totalBits, firstBits, GetValue(first) | (GetValue(second) << 8));
+			}
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+inline uint64 Load64Le(const uint8* p)
+{
+	uint64 value;
+	memcpy(&value, p, 8);
+	if( k_ePlatformByteOrder == boBigEndian )
+	{
+		uint64 swapped = 0;
+		for(int i = 0; i < 8; ++i)
+		{
+			swapped |= uint64(p[i]) << (8 * i);
+		}
+		value = swapped;
+	}
+	return value;
+}
+
+// Bits of the input, the lowest one first. When the input is over, zero bytes are added so
+// the decoding loop does not check it: the padding must not be consumed.
+struct BitReader
+{
+	const uint8* p;
+	const uint8* pEnd;
+	uint64 bits;
+	uint32 bitCount;
+	uint32 paddingBytes;
+
+	void Init(const uint8* pBegin, const uint8* pEndIn)
+	{
+		p = pBegin;
+		pEnd = pEndIn;
+		bits = 0;
+		bitCount = 0;
+		paddingBytes = 0;
+	}
+
+	// Fills the bit buffer to 56 bits at least
+	void Refill()
+	{
+		if( pEnd - p >= 8 )
+		{
+			// The bits above bitCount are loaded again later, with the same values
+			bits |= Load64Le(p) << bitCount;
+			p += (63 - bitCount) >> 3;
+			bitCount |= 56;
+		}
+		else
+		{
+			while( bitCount <= 56 )
+			{
+				if( p < pEnd )
+				{
+					bits |= uint64(*p++) << bitCount;
+				}
+				else
+				{
+					paddingBytes++;
+				}
+				bitCount += 8;
+			}
+		}
+	}
+
+	uint32 Peek(uint32 bitCountToPeek) const
+	{
+		return uint32(bits) & ((1u << bitCountToPeek) - 1);
+	}
+
+	void Consume(uint32 bitCountToConsume)
+	{
+		bits >>= bitCountToConsume;
+		bitCount -= bitCountToConsume;
+	}
+
+	// Returns true if the padding after the input was consumed
+	bool IsOverrun() const
+	{
+		return paddingBytes * 8 > bitCount;
+	}
+
+	// Skips the bits up to the next byte boundary, and gives the buffered bytes back to
+	// the input. Returns false if the padding after the input was consumed.
+	bool AlignToByte()
+	{
+		Consume(bitCount & 7);
+		const uint32 bufferedBytes = bitCount / 8;
+		if( paddingBytes > bufferedBytes )
+		{
+			return false;
+		}
+		p -= bufferedBytes - paddingBytes;
+		bits = 0;
+		bitCount = 0;
+		paddingBytes = 0;
+		return true;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct Decoder
+{
+	BitReader in;
+	uint8* pOutBegin;
+	uint8* pOut;
+	uint8* pOutEnd;
+
+	uint32 litLenTable[k_litLenTableSize];
+	uint32 distTable[k_distTableSize];
+};
+
+inline void Copy8(uint8* pDst, const uint8* pSrc)
+{
+	uint64 block;
+	memcpy(&block, pSrc, 8);
+	memcpy(pDst, &block, 8);
+}
+
+// Copies a match, the source and the destination overlapping if the distance is shorter
+// than the length. There are 8 bytes of room after the match at least if wide is true.
+inline void CopyMatch(uint8* pDst, uint32 dist, uint32 length, bool wide)
+{
+	const uint8* pSrc = pDst - dist;
+	if( !wide )
+	{
+		for(uint32 i = 0; i < length; ++i)
+		{
+			pDst[i] = pSrc[i];
+		}
+		return;
+	}
+
+	uint8* const pDstEnd = pDst + length;
+	if( dist < 8 )
+	{
+		// The bytes repeat every dist bytes, so every period bytes too, period being the
+		// first multiple of dist of 8 bytes at least. Once there are period bytes before
+		// pDst, the copy goes on with 8 byte blocks.
+		const uint32 period = ((8 + dist - 1) / dist) * dist;
+		for(uint32 i = dist; i < period; ++i)
+		{
+			*pDst++ = *pSrc++;
+		}
+		pSrc = pDst - period;
+	}
+
+	// Each 8 byte block reads before the bytes it writes
+	while( pDst < pDstEnd )
+	{
+		Copy8(pDst, pSrc);
+		pDst += 8;
+		pSrc += 8;
+	}
+}
+
+// Decodes the symbols of a block up to its end-of-block code
+DeflateRet DecodeHuffmanBlock(Decoder& dec)
+{
+	// Local copies, so they stay in registers
+	BitReader in = dec.in;
+	uint8* pOut = dec.pOut;
+	const uint8* const pOutBegin = dec.pOutBegin;
+	uint8* const pOutEnd = dec.pOutEnd;
+	const uint32* const pLitLenTable = dec.litLenTable;
+	const uint32* const pDistTable = dec.distTable;
+	const uint32 litLenMask = (1 << k_litLenTableBits) - 1;
+	const uint32 distMask = (1 << k_distTableBits) - 1;
+
+	DeflateRet ret = DF_RET_OK;
+	for(;;)
+	{
+		// 56 bits hold the longest length and distance: 15 + 5 + 15 + 13 bits,
+		// or three literal codes
+		in.Refill();
+		if( in.IsOverrun() )
+		{
+			ret = DF_RET_BUF_ERROR;
+			break;
+		}
+
+		uint32 entry = pLitLenTable[uint32(in.bits) & litLenMask];
+		if( GetKind(entry) <= kindLiteralPair && pOutEnd - pOut >= 6 )
+		{
+			// Up to three entries of literals, each of them being written as a pair
+			for(int i = 0; i < 3; ++i)
+			{
+				pOut[0] = uint8(GetValue(entry));
+				pOut[1] = uint8(GetValue(entry) >> 8);
+				pOut += 1 + GetKind(entry);
+				in.Consume(GetCodeBits(entry));
+				entry = pLitLenTable[uint32(in.bits) & litLenMask];
+				if( GetKind(entry) > kindLiteralPair )
+				{
+					break;
+				}
+			}
+			continue;
+		}
+
+		if( GetKind(entry) == kindSubTable )
+		{
+			in.Consume(k_litLenTableBits);
+			entry = pLitLenTable[GetValue(entry) + in.Peek(GetExtra(entry))];
+		}
+		in.Consume(GetCodeBits(entry));
+
+		const uint32 kind = GetKind(entry);
+		if( kind == kindLiteral )
+		{
+			if( pOut == pOutEnd )
+			{
+				ret = DF_RET_BUF_ERROR;
+				break;
+			}
+			*pOut++ = uint8(GetValue(entry));
+			continue;
+		}
+		if( kind == kindLiteralPair )
+		{
+			if( pOutEnd - pOut < 2 )
+			{
+				ret = DF_RET_BUF_ERROR;
+				break;
+			}
+			pOut[0] = uint8(GetValue(entry));
+			pOut[1] = uint8(GetValue(entry) >> 8);
+			pOut += 2;
+			continue;
+		}
+		if( kind == kindEndOfBlock )
+		{
+			break;
+		}
+		if( kind != kindBase )
+		{
+			ret = DF_RET_DATA_ERROR;
+			break;
+		}
+
+		const uint32 length = GetValue(entry) + in.Peek(GetExtra(entry));
+		in.Consume(GetExtra(entry));
+
+		entry = pDistTable[uint32(in.bits) & distMask];
+		if( GetKind(entry) == kindSubTable )
+		{
+			in.Consume(k_distTableBits);
+			entry = pDistTable[GetValue(entry) + in.Peek(GetExtra(entry))];
+		}
+		in.Consume(GetCodeBits(entry));
+		if( GetKind(entry) != kindBase )
+		{
+			ret = DF_RET_DATA_ERROR;
+			break;
+		}
+		const uint32 dist = GetValue(entry) + in.Peek(GetExtra(entry));
+		in.Consume(GetExtra(entry));
+
+		const uint32 room = uint32(pOutEnd - pOut);
+		if( dist > uint32(pOut - pOutBegin) )
+		{
+			ret = DF_RET_DATA_ERROR;
+			break;
+		}
+		if( length > room )
+		{
+			ret = DF_RET_BUF_ERROR;
+			break;
+		}
+		CopyMatch(pOut, dist, length, room >= length + 8);
+		pOut += length;
+	}
+
+	dec.in = in;
+	dec.pOut = pOut;
+	return ret;
+}
+
+DeflateRet DecodeStoredBlock(Decoder& dec)
+{
+	BitReader& in = dec.in;
+	if( !in.AlignToByte() || in.pEnd - in.p < 4 )
+	{
+		return DF_RET_BUF_ERROR;
+	}
+	const uint32 length = in.p[0] | (in.p[1] << 8);
+	const uint32 lengthComplement = in.p[2] | (in.p[3] << 8);
+	in.p += 4;
+	if( length != (~lengthComplement & 0xffff) )
+	{
+		return DF_RET_DATA_ERROR;
+	}
+	if( uint32(in.pEnd - in.p) < length || uint32(dec.pOutEnd - dec.pOut) < length )
+	{
+		return DF_RET_BUF_ERROR;
+	}
+	memcpy(dec.pOut, in.p, length);
+	dec.pOut += length;
+	in.p += length;
+	return DF_RET_OK;
+}
+
+void BuildFixedTables(Decoder& dec)
+{
+	uint8 lengths[k_litLenCount];
+	for(int i = 0; i < k_litLenCount; ++i)
+	{
+		lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	BuildTable(dec.litLenTable, k_litLenTableBits, tableLitLen, lengths, k_litLenCount);
+
+	for(int i = 0; i < k_distCount; ++i)
+	{
+		lengths[i] = 5;
+	}
+	BuildTable(dec.distTable, k_distTableBits, tableDist, lengths, k_distCount);
+}
+
+DeflateRet ReadDynamicTables(Decoder& dec)
+{
+	BitReader& in = dec.in;
+	in.Refill();
+	const int litLenCount = 257 + in.Peek(5);
+	in.Consume(5);
+	const int distCount = 1 + in.Peek(5);
+	in.Consume(5);
+	const int codeLengthCount = 4 + in.Peek(4);
+	in.Consume(4);
+	if( litLenCount > 286 || distCount > 30 )
+	{
+		return DF_RET_DATA_ERROR;
+	}
+
+	uint8 codeLengthLengths[k_codeLengthCount] = { 0 };
+	for(int i = 0; i < codeLengthCount; ++i)
+	{
+		in.Refill();
+		codeLengthLengths[k_codeLengthOrder[i]] = uint8(in.Peek(3));
+		in.Consume(3);
+	}
+	uint32 codeLengthTable[1 << k_codeLengthTableBits];
+	if( !BuildTable(codeLengthTable, k_codeLengthTableBits, tableCodeLength, codeLengthLengths, k_codeLengthCount) )
+	{
+		return DF_RET_DATA_ERROR;
+	}
+
+	// The distance code lengths follow the literal/length ones, a repeat can cross between them
+	uint8 lengths[k_litLenCount + k_distCount];
+	const int totalCount = litLenCount + distCount;
+	int index = 0;
+	while( index < totalCount )
+	{
+		in.Refill();
+		if( in.IsOverrun() )
+		{
+			return DF_RET_BUF_ERROR;
+		}
+		const uint32 entry = codeLengthTable[in.Peek(k_codeLengthTableBits)];
+		if( GetKind(entry) != kindLiteral )
+		{
+			return DF_RET_DATA_ERROR;
+		}
+		in.Consume(GetCodeBits(entry));
+
+		const uint32 symbol = GetValue(entry);
+		if( symbol < 16 )
+		{
+			lengths[index++] = uint8(symbol);
+			continue;
+		}
+
+		int repeat = 0;
+		uint8 value = 0;
+		if( symbol == 16 )
+		{
+			if( index == 0 )
+			{
+				return DF_RET_DATA_ERROR;
+			}
+			value = lengths[index - 1];
+			repeat = 3 + in.Peek(2);
+			in.Consume(2);
+		}
+		else if( symbol == 17 )
+		{
+			repeat = 3 + in.Peek(3);
+			in.Consume(3);
+		}
+		else
+		{
+			repeat = 11 + in.Peek(7);
+			in.Consume(7);
+		}
+		if( index + repeat > totalCount )
+		{
+			return DF_RET_DATA_ERROR;
+		}
+		for(int i = 0; i < repeat; ++i)
+		{
+			lengths[index++] = value;
+		}
+	}
+
+	if( lengths[k_endOfBlock] == 0 )
+	{
+		return DF_RET_DATA_ERROR;
+	}
+	if( !BuildTable(dec.litLenTable, k_litLenTableBits, tableLitLen, lengths, litLenCount)
+	 || !BuildTable(dec.distTable, k_distTableBits, tableDist, lengths + litLenCount, distCount) )
+	{
+		return DF_RET_DATA_ERROR;
+	}
+	return DF_RET_OK;
+}
+
+DeflateRet DecodeStream(Decoder& dec, const uint8* pSource, uint32 sourceLen)
+{
+	// zlib header
+	if( sourceLen < 2 )
+	{
+		return DF_RET_BUF_ERROR;
+	}
+	const uint32 cmf = pSource[0];
+	const uint32 flg = pSource[1];
+	if( ((cmf << 8) | flg) % 31 != 0 || (cmf & 0x0f) != 8 || (cmf >> 4) > 7 )
+	{
+		return DF_RET_DATA_ERROR;
+	}
+	if( flg & 0x20 )
+	{
+		return DF_RET_NEED_DICT;
+	}
+
+	BitReader& in = dec.in;
+	in.Init(pSource + 2, pSource + sourceLen);
+
+	bool lastBlock = false;
+	while( !lastBlock )
+	{
+		in.Refill();
+		if( in.IsOverrun() )
+		{
+			return DF_RET_BUF_ERROR;
+		}
+		lastBlock = in.Peek(1) != 0;
+		const uint32 blockType = (in.Peek(3) >> 1);
+		in.Consume(3);
+
+		DeflateRet ret = DF_RET_OK;
+		if( blockType == 0 )
+		{
+			ret = DecodeStoredBlock(dec);
+		}
+		else if( blockType == 1 )
+		{
+			BuildFixedTables(dec);
+			ret = DecodeHuffmanBlock(dec);
+		}
+		else if( blockType == 2 )
+		{
+			ret = ReadDynamicTables(dec);
+			if( ret == DF_RET_OK )
+			{
+				ret = DecodeHuffmanBlock(dec);
+			}
+		}
+		else
+		{
+			ret = DF_RET_DATA_ERROR;
+		}
+		if( ret != DF_RET_OK )
+		{
+			return ret;
+		}
+	}
+
+	// Adler-32 of the uncompressed data, big endian
+	if( !in.AlignToByte() || in.pEnd - in.p < 4 )
+	{
+		return DF_RET_BUF_ERROR;
+	}
+	const uint32 adler = (uint32(in.p[0]) << 24) | (uint32(in.p[1]) << 16) | (uint32(in.p[2]) << 8) | in.p[3];
+	if( adler != Checksum::Adler32(1, dec.pOutBegin, uint32(dec.pOut - dec.pOutBegin)) )
+	{
+		return DF_RET_DATA_ERROR;
+	}
+	return DF_RET_OK;
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+DeflateRet DeflateUncompressor::UncompressBuffer(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen)
+{
+	// 44 KB of tables
+	Decoder* pDec = new Decoder;
+	if( pDec == nullptr )
+	{
+		return DF_RET_MEM_ERROR;
+	}
+	pDec->pOutBegin = pDest;
+	pDec->pOut = pDest;
+	pDec->pOutEnd = pDest + *pDestLen;
+
+	const DeflateRet ret = DecodeStream(*pDec, pSource, sourceLen);
+	*pDestLen = uint32(pDec->pOut - pDest);
+	delete pDec;
+	return ret;
+}
@@ -0,0 +1,1050 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+// Deflate encoder looking for the smallest stream rather than for speed.
+// The input is processed by chunks of 1 MB:
+// 1. All the matches of each position are searched once and cached.
+// 2. The chunk is parsed with the costs of the fixed Huffman codes, and the
+//    result is split in blocks where new Huffman codes pay off.
+// 3. Each block is parsed again several times, the symbol costs coming from the
+//    statistics of the previous parse. A parse is the cheapest path from the
+//    start to the end of the block, each step being a literal or a match.
+// 4. Each block is written with the smallest of the stored, fixed and
+//    dynamic modes.
+
+#include "stdafx.h"
+#include "DeflateCompressor.h"
+#include "Array.h"
+#include "Math.h"
+#include "Memory.h"
+
+//////////////////////////////////////////////////////////////////////
+using namespace chustd;
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const int32 k_windowSize = 32768;
+const int32 k_windowMask = k_windowSize - 1;
+const int32 k_hashSize = 32768;
+const int32 k_minMatch = 3;
+const int32 k_maxMatch = 258;
+const int32 k_maxChainLength = 1024; // Candidates checked for each position
+const int32 k_chunkSize = 1024 * 1024;
+const int32 k_minBlockSymbols = 256; // Smallest block tried when splitting
+
+const int k_litLenCount = 288;
+const int k_distCount = 32;
+const int k_codeLengthCount = 19;
+const int k_endOfBlock = 256;
+
+const uint16 k_lengthBases[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const uint8 k_lengthExtraBits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const uint16 k_distBases[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const uint8 k_distExtraBits[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order of the code length code lengths in a dynamic block header
+const uint8 k_codeLengthOrder[k_codeLengthCount] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the index in k_lengthBases of a match length in [3..258]
+int GetLengthIndex(int32 length)
+{
+	int index = 28;
+	while( k_lengthBases[index] > length )
+	{
+		index--;
+	}
+	return index;
+}
+
+// Gets the distance symbol of a match distance in [1..32768]
+int GetDistSymbol(int32 dist)
+{
+	if( dist <= 4 )
+	{
+		return dist - 1;
+	}
+	const uint32 value = uint32(dist - 1);
+	int highBit = 0;
+	while( (value >> (highBit + 1)) != 0 )
+	{
+		highBit++;
+	}
+	return 2 * highBit + int((value >> (highBit - 1)) & 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A literal or a match of a parse
+struct DeflateSymbol
+{
+	uint16 litLen; // Literal byte or match length
+	uint16 dist;   // 0 for a literal
+
+	int32 GetByteCount() const { return dist == 0 ? 1 : litLen; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Symbol counts of a block
+struct DeflateStats
+{
+	uint32 litLens[k_litLenCount];
+	uint32 dists[k_distCount];
+
+	// [in] pSymbols  Symbols of the block
+	// [in] count     Number of symbols
+	void Compute(const DeflateSymbol* pSymbols, int32 count)
+	{
+		Memory::Zero(litLens, sizeof(litLens));
+		Memory::Zero(dists, sizeof(dists));
+		for(int32 i = 0; i < count; ++i)
+		{
+			const DeflateSymbol& symbol = pSymbols[i];
+			if( symbol.dist == 0 )
+			{
+				litLens[symbol.litLen]++;
+			}
+			else
+			{
+				litLens[257 + GetLengthIndex(symbol.litLen)]++;
+				dists[GetDistSymbol(symbol.dist)]++;
+			}
+		}
+		litLens[k_endOfBlock] = 1;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Cost in bits of each symbol, extra bits excluded
+struct DeflateCostModel
+{
+	float64 litLens[k_litLenCount];
+	float64 dists[k_distCount];
+
+	// Costs of the fixed Huffman codes
+	void SetFixed()
+	{
+		for(int i = 0; i < k_litLenCount; ++i)
+		{
+			litLens[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+		}
+		for(int i = 0; i < k_distCount; ++i)
+		{
+			dists[i] = 5;
+		}
+	}
+
+	// Entropy of the symbols of a previous parse. Unused symbols cost as much as
+	// symbols used once.
+	void SetFromStats(const DeflateStats& stats)
+	{
+		SetFromCounts(stats.litLens, k_litLenCount, litLens);
+		SetFromCounts(stats.dists, k_distCount, dists);
+	}
+
+private:
+	static void SetFromCounts(const uint32* pCounts, int count, float64* pCosts)
+	{
+		uint32 total = 0;
+		for(int i = 0; i < count; ++i)
+		{
+			total += pCounts[i];
+		}
+		const float64 log2Total = (total == 0) ? 0 : log(float64(total)) / log(2.0);
+		for(int i = 0; i < count; ++i)
+		{
+			pCosts[i] = (pCounts[i] == 0) ? log2Total : log2Total - log(float64(pCounts[i])) / log(2.0);
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the code lengths of a Huffman code, limited to maxBits.
+// At least two symbols get a code, so the code is always complete, as required
+// by inflate.
+// [in]  pCounts   Symbol counts
+// [in]  count     Number of symbols
+// [in]  maxBits   Maximum code length
+// [out] pLengths  Code length of each symbol, 0 for unused symbols
+void BuildCodeLengths(const uint32* pCounts, int count, int maxBits, uint8* pLengths)
+{
+	ASSERT(count <= k_litLenCount);
+	Memory::Zero(pLengths, count);
+
+	// Leaves sorted by increasing counts
+	uint32 weights[2 * k_litLenCount];
+	int    symbols[k_litLenCount];
+	int leafCount = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		if( pCounts[i] == 0 )
+		{
+			continue;
+		}
+		int j = leafCount++;
+		while( j > 0 && pCounts[symbols[j - 1]] > pCounts[i] )
+		{
+			symbols[j] = symbols[j - 1];
+			j--;
+		}
+		symbols[j] = i;
+	}
+	if( leafCount < 2 )
+	{
+		const int used = (leafCount == 1) ? symbols[0] : 0;
+		pLengths[used] = 1;
+		pLengths[used == 0 ? 1 : 0] = 1;
+		return;
+	}
+
+	for(int shift = 0; ; ++shift)
+	{
+		// Counts are scaled down until the longest code fits
+		for(int i = 0; i < leafCount; ++i)
+		{
+			weights[i] = (pCounts[symbols[i]] >> shift) | 1;
+		}
+
+		// Two queues: leaves, and internal nodes which are created in increasing weights
+		int parents[2 * k_litLenCount];
+		int nextLeaf = 0;
+		int nextNode = leafCount;
+		int nodeCount = leafCount;
+		for(int n = 0; n < leafCount - 1; ++n)
+		{
+			int children[2];
+			for(int c = 0; c < 2; ++c)
+			{
+				if( nextLeaf < leafCount && (nextNode >= nodeCount || weights[nextLeaf] <= weights[nextNode]) )
+				{
+					children[c] = nextLeaf++;
+				}
+				else
+				{
+					children[c] = nextNode++;
+				}
+			}
+			weights[nodeCount] = weights[children[0]] + weights[children[1]];
+			parents[children[0]] = nodeCount;
+			parents[children[1]] = nodeCount;
+			nodeCount++;
+		}
+
+		// Depths from the root, which is the last node
+		int depths[2 * k_litLenCount];
+		depths[nodeCount - 1] = 0;
+		int maxDepth = 0;
+		for(int i = nodeCount - 2; i >= 0; --i)
+		{
+			depths[i] = depths[parents[i]] + 1;
+			maxDepth = Math::Max(maxDepth, depths[i]);
+		}
+		if( maxDepth <= maxBits )
+		{
+			for(int i = 0; i < leafCount; ++i)
+			{
+				pLengths[symbols[i]] = uint8(depths[i]);
+			}
+			return;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the canonical codes of a Huffman code, bit reversed as deflate writes them
+// [in]  pLengths  Code length of each symbol
+// [in]  count     Number of symbols
+// [out] pCodes    Code of each symbol
+void BuildCodes(const uint8* pLengths, int count, uint16* pCodes)
+{
+	int lengthCounts[16] = { 0 };
+	for(int i = 0; i < count; ++i)
+	{
+		lengthCounts[pLengths[i]]++;
+	}
+	lengthCounts[0] = 0;
+
+	int nextCodes[16] = { 0 };
+	int code = 0;
+	for(int bits = 1; bits < 16; ++bits)
+	{
+		code = (code + lengthCounts[bits - 1]) << 1;
+		nextCodes[bits] = code;
+	}
+	for(int i = 0; i < count; ++i)
+	{
+		const int length = pLengths[i];
+		if( length == 0 )
+		{
+			pCodes[i] = 0;
+			continue;
+		}
+		const int value = nextCodes[length]++;
+		int reversed = 0;
+		for(int bit = 0; bit < length; ++bit)
+		{
+			reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+		}
+		pCodes[i] = uint16(reversed);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Huffman codes of a dynamic block and the header describing them
+struct DeflateDynamicCodes
+{
+	uint8  litLenLengths[k_litLenCount];
+	uint8  distLengths[k_distCount];
+	uint8  codeLengthLengths[k_codeLengthCount];
+	int    litLenCount;     // HLIT + 257
+	int    distCount;       // HDIST + 1
+	int    codeLengthCount; // HCLEN + 4
+	uint16 rleSymbols[k_litLenCount + k_distCount]; // Code length symbol | extra value << 5
+	int    rleSymbolCount;
+
+	// [in] stats  Symbol counts of the block
+	void Build(const DeflateStats& stats)
+	{
+		// Codes 286 and 287 cannot appear in the data, nor distances 30 and 31
+		BuildCodeLengths(stats.litLens, 286, 15, litLenLengths);
+		litLenLengths[286] = litLenLengths[287] = 0;
+		BuildCodeLengths(stats.dists, 30, 15, distLengths);
+		distLengths[30] = distLengths[31] = 0;
+
+		litLenCount = 286;
+		while( litLenCount > 257 && litLenLengths[litLenCount - 1] == 0 )
+		{
+			litLenCount--;
+		}
+		distCount = 30;
+		while( distCount > 1 && distLengths[distCount - 1] == 0 )
+		{
+			distCount--;
+		}
+
+		// Run-length encoding of all the code lengths
+		uint8 lengths[k_litLenCount + k_distCount];
+		Memory::Copy(lengths, litLenLengths, litLenCount);
+		Memory::Copy(lengths + litLenCount, distLengths, distCount);
+		const int total = litLenCount + distCount;
+
+		uint32 counts[k_codeLengthCount] = { 0 };
+		rleSymbolCount = 0;
+		for(int i = 0; i < total; )
+		{
+			const uint8 value = lengths[i];
+			int run = 1;
+			while( i + run < total && lengths[i + run] == value )
+			{
+				run++;
+			}
+			i += run;
+
+			if( value == 0 )
+			{
+				while( run >= 11 )
+				{
+					const int repeat = Math::Min(run, 138);
+					AddRleSymbol(18, repeat - 11, counts);
+					run -= repeat;
+				}
+				if( run >= 3 )
+				{
+					AddRleSymbol(17, run - 3, counts);
+					run = 0;
+				}
+			}
+			else
+			{
+				AddRleSymbol(value, 0, counts);
+				run--;
+				while( run >= 3 )
+				{
+					const int repeat = Math::Min(run, 6);
+					AddRleSymbol(16, repeat - 3, counts);
+					run -= repeat;
+				}
+			}
+			while( run > 0 )
+			{
+				AddRleSymbol(value, 0, counts);
+				run--;
+			}
+		}
+
+		BuildCodeLengths(counts, k_codeLengthCount, 7, codeLengthLengths);
+		codeLengthCount = k_codeLengthCount;
+		while( codeLengthCount > 4 && codeLengthLengths[k_codeLengthOrder[codeLengthCount - 1]] == 0 )
+		{
+			codeLengthCount--;
+		}
+	}
+
+	// Gets the size of the block header in bits, block type excluded
+	uint32 GetHeaderBits() const
+	{
+		uint32 bits = 5 + 5 + 4 + 3 * codeLengthCount;
+		for(int i = 0; i < rleSymbolCount; ++i)
+		{
+			const int symbol = rleSymbols[i] & 0x1f;
+			bits += codeLengthLengths[symbol] + GetRleExtraBits(symbol);
+		}
+		return bits;
+	}
+
+	static int GetRleExtraBits(int symbol)
+	{
+		return (symbol == 16) ? 2 : (symbol == 17) ? 3 : (symbol == 18) ? 7 : 0;
+	}
+
+private:
+	void AddRleSymbol(int symbol, int extra, uint32* pCounts)
+	{
+		rleSymbols[rleSymbolCount++] = uint16(symbol | (extra << 5));
+		pCounts[symbol]++;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the size in bits of the data of a block coded with some code lengths,
+// end of block code included
+uint32 GetDataBits(const DeflateStats& stats, const uint8* pLitLenLengths, const uint8* pDistLengths)
+{
+	uint32 bits = 0;
+	for(int i = 0; i < 286; ++i)
+	{
+		bits += stats.litLens[i] * pLitLenLengths[i];
+		if( i > 256 )
+		{
+			bits += stats.litLens[i] * k_lengthExtraBits[i - 257];
+		}
+	}
+	for(int i = 0; i < 30; ++i)
+	{
+		bits += stats.dists[i] * (pDistLengths[i] + k_distExtraBits[i]);
+	}
+	return bits;
+}
+
+// Gets the size in bits of a dynamic block
+uint32 GetDynamicBlockBits(const DeflateSymbol* pSymbols, int32 count)
+{
+	DeflateStats stats;
+	stats.Compute(pSymbols, count);
+	DeflateDynamicCodes codes;
+	codes.Build(stats);
+	return 3 + codes.GetHeaderBits() + GetDataBits(stats, codes.litLenLengths, codes.distLengths);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Optimal parsing deflate encoder, see the top of this file
+class DeflateOptimal
+{
+public:
+	DeflateRet Compress(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+		int iterationCount, DeflateSizeLimit* pSizeLimit);
+
+	DeflateOptimal();
+
+private:
+	const uint8* m_pSource;
+	int32        m_sourceLen;
+
+	// Hash chains over the whole input
+	Array<int32> m_head;  // Last position of each hash, -1 if none
+	Array<int32> m_prev;  // Previous position with the same hash, indexed by position & k_windowMask
+
+	// Matches of each position of the current chunk. For each position, the entries
+	// are sorted by increasing length and distance: an entry gives the smallest distance
+	// for the lengths above the previous entry length.
+	int32         m_chunkStart;
+	Array<uint32> m_matches;     // length | distance << 9
+	Array<int32>  m_matchStarts; // Index in m_matches of the first entry of each position
+
+	// Work buffers of Parse()
+	Array<float64> m_costs;
+	Array<uint16>  m_steps;
+
+	// Output
+	uint8* m_pOut;
+	uint32 m_outCapacity;
+	uint32 m_outPos;
+	uint32 m_bitBuffer;
+	int    m_bitCount;
+	bool   m_overflow;
+
+private:
+	bool FindMatches(int32 chunkStart, int32 chunkEnd);
+	bool Parse(int32 start, int32 end, const DeflateCostModel& model, Array<DeflateSymbol>& symbols);
+	bool OptimizeBlock(int32 start, int32 end, int iterationCount, Array<DeflateSymbol>& symbols);
+	void SplitBlock(const DeflateSymbol* pSymbols, int32 start, int32 end, Array<int32>& splits);
+	void WriteBlock(const DeflateSymbol* pSymbols, int32 count, int32 start, int32 end, bool last);
+	void WriteSymbols(const DeflateSymbol* pSymbols, int32 count,
+		const uint8* pLitLenLengths, const uint8* pDistLengths);
+
+	void WriteBits(uint32 value, int bitCount);
+	void WriteByte(uint8 value);
+	void AlignToByte();
+};
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+DeflateOptimal::DeflateOptimal()
+{
+	m_pSource = nullptr;
+	m_sourceLen = 0;
+	m_chunkStart = 0;
+	m_pOut = nullptr;
+	m_outCapacity = 0;
+	m_outPos = 0;
+	m_bitBuffer = 0;
+	m_bitCount = 0;
+	m_overflow = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DeflateOptimal::WriteByte(uint8 value)
+{
+	if( m_outPos >= m_outCapacity )
+	{
+		m_overflow = true;
+		return;
+	}
+	m_pOut[m_outPos++] = value;
+}
+
+// Writes bits, least significant first
+void DeflateOptimal::WriteBits(uint32 value, int bitCount)
+{
+	m_bitBuffer |= value << m_bitCount;
+	m_bitCount += bitCount;
+	while( m_bitCount >= 8 )
+	{
+		WriteByte(uint8(m_bitBuffer));
+		m_bitBuffer >>= 8;
+		m_bitCount -= 8;
+	}
+}
+
+void DeflateOptimal::AlignToByte()
+{
+	if( m_bitCount > 0 )
+	{
+		WriteBits(0, 8 - m_bitCount);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds and caches the matches of each position of a chunk
+// [in] chunkStart  First position of the chunk
+// [in] chunkEnd    Position after the chunk
+// Returns false if not enough memory
+bool DeflateOptimal::FindMatches(int32 chunkStart, int32 chunkEnd)
+{
+	const int32 count = chunkEnd - chunkStart;
+	if( !m_matchStarts.SetSize(count + 1) )
+	{
+		return false;
+	}
+	m_chunkStart = chunkStart;
+	m_matches.SetSize(0);
+
+	const uint8* const pSrc = m_pSource;
+	int32* const pHead = m_head.GetPtr();
+	int32* const pPrev = m_prev.GetPtr();
+
+	for(int32 pos = chunkStart; pos < chunkEnd; ++pos)
+	{
+		m_matchStarts[pos - chunkStart] = m_matches.GetSize();
+		if( pos + k_minMatch > m_sourceLen )
+		{
+			continue;
+		}
+		const int32 hash = ((pSrc[pos] << 10) ^ (pSrc[pos + 1] << 5) ^ pSrc[pos + 2]) & (k_hashSize - 1);
+
+		// Matches cannot go past the chunk so the chunk can be parsed alone
+		const int32 maxLength = Math::Min(k_maxMatch, chunkEnd - pos);
+		int32 bestLength = k_minMatch - 1;
+		int32 chainLength = 0;
+		for(int32 cand = pHead[hash]; cand >= 0 && pos - cand <= k_windowSize && chainLength < k_maxChainLength;
+			cand = pPrev[cand & k_windowMask], ++chainLength)
+		{
+			if( bestLength >= maxLength )
+			{
+				break;
+			}
+			// Only longer matches are interesting
+			if( pSrc[cand + bestLength] != pSrc[pos + bestLength] )
+			{
+				continue;
+			}
+			int32 length = 0;
+			while( length < maxLength && pSrc[cand + length] == pSrc[pos + length] )
+			{
+				length++;
+			}
+			if( length > bestLength )
+			{
+				if( m_matches.Add(uint32(length) | (uint32(pos - cand) << 9)) < 0 )
+				{
+					return false;
+				}
+				bestLength = length;
+			}
+		}
+
+		pPrev[pos & k_windowMask] = pHead[hash];
+		pHead[hash] = pos;
+	}
+	m_matchStarts[count] = m_matches.GetSize();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds the cheapest sequence of literals and matches for a block
+// [in]  start    First position of the block, in the current chunk
+// [in]  end      Position after the block
+// [in]  model    Cost of each symbol
+// [out] symbols  Literals and matches
+// Returns false if not enough memory
+bool DeflateOptimal::Parse(int32 start, int32 end, const DeflateCostModel& model, Array<DeflateSymbol>& symbols)
+{
+	const int32 count = end - start;
+	if( !(m_costs.SetSize(count + 1) && m_steps.SetSize(count + 1)) )
+	{
+		return false;
+	}
+	float64* const pCosts = m_costs.GetPtr();
+	uint16* const pSteps = m_steps.GetPtr();
+	pCosts[0] = 0;
+	for(int32 i = 1; i <= count; ++i)
+	{
+		pCosts[i] = 1e30;
+	}
+
+	float64 lengthCosts[k_maxMatch + 1];
+	for(int32 length = k_minMatch; length <= k_maxMatch; ++length)
+	{
+		const int index = GetLengthIndex(length);
+		lengthCosts[length] = model.litLens[257 + index] + k_lengthExtraBits[index];
+	}
+
+	const uint32* const pMatches = m_matches.GetPtr();
+	const int32* const pMatchStarts = m_matchStarts.GetPtr() + (start - m_chunkStart);
+
+	for(int32 i = 0; i < count; ++i)
+	{
+		const float64 cost = pCosts[i];
+		const float64 literalCost = cost + model.litLens[m_pSource[start + i]];
+		if( literalCost < pCosts[i + 1] )
+		{
+			pCosts[i + 1] = literalCost;
+			pSteps[i + 1] = 1;
+		}
+
+		const int32 firstMatch = pMatchStarts[i];
+		const int32 lastMatch = pMatchStarts[i + 1];
+		if( firstMatch == lastMatch )
+		{
+			continue;
+		}
+		const int32 available = count - i;
+
+		// In long repetitions, shorter matches are not worth trying
+		const uint32 longest = pMatches[lastMatch - 1];
+		if( int32(longest & 0x1ff) == k_maxMatch && available >= k_maxMatch )
+		{
+			const int32 dist = int32(longest >> 9);
+			const int distSymbol = GetDistSymbol(dist);
+			const float64 matchCost = cost + lengthCosts[k_maxMatch]
+				+ model.dists[distSymbol] + k_distExtraBits[distSymbol];
+			if( matchCost < pCosts[i + k_maxMatch] )
+			{
+				pCosts[i + k_maxMatch] = matchCost;
+				pSteps[i + k_maxMatch] = uint16(k_maxMatch);
+			}
+			continue;
+		}
+
+		int32 prevLength = k_minMatch - 1;
+		for(int32 iMatch = firstMatch; iMatch < lastMatch && prevLength < available; ++iMatch)
+		{
+			const int32 length = Math::Min(int32(pMatches[iMatch] & 0x1ff), available);
+			const int32 dist = int32(pMatches[iMatch] >> 9);
+			const int distSymbol = GetDistSymbol(dist);
+			const float64 distCost = cost + model.dists[distSymbol] + k_distExtraBits[distSymbol];
+			for(int32 l = prevLength + 1; l <= length; ++l)
+			{
+				const float64 matchCost = distCost + lengthCosts[l];
+				if( matchCost < pCosts[i + l] )
+				{
+					pCosts[i + l] = matchCost;
+					pSteps[i + l] = uint16(l);
+				}
+			}
+			prevLength = length;
+		}
+	}
+
+	// Walk back the cheapest path
+	int32 symbolCount = 0;
+	for(int32 i = count; i > 0; i -= pSteps[i])
+	{
+		symbolCount++;
+	}
+	if( !symbols.SetSize(symbolCount) )
+	{
+		return false;
+	}
+	int32 iSymbol = symbolCount;
+	for(int32 i = count; i > 0; )
+	{
+		const int32 length = pSteps[i];
+		i -= length;
+
+		DeflateSymbol& symbol = symbols[--iSymbol];
+		if( length == 1 )
+		{
+			symbol.litLen = m_pSource[start + i];
+			symbol.dist = 0;
+			continue;
+		}
+		// The first entry long enough has the smallest distance
+		int32 iMatch = pMatchStarts[i];
+		while( int32(pMatches[iMatch] & 0x1ff) < length )
+		{
+			iMatch++;
+		}
+		symbol.litLen = uint16(length);
+		symbol.dist = uint16(pMatches[iMatch] >> 9);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parses a block several times, each parse using the symbol statistics of the previous one.
+// [in]     start           First position of the block, in the current chunk
+// [in]     end             Position after the block
+// [in]     iterationCount  Maximum number of parses
+// [in,out] symbols         Initial parse of the block, receives the smallest parse
+// Returns false if not enough memory
+bool DeflateOptimal::OptimizeBlock(int32 start, int32 end, int iterationCount, Array<DeflateSymbol>& symbols)
+{
+	uint32 bestBits = GetDynamicBlockBits(symbols.GetPtr(), symbols.GetSize());
+	DeflateStats stats;
+	stats.Compute(symbols.GetPtr(), symbols.GetSize());
+
+	Array<DeflateSymbol> current;
+	uint32 prevBits = 0;
+	for(int iteration = 0; iteration < iterationCount; ++iteration)
+	{
+		DeflateCostModel model;
+		model.SetFromStats(stats);
+		if( !Parse(start, end, model, current) )
+		{
+			return false;
+		}
+		const uint32 bits = GetDynamicBlockBits(current.GetPtr(), current.GetSize());
+		stats.Compute(current.GetPtr(), current.GetSize());
+		if( bits < bestBits )
+		{
+			bestBits = bits;
+			symbols.Swap(current);
+		}
+		if( bits == prevBits )
+		{
+			// The statistics do not change anymore
+			break;
+		}
+		prevBits = bits;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Splits a range of symbols in blocks if new Huffman codes make the result smaller.
+// The split points are searched by narrowing an interval around the best candidate.
+// [in]     pSymbols     Symbols of the chunk
+// [in]     start        First symbol of the range
+// [in]     end          Symbol after the range
+// [in,out] splits       Receives the split points, in increasing order
+void DeflateOptimal::SplitBlock(const DeflateSymbol* pSymbols, int32 start, int32 end, Array<int32>& splits)
+{
+	int32 low = start + k_minBlockSymbols;
+	int32 high = end - k_minBlockSymbols;
+	if( low > high )
+	{
+		return;
+	}
+
+	const int candidateCount = 9;
+	uint32 bestBits = MAX_UINT32;
+	int32 bestSplit = low;
+	for(;;)
+	{
+		const int32 step = Math::Max((high - low) / (candidateCount - 1), 1);
+		for(int32 split = low; split <= high; split += step)
+		{
+			const uint32 bits = GetDynamicBlockBits(pSymbols + start, split - start)
+				+ GetDynamicBlockBits(pSymbols + split, end - split);
+			if( bits < bestBits )
+			{
+				bestBits = bits;
+				bestSplit = split;
+			}
+		}
+		if( step == 1 )
+		{
+			break;
+		}
+		low = Math::Max(low, bestSplit - step);
+		high = Math::Min(high, bestSplit + step);
+	}
+
+	if( bestBits >= GetDynamicBlockBits(pSymbols + start, end - start) )
+	{
+		return;
+	}
+	SplitBlock(pSymbols, start, bestSplit, splits);
+	splits.Add(bestSplit);
+	SplitBlock(pSymbols, bestSplit, end, splits);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes the literals and matches of a block followed by the end of block code
+void DeflateOptimal::WriteSymbols(const DeflateSymbol* pSymbols, int32 count,
+                                  const uint8* pLitLenLengths, const uint8* pDistLengths)
+{
+	uint16 litLenCodes[k_litLenCount];
+	uint16 distCodes[k_distCount];
+	BuildCodes(pLitLenLengths, k_litLenCount, litLenCodes);
+	BuildCodes(pDistLengths, k_distCount, distCodes);
+
+	for(int32 i = 0; i < count; ++i)
+	{
+		const DeflateSymbol& symbol = pSymbols[i];
+		if( symbol.dist == 0 )
+		{
+			WriteBits(litLenCodes[symbol.litLen], pLitLenLengths[symbol.litLen]);
+			continue;
+		}
+		const int lengthIndex = GetLengthIndex(symbol.litLen);
+		WriteBits(litLenCodes[257 + lengthIndex], pLitLenLengths[257 + lengthIndex]);
+		WriteBits(symbol.litLen - k_lengthBases[lengthIndex], k_lengthExtraBits[lengthIndex]);
+
+		const int distSymbol = GetDistSymbol(symbol.dist);
+		WriteBits(distCodes[distSymbol], pDistLengths[distSymbol]);
+		WriteBits(symbol.dist - k_distBases[distSymbol], k_distExtraBits[distSymbol]);
+	}
+	WriteBits(litLenCodes[k_endOfBlock], pLitLenLengths[k_endOfBlock]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes a block with the smallest of the stored, fixed and dynamic modes
+// [in] pSymbols  Literals and matches of the block
+// [in] count     Number of symbols
+// [in] start     First position of the block
+// [in] end       Position after the block
+// [in] last      true for the last block of the stream
+void DeflateOptimal::WriteBlock(const DeflateSymbol* pSymbols, int32 count, int32 start, int32 end, bool last)
+{
+	DeflateStats stats;
+	stats.Compute(pSymbols, count);
+
+	DeflateDynamicCodes codes;
+	codes.Build(stats);
+	const uint32 dynamicBits = 3 + codes.GetHeaderBits()
+		+ GetDataBits(stats, codes.litLenLengths, codes.distLengths);
+
+	uint8 fixedLitLenLengths[k_litLenCount];
+	uint8 fixedDistLengths[k_distCount];
+	for(int i = 0; i < k_litLenCount; ++i)
+	{
+		fixedLitLenLengths[i] = uint8((i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8);
+	}
+	for(int i = 0; i < k_distCount; ++i)
+	{
+		fixedDistLengths[i] = 5;
+	}
+	const uint32 fixedBits = 3 + GetDataBits(stats, fixedLitLenLengths, fixedDistLengths);
+
+	// A stored block holds 65535 bytes at most and starts on a byte boundary
+	const int32 byteCount = end - start;
+	const int32 storedCount = Math::Max((byteCount + 65534) / 65535, 1);
+	const uint32 storedBits = uint32(storedCount) * (3 + 7 + 32) + uint32(byteCount) * 8;
+
+	if( storedBits < fixedBits && storedBits < dynamicBits )
+	{
+		for(int32 iStored = 0; iStored < storedCount; ++iStored)
+		{
+			const int32 offset = iStored * 65535;
+			const int32 length = Math::Min(byteCount - offset, 65535);
+			WriteBits((last && iStored == storedCount - 1) ? 1 : 0, 1);
+			WriteBits(0, 2);
+			AlignToByte();
+			WriteBits(uint32(length), 16);
+			WriteBits(uint32(~length) & 0xffff, 16);
+			for(int32 i = 0; i < length; ++i)
+			{
+				WriteByte(m_pSource[start + offset + i]);
+			}
+		}
+	}
+	else if( fixedBits <= dynamicBits )
+	{
+		WriteBits(last ? 1 : 0, 1);
+		WriteBits(1, 2);
+		WriteSymbols(pSymbols, count, fixedLitLenLengths, fixedDistLengths);
+	}
+	else
+	{
+		WriteBits(last ? 1 : 0, 1);
+		WriteBits(2, 2);
+		WriteBits(uint32(codes.litLenCount - 257), 5);
+		WriteBits(uint32(codes.distCount - 1), 5);
+		WriteBits(uint32(codes.codeLengthCount - 4), 4);
+		for(int i = 0; i < codes.codeLengthCount; ++i)
+		{
+			WriteBits(codes.codeLengthLengths[k_codeLengthOrder[i]], 3);
+		}
+
+		uint16 codeLengthCodes[k_codeLengthCount];
+		BuildCodes(codes.codeLengthLengths, k_codeLengthCount, codeLengthCodes);
+		for(int i = 0; i < codes.rleSymbolCount; ++i)
+		{
+			const int symbol = codes.rleSymbols[i] & 0x1f;
+			WriteBits(codeLengthCodes[symbol], codes.codeLengthLengths[symbol]);
+			WriteBits(codes.rleSymbols[i] >> 5, DeflateDynamicCodes::GetRleExtraBits(symbol));
+		}
+		WriteSymbols(pSymbols, count, codes.litLenLengths, codes.distLengths);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Same parameters as DeflateCompressor::CompressOptimal()
+DeflateRet DeflateOptimal::Compress(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+                                    int iterationCount, DeflateSizeLimit* pSizeLimit)
+{
+	if( sourceLen > uint32(MAX_INT32) )
+	{
+		return DF_RET_STREAM_ERROR;
+	}
+	m_pSource = pSource;
+	m_sourceLen = int32(sourceLen);
+	m_pOut = pDest;
+	m_outCapacity = *pDestLen;
+	m_outPos = 0;
+	m_bitBuffer = 0;
+	m_bitCount = 0;
+	m_overflow = false;
+
+	if( !(m_head.SetSize(k_hashSize) && m_prev.SetSize(k_windowSize)) )
+	{
+		return DF_RET_MEM_ERROR;
+	}
+	m_head.Set(-1);
+
+	// zlib header: deflate with a 32K window, maximum compression
+	WriteByte(0x78);
+	WriteByte(0xda);
+
+	if( m_sourceLen == 0 )
+	{
+		// One fixed block with the end of block code only
+		WriteBits(1, 1);
+		WriteBits(1, 2);
+		WriteBits(0, 7);
+	}
+
+	Array<DeflateSymbol> chunkSymbols;
+	Array<DeflateSymbol> blockSymbols;
+	Array<int32> splits;
+	for(int32 chunkStart = 0; chunkStart < m_sourceLen; chunkStart += k_chunkSize)
+	{
+		const int32 chunkEnd = Math::Min(chunkStart + k_chunkSize, m_sourceLen);
+		if( !FindMatches(chunkStart, chunkEnd) )
+		{
+			return DF_RET_MEM_ERROR;
+		}
+
+		// A first parse to know where to split the blocks
+		DeflateCostModel model;
+		model.SetFixed();
+		if( !Parse(chunkStart, chunkEnd, model, chunkSymbols) )
+		{
+			return DF_RET_MEM_ERROR;
+		}
+		splits.SetSize(0);
+		SplitBlock(chunkSymbols.GetPtr(), 0, chunkSymbols.GetSize(), splits);
+		splits.Add(chunkSymbols.GetSize());
+
+		int32 blockStart = chunkStart;
+		int32 firstSymbol = 0;
+		for(int iBlock = 0; iBlock < splits.GetSize(); ++iBlock)
+		{
+			const int32 endSymbol = splits[iBlock];
+			int32 blockEnd = blockStart;
+			for(int32 i = firstSymbol; i < endSymbol; ++i)
+			{
+				blockEnd += chunkSymbols[i].GetByteCount();
+			}
+
+			blockSymbols.Set(chunkSymbols.GetPtr() + firstSymbol, endSymbol - firstSymbol);
+			if( !OptimizeBlock(blockStart, blockEnd, iterationCount, blockSymbols) )
+			{
+				return DF_RET_MEM_ERROR;
+			}
+			const bool last = (chunkEnd == m_sourceLen) && (iBlock == splits.GetSize() - 1);
+			WriteBlock(blockSymbols.GetPtr(), blockSymbols.GetSize(), blockStart, blockEnd, last);
+			if( m_overflow )
+			{
+				return DF_RET_BUF_ERROR;
+			}
+			if( pSizeLimit && pSizeLimit->IsExceeded(m_outPos) )
+			{
+				return DF_RET_BUF_ERROR;
+			}
+			blockStart = blockEnd;
+			firstSymbol = endSymbol;
+		}
+	}
+	AlignToByte();
+
+	const uint32 adler = DeflateCompressor::Adler32(1, pSource, sourceLen);
+	WriteByte(uint8(adler >> 24));
+	WriteByte(uint8(adler >> 16));
+	WriteByte(uint8(adler >> 8));
+	WriteByte(uint8(adler));
+	if( m_overflow )
+	{
+		return DF_RET_BUF_ERROR;
+	}
+	*pDestLen = m_outPos;
+	return DF_RET_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+DeflateRet DeflateCompressor::CompressOptimal(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+                                              int iterationCount, DeflateSizeLimit* pSizeLimit)
+{
+	DeflateOptimal encoder;
+	return encoder.Compress(pDest, pDestLen, pSource, sourceLen, iterationCount, pSizeLimit);
+}
@@ -62,11 +62,21 @@ void DeflateStream::SetBuffers(const uint8* pInNext, uint32 nInAvailable, uint8*
 	m_pImpl->m_ZLibStream.avail_out = outAvailable;
 }
 
+uint32 DeflateStream::GetInAvailable() const
+{
+	return m_pImpl->m_ZLibStream.avail_in;
+}
+
 uint32 DeflateStream::GetOutAvailable() const
 {
 	return m_pImpl->m_ZLibStream.avail_out;
 }
 
+void DeflateStream::SetOutAvailable(uint32 outAvailable)
+{
+	m_pImpl->m_ZLibStream.avail_out = outAvailable;
+}
+
 uint32 DeflateStream::GetOutTotalRead() const
 {
 	return m_pImpl->m_ZLibStream.total_out;
@@ -38,7 +38,9 @@ class DeflateStream
 {
 public:
 	void SetBuffers(const uint8* pInNext, uint32 nInAvailable, uint8* pOutNext, uint32 outAvailable);
+	uint32 GetInAvailable() const;  // Input bytes not consumed yet
 	uint32 GetOutAvailable() const;
+	void   SetOutAvailable(uint32 outAvailable); // Room after the current output position
 	uint32 GetOutTotalRead() const;
 	
 	const char* GetLastError() const;
@@ -26,6 +26,15 @@ public:
 	DeflateRet SyncPoint();
 
 	int GetTotalOut() const;
+
+	// Uncompresses a whole zlib stream in one call, faster than the streaming Uncompress().
+	// Upon entry, destLen is the size of the destination buffer. Upon exit, it is the byte
+	// count written, even on error.
+	// Returns DF_RET_OK if the stream is complete and its checksum right, DF_RET_BUF_ERROR if
+	// the source is truncated or the destination too small, DF_RET_DATA_ERROR if the stream
+	// is invalid, DF_RET_NEED_DICT if it uses a preset dictionary (not supported).
+	// GetLastError() gives nothing for these errors, the streaming decoder has the details.
+	static DeflateRet UncompressBuffer(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen);
 };
 
 } // namespace chustd
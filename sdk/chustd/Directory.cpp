@@ -74,42 +74,55 @@ bool Joker::Matches(const String& fileName) const
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// [in] fullPath : true to get paths as dir+name instead of name only
-StringArray Directory::GetFileNames(const String& dirPath, const String& joker,
-                                    bool fullPaths)
+// Platform data of a DirectoryReader
+struct DirectoryReaderImpl
 {
-	StringArray filePaths;
-	StringArray jokerPatterns;
+#if defined(_WIN32)
+	HANDLE hFind;
+	WIN32_FIND_DATAW fdw;
+	bool hasEntry; // true if fdw holds an entry not yet returned
+#elif defined(__linux__)
+	DIR* pDir;
+#endif
+};
 
-	Array<Joker> jokers;
+///////////////////////////////////////////////////////////////////////////////
+DirectoryReader::DirectoryReader()
+{
+	m_pImpl = nullptr;
+}
 
-	if( !joker.IsEmpty() )
-	{
-		jokerPatterns = joker.Split('|');
-	}
-	else
-	{
-		jokerPatterns.Add("*");
-	}
+///////////////////////////////////////////////////////////////////////////////
+DirectoryReader::~DirectoryReader()
+{
+	Close();
+}
 
-	jokers.EnsureCapacity(jokerPatterns.GetSize());
-	foreach(jokerPatterns, i)
-	{
-		jokers.Add( Joker(jokerPatterns[i]) );
-	}
+///////////////////////////////////////////////////////////////////////////////
+// Opens a directory to read its entries.
+//
+// [in] dirPath  Path of the directory
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////
+bool DirectoryReader::Open(const String& dirPath)
+{
+	Close();
 
 	// We bypass the filter mechanism of FindFirstFile and use always use *
-	// Instead we use our own filter mechanism to get a consistent behavior
+	// The callers use their own filter mechanism to get a consistent behavior
 	// on both Windows and Linux.
 
 #if defined(_WIN32)
-	WIN32_FIND_DATAW fdw;
+	DirectoryReaderImpl* pImpl = new DirectoryReaderImpl;
 	String fffPath = FilePath::Combine(dirPath, "*");
-	HANDLE hFind = FindFirstFileW(fffPath.GetBuffer(), &fdw);
-	if( hFind == INVALID_HANDLE_VALUE )
+	pImpl->hFind = FindFirstFileW(fffPath.GetBuffer(), &pImpl->fdw);
+	if( pImpl->hFind == INVALID_HANDLE_VALUE )
 	{
-		return filePaths;
+		delete pImpl;
+		return false;
 	}
+	pImpl->hasEntry = true;
 
 #elif defined(__linux__)
 	// Linux wants ./ for local paths
@@ -118,7 +131,7 @@ StringArray Directory::GetFileNames(const String& dirPath, const String& joker,
 
 	if( !dirPath.ToUtf8Z(dirPath8, sizeof(buf)-2) )
 	{
-		return filePaths;
+		return false;
 	}
 	if( dirPath8[0] != '/' )
 	{
@@ -131,28 +144,53 @@ StringArray Directory::GetFileNames(const String& dirPath, const String& joker,
 	DIR* pDir = opendir(dirPath8);
 	if( !pDir )
 	{
-		return filePaths;
-	}
-	struct dirent* pEntry = readdir(pDir);
-	if( !pEntry )
-	{
-		return filePaths;
+		return false;
 	}
+	DirectoryReaderImpl* pImpl = new DirectoryReaderImpl;
+	pImpl->pDir = pDir;
 #endif
 
-	String fileName;
+	m_pImpl = pImpl;
+	return true;
+}
 
-	for(;;)
+///////////////////////////////////////////////////////////////////////////////
+// Reads the next entry of the directory, the "." and ".." entries are skipped.
+// The entries come in the order given by the system.
+//
+// [out] fileName  Name of the file or sub-directory
+//
+// Returns true upon success, false if there is no more entry
+///////////////////////////////////////////////////////////////////////////////
+bool DirectoryReader::GetNext(String& fileName)
+{
+	if( m_pImpl == nullptr )
 	{
+		return false;
+	}
 
+	for(;;)
+	{
 #if defined(_WIN32)
-		const wchar* entryName = fdw.cFileName;
+		if( !m_pImpl->hasEntry )
+		{
+			if( !FindNextFileW(m_pImpl->hFind, &m_pImpl->fdw) )
+			{
+				return false;
+			}
+		}
+		m_pImpl->hasEntry = false;
+		const wchar* entryName = m_pImpl->fdw.cFileName;
+
 #elif defined(__linux__)
+		struct dirent* pEntry = readdir(m_pImpl->pDir);
+		if( !pEntry )
+		{
+			return false;
+		}
 		const char* entryName = pEntry->d_name;
 #endif
 
-		bool keepIt = false;
-
 		// We do not want the "." nor the ".." directories
 		bool dot = (entryName[0] == '.' && entryName[1] == 0);
 		bool dotDot = (entryName[0] == '.' && entryName[1] == '.' && entryName[2] == 0);
@@ -163,13 +201,73 @@ StringArray Directory::GetFileNames(const String& dirPath, const String& joker,
 #elif defined(__linux__)
 			fileName = String::FromUtf8Z(entryName);
 #endif
-			foreach(jokers, i)
+			return true;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Closes the directory, done by the destructor too
+///////////////////////////////////////////////////////////////////////////////
+void DirectoryReader::Close()
+{
+	if( m_pImpl == nullptr )
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	FindClose(m_pImpl->hFind);
+
+#elif defined(__linux__)
+	closedir(m_pImpl->pDir);
+#endif
+
+	delete m_pImpl;
+	m_pImpl = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// [in] fullPath : true to get paths as dir+name instead of name only
+StringArray Directory::GetFileNames(const String& dirPath, const String& joker,
+                                    bool fullPaths)
+{
+	StringArray filePaths;
+	StringArray jokerPatterns;
+
+	Array<Joker> jokers;
+
+	if( !joker.IsEmpty() )
+	{
+		jokerPatterns = joker.Split('|');
+	}
+	else
+	{
+		jokerPatterns.Add("*");
+	}
+
+	jokers.EnsureCapacity(jokerPatterns.GetSize());
+	foreach(jokerPatterns, i)
+	{
+		jokers.Add( Joker(jokerPatterns[i]) );
+	}
+
+	DirectoryReader reader;
+	if( !reader.Open(dirPath) )
+	{
+		return filePaths;
+	}
+
+	String fileName;
+	while( reader.GetNext(fileName) )
+	{
+		bool keepIt = false;
+		foreach(jokers, i)
+		{
+			if( jokers[i].Matches(fileName) )
 			{
-				if( jokers[i].Matches(fileName) )
-				{
-					keepIt = true;
-					break;
-				}
+				keepIt = true;
+				break;
 			}
 		}
 
@@ -184,29 +282,7 @@ StringArray Directory::GetFileNames(const String& dirPath, const String& joker,
 				filePaths.Add(fileName);
 			}
 		}
-
-#if defined(_WIN32)
-		if( !FindNextFileW(hFind, &fdw) )
-		{
-			break;
-		}
-
-#elif defined(__linux__)
-		pEntry = readdir(pDir);
-		if( !pEntry )
-		{
-			break;
-		}
-#endif
 	}
-
-#if defined(_WIN32)
-	FindClose(hFind);
-
-#elif defined(__linux__)
-	closedir(pDir);
-#endif
-
 	return filePaths;
 }
 
@@ -24,6 +24,23 @@ public:
 	static bool Delete(const String& dirPath);
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Reads the entries of a directory one by one. Unlike Directory::GetFileNames,
+// the memory used does not depend on the number of entries.
+class DirectoryReader
+{
+public:
+	bool Open(const String& dirPath);
+	bool GetNext(String& fileName);
+	void Close();
+
+	DirectoryReader();
+	~DirectoryReader();
+
+private:
+	struct DirectoryReaderImpl* m_pImpl;
+};
+
 class Joker
 {
 public:
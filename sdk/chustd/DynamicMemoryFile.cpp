@@ -17,6 +17,40 @@ DynamicMemoryFile::DynamicMemoryFile()
 	m_position = 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Takes the content of dmf, which is left closed
+DynamicMemoryFile::DynamicMemoryFile(DynamicMemoryFile&& dmf)
+{
+	m_byteOrder = boBigEndian;
+	m_position = 0;
+	Swap(dmf);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+DynamicMemoryFile& DynamicMemoryFile::operator=(DynamicMemoryFile&& dmf)
+{
+	if( this != &dmf )
+	{
+		Swap(dmf);
+		dmf.Close();
+	}
+	return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DynamicMemoryFile::Swap(DynamicMemoryFile& dmf)
+{
+	m_content.Swap(dmf.m_content);
+
+	const ByteOrder byteOrder = m_byteOrder;
+	m_byteOrder = dmf.m_byteOrder;
+	dmf.m_byteOrder = byteOrder;
+
+	const int32 position = m_position;
+	m_position = dmf.m_position;
+	dmf.m_position = position;
+}
+
 bool DynamicMemoryFile::SetPosition(int64 offset, Whence whence)
 {
 	int64 newPos = 0;
@@ -79,14 +113,9 @@ int DynamicMemoryFile::Read(void* pBuffer, int size)
 
 int DynamicMemoryFile::Write(const void* pBuffer, int size)
 {
-	int newSize = m_position + size;
-	if( newSize > m_content.GetSize() )
+	if( size < 0 || !GrowTo(int64(m_position) + size) )
 	{
-		// Realloc
-		if( !m_content.SetSize(newSize) )
-		{
-			return -1;
-		}
+		return -1;
 	}
 
 	uint8* pDst = m_content.GetWritePtr() + m_position;
@@ -159,13 +188,9 @@ int DynamicMemoryFile::WriteFromFile(IFile& fileSrc, int size, int readAmount)
 	}
 	else
 	{
-		int newSize = m_position + size;
-		if( newSize > m_content.GetSize() )
+		if( !GrowTo(int64(m_position) + size) )
 		{
-			if( !m_content.SetSize(newSize) )
-			{
-				return -1;
-			}
+			return -1;
 		}
 		readAmount = size;
 	}
@@ -173,14 +198,9 @@ int DynamicMemoryFile::WriteFromFile(IFile& fileSrc, int size, int readAmount)
 	int64 totalRead = 0;
 	for(;;)
 	{
-		int newSize = m_position + readAmount;
-		if( newSize > m_content.GetSize() )
+		if( !GrowTo(int64(m_position) + readAmount) )
 		{
-			// Realloc
-			if( !m_content.SetSize(newSize) )
-			{
-				return -1;
-			}
+			return -1;
 		}
 
 		uint8* pDst = m_content.GetWritePtr() + m_position;
@@ -212,3 +232,21 @@ int DynamicMemoryFile::WriteFromFile(IFile& fileSrc, int size, int readAmount)
 
 	return static_cast<int>(totalRead);
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// Enlarges the content so it holds at least size bytes (private)
+//
+// Returns false if the size does not fit in a buffer or upon memory shortage
+///////////////////////////////////////////////////////////////////////////////
+bool DynamicMemoryFile::GrowTo(int64 size)
+{
+	if( size <= m_content.GetSize() )
+	{
+		return true;
+	}
+	if( size > Buffer::MaxSize )
+	{
+		return false;
+	}
+	return m_content.SetSize(int32(size));
+}
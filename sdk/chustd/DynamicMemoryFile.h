@@ -39,12 +39,22 @@ public:
 	// Writes to this DynamicMemoryFile from content found in an external file
 	int WriteFromFile(IFile& fileSrc, int size, int readAmount = -1);
 
+	// Exchanges the content, the position and the byte order of two files, nothing is copied
+	void Swap(DynamicMemoryFile& dmf);
+
 	DynamicMemoryFile();
+	DynamicMemoryFile(const DynamicMemoryFile&) = default;
+	DynamicMemoryFile(DynamicMemoryFile&& dmf);
+
+	DynamicMemoryFile& operator=(const DynamicMemoryFile&) = default;
+	DynamicMemoryFile& operator=(DynamicMemoryFile&& dmf);
 
 private:
 	Buffer    m_content;
 	ByteOrder m_byteOrder;
 	int32     m_position;
+
+	bool GrowTo(int64 size);
 };
 
 } // namespace chustd
@@ -404,7 +404,12 @@ bool Gif::LoadFromFile(IFile& file)
 	}
 
 	// Prepare the main pixel buffer and copy the first frame pixels into it
-	const int32 pixelCount = m_width * m_height;
+	int32 pixelCount = 0;
+	if( !ImageFormat::ComputeBufferSize(m_width, m_height, pixelCount) )
+	{
+		m_lastError = imageTooBig;
+		return false;
+	}
 	if( !m_pixels.SetSize(pixelCount) )
 	{
 		m_lastError = notEnoughMemory;
@@ -413,7 +418,7 @@ bool Gif::LoadFromFile(IFile& file)
 	
 	// Clear background
 	uint8 clearIndex = GetClearIndex(0);
-	Memory::Set(m_pixels.GetWritePtr(), clearIndex, m_width * m_height);
+	Memory::Set(m_pixels.GetWritePtr(), clearIndex, pixelCount);
 
 	if( frameCount == 0 )
 	{
@@ -646,6 +651,15 @@ bool Gif::ReadImageDescriptor(IFile& file, GifAnimFrame* pFrame)
 		m_height = imageHeight;
 	}
 
+	// 65535 x 65535 is possible, then the frame pixel count does not fit in an int32.
+	// Checking the logical screen is enough for all the frames.
+	int32 screenSize = 0;
+	if( !ImageFormat::ComputeBufferSize(m_width, m_height, screenSize) )
+	{
+		m_lastError = imageTooBig;
+		return false;
+	}
+
 	pFrame->m_offsetX = imageLeft;
 	pFrame->m_offsetY = imageTop;
 	pFrame->m_width = imageWidth;
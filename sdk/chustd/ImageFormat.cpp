@@ -221,18 +221,49 @@ int32 ImageFormat::SizeofPixelInBits(PixelFormat ePixelFormat)
 	return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the size of a row in bytes, or -1 if it does not fit in an int32
+///////////////////////////////////////////////////////////////////////////////////////////////////
 int32 ImageFormat::ComputeByteWidth(PixelFormat epf, int32 width)
 {
 	const int32 sizeofPixelInBits = ImageFormat::SizeofPixelInBits(epf);
 
 	// Size of a row in bits
-	const int32 bitWidth = width * sizeofPixelInBits;
+	const int64 bitWidth = int64(width) * sizeofPixelInBits;
 	
 	// Round up for size of a row in bytes
-	const int32 addWidth = ((bitWidth & 7) != 0) ? 1 : 0;
-	const int32 byteWidth = bitWidth / 8 + addWidth;
+	const int64 addWidth = ((bitWidth & 7) != 0) ? 1 : 0;
+	const int64 byteWidth = bitWidth / 8 + addWidth;
+	if( byteWidth > MAX_INT32 )
+	{
+		return -1;
+	}
+	return int32(byteWidth);
+}
 
-	return byteWidth;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the size of a pixel buffer, computed without overflow. Image sizes come from the file
+// headers, and their product can exceed what a Buffer holds.
+//
+// [in]  rowSize   Size of a row in bytes
+// [in]  rowCount  Number of rows
+// [out] size      Size of the buffer in bytes
+//
+// Returns false if the size is negative or too big for a Buffer
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ImageFormat::ComputeBufferSize(int64 rowSize, int64 rowCount, int32& size)
+{
+	size = 0;
+	if( rowSize < 0 || rowCount < 0 )
+	{
+		return false;
+	}
+	if( rowSize > 0 && rowCount > Buffer::MaxSize / rowSize )
+	{
+		return false;
+	}
+	size = int32(rowSize * rowCount);
+	return true;
 }
 //////////////////////////////////////////////////////////////////////////////
 
@@ -248,6 +279,8 @@ String ImageFormat::GetLastErrorString() const
 		return "Not enough memory";
 	case uncompleteFile:
 		return "Uncomplete file";
+	case imageTooBig:
+		return "Image too big";
 	}
 	return "Unknown error";
 }
@@ -283,6 +316,17 @@ void ImageFormat::FreeBuffer()
 	m_pixels.Clear();
 }
 
+Buffer ImageFormat::TakePixels()
+{
+	// Derived classes may give the pixels of a frame
+	Buffer pixels = GetPixels();
+	if( pixels.GetReadPtr() == m_pixels.GetReadPtr() )
+	{
+		m_pixels.Clear();
+	}
+	return pixels;
+}
+
 void ImageFormat::FlipVertical()
 {
 	PixelFormat epf = GetPixelFormat();
@@ -458,8 +502,9 @@ bool ImageFormat::UnpackPixels(Buffer& pixels, int width, int height, PixelForma
 		// Nothing to do
 		return true;
 	}
+	int32 newSize = 0;
 	Buffer newBuffer;
-	if( !newBuffer.SetSize(width * height) )
+	if( !ComputeBufferSize(width, height, newSize) || !newBuffer.SetSize(newSize) )
 	{
 		return false;
 	}
@@ -329,6 +329,7 @@ public:
 		badFileFormat,	// Bad file format
 		notEnoughMemory,
 		uncompleteFile,
+		imageTooBig,	// The pixels do not fit in a buffer
 		firstErrEnumDerived = 0x0100,
 	};
 
@@ -337,6 +338,7 @@ public:
 	static bool IsGray(PixelFormat);
 	static int32 SizeofPixelInBits(PixelFormat epf);
 	static int32 ComputeByteWidth(PixelFormat epf, int32 width);
+	static bool ComputeBufferSize(int64 rowSize, int64 rowCount, int32& size);
 	static bool PackPixels(Buffer& pixels, int width, int height, PixelFormat pixelFormat);
 	static bool UnpackPixels(Buffer& pixels, int width, int height, PixelFormat pixelFormat);
 	///////////////////////////////////////////////
@@ -352,6 +354,10 @@ public:
 
 	void  FreeBuffer();
 
+	// Same as GetPixels(), but the image drops its own reference to the pixels, so the caller
+	// usually holds the only one and can modify them without a copy
+	Buffer TakePixels();
+
 	int32 GetLastError() const;
 	bool  IsIndexed() const;
 
@@ -0,0 +1,166 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "MappedFile.h"
+
+namespace chustd {
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MappedFile::MappedFile()
+{
+	m_pView = nullptr;
+	m_viewSize = 0;
+#if defined(_WIN32)
+	m_hMapping = nullptr;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Maps a whole file for reading
+//
+// [in] filePath  Path of the file
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MappedFile::Open(const String& filePath)
+{
+	Close();
+
+#if defined(_WIN32)
+	HANDLE hFile = CreateFileW(filePath.GetBuffer(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if( hFile == INVALID_HANDLE_VALUE )
+	{
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if( !GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart <= 0 || fileSize.QuadPart > MAX_INT32 )
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+	HANDLE hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(hFile); // The mapping keeps the file open
+	if( hMapping == nullptr )
+	{
+		return false;
+	}
+	void* pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if( pView == nullptr )
+	{
+		CloseHandle(hMapping);
+		return false;
+	}
+	m_hMapping = hMapping;
+	const int32 viewSize = int32(fileSize.QuadPart);
+
+#elif defined(__linux__)
+	char filePath8[260];
+	if( !filePath.ToUtf8Z(filePath8) )
+	{
+		return false;
+	}
+	int fd = open(filePath8, O_RDONLY);
+	if( fd < 0 )
+	{
+		return false;
+	}
+	struct stat st;
+	if( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > MAX_INT32 )
+	{
+		close(fd);
+		return false;
+	}
+	const int32 viewSize = int32(st.st_size);
+	void* pView = mmap(nullptr, viewSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file open
+	if( pView == MAP_FAILED )
+	{
+		return false;
+	}
+	// The decoders read from the beginning to the end
+	madvise(pView, viewSize, MADV_SEQUENTIAL);
+#endif
+
+	m_pView = (uint8*)pView;
+	m_viewSize = viewSize;
+	m_smf.OpenRead(m_pView, m_viewSize);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MappedFile::Close()
+{
+	m_smf.Close();
+	if( m_pView == nullptr )
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	UnmapViewOfFile(m_pView);
+	CloseHandle(m_hMapping);
+	m_hMapping = nullptr;
+#elif defined(__linux__)
+	munmap(m_pView, m_viewSize);
+#endif
+
+	m_pView = nullptr;
+	m_viewSize = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MappedFile::SetPosition(int64 offset, Whence whence)
+{
+	return m_smf.SetPosition(offset, whence);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int64 MappedFile::GetPosition() const
+{
+	return m_smf.GetPosition();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int64 MappedFile::GetSize()
+{
+	return m_smf.GetSize();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int MappedFile::Read(void* pBuffer, int size)
+{
+	return m_smf.Read(pBuffer, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int MappedFile::Write(const void* /*pBuffer*/, int /*size*/)
+{
+	// Read-only
+	return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ByteOrder MappedFile::GetByteOrder() const
+{
+	return m_smf.GetByteOrder();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MappedFile::SetByteOrder(ByteOrder byteOrder)
+{
+	m_smf.SetByteOrder(byteOrder);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace chustd
@@ -0,0 +1,55 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef CHUSTD_MAPPEDFILE_H
+#define CHUSTD_MAPPEDFILE_H
+
+#include "IFile.h"
+#include "StaticMemoryFile.h"
+
+namespace chustd {
+
+// Read-only file mapped in memory. Reading does not copy the whole file first: the pages
+// are loaded on demand, and the system can drop them again under memory pressure.
+// The file must not be modified while it is open. On Windows, it is opened without write
+// sharing, so other processes cannot change it. On POSIX systems, nothing prevents it: reading
+// a page beyond the end of a file truncated by another process raises SIGBUS, which is not
+// handled and ends the process. Keep the file open only as long as needed.
+class MappedFile : public IFile
+{
+public:
+	///////////////////////////////////////////////////////////////////////
+	virtual bool  SetPosition(int64 offset, Whence whence = posBegin);
+	virtual int64 GetPosition() const;
+	virtual int64 GetSize();
+	virtual int   Read(void* pBuffer, int size);
+	virtual int   Write(const void* pBuffer, int size); // Always fails
+	virtual ByteOrder GetByteOrder() const;
+	virtual void SetByteOrder(ByteOrder byteOrder);
+	virtual void Close();
+	///////////////////////////////////////////////////////////////////////
+
+	// Fails for empty files, files over 2 GB and what cannot be mapped, like pipes
+	bool Open(const String& filePath);
+
+	// Content of the file, nullptr if not open
+	const uint8* GetPtr() const { return m_pView; }
+
+	MappedFile();
+	virtual ~MappedFile();
+
+private:
+	uint8* m_pView;
+	int32  m_viewSize;
+#if defined(_WIN32)
+	void*  m_hMapping;
+#endif
+	StaticMemoryFile m_smf; // Reads the view
+};
+
+} // namespace chustd
+
+#endif // ndef CHUSTD_MAPPEDFILE_H
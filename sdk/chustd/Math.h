@@ -270,6 +270,22 @@ public:
 			return value2;
 	}
 
+	static inline int64 Max(int64 value1, int64 value2)
+	{
+		if(value1 > value2)
+			return value1;
+		else
+			return value2;
+	}
+
+	static inline int64 Min(int64 value1, int64 value2)
+	{
+		if(value1 < value2)
+			return value1;
+		else
+			return value2;
+	}
+
 	static inline float32 MaxAbs(float32 f1, float32 f2)
 	{
 		float32 f1abs = AbsF(f1);
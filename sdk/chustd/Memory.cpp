@@ -6,6 +6,7 @@
 
 #include "stdafx.h"
 #include "Memory.h"
+#include "MemoryArena.h"
 #include "Array.h"
 
 using namespace chustd;
@@ -327,3 +328,33 @@ int Memory::GetSize(void* p)
 #endif
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void* Memory::Alloc(int size, MemoryArena* pArena)
+{
+	if( pArena )
+	{
+		return pArena->Alloc(size);
+	}
+	return Alloc(size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void  Memory::Free(void* p, MemoryArena* pArena)
+{
+	if( pArena )
+	{
+		pArena->Free(p);
+		return;
+	}
+	Free(p);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int Memory::GetSize(void* p, MemoryArena* pArena)
+{
+	if( pArena )
+	{
+		return pArena->GetSize(p);
+	}
+	return GetSize(p);
+}
@@ -9,6 +9,8 @@
 
 namespace chustd {
 
+class MemoryArena;
+
 class Memory
 {
 public:
@@ -52,6 +54,11 @@ public:
 	static void* Alloc(int size);
 	static void  Free(void* p);
 	static int   GetSize(void* p);
+
+	// Same as above, but the memory comes from pArena, or from the heap if nullptr
+	static void* Alloc(int size, MemoryArena* pArena);
+	static void  Free(void* p, MemoryArena* pArena);
+	static int   GetSize(void* p, MemoryArena* pArena);
 };
 
 bool Memory::Is16BitsAligned(const void* p)
@@ -0,0 +1,212 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "MemoryArena.h"
+#include "Memory.h"
+
+///////////////////////////////////////////////////////////////////////////////
+using namespace chustd;
+///////////////////////////////////////////////////////////////////////////////
+
+// Big piece of memory where the blocks are cut
+struct MemoryArena::Chunk
+{
+	Chunk* pNext;
+	int64  capacity; // Bytes available for blocks
+	int64  used;     // Bytes given to blocks, from the beginning
+
+	uint8* GetBytes()
+	{
+		return (uint8*)this + ROUND64(sizeof(Chunk));
+	}
+
+	static Chunk* Create(int64 capacity)
+	{
+		int64 allocSize = ROUND64(sizeof(Chunk)) + capacity;
+		if( allocSize > MAX_INT32 )
+		{
+			return nullptr;
+		}
+		Chunk* pChunk = (Chunk*)Memory::Alloc(int(allocSize));
+		if( pChunk == nullptr )
+		{
+			return nullptr;
+		}
+		pChunk->pNext = nullptr;
+		pChunk->capacity = capacity;
+		pChunk->used = 0;
+		return pChunk;
+	}
+};
+
+// Stored before each block
+struct BlockHeader
+{
+	int32 size;   // Rounded size of the block, header excluded
+	int32 unused; // Keeps the block 8 bytes aligned
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MemoryArena::MemoryArena(int32 chunkSize, int64 keptSizeMax)
+{
+	m_pChunks = nullptr;
+	m_chunkSize = chunkSize;
+	m_keptSizeMax = keptSizeMax;
+	m_nextChunkSize = chunkSize;
+	m_heldSize = 0;
+	m_peakSize = 0;
+	m_blockCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MemoryArena::~MemoryArena()
+{
+	// Blocks still used would point to freed memory
+	ASSERT( m_blockCount == 0 );
+
+	while( m_pChunks )
+	{
+		Chunk* pNext = m_pChunks->pNext;
+		Memory::Free(m_pChunks);
+		m_pChunks = pNext;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Allocates a block. Same as Memory::Alloc, the block is 8 bytes aligned.
+//
+// [in] size  Size of the block in bytes
+//
+// Returns the block or nullptr if out of memory
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void* MemoryArena::Alloc(int size)
+{
+	if( size < 0 || size > MAX_INT32 - 64 )
+	{
+		return nullptr;
+	}
+	const int32 blockSize = ROUND64(size);
+	const int64 allocSize = int64(sizeof(BlockHeader)) + blockSize;
+
+	TmpLock lock(m_cs);
+
+	Chunk* pChunk = m_pChunks;
+	if( pChunk == nullptr || pChunk->capacity - pChunk->used < allocSize )
+	{
+		// The end of the current chunk is lost until the arena is rewound
+		int64 capacity = m_nextChunkSize;
+		if( capacity < allocSize )
+		{
+			capacity = allocSize;
+		}
+		pChunk = Chunk::Create(capacity);
+		if( pChunk == nullptr )
+		{
+			return nullptr;
+		}
+		pChunk->pNext = m_pChunks;
+		m_pChunks = pChunk;
+		m_nextChunkSize = m_chunkSize;
+
+		m_heldSize += capacity;
+		if( m_peakSize < m_heldSize )
+		{
+			m_peakSize = m_heldSize;
+		}
+	}
+
+	BlockHeader* pHeader = (BlockHeader*)(pChunk->GetBytes() + pChunk->used);
+	pHeader->size = blockSize;
+	pHeader->unused = 0;
+	pChunk->used += allocSize;
+	m_blockCount++;
+	return pHeader + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Frees a block given by Alloc.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MemoryArena::Free(void* p)
+{
+	if( p == nullptr )
+	{
+		return;
+	}
+	BlockHeader* pHeader = (BlockHeader*)p - 1;
+
+	TmpLock lock(m_cs);
+	ASSERT( m_blockCount > 0 );
+
+	// The last block of the current chunk can be reused at once, which is handy for a
+	// buffer that grows
+	Chunk* pChunk = m_pChunks;
+	uint8* pEnd = (uint8*)p + pHeader->size;
+	if( pEnd == pChunk->GetBytes() + pChunk->used )
+	{
+		pChunk->used -= int64(sizeof(BlockHeader)) + pHeader->size;
+	}
+
+	m_blockCount--;
+	if( m_blockCount == 0 )
+	{
+		Rewind();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the size of a block given by Alloc. The size returned can be greater than the
+// argument of Alloc.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int MemoryArena::GetSize(void* p) const
+{
+	const BlockHeader* pHeader = (const BlockHeader*)p - 1;
+	return pHeader->size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int MemoryArena::GetBlockCount() const
+{
+	TmpLock lock(m_cs);
+	return m_blockCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int64 MemoryArena::GetPeakSize() const
+{
+	TmpLock lock(m_cs);
+	return m_peakSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Makes the whole memory available again, once all the blocks are freed (private)
+// A single chunk is kept as is. Several chunks are given back, and the next chunk will be
+// big enough for all of them, so the next round of the same size needs one allocation.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MemoryArena::Rewind()
+{
+	if( m_pChunks && m_pChunks->pNext == nullptr && m_pChunks->capacity <= m_keptSizeMax )
+	{
+		m_pChunks->used = 0;
+		return;
+	}
+
+	int64 totalCapacity = 0;
+	while( m_pChunks )
+	{
+		Chunk* pNext = m_pChunks->pNext;
+		totalCapacity += m_pChunks->capacity;
+		Memory::Free(m_pChunks);
+		m_pChunks = pNext;
+	}
+	m_heldSize = 0;
+
+	m_nextChunkSize = m_chunkSize;
+	if( m_nextChunkSize < totalCapacity && totalCapacity <= m_keptSizeMax )
+	{
+		m_nextChunkSize = totalCapacity;
+	}
+}
@@ -0,0 +1,51 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef CHUSTD_MEMORYARENA_H
+#define CHUSTD_MEMORYARENA_H
+
+#include "CriticalSection.h"
+
+namespace chustd {
+
+///////////////////////////////////////////////////////////////////////////////
+// Bump allocator for blocks that die at about the same time, like the work buffers
+// of one image. Blocks are cut in big chunks. Freeing a block only gives its memory
+// back if it is the last one allocated; once every block is freed, the arena is
+// rewound and keeps its memory for the next round, up to a limit. Thread safe.
+class MemoryArena
+{
+public:
+	void* Alloc(int size);
+	void  Free(void* p);
+	int   GetSize(void* p) const;
+
+	int   GetBlockCount() const;  // Blocks not freed yet
+	int64 GetPeakSize() const;    // Biggest amount of memory held at once, in bytes
+
+	// [in] chunkSize    Default size of a chunk, bigger blocks get a chunk of their own
+	// [in] keptSizeMax  Memory kept when the arena is rewound, the rest is given back
+	MemoryArena(int32 chunkSize = 1024 * 1024, int64 keptSizeMax = 64 * 1024 * 1024);
+	~MemoryArena();
+
+private:
+	struct Chunk;
+
+	mutable CriticalSection m_cs;
+	Chunk* m_pChunks;        // Current chunk first
+	int32  m_chunkSize;
+	int64  m_keptSizeMax;
+	int64  m_nextChunkSize;  // Size of the next chunk created, enough for a whole round
+	int64  m_heldSize;       // Sum of the chunk capacities
+	int64  m_peakSize;
+	int    m_blockCount;
+
+	void Rewind();
+};
+
+} // namespace chustd
+
+#endif // ndef CHUSTD_MEMORYARENA_H
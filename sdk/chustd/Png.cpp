@@ -6,6 +6,7 @@
 
 #include "stdafx.h"
 #include "Png.h"
+#include "PngFilter.h"
 #include "File.h"
 #include "Math.h"
 #include "TextEncoding.h"
@@ -203,8 +204,6 @@ bool Png::LoadFromFile(IFile& file)
 		}
 	}
 
-	m_compressedBuffer.Clear();
-
 	if( bOkHandled && !bIENDFound )
 	{
 		// End of stream with no damaged chunk but IEND not found
@@ -218,6 +217,8 @@ bool Png::LoadFromFile(IFile& file)
 	{
 		// An error occurred, we clean the object except the lasterror field
 		m_deflateUncompressor.End();
+		m_compressedBuffer.Clear();
+		m_compressedSizes.Clear();
 
 		int32 lastError = m_lastError;
 		FreeBuffer();
@@ -234,6 +235,8 @@ bool Png::LoadFromFile(IFile& file)
 	}
 
 	bool bTerminateOk = EndImageDataProcessing();
+	m_compressedBuffer.Clear();
+	m_compressedSizes.Clear();
 	if( !bTerminateOk )
 	{
 		// An error occurred, we clean the object except the lasterror field
@@ -389,6 +392,15 @@ bool Png::Handle_IHDR(IFile& file, int32 dataSizeof)
 
 	// Computes the size of a pixel in bytes
 	m_sizeofPixel = (m_sizeofPixelInBits + 7 ) / 8;
+
+	// Rejected here rather than on the first IDAT, so the caller knows at once
+	const int32 byteWidth = ComputeByteWidth(epf, m_width);
+	int32 dataSize = 0;
+	if( byteWidth < 0 || !ImageFormat::ComputeBufferSize(int64(byteWidth) + 1, m_height, dataSize) )
+	{
+		m_lastError = imageTooBig;
+		return false;
+	}
 	return true;
 }
 
@@ -399,16 +411,18 @@ bool Png::Handle_IHDR(IFile& file, int32 dataSizeof)
 bool Png::AllocateImageBuffer(bool interlacedBuffer)
 {
 	// One extra byte is used in order to store the filtering sub-code
-	const int32 rowByteCount = m_idiCurrent.byteWidth + 1;
+	const int64 rowByteCount = int64(m_idiCurrent.byteWidth) + 1;
 
-	if( interlacedBuffer )
-	{
-		// The raw data size is bigger is interlacing is used
-		m_idiCurrent.uncompressedDataSize = ComputeInterlacedSize(m_idiCurrent.width, m_idiCurrent.height, m_sizeofPixelInBits);
-	}
-	else
+	// The raw data size is bigger is interlacing is used
+	const int64 dataSize = interlacedBuffer
+		? ComputeInterlacedSize(m_idiCurrent.width, m_idiCurrent.height, m_sizeofPixelInBits)
+		: rowByteCount * m_idiCurrent.height;
+
+	// The IHDR allows sizes that do not fit in a buffer
+	if( m_idiCurrent.byteWidth < 0 || !ImageFormat::ComputeBufferSize(dataSize, 1, m_idiCurrent.uncompressedDataSize) )
 	{
-		m_idiCurrent.uncompressedDataSize = rowByteCount * m_idiCurrent.height;
+		m_lastError = imageTooBig;
+		return false;
 	}
 
 	if( !m_idiCurrent.pPixels->SetSize(m_idiCurrent.uncompressedDataSize) )
@@ -669,15 +683,9 @@ bool Png::BeginImageDataProcessing()
 		return false;
 	}
 
-	// The first time we meet an IDAT chunk, we initialize the zstream structure
-	m_deflateUncompressor.SetBuffers(nullptr, 0, nullptr, 0);
-
-	const int nZErr = m_deflateUncompressor.Init();
-	if( nZErr != DF_RET_OK )
-	{
-		m_lastError = errInflateErr;
-		return false;
-	}
+	// The compressed data is gathered until the last chunk, then uncompressed at once
+	m_compressedBuffer.SetSize(0);
+	m_compressedSizes.SetSize(0);
 	m_outputOffset = 0;
 	return true;
 }
@@ -705,46 +713,91 @@ bool Png::ProcessImageData(IFile& file, int32 dataSizeof)
 		// Valid, skip this data to avoid any decoding error
 		return true;
 	}
+	if( dataSizeof < 0 )
+	{
+		m_lastError = errNotEnoughDataInChunk;
+		return false;
+	}
 
-	const uint32 compressedSize = dataSizeof;
-	if( !m_compressedBuffer.SetSize(compressedSize) )
+	const int32 offset = m_compressedBuffer.GetSize();
+	if( dataSizeof > MAX_INT32 - offset )
+	{
+		m_lastError = imageTooBig;
+		return false;
+	}
+	const int32 newSize = offset + dataSizeof;
+	if( newSize > m_compressedBuffer.GetCapacity() )
+	{
+		// Grows by half at least, as a stream is often split in many small chunks
+		const int64 capacity = Math::Min(Math::Max(int64(newSize), int64(offset) * 3 / 2), int64(MAX_INT32));
+		if( !m_compressedBuffer.EnsureCapacity(int32(capacity)) )
+		{
+			m_lastError = notEnoughMemory;
+			return false;
+		}
+	}
+	if( !m_compressedBuffer.SetSize(newSize) || m_compressedSizes.Add(dataSizeof) < 0 )
 	{
 		m_lastError = notEnoughMemory;
 		return false;
 	}
 
-	uint32 read = file.Read(m_compressedBuffer.GetPtr(), compressedSize);
-	if( read != compressedSize )
+	const int32 read = file.Read(m_compressedBuffer.GetPtr() + offset, dataSizeof);
+	if( read != dataSizeof )
 	{
 		m_lastError = uncompleteFile;
 		return false;
 	}
+	return true;
+}
 
-	const uint32 availableOut = m_idiCurrent.uncompressedDataSize - m_outputOffset;
-
-	uint8* pIn  = m_compressedBuffer.GetPtr();
-	uint8* pOut = m_idiCurrent.pPixels->GetWritePtr() + m_outputOffset;
-	m_deflateUncompressor.SetBuffers(pIn, compressedSize, pOut, availableOut);
-
-	int nZRet2 = m_deflateUncompressor.Uncompress(DF_FLUSH_SYNC);
+// Uncompresses the data gathered from the IDAT or fdAT chunks into the pixel buffer.
+// When the one-call decoder fails, the streaming one is run chunk by chunk to tell
+// the same errors as when each chunk was uncompressed on its own.
+bool Png::UncompressImageData()
+{
+	uint8* pOut = m_idiCurrent.pPixels->GetWritePtr();
+	const uint32 outSize = m_idiCurrent.uncompressedDataSize;
 
-	if( nZRet2 == DF_RET_OK )
+	uint32 written = outSize;
+	if( DeflateUncompressor::UncompressBuffer(pOut, &written, m_compressedBuffer.GetPtr(),
+	                                          m_compressedBuffer.GetSize()) == DF_RET_OK )
 	{
+		m_outputOffset = written;
+		return true;
+	}
 
+	m_deflateUncompressor.SetBuffers(nullptr, 0, nullptr, 0);
+	if( m_deflateUncompressor.Init() != DF_RET_OK )
+	{
+		m_lastError = errInflateErr;
+		return false;
 	}
-	else if( nZRet2 == DF_RET_STREAM_END )
+
+	m_outputOffset = 0;
+	const uint8* pIn = m_compressedBuffer.GetPtr();
+	foreach(m_compressedSizes, i)
 	{
+		const uint32 compressedSize = m_compressedSizes[i];
+		const uint32 availableOut = outSize - m_outputOffset;
+		m_deflateUncompressor.SetBuffers(pIn, compressedSize, pOut + m_outputOffset, availableOut);
 
+		const int nZRet = m_deflateUncompressor.Uncompress(DF_FLUSH_SYNC);
+		if( nZRet != DF_RET_OK && nZRet != DF_RET_STREAM_END )
+		{
+			m_deflateUncompressor.End();
+			m_lastError = errInflateErr;
+			return false;
+		}
+		m_outputOffset += availableOut - m_deflateUncompressor.GetOutAvailable();
+		pIn += compressedSize;
 	}
-	else
+
+	if( m_deflateUncompressor.End() != DF_RET_OK )
 	{
 		m_lastError = errInflateErr;
 		return false;
 	}
-
-	uint32 uncompressedSize = availableOut - m_deflateUncompressor.GetOutAvailable();
-	m_outputOffset += uncompressedSize;
-
 	return true;
 }
 
@@ -829,6 +882,16 @@ bool Png::Handle_fcTL(IFile& file, int32 dataSizeof)
 		return false;
 	}
 
+	// Checked in 64 bits, the fields come from the file. Without this check, the frame
+	// size would be limited by the buffer size only, not by the IHDR.
+	if( fctl.width <= 0 || fctl.height <= 0 || fctl.offsetX < 0 || fctl.offsetY < 0
+	 || int64(fctl.offsetX) + fctl.width > m_IHDR.width
+	 || int64(fctl.offsetY) + fctl.height > m_IHDR.height )
+	{
+		m_lastError = errFrameOutsideImage;
+		return false;
+	}
+
 	if( fctl.delayFracDenominator == 0 )
 	{
 		// If the denominator is 0, it is to be treated as if it were 100
@@ -948,10 +1011,8 @@ const Buffer& Png::GetPixels() const
 // Ends uncompression and unfilters
 bool Png::EndImageDataProcessing()
 {
-	int nZRet = m_deflateUncompressor.End();
-	if( nZRet != DF_RET_OK )
+	if( !UncompressImageData() )
 	{
-		m_lastError = errInflateErr;
 		return false;
 	}
 	// Reset image data chunk counters
@@ -1184,9 +1245,9 @@ bool Png::UnfilterAndUninterlace()
 	return true;
 }
 
-int32 Png::ComputeInterlacedSize(int32 width, int32 height, int32 sizeofPixelInBits)
+int64 Png::ComputeInterlacedSize(int32 width, int32 height, int32 sizeofPixelInBits)
 {
-	int32 totalByteCount = 0;
+	int64 totalByteCount = 0;
 
 	for(int8 iPass = 0; iPass < 7; ++iPass)
 	{
@@ -1196,7 +1257,7 @@ int32 Png::ComputeInterlacedSize(int32 width, int32 height, int32 sizeofPixelInB
 		if( pixelBytesPerRow > 0 )
 		{
 			// + 1 for each row to count the filtering byte
-			totalByteCount += rowCount * (pixelBytesPerRow + 1);
+			totalByteCount += int64(rowCount) * (int64(pixelBytesPerRow) + 1);
 		}
 	}
 	return totalByteCount;
@@ -1212,9 +1273,10 @@ void Png::GetPassSize(int8 iPass, int32& rowCount, int32& pixelBytesPerRow,
 	static const int32 anDividers[8] = { 8, 8, 8, 4, 4, 2, 2, 1 };
 
 	int32 pixelsPerRow = (width + anAdders[iPass + 1]) / anDividers[iPass + 1];
-	int32 pixelBitsPerRow = pixelsPerRow * sizeofPixelInBits;
+	int64 pixelBitsPerRow = int64(pixelsPerRow) * sizeofPixelInBits;
 
-	pixelBytesPerRow = pixelBitsPerRow / 8 + ((pixelBitsPerRow % 8) > 0 ? 1 : 0);
+	// Less than 2**25 pixels of 64 bits, fits in an int32
+	pixelBytesPerRow = int32(pixelBitsPerRow / 8 + ((pixelBitsPerRow % 8) > 0 ? 1 : 0));
 
 	rowCount = (height + anAdders[iPass]) / anDividers[iPass];
 }
@@ -1282,192 +1344,23 @@ bool Png::UnfilterBlock(uint8* pBlock, int32 rowCount, int32 pixelBytesPerRow, i
 	// pUnfilteredRow points on the start of the unfiltered row
 	// Then, for each row, pUnfilteredRow loses one byte in comparison with pRow
 
-	uint8* pRow = pBlock;
+	const uint8* pRow = pBlock;
 	uint8* pUnfilteredRow = pBlock;
-
-	// Create constant data for the loop
-	const int32 sizeofPixel = bytesPerPixel;
-	const int32 byteWidth = pixelBytesPerRow;
+	const uint8* pPrevRow = nullptr;
 
 	for(int iRow = 0; iRow < rowCount; ++iRow)
 	{
-		// Initialize the index (iByte) of the current byte in the row
-		int32 iByte = 0;
-
-		// Get the filtering method used for this row
+		// Get the filtering method used for this row, then jump over it
 		const uint8 method = pRow[0];
-
-		// Jump over the filtering method byte
 		pRow++;
 
-		switch(method)
+		if( !PngFilter::UnfilterRow(method, pUnfilteredRow, pRow, pPrevRow, pixelBytesPerRow, bytesPerPixel) )
 		{
-		case 0:
-			// Method "None"
-			{
-				int counter = byteWidth;
-				do
-				{
-					const uint8 pixel = pRow[0];
-					pRow++;
-
-					pUnfilteredRow[0] = pixel;
-					pUnfilteredRow++;
-
-				}
-				while(--counter > 0);
-			}
-			break;
-		case 1:
-			// Method "Sub"
-			for(;iByte < sizeofPixel; iByte++)
-			{
-				pUnfilteredRow[0] = pRow[0];
-				pUnfilteredRow++;
-				pRow++;
-			}
-			for(;iByte < byteWidth; iByte++)
-			{
-				uint8 sub = pRow[0];
-				uint8 left = pUnfilteredRow[0 - sizeofPixel];
-				uint8 res = uint8(sub + left);
-				pUnfilteredRow[0] = res;
-				pUnfilteredRow++;
-				pRow++;
-			}
-			break;
-		case 2:
-			// Method "Up"
-			if( iRow == 0 )
-			{
-				for(;iByte < byteWidth; iByte++)
-				{
-					uint8 nUp = pRow[0];
-					uint8 above = 0;
-					uint8 res = uint8(nUp + above);
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-			}
-			else
-			{
-				for(;iByte < byteWidth; iByte++)
-				{
-					uint8 nUp = pRow[0];
-					uint8 above = pUnfilteredRow[0 - byteWidth];
-					uint8 res = uint8(nUp + above);
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-			}
-			break;
-		case 3:
-			// Method "Average"
-			if( iRow == 0 )
-			{
-				for(; iByte < sizeofPixel; iByte++)
-				{
-					uint8 average = pRow[0];
-					uint8 left = 0;
-					uint8 above = 0;
-					uint8 res = uint8(average + (left + above) / 2);
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-				for(;iByte < byteWidth; iByte++)
-				{
-					uint8 average = pRow[0];
-					uint8 left = pUnfilteredRow[0 - sizeofPixel];
-					uint8 above = 0;
-					uint8 res = uint8(average + (left + above) / 2);
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-			}
-			else
-			{
-				for(; iByte < sizeofPixel; iByte++)
-				{
-					uint8 average = pRow[0];
-					uint8 left = 0;
-					uint8 above = pUnfilteredRow[0 - byteWidth];
-					uint8 res = uint8(average + (left + above) / 2);
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-				for(;iByte < byteWidth; iByte++)
-				{
-					uint8 average = pRow[0];
-					uint8 left = pUnfilteredRow[0 - sizeofPixel];
-					uint8 above = pUnfilteredRow[0 - byteWidth];
-					uint8 res = uint8(average + (left + above) / 2);
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-			}
-			break;
-		case 4:
-			// Method "Paeth"
-			if( iRow == 0 )
-			{
-				for(;iByte < sizeofPixel; iByte++)
-				{
-					uint8 paeth = pRow[0];
-					uint8 left = 0;
-					uint8 above = 0;
-					uint8 upperLeft = 0;
-					uint8 res = uint8(paeth + PaethPredictor(left, above, upperLeft));
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-				for(;iByte < byteWidth; iByte++)
-				{
-					uint8 paeth = pRow[0];
-					uint8 left = pUnfilteredRow[0 - sizeofPixel];
-					uint8 above = 0;
-					uint8 upperLeft = 0;
-					uint8 res = uint8(paeth + PaethPredictor(left, above, upperLeft));
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-			}
-			else
-			{
-				for(;iByte < sizeofPixel; iByte++)
-				{
-					uint8 paeth = pRow[0];
-					uint8 left = 0;
-					uint8 above = pUnfilteredRow[0 - byteWidth];
-					uint8 upperLeft = 0;
-					uint8 res = uint8(paeth + PaethPredictor(left, above, upperLeft));
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-				for(;iByte < byteWidth; iByte++)
-				{
-					uint8 paeth = pRow[0];
-					uint8 left = pUnfilteredRow[0 - sizeofPixel];
-					uint8 above = pUnfilteredRow[0 - byteWidth];
-					uint8 upperLeft = pUnfilteredRow[0 - sizeofPixel - byteWidth];
-					uint8 res = uint8(paeth + PaethPredictor(left, above, upperLeft));
-					pUnfilteredRow[0] = res;
-					pUnfilteredRow++;
-					pRow++;
-				}
-			}
-			break;
-		default:
 			return false;
 		}
+		pPrevRow = pUnfilteredRow;
+		pUnfilteredRow += pixelBytesPerRow;
+		pRow += pixelBytesPerRow;
 	}
 	return true;
 }
@@ -1565,6 +1458,8 @@ String Png::GetLastErrorString() const
 		return "Keyword/data separator missing in tEXt";
 	case Png::errTextBadKeywordLength:
 		return "Bad tEXt keyword length";
+	case Png::errFrameOutsideImage:
+		return "Frame outside the image in fcTL";
 	}
 
 	return ImageFormat::GetLastErrorString();
@@ -201,7 +201,8 @@ public:
 		errFrameCountOutsideRange,
 		errImageDataMissing,
 		errTextMissingSeparator,
-		errTextBadKeywordLength
+		errTextBadKeywordLength,
+		errFrameOutsideImage
 	};
 
 public:
@@ -259,7 +260,7 @@ public:
 	/////////////////////////////////////////////////////////////////////////////////////
 	static String StringFromChunkType(uint32 type);
 	static bool IsPng(IFile& file);
-	static int32 ComputeInterlacedSize(int32 width, int32 height, int32 sizeofPixelInBits);
+	static int64 ComputeInterlacedSize(int32 width, int32 height, int32 sizeofPixelInBits);
 	static void GetPassSize(int8 iPass, int32& rowCount, int32& pixelBytesPerRow,
 		int32 width, int32 height, int32 sizeofPixelInBits);
 	static uint8 PaethPredictor(uint8 a, uint8 b, uint8 c);
@@ -335,7 +336,8 @@ private:
 
 	DeflateUncompressor m_deflateUncompressor;
 	uint32    m_outputOffset;
-	ByteArray m_compressedBuffer;
+	ByteArray m_compressedBuffer;     // Payloads of the IDAT or fdAT chunks of the current image
+	Array<int32> m_compressedSizes;   // Payload size of each of these chunks
 
 	struct AnimationControl
 	{
@@ -365,6 +367,7 @@ private:
 	bool AllocateImageBuffer(bool interlacedBuffer);
 	bool BeginImageDataProcessing();
 	bool ProcessImageData(IFile& file, int32 dataSizeof);
+	bool UncompressImageData();
 	bool EndImageDataProcessing();
 	
 	bool UnfilterAndUninterlace();
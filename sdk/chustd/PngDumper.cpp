@@ -6,11 +6,33 @@
 
 #include "stdafx.h"
 #include "PngDumper.h"
+#include "PngFilter.h"
 #include "TextEncoding.h"
+#include "Math.h"
+#include "System.h"
+#include "Thread.h"
+#include "CriticalSection.h"
 
 //////////////////////////////////////////////////////////////////////
 using namespace chustd;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PngDumpContext::PngDumpContext()
+{
+	m_compressorReady = false;
+	m_windowBits = 0;
+	m_memLevel = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PngDumpContext::~PngDumpContext()
+{
+	if( m_compressorReady )
+	{
+		m_compressor.End();
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Dumps image data as a PNG file
 bool PngDumper::Dump(const String& filePath, const PngDumpData& dd, const PngDumpSettings& ds)
@@ -33,6 +55,177 @@ bool PngDumper::Dump(const String& filePath, const PngDumpData& dd, const PngDum
 // Returns true upon success
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool PngDumper::Dump(IFile& fileDst, const PngDumpData& dd, const PngDumpSettings& ds)
+{
+	return DumpInternal(fileDst, dd, ds, nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Dumps an image or animation in the PNG format, using scanlines already filtered.
+//
+// [in,out] fileDst    File to write to
+// [in]     dd         Dump data
+// [in]     ds         Dump settings. The filtering member is ignored.
+// [in]     scanlines  Scanlines prepared with PrepareScanlines() from the same dump data
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngDumper::Dump(IFile& fileDst, const PngDumpData& dd, const PngDumpSettings& ds, const PngScanlines& scanlines)
+{
+	PngDumpSettings dsScanlines = ds;
+	dsScanlines.filtering = scanlines.GetFiltering();
+	return DumpInternal(fileDst, dd, dsScanlines, &scanlines);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Filters the default image and the frames of an animation, so several dumps can share the work.
+//
+// [in]  dd         Dump data
+// [in]  filtering  Filtering mode, see PngDumpSettings::filtering
+// [out] scanlines  Scanlines for the IDAT and each fdAT
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngDumper::PrepareScanlines(const PngDumpData& dd, uint8 filtering, PngScanlines& scanlines)
+{
+	scanlines.m_images.Clear();
+	scanlines.m_filtering = filtering;
+
+	// Same image order as in DumpInternal()
+	const uint8* pIdatSrc = dd.pixels.GetReadPtr();
+	int32 idatWidth = dd.width;
+	int32 idatHeight = dd.height;
+	int32 iFrame = 0;
+
+	const int32 frameCount = dd.frames.GetSize();
+	if( frameCount > 0 && !dd.hasDefaultImage )
+	{
+		const ApngFrame* pFrame = dd.frames[0];
+		pIdatSrc = pFrame->GetPixels().GetReadPtr();
+		idatWidth = pFrame->GetWidth();
+		idatHeight = pFrame->GetHeight();
+		iFrame++;
+	}
+
+	if( !scanlines.m_images.SetSize(1 + frameCount - iFrame) )
+	{
+		return false;
+	}
+	ByteArray filteredRows;
+	if( !CreateScanlines(pIdatSrc, idatWidth, idatHeight, dd, filtering, filteredRows, scanlines.m_images[0]) )
+	{
+		return false;
+	}
+
+	for(int32 iImage = 1; iFrame < frameCount; ++iFrame, ++iImage)
+	{
+		const ApngFrame* pFrame = dd.frames[iFrame];
+		const uint8* pFramePixels = pFrame->GetPixels().GetReadPtr();
+		if( !CreateScanlines(pFramePixels, pFrame->GetWidth(), pFrame->GetHeight(), dd, filtering,
+		                     filteredRows, scanlines.m_images[iImage]) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Estimates the deflate size of prepared scanlines without compressing them.
+// A greedy LZ77 pass with a single entry hash table finds the matches, the literals are counted
+// at their order-0 entropy and each match costs a flat amount. The result is only good to compare
+// several scanlines of the same image, e.g. two filterings.
+//
+// [in] scanlines  Scanlines prepared with PrepareScanlines()
+//
+// Returns the estimated compressed size in bytes, or -1 if there is not enough memory
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int64 PngDumper::EstimateCompressedSize(const PngScanlines& scanlines)
+{
+	const int32 hashBits = 15;
+	const int32 windowSize = 32768;
+	const int32 minMatch = 4;
+	const int32 maxMatch = 258;
+	const float64 matchBits = 7.0;
+
+	Array<int32> hashTable;
+	if( !hashTable.SetSize(1 << hashBits) )
+	{
+		return -1;
+	}
+
+	float64 totalBits = 0;
+	const int32 imageCount = scanlines.GetImageCount();
+	for(int32 iImage = 0; iImage < imageCount; ++iImage)
+	{
+		const ByteArray& image = scanlines.GetImage(iImage);
+		const uint8* pData = image.GetPtr();
+		const int32 size = image.GetSize();
+
+		int32* pHash = hashTable.GetPtr();
+		for(int32 i = 0; i < (1 << hashBits); ++i)
+		{
+			pHash[i] = -windowSize - 1;
+		}
+
+		uint32 literalCounts[256];
+		Memory::Zero(literalCounts, sizeof(literalCounts));
+		int32 literalCount = 0;
+		int32 matchCount = 0;
+
+		int32 pos = 0;
+		while( pos < size )
+		{
+			if( pos + minMatch <= size )
+			{
+				const uint32 v = uint32(pData[pos]) | (uint32(pData[pos + 1]) << 8)
+				               | (uint32(pData[pos + 2]) << 16) | (uint32(pData[pos + 3]) << 24);
+				const uint32 hash = (v * 2654435761u) >> (32 - hashBits);
+				const int32 candidate = pHash[hash];
+				pHash[hash] = pos;
+
+				if( pos - candidate <= windowSize
+				 && Memory::Equals(pData + candidate, pData + pos, minMatch) )
+				{
+					const int32 maxLength = Math::Min(maxMatch, size - pos);
+					int32 length = minMatch;
+					while( length < maxLength && pData[candidate + length] == pData[pos + length] )
+					{
+						length++;
+					}
+					matchCount++;
+					pos += length;
+					continue;
+				}
+			}
+			literalCounts[pData[pos]]++;
+			literalCount++;
+			pos++;
+		}
+
+		for(int32 i = 0; i < 256; ++i)
+		{
+			if( literalCounts[i] > 0 )
+			{
+				totalBits += literalCounts[i] * (log(float64(literalCount) / literalCounts[i]) / log(2.0));
+			}
+		}
+		totalBits += matchCount * matchBits;
+	}
+	return int64(totalBits / 8) + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Dumps an image or animation in the PNG format.
+//
+// [in,out] fileDst     File to write to
+// [in]     dd          Dump data
+// [in]     ds          Dump settings
+// [in]     pScanlines  Filtered scanlines, or nullptr to filter the pixels during the dump
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngDumper::DumpInternal(IFile& fileDst, const PngDumpData& dd, const PngDumpSettings& ds,
+                             const PngScanlines* pScanlines)
 {
 	PixelFormat epf = dd.pixelFormat;
 	const int32 width = dd.width;
@@ -41,7 +234,7 @@ bool PngDumper::Dump(IFile& fileDst, const PngDumpData& dd, const PngDumpSetting
 
 	if( epf == PF_32bppBgra )
 	{
-		// Accept BGRA pixels, they will be reverted in CreateImageData()
+		// Accept BGRA pixels, they will be reverted in CreateScanlines() or StreamImageData()
 		epf = PF_32bppRgba;
 	}
 
@@ -59,6 +252,7 @@ bool PngDumper::Dump(IFile& fileDst, const PngDumpData& dd, const PngDumpSetting
 
 	/////////////////////////////////////////////////////////////////////////
 	// Send the data to the stream
+	const int64 startPos = fileDst.GetPosition();
 	
 	// Start to send the png signature
 	if( !WriteSignature(fileDst) )
@@ -277,12 +471,9 @@ bool PngDumper::Dump(IFile& fileDst, const PngDumpData& dd, const PngDumpSetting
 	// Write the IDAT
 	file.BeginChunkWrite(PngChunk_IDAT::Name);
 
-	ByteArray abImageData;
-	if( !CreateImageData(pIdatSrc, width, height, dd, ds, abImageData) )
-	{
-		return false;
-	}
-	if( !file.Write(abImageData.GetPtr(), abImageData.GetSize()) )
+	int32 imageIndex = 0; // Index in pScanlines
+	if( !WriteImageData(file, pIdatSrc, width, height, dd, ds, pScanlines, imageIndex,
+	                    file.GetPosition() - startPos) )
 	{
 		return false;
 	}
@@ -294,8 +485,6 @@ bool PngDumper::Dump(IFile& fileDst, const PngDumpData& dd, const PngDumpSetting
 	
 	/////////////////////////////////////////////////
 	// Write remaining APNG frames
-	ByteArray frameImageData;
-
 	for(; iFrame < frameCount; ++iFrame)
 	{
 		const ApngFrame* pFrame = dd.frames[iFrame];
@@ -323,11 +512,9 @@ bool PngDumper::Dump(IFile& fileDst, const PngDumpData& dd, const PngDumpSetting
 		const int32 frameWidth = pFrame->GetWidth();
 		const int32 frameHeight = pFrame->GetHeight();
 
-		if( !CreateImageData(pFramePixels, frameWidth, frameHeight, dd, ds, frameImageData) )
-		{
-			return false;
-		}
-		if( !file.Write(frameImageData.GetPtr(), frameImageData.GetSize()) )
+		imageIndex++;
+		if( !WriteImageData(file, pFramePixels, frameWidth, frameHeight, dd, ds, pScanlines, imageIndex,
+		                    file.GetPosition() - startPos) )
 		{
 			return false;
 		}
@@ -559,8 +746,92 @@ bool PngDumper::WriteFrameControlChunk(const ApngFrame* pFrame, int32 apngSequen
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool PngDumper::CreateImageData(const uint8* pSrc, int32 width, int32 height, 
-                          const PngDumpData& dd, const PngDumpSettings& ds, ByteArray& abImageData)
+// Compresses an image and writes the result as the content of the current IDAT or fdAT chunk.
+// A single zlib stream is written as it is produced, and the rows of a non-interlaced image
+// are filtered by bands: the memory used does not depend on the image height. The optimal
+// encoder and the compression by blocks need the whole scanlines and the whole result.
+//
+// [in]  file         Destination file, inside the chunk
+// [in]  pSrc         Pixels of the image
+// [in]  width        Image width
+// [in]  height       Image height
+// [in]  dd           Dump data
+// [in]  ds           Dump settings
+// [in]  pScanlines   Filtered scanlines, or nullptr to filter pSrc
+// [in]  imageIndex   Index of the image in pScanlines
+// [in]  sizeBefore   Bytes already written in the file, for the size limit
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngDumper::WriteImageData(ChunkedFile& file, const uint8* pSrc, int32 width, int32 height,
+                          const PngDumpData& dd, const PngDumpSettings& ds, const PngScanlines* pScanlines,
+                          int32 imageIndex, int64 sizeBefore)
+{
+	const ByteArray* pImageScanlines = nullptr;
+	if( pScanlines )
+	{
+		if( !(0 <= imageIndex && imageIndex < pScanlines->GetImageCount()) )
+		{
+			// Scanlines not prepared from the same dump data
+			return false;
+		}
+		pImageScanlines = &pScanlines->GetImage(imageIndex);
+	}
+
+	PixelFormat epf = dd.pixelFormat;
+	if( epf == PF_32bppBgra )
+	{
+		epf = PF_32bppRgba;
+	}
+	const int32 bitsPerPixel = ImageFormat::SizeofPixelInBits(epf);
+	const int32 pixelBytesPerRow = ImageFormat::ComputeByteWidth(epf, width);
+	const int64 scanlinesSize = dd.interlaced ? Png::ComputeInterlacedSize(width, height, bitsPerPixel)
+	                                          : int64(pixelBytesPerRow + 1) * height;
+
+	const bool wholeBuffer = (ds.zlibStrategy == PngDumpSettings::zlibStrategyOptimal)
+	                      || (ds.deflateBlockSize > 0 && scanlinesSize > ds.deflateBlockSize);
+
+	ByteArray abScanlines;
+	if( pImageScanlines == nullptr && (wholeBuffer || dd.interlaced) )
+	{
+		ByteArray localFilteredRows;
+		ByteArray& filteredRows = ds.pContext ? ds.pContext->m_filteredRows : localFilteredRows;
+		if( !CreateScanlines(pSrc, width, height, dd, ds.filtering, filteredRows, abScanlines) )
+		{
+			return false;
+		}
+		pImageScanlines = &abScanlines;
+	}
+
+	if( !wholeBuffer )
+	{
+		return StreamImageData(file, pSrc, width, height, dd, ds, pImageScanlines, sizeBefore);
+	}
+
+	ByteArray abImageData;
+	if( !CompressScanlines(*pImageScanlines, dd, ds, sizeBefore, abImageData) )
+	{
+		return false;
+	}
+	return file.Write(abImageData.GetPtr(), abImageData.GetSize()) == abImageData.GetSize();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Creates the buffer to compress: the rows of the image, each one starting with
+// its filter byte. Interlacing is done here too.
+//
+// [in]  pSrc         Pixels of the image
+// [in]  width        Image width
+// [in]  height       Image height
+// [in]  dd           Dump data
+// [in]  filtering    Filtering mode, see PngDumpSettings::filtering
+// [in]  filteredRows Work buffer of the filtering, kept to be reused
+// [out] abScanlines  Buffer to compress
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngDumper::CreateScanlines(const uint8* pSrc, int32 width, int32 height,
+                          const PngDumpData& dd, uint8 filtering, ByteArray& filteredRows, ByteArray& abScanlines)
 {
 	PixelFormat epf = dd.pixelFormat;
 
@@ -600,59 +871,28 @@ bool PngDumper::CreateImageData(const uint8* pSrc, int32 width, int32 height,
 	////////////////////////////////////////////////////////////
 
 	const int32 pixelBytesPerRow = ImageFormat::ComputeByteWidth(epf, width);
-	const int32 srcSize = pixelBytesPerRow * height;
 
 	/////////////////////////////////////
 	const int32 bitsPerPixel = ImageFormat::SizeofPixelInBits(epf);
-
-	DeflateStrategy strategy = DF_STRATEGY_DEFAULT;
-	if( ds.zlibStrategy == PngDumpSettings::zlibStrategyGuess )
-	{
-		// Guess which strategy we should use
-		if( ds.filtering != 0 )
-		{
-			// Usually achieves better compression with filtered images
-			if( bitsPerPixel <= 8 )
-			{
-				// But for low depths only
-				strategy = DF_STRATEGY_FILTERED;
-			}
-		}
-	}
-	else
-	{
-		if( ds.zlibStrategy == PngDumpSettings::zlibStrategyFilter )
-		{
-			strategy = DF_STRATEGY_FILTERED;
-		}
-	}
-
-	// The buffer that will be given to the zlib routines
-	ByteArray abBufferToCompress;
-
 	const int32 bytesPerPixel = (bitsPerPixel + 7 ) / 8;
 
-	// If special sub-filtering is not requested do not try other methods
-	bool bDoFiltering = false;
-	if( ds.filtering != 0 )
-	{
-		bDoFiltering = true;
-	}
-	
+	// The pixels fit in a buffer, but with a filter byte for each row the scanlines may not
 	int32 bufferToCompressSize = 0;
 	uint8* pBufferToCompress = nullptr;
 
 	if( dd.interlaced )
 	{
-		bufferToCompressSize = Png::ComputeInterlacedSize(width, height, bitsPerPixel);
-		if( !abBufferToCompress.SetSize(bufferToCompressSize) )
+		const int64 interlacedSize = Png::ComputeInterlacedSize(width, height, bitsPerPixel);
+		if( !ImageFormat::ComputeBufferSize(interlacedSize, 1, bufferToCompressSize)
+		 || !abScanlines.SetSize(bufferToCompressSize) )
 		{
 			// Not enough memory
 			return false;
 		}
 
-		pBufferToCompress = abBufferToCompress.GetPtr();
-		if( !InterlaceAndFilter(pBufferToCompress, pSrc, width, height, pixelBytesPerRow, bitsPerPixel, bDoFiltering) )
+		pBufferToCompress = abScanlines.GetPtr();
+		if( !InterlaceAndFilter(pBufferToCompress, pSrc, width, height, pixelBytesPerRow, bitsPerPixel, filtering,
+		                        filteredRows) )
 		{
 			// Not enough memory
 			return false;
@@ -664,13 +904,13 @@ bool PngDumper::CreateImageData(const uint8* pSrc, int32 width, int32 height,
 		// Create a new buffer from the image with a blank byte at each
 		// row beginning (the sub-filtering method)
 
-		bufferToCompressSize = srcSize + height;
-		if( !abBufferToCompress.SetSize(bufferToCompressSize) )
+		if( !ImageFormat::ComputeBufferSize(int64(pixelBytesPerRow) + 1, height, bufferToCompressSize)
+		 || !abScanlines.SetSize(bufferToCompressSize) )
 		{
 			// Not enough memory
 			return false;
 		}
-		pBufferToCompress = abBufferToCompress.GetPtr();
+		pBufferToCompress = abScanlines.GetPtr();
 
 		uint8* pCurNewByte = pBufferToCompress;
 		const uint8* pCurSrcByte = pSrc;
@@ -690,12 +930,105 @@ bool PngDumper::CreateImageData(const uint8* pSrc, int32 width, int32 height,
 
 		////////////////////////////////////////////////////////////////
 		// Apply filtering
-		if( bDoFiltering )
+		if( filtering != PngDumpSettings::filteringNone )
+		{
+			if( !FilterBlock(pBufferToCompress, height, pixelBytesPerRow, bytesPerPixel, filtering, filteredRows) )
+			{
+				// Not enough memory
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the zlib parameters matching the dump settings (private)
+//
+// [in]  dd          Dump data
+// [in]  ds          Dump settings
+// [out] strategy    zlib parameters
+// [out] windowBits
+// [out] memLevel
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PngDumper::GetDeflateParams(const PngDumpData& dd, const PngDumpSettings& ds,
+                                 DeflateStrategy& strategy, int& windowBits, int& memLevel)
+{
+	PixelFormat epf = dd.pixelFormat;
+	if( epf == PF_32bppBgra )
+	{
+		epf = PF_32bppRgba;
+	}
+	const int32 bitsPerPixel = ImageFormat::SizeofPixelInBits(epf);
+
+	strategy = DF_STRATEGY_DEFAULT;
+	if( ds.zlibStrategy == PngDumpSettings::zlibStrategyGuess )
+	{
+		// Guess which strategy we should use
+		if( ds.filtering != PngDumpSettings::filteringNone )
 		{
-			FilterBlock(pBufferToCompress, height, pixelBytesPerRow, bytesPerPixel);
+			// Usually achieves better compression with filtered images
+			if( bitsPerPixel <= 8 )
+			{
+				// But for low depths only
+				strategy = DF_STRATEGY_FILTERED;
+			}
+		}
+	}
+	else
+	{
+		if( ds.zlibStrategy == PngDumpSettings::zlibStrategyFilter )
+		{
+			strategy = DF_STRATEGY_FILTERED;
+		}
+		else if( ds.zlibStrategy == PngDumpSettings::zlibStrategyRle )
+		{
+			strategy = DF_STRATEGY_RLE;
+		}
+		else if( ds.zlibStrategy == PngDumpSettings::zlibStrategyHuffmanOnly )
+		{
+			strategy = DF_STRATEGY_HUFFMAN_ONLY;
 		}
 	}
 
+	windowBits = 15;
+	memLevel = 8;
+
+	// Sometimes it improves compression to use settings for low memory platforms,
+	// that's why we have this option
+	if( ds.zlibWindowBitsAndMem == PngDumpSettings::zlibWindowBitsAndMemLow )
+	{
+		windowBits = 14;
+		memLevel = 6;
+	}
+	else if( ds.zlibWindowBitsAndMem == PngDumpSettings::zlibWindowBitsAndMemMax )
+	{
+		memLevel = 9;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Compresses the whole scanlines of an image in memory, with the optimal encoder or by
+// blocks. A single zlib stream is written by StreamImageData() instead.
+//
+// [in]  abScanlines  Buffer created by CreateScanlines()
+// [in]  dd           Dump data
+// [in]  ds           Dump settings
+// [in]  sizeBefore   Bytes already written in the file, for the size limit
+// [out] abImageData  Compressed image
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngDumper::CompressScanlines(const ByteArray& abScanlines, const PngDumpData& dd,
+                          const PngDumpSettings& ds, int64 sizeBefore, ByteArray& abImageData)
+{
+	DeflateStrategy strategy;
+	int windowBits, memLevel;
+	GetDeflateParams(dd, ds, strategy, windowBits, memLevel);
+
+	const int32 bufferToCompressSize = abScanlines.GetSize();
+	const uint8* pBufferToCompress = abScanlines.GetPtr();
+
 	// ZLib documentation about compress() :
 	// Upon entry, destLen is the total size of the destination buffer,
 	// which must be at least 0.1% larger than sourceLen plus 12 bytes.
@@ -708,22 +1041,20 @@ bool PngDumper::CreateImageData(const uint8* pSrc, int32 width, int32 height,
 	}
 	uint8* const pCompressedBuffer = abImageData.GetPtr();
 
-	const int32 compressionLevel = ds.zlibCompressionLevel;
-
-	int maxWindowBits = 15;
-	int memLevel = 8;
-
-	// Sometimes it improves compression to use settings for low memory platforms,
-	// that's why we have this option
-	if( ds.zlibWindowBitsAndMem == PngDumpSettings::zlibWindowBitsAndMemLow )
+	int32 ret = 0;
+	if( ds.zlibStrategy == PngDumpSettings::zlibStrategyOptimal )
 	{
-		maxWindowBits = 14;
-		memLevel = 6;
+		ret = CompressOptimal(pCompressedBuffer, &compressedBufferSize,
+						pBufferToCompress, bufferToCompressSize,
+						ds.pSizeLimit, sizeBefore);
 	}
-
-	int32 ret = Compress(pCompressedBuffer, &compressedBufferSize,
+	else
+	{
+		ret = CompressBlocks(pCompressedBuffer, &compressedBufferSize,
 						pBufferToCompress, bufferToCompressSize,
-						compressionLevel, strategy, maxWindowBits, memLevel);
+						ds.zlibCompressionLevel, strategy, windowBits, memLevel, ds.deflateBlockSize,
+						ds.deflateThreadCount, ds.pSizeLimit, sizeBefore);
+	}
 
 	if( ret != 0 )
 	{
@@ -741,7 +1072,7 @@ bool PngDumper::CreateImageData(const uint8* pSrc, int32 width, int32 height,
 bool PngDumper::InterlaceAndFilter(uint8* pDst, const uint8* pSrc,
 							  const int32 srcWidth, const int32 srcHeight,
 							  const int32 srcPixelBytesPerRow,
-							  int32 sizeofPixelInBits, bool bDoFiltering)
+							  int32 sizeofPixelInBits, uint8 filtering, ByteArray& filteredRows)
 {
 	static const int32 aStartingRow[7] =  { 0, 0, 4, 0, 2, 0, 1 };
 	static const int32 aRowIncrement[7] = { 8, 8, 8, 4, 4, 2, 2 };
@@ -894,9 +1225,10 @@ bool PngDumper::InterlaceAndFilter(uint8* pDst, const uint8* pSrc,
 		}
 		
 		// End of the pass !
-		if( bDoFiltering )
+		if( filtering != PngDumpSettings::filteringNone )
 		{
-			if( !FilterBlock(pDstPass, localRowCount, localPixelBytesPerRow, sizeofPixelInBytes) )
+			if( !FilterBlock(pDstPass, localRowCount, localPixelBytesPerRow, sizeofPixelInBytes, filtering,
+			                 filteredRows) )
 			{
 				// Not enough memory
 				return false;
@@ -908,239 +1240,591 @@ bool PngDumper::InterlaceAndFilter(uint8* pDst, const uint8* pSrc,
 
 // pBlock points on a buffer which already has room for the sub-filtering byte info given
 // at the beginning of each row.
-bool PngDumper::FilterBlock(uint8* const pBlock, int32 rowCount, int32 pixelBytesPerRow, int32 bytesPerPixel)
+// filtering is filteringAdaptive, which uses Paeth for each row, or one of the fixed filters.
+// filteredRows is a work buffer, kept by the caller to be reused.
+bool PngDumper::FilterBlock(uint8* const pBlock, int32 rowCount, int32 pixelBytesPerRow, int32 bytesPerPixel,
+                            uint8 filtering, ByteArray& filteredRows)
 {
-	// Prepare the rows so the filter byte appears at the beginning of each row
-	//for(int iRow = rowCount - 1; iRow >= 0; --iRow)
+	// The rows are filtered top-down, while they are in the cache. A filtered row is written
+	// over its source once the row below is filtered, as the filters need the source of the
+	// row above. So there are two filtered rows, used in turn.
+	if( !filteredRows.SetSize(pixelBytesPerRow * 2) )
 	{
-
+		// Not enough memory
+		return false;
 	}
-	// Add the byte size for the filtering type
-	const int32 totalBytesPerRow = pixelBytesPerRow + 1;
-	///////////////////////////////////////////////////////////////////////////
-
-	//const int32 filteredBufSize = filteredRowSize * rowCount;
+	uint8* const apTmpRows[2] = { filteredRows.GetPtr(), filteredRows.GetPtr() + pixelBytesPerRow };
 
-	// Allocate buffers for 5 possible filtered rows
-	ByteArray rbFilteredRows;
-	if( !rbFilteredRows.SetSize(pixelBytesPerRow * 5) )
+	// Filter type used for all the rows
+	uint8 method = PngFilter::typePaeth;
+	if( filtering >= PngDumpSettings::filteringSub && filtering < PngDumpSettings::filteringCount )
 	{
-		// Not enough memory
-		return false;
+		method = uint8(1 + filtering - PngDumpSettings::filteringSub);
 	}
 
-	uint8* const pFilteredRows = rbFilteredRows.GetPtr();
+	uint8* pRow = pBlock;
+	const uint8* pRowAbove = nullptr;
 
-	uint8* const pDstNone = pFilteredRows;
-	uint8* const pDstSub = pDstNone + pixelBytesPerRow;
-	uint8* const pDstUp = pDstSub + pixelBytesPerRow;
-	uint8* const pDstAverage = pDstUp + pixelBytesPerRow;
-	uint8* const pDstPaeth = pDstAverage + pixelBytesPerRow;
+	// Previous row, waiting for its filtered version to be written
+	uint8* pPendingRow = nullptr;
+	const uint8* pPendingFiltered = nullptr;
 
-	uint8* const apTmpRows[5] = {pDstNone, pDstSub, pDstUp, pDstAverage, pDstPaeth };
-	
-	////////////////////////////////////////////////////////////////////////
-	// The filtering process must be bottom-up
-	// TODO : this kills the CPU cache we should sometimes prefetch some data to speed-up the process
+	for(int iRow = 0; iRow < rowCount; ++iRow)
+	{
+		// The method byte, then the row
+		pRow[0] = method;
+		pRow++;
 
-	uint8* pRow = pBlock + totalBytesPerRow * rowCount - totalBytesPerRow;
+		uint8* const pFiltered = apTmpRows[iRow & 1];
+		PngFilter::FilterRow(method, pFiltered, pRow, pRowAbove, pixelBytesPerRow, bytesPerPixel);
 
-	for(int iRow = rowCount - 1; iRow >= 0; --iRow)
-	{
-		uint8* pMethod = pRow;
+		// The source of the previous row is not needed anymore
+		if( pPendingRow )
+		{
+			Memory::Copy(pPendingRow, pPendingFiltered, pixelBytesPerRow);
+		}
+		pPendingRow = pRow;
+		pPendingFiltered = pFiltered;
 
-		// Jump over the method byte
-		pRow++;
+		pRowAbove = pRow;
+		pRow += pixelBytesPerRow;
+	}
 
-		// Filtering method used
-		uint8 method = 0;
+	if( pPendingRow )
+	{
+		Memory::Copy(pPendingRow, pPendingFiltered, pixelBytesPerRow);
+	}
+	return true;
+}
 
-		///////////////////////////////////////
-		// Try all of the 5 sub-filter types //
-		///////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Prepares a compressor for a new zlib stream (private)
+//
+// [in,out] compressor   Compressor to prepare, the one of pContext if any
+// [in]     level        zlib parameters
+// [in]     strategy
+// [in]     windowBits
+// [in]     memLevel
+// [in,out] pContext     Keeps the zlib state for the next call, can be nullptr
+//
+// Returns 0 upon success, a DeflateRet error otherwise
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int PngDumper::InitCompressor(DeflateCompressor& compressor, int level, DeflateStrategy strategy,
+                              int windowBits, int memLevel, PngDumpContext* pContext)
+{
+	ASSERT(strategy != DF_STRATEGY_FIXED);
 
-		// Filtering = None (0)
-		for(int iByte = 0; iByte < pixelBytesPerRow; ++iByte)
+	DeflateRet err;
+	if( pContext && pContext->m_compressorReady
+	 && pContext->m_windowBits == windowBits && pContext->m_memLevel == memLevel )
+	{
+		// Same tables, only the level and the strategy may change
+		err = compressor.Reset();
+		if( err == DF_RET_OK )
 		{
-			const uint8 byteCurrent = pRow[iByte];
-			const uint8 none = byteCurrent;
-			
-			pDstNone[iByte] = none;
+			err = compressor.Params(level, strategy);
+		}
+	}
+	else
+	{
+		if( pContext && pContext->m_compressorReady )
+		{
+			compressor.End();
+			pContext->m_compressorReady = false;
 		}
+		err = compressor.Init2(level, DF_METHOD_DEFLATED, windowBits, memLevel, strategy);
+		if( pContext && err == DF_RET_OK )
+		{
+			pContext->m_compressorReady = true;
+			pContext->m_windowBits = windowBits;
+			pContext->m_memLevel = memLevel;
+		}
+	}
+	if( err != DF_RET_OK && pContext && pContext->m_compressorReady )
+	{
+		compressor.End();
+		pContext->m_compressorReady = false;
+	}
+	return err;
+}
 
-		// Try other types of filtering
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Feeds a compressor by parts and writes its output to a file each time the output buffer
+// is full. The size limit is checked at these times.
+class DeflateFileWriter
+{
+public:
+	DeflateFileWriter(DeflateCompressor& compressor, IFile& file, uint8* pOut, uint32 outSize,
+	                  PngDumpSizeLimit* pSizeLimit, int64 sizeBefore)
+		: m_compressor(compressor), m_file(file), m_pOut(pOut), m_outSize(outSize), m_outUsed(0),
+		  m_pSizeLimit(pSizeLimit), m_sizeBefore(sizeBefore)
+	{
+	}
 
-		// Filtering = Sub (1)
-		for(int iByte = 0; iByte < pixelBytesPerRow; ++iByte)
+	// Compresses the next part of the stream. last is true for the final part, which finishes
+	// the stream and writes all the remaining output.
+	DeflateRet Write(const uint8* pIn, uint32 inSize, bool last)
+	{
+		if( inSize == 0 && !last )
 		{
-			uint8 byteLeft;
-			if( iByte < bytesPerPixel )
-			{
-				byteLeft = 0;
-			}
-			else
-			{
-				byteLeft = pRow[iByte - bytesPerPixel];
-			}
-
-			const uint8 byteCurrent = pRow[iByte];
-			const uint8 sub = uint8(byteCurrent - byteLeft);
-			
-			pDstSub[iByte] = sub;
+			// zlib reports an error when it cannot progress
+			return DF_RET_OK;
 		}
 
-		// Filtering = Up (2)
-		for(int iByte = 0; iByte < pixelBytesPerRow; ++iByte)
+		const DeflateFlush flush = last ? DF_FLUSH_FINISH : DF_FLUSH_NONE;
+		m_compressor.SetBuffers(pIn, inSize, m_pOut + m_outUsed, m_outSize - m_outUsed);
+		for(;;)
 		{
-			uint8 byteUp;
-			if( iRow == 0 )
+			const DeflateRet err = m_compressor.Compress(flush);
+			m_outUsed = m_outSize - m_compressor.GetOutAvailable();
+			if( err == DF_RET_STREAM_END )
 			{
-				byteUp = 0;
+				return FlushOutput() ? DF_RET_OK : DF_RET_ERRNO;
 			}
-			else
+			if( err != DF_RET_OK )
 			{
-				byteUp = pRow[-totalBytesPerRow + iByte];
+				return err;
 			}
-
-			const uint8 byteCurrent = pRow[iByte];
-			const uint8 nUp = uint8(byteCurrent - byteUp);
-			
-			pDstUp[iByte] = nUp;
-		}
-
-		// Filtering = Average (3)
-		for(int iByte = 0; iByte < pixelBytesPerRow; ++iByte)
-		{
-			uint8 byteUp;
-			if( iRow == 0 )
+			if( m_outUsed < m_outSize )
 			{
-				byteUp = 0;
-			}
-			else
-			{
-				byteUp = pRow[-totalBytesPerRow + iByte];
+				// Input consumed, the stream is not finished yet
+				ASSERT( !last && m_compressor.GetInAvailable() == 0 );
+				return DF_RET_OK;
 			}
 
-			uint8 byteLeft;
-			if( iByte < bytesPerPixel )
+			// Output buffer full
+			if( m_pSizeLimit && m_pSizeLimit->IsExceeded(m_sizeBefore + m_compressor.GetOutTotalRead()) )
 			{
-				byteLeft = 0;
+				return DF_RET_BUF_ERROR;
 			}
-			else
+			if( !FlushOutput() )
 			{
-				byteLeft = pRow[iByte - bytesPerPixel];
+				return DF_RET_ERRNO;
 			}
+			const uint32 inAvailable = m_compressor.GetInAvailable();
+			m_compressor.SetBuffers(pIn + inSize - inAvailable, inAvailable, m_pOut, m_outSize);
+		}
+	}
 
-			const uint8 byteCurrent = pRow[iByte];
-			const uint8 average = uint8(byteCurrent - (byteLeft + byteUp) / 2);
-			
-			pDstAverage[iByte] = average;
+private:
+	DeflateCompressor& m_compressor;
+	IFile&             m_file;
+	uint8* const       m_pOut;
+	const uint32       m_outSize;
+	uint32             m_outUsed;
+	PngDumpSizeLimit*  m_pSizeLimit;
+	const int64        m_sizeBefore;
+
+	bool FlushOutput()
+	{
+		const int32 outUsed = int32(m_outUsed);
+		m_outUsed = 0;
+		return m_file.Write(m_pOut, outUsed) == outUsed;
+	}
+
+	DeflateFileWriter& operator=(const DeflateFileWriter&);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copies a row of pixels after a null filter byte, swapping BGRA to RGBA if needed (private)
+static void CopyRowToFilter(uint8* pDst, const uint8* pSrc, int32 pixelBytesPerRow, bool bgra)
+{
+	pDst[0] = 0;
+	pDst++;
+
+	if( bgra )
+	{
+		// PNG does not support BGRA8
+		for(int32 iByte = 0; iByte < pixelBytesPerRow; iByte += 4)
+		{
+			pDst[iByte + 0] = pSrc[iByte + 2];
+			pDst[iByte + 1] = pSrc[iByte + 1];
+			pDst[iByte + 2] = pSrc[iByte + 0];
+			pDst[iByte + 3] = pSrc[iByte + 3];
 		}
+	}
+	else
+	{
+		Memory::Copy(pDst, pSrc, pixelBytesPerRow);
+	}
+}
 
-		// Filtering = Paeth (4)
-		for(int iByte = 0; iByte < pixelBytesPerRow; ++iByte)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Compresses an image as a single zlib stream written to the file as it is produced.
+// Without scanlines, the rows are filtered by bands of about 64 KB: each band starts
+// with the unfiltered row above it, as the filters of its first row need it.
+//
+// [in]  file         Destination file, inside the chunk
+// [in]  pSrc         Pixels of a non-interlaced image, used if pScanlines is nullptr
+// [in]  width        Image width
+// [in]  height       Image height
+// [in]  dd           Dump data
+// [in]  ds           Dump settings
+// [in]  pScanlines   Whole scanlines to compress, or nullptr to filter pSrc
+// [in]  sizeBefore   Bytes already written in the file, for the size limit
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngDumper::StreamImageData(ChunkedFile& file, const uint8* pSrc, int32 width, int32 height,
+                          const PngDumpData& dd, const PngDumpSettings& ds, const ByteArray* pScanlines,
+                          int64 sizeBefore)
+{
+	DeflateStrategy strategy;
+	int windowBits, memLevel;
+	GetDeflateParams(dd, ds, strategy, windowBits, memLevel);
+
+	PngDumpContext* pContext = ds.pContext;
+	DeflateCompressor localCompressor;
+	DeflateCompressor& compressor = pContext ? pContext->m_compressor : localCompressor;
+	if( InitCompressor(compressor, ds.zlibCompressionLevel, strategy, windowBits, memLevel, pContext) != DF_RET_OK )
+	{
+		return false;
+	}
+
+	ByteArray localImageData, localRows, localFilteredRows;
+	ByteArray& imageData = pContext ? pContext->m_imageData : localImageData;
+	ByteArray& rows = pContext ? pContext->m_rows : localRows;
+	ByteArray& filteredRows = pContext ? pContext->m_filteredRows : localFilteredRows;
+
+	const int32 outSize = 64 * 1024;
+	bool ok = imageData.SetSize(outSize);
+	if( ok )
+	{
+		DeflateFileWriter writer(compressor, file, imageData.GetPtr(), outSize, ds.pSizeLimit, sizeBefore);
+		if( pScanlines )
 		{
-			uint8 byteUp;
-			if( iRow == 0 )
-			{
-				byteUp = 0;
-			}
-			else
+			ok = writer.Write(pScanlines->GetPtr(), pScanlines->GetSize(), true) == DF_RET_OK;
+		}
+		else
+		{
+			ASSERT( !dd.interlaced );
+			const bool bgra = (dd.pixelFormat == PF_32bppBgra);
+			const PixelFormat epf = bgra ? PF_32bppRgba : dd.pixelFormat;
+			const int32 pixelBytesPerRow = ImageFormat::ComputeByteWidth(epf, width);
+			const int32 bytesPerPixel = (ImageFormat::SizeofPixelInBits(epf) + 7) / 8;
+			const int32 rowSize = pixelBytesPerRow + 1;
+
+			int32 bandRowCount = Math::Max(1, (64 * 1024) / rowSize);
+			if( bandRowCount > height )
 			{
-				byteUp = pRow[-totalBytesPerRow + iByte];
+				bandRowCount = height;
 			}
+			ok = rows.SetSize(rowSize * (bandRowCount + 1));
+			uint8* const pBand = rows.GetPtr();
 
-			uint8 byteLeft;
-			if( iByte < bytesPerPixel )
+			for(int32 iRow = 0; ok && iRow < height; iRow += bandRowCount)
 			{
-				byteLeft = 0;
+				const int32 rowCount = Math::Min(bandRowCount, height - iRow);
+				const bool hasRowAbove = (iRow > 0);
+				if( hasRowAbove )
+				{
+					CopyRowToFilter(pBand, pSrc + pixelBytesPerRow * (iRow - 1), pixelBytesPerRow, bgra);
+				}
+				for(int32 iBandRow = 0; iBandRow < rowCount; ++iBandRow)
+				{
+					CopyRowToFilter(pBand + rowSize * (iBandRow + 1), pSrc + pixelBytesPerRow * (iRow + iBandRow),
+					                pixelBytesPerRow, bgra);
+				}
+
+				uint8* const pRows = pBand + rowSize;
+				if( ds.filtering != PngDumpSettings::filteringNone )
+				{
+					uint8* const pBlock = hasRowAbove ? pBand : pRows;
+					const int32 blockRowCount = hasRowAbove ? rowCount + 1 : rowCount;
+					ok = FilterBlock(pBlock, blockRowCount, pixelBytesPerRow, bytesPerPixel, ds.filtering, filteredRows);
+				}
+				if( ok )
+				{
+					const bool last = (iRow + rowCount == height);
+					ok = writer.Write(pRows, rowSize * rowCount, last) == DF_RET_OK;
+				}
 			}
-			else
+			if( ok && height == 0 )
 			{
-				byteLeft = pRow[iByte - bytesPerPixel];
+				ok = writer.Write(nullptr, 0, true) == DF_RET_OK;
 			}
+		}
+	}
 
-			uint8 byteUpLeft;
-			if( iByte < bytesPerPixel || iRow == 0 )
-			{
-				byteUpLeft = 0;
-			}
-			else
+	if( pContext == nullptr )
+	{
+		// Kept for the next call otherwise
+		compressor.End();
+	}
+	return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Forwards the checks of the optimal deflate encoder to the dump size limit
+class DeflateSizeLimitAdapter : public DeflateSizeLimit
+{
+public:
+	PngDumpSizeLimit* m_pSizeLimit;
+	int64             m_sizeBefore;
+
+	virtual bool IsExceeded(uint32 size)
+	{
+		return m_pSizeLimit->IsExceeded(m_sizeBefore + size);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Compresses a buffer as a zlib stream with the optimal parsing encoder.
+//
+// Same parameters as CompressBlocks(), without the zlib parameters.
+//
+// Returns 0 upon success, a DeflateRet error otherwise
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int PngDumper::CompressOptimal(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+                               PngDumpSizeLimit* pSizeLimit, int64 sizeBefore)
+{
+	// More iterations rarely make a difference
+	const int iterationCount = 15;
+
+	DeflateSizeLimitAdapter adapter;
+	adapter.m_pSizeLimit = pSizeLimit;
+	adapter.m_sizeBefore = sizeBefore;
+	return DeflateCompressor::CompressOptimal(pDest, pDestLen, pSource, sourceLen, iterationCount,
+		pSizeLimit ? &adapter : nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Work shared by the threads of CompressBlocks()
+struct DeflateBlocksContext
+{
+	const uint8*    pSource;
+	uint32          sourceLen;
+	uint32          blockSize;
+	int             level;
+	DeflateStrategy strategy;
+	int             windowBits;
+	int             memLevel;
+
+	Array<ByteArray> outputs;   // Compressed blocks
+	Array<uint32>    adlers;    // Adler-32 of each source block
+	Array<int>       rets;      // Compression result of each block
+
+	PngDumpSizeLimit* pSizeLimit; // Can be nullptr
+	int64             sizeBefore; // Bytes already written in the file
+
+	CriticalSection cs;
+	int             nextBlock;       // Protected by cs
+	int64           compressedTotal; // Protected by cs, sum of the compressed blocks
+	bool            limitExceeded;   // Protected by cs
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Compresses blocks of a DeflateBlocksContext until there is no more
+int PngDumper::CompressBlocksThreadProc(void* arg)
+{
+	DeflateBlocksContext& context = *static_cast<DeflateBlocksContext*>(arg);
+	const int blockCount = context.outputs.GetSize();
+	for(;;)
+	{
+		int iBlock = 0;
+		{
+			TmpLock lock(context.cs);
+			if( context.limitExceeded )
 			{
-				byteUpLeft = pRow[-totalBytesPerRow + iByte - bytesPerPixel];
+				break;
 			}
-
-			const uint8 byteCurrent = pRow[iByte];
-			const uint8 paeth = uint8(byteCurrent - Png::PaethPredictor(byteLeft, byteUp, byteUpLeft));
-			
-			pDstPaeth[iByte] = paeth;
+			iBlock = context.nextBlock++;
+		}
+		if( iBlock >= blockCount )
+		{
+			break;
 		}
 
-		//////////////////////////////////////////////////////////////////////////////////
-		// Choose the best filtered row of the 5
+		const uint32 start = uint32(iBlock) * context.blockSize;
+		const uint32 remaining = context.sourceLen - start;
+		const uint32 length = (remaining < context.blockSize) ? remaining : context.blockSize;
+		const uint8* pBlock = context.pSource + start;
+		const bool lastBlock = (iBlock == blockCount - 1);
 
-		uint32 smallest = MAX_UINT32;
-		method = 0; // Index of the method to use. If all have a sum of 0, choose the method 0
+		context.adlers[iBlock] = DeflateCompressor::Adler32(1, pBlock, length);
 
-		for(uint8 i = 0; i < 5; ++i)
+		// Some margin for the sync flush marker
+		ByteArray& output = context.outputs[iBlock];
+		if( !output.SetSize(DeflateCompressor::Bound(length) + 16) )
 		{
-			uint32 sum = 0;
-			for(int iByte = 0; iByte < pixelBytesPerRow; ++iByte)
+			context.rets[iBlock] = DF_RET_MEM_ERROR;
+			continue;
+		}
+
+		// Raw deflate, the zlib header and trailer are written by CompressBlocks()
+		DeflateCompressor deflateCompressor;
+		DeflateRet err = deflateCompressor.Init2(context.level, DF_METHOD_DEFLATED,
+			-context.windowBits, context.memLevel, context.strategy);
+		if( err != DF_RET_OK )
+		{
+			context.rets[iBlock] = err;
+			continue;
+		}
+
+		// Prime with the end of the previous block so matches can cross the boundary
+		const uint32 windowSize = uint32(1) << context.windowBits;
+		const uint32 dictLength = (start < windowSize) ? start : windowSize;
+		if( dictLength > 0 )
+		{
+			err = deflateCompressor.SetDictionary(pBlock - dictLength, dictLength);
+		}
+		if( err == DF_RET_OK )
+		{
+			deflateCompressor.SetBuffers(pBlock, length, output.GetPtr(), output.GetSize());
+
+			// The sync flush ends the block on a byte boundary, so the outputs can be concatenated
+			err = deflateCompressor.Compress(lastBlock ? DF_FLUSH_FINISH : DF_FLUSH_SYNC);
+			if( lastBlock )
 			{
-				uint8 byte = apTmpRows[i][iByte];
-				/*
-				if( byte >= 128 )
-				{
-					byte = uint8(256 - byte);
-				}*/
-			
-				sum += byte;
+				err = (err == DF_RET_STREAM_END) ? DF_RET_OK : DF_RET_BUF_ERROR;
 			}
-
-			if( sum < smallest )
+			else if( err == DF_RET_OK && deflateCompressor.GetOutAvailable() == 0 )
 			{
-				smallest = sum;
-				method = i;
+				// The flush may be incomplete
+				err = DF_RET_BUF_ERROR;
 			}
 		}
-		method = 4; // dbg
-		///////////////////////////////////////////////////////////////////////
-		// Copy the wanted filtered row to the result buffer
-		pMethod[0] = method;
-		Memory::Copy(pRow, apTmpRows[method], pixelBytesPerRow);
+		if( err == DF_RET_OK )
+		{
+			output.SetSize(deflateCompressor.GetOutTotalRead());
+		}
+		deflateCompressor.End();
+		context.rets[iBlock] = err;
 
-		pRow -= (1 + totalBytesPerRow);
+		if( err == DF_RET_OK && context.pSizeLimit )
+		{
+			TmpLock lock(context.cs);
+			context.compressedTotal += output.GetSize();
+			if( context.pSizeLimit->IsExceeded(context.sizeBefore + context.compressedTotal) )
+			{
+				context.limitExceeded = true;
+			}
+		}
 	}
-	////////////////////////////////////////////////////////////////////////
-	return true;
+	return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int PngDumper::Compress(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen, 
-				  int level, DeflateStrategy strategy, int windowBits, int memLevel)
+// Compresses a buffer as a zlib stream made of blocks compressed in parallel.
+// Each block is primed with the end of the previous one, so the size penalty stays small.
+//
+// [in]     pDest        Destination buffer
+// [in,out] pDestLen     Size of the destination buffer, receives the compressed size
+// [in]     pSource      Buffer to compress
+// [in]     sourceLen    Size of the buffer to compress
+// [in]     level        zlib parameters
+// [in]     strategy
+// [in]     windowBits
+// [in]     memLevel
+// [in]     blockSize    Size of the source blocks
+// [in]     threadCount  Threads compressing the blocks, the calling thread included
+// [in]     pSizeLimit   Checked while compressing, can be nullptr
+// [in]     sizeBefore   Bytes already written in the file, for the size limit
+//
+// Returns 0 upon success, a DeflateRet error otherwise
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int PngDumper::CompressBlocks(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+                              int level, DeflateStrategy strategy, int windowBits, int memLevel, uint32 blockSize,
+                              int threadCount, PngDumpSizeLimit* pSizeLimit, int64 sizeBefore)
 {
-	ASSERT(strategy == DF_STRATEGY_DEFAULT || strategy == DF_STRATEGY_FILTERED);
+	ASSERT(blockSize > 0);
+
+	DeflateBlocksContext context;
+	context.pSource = pSource;
+	context.sourceLen = sourceLen;
+	context.blockSize = blockSize;
+	context.level = level;
+	context.strategy = strategy;
+	context.windowBits = windowBits;
+	context.memLevel = memLevel;
+	context.pSizeLimit = pSizeLimit;
+	context.sizeBefore = sizeBefore;
+	context.nextBlock = 0;
+	context.compressedTotal = 0;
+	context.limitExceeded = false;
+
+	const int blockCount = int((sourceLen + blockSize - 1) / blockSize);
+	if( !(context.outputs.SetSize(blockCount) && context.adlers.SetSize(blockCount)
+	   && context.rets.SetSize(blockCount)) )
+	{
+		return DF_RET_MEM_ERROR;
+	}
+	context.rets.Set(DF_RET_OK);
 
-	DeflateCompressor deflateCompressor;
-	deflateCompressor.SetBuffers(pSource, sourceLen, pDest, *pDestLen);
-	
-	DeflateRet err;
-	
-	DeflateMethod method = DF_METHOD_DEFLATED;
+	// The calling thread works too
+	threadCount = Math::Min(threadCount, blockCount);
+	PtrArray<Thread> threads;
+	for(int i = 1; i < threadCount; ++i)
+	{
+		Thread* pThread = new Thread;
+		threads.Add(pThread);
+		pThread->Start(&CompressBlocksThreadProc, &context);
+	}
+	CompressBlocksThreadProc(&context);
+	for(int i = 0; i < threads.GetSize(); ++i)
+	{
+		threads[i]->WaitForExit();
+	}
 
-	err = deflateCompressor.Init2(level, method, windowBits, memLevel, strategy);
-	if( err != DF_RET_OK )
+	if( context.limitExceeded )
 	{
-		return err;
+		return DF_RET_BUF_ERROR;
 	}
-	err = deflateCompressor.Compress(DF_FLUSH_FINISH);
-	if( err != DF_RET_STREAM_END )
+
+	/////////////////////////////////////////////////
+	// Stitch the blocks: zlib header, deflate data, Adler-32 of the whole source
+	uint32 totalSize = 2 + 4;
+	uint32 adler = 1;
+	for(int iBlock = 0; iBlock < blockCount; ++iBlock)
 	{
-		deflateCompressor.End();
-		return err == DF_RET_OK ? DF_RET_BUF_ERROR : err;
+		if( context.rets[iBlock] != DF_RET_OK )
+		{
+			return context.rets[iBlock];
+		}
+		totalSize += context.outputs[iBlock].GetSize();
+
+		const uint32 start = uint32(iBlock) * blockSize;
+		const uint32 remaining = sourceLen - start;
+		const uint32 length = (remaining < blockSize) ? remaining : blockSize;
+		adler = DeflateCompressor::Adler32Combine(adler, context.adlers[iBlock], length);
 	}
-	*pDestLen = deflateCompressor.GetOutTotalRead();
-	
-	err = deflateCompressor.End();
-	return err;
+	if( totalSize > *pDestLen )
+	{
+		return DF_RET_BUF_ERROR;
+	}
+
+	// Same header as zlib would write
+	uint32 levelFlags = 3;
+	if( strategy >= DF_STRATEGY_HUFFMAN_ONLY || level < 2 )
+	{
+		levelFlags = 0;
+	}
+	else if( level < 6 )
+	{
+		levelFlags = 1;
+	}
+	else if( level == 6 )
+	{
+		levelFlags = 2;
+	}
+	uint32 header = (DF_METHOD_DEFLATED + ((windowBits - 8) << 4)) << 8;
+	header |= (levelFlags << 6);
+	header += 31 - (header % 31);
+
+	uint8* pOut = pDest;
+	*pOut++ = uint8(header >> 8);
+	*pOut++ = uint8(header);
+	for(int iBlock = 0; iBlock < blockCount; ++iBlock)
+	{
+		const ByteArray& output = context.outputs[iBlock];
+		Memory::Copy(pOut, output.GetPtr(), output.GetSize());
+		pOut += output.GetSize();
+	}
+	*pOut++ = uint8(adler >> 24);
+	*pOut++ = uint8(adler >> 16);
+	*pOut++ = uint8(adler >> 8);
+	*pOut++ = uint8(adler);
+
+	*pDestLen = totalSize;
+	return DF_RET_OK;
 }
@@ -59,6 +59,39 @@ struct PngDumpData
 	}
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Lets the caller stop a dump that is not worth finishing, for instance because
+// a smaller file was already found. Can be called by several threads at once.
+class PngDumpSizeLimit
+{
+public:
+	// Returns true if the dump should stop, size being a lower bound of the final file size
+	virtual bool IsExceeded(int64 size) = 0;
+
+	virtual ~PngDumpSizeLimit() {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Work state kept between dumps, so a thread performing many dumps does not allocate
+// the zlib tables and the work buffers each time. Not thread safe: one per thread.
+class PngDumpContext
+{
+public:
+	PngDumpContext();
+	~PngDumpContext();
+
+private:
+	DeflateCompressor m_compressor;
+	bool      m_compressorReady; // true once m_compressor is initialized
+	int       m_windowBits;      // Parameters m_compressor was initialized with
+	int       m_memLevel;
+	ByteArray m_filteredRows;    // Work rows of the filtering
+	ByteArray m_rows;            // Band of rows being filtered
+	ByteArray m_imageData;       // Compressed data waiting to be written
+
+	friend class PngDumper;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Settings of the PngDumper
 struct PngDumpSettings
@@ -70,9 +103,24 @@ public:
 		zlibStrategyGuess = 0x00,   // Default
 		zlibStrategyDefault = 0x01,
 		zlibStrategyFilter = 0x02,
+		zlibStrategyRle = 0x03,
+		zlibStrategyHuffmanOnly = 0x04,
+		zlibStrategyOptimal = 0x05,  // Optimal parsing encoder instead of zlib, very slow
 	
 		zlibWindowBitsAndMemHigh = 0x00, // Default
-		zlibWindowBitsAndMemLow = 0x10   // Can sometimes improve compression
+		zlibWindowBitsAndMemLow = 0x10,  // Can sometimes improve compression
+		zlibWindowBitsAndMemMax = 0x20   // Biggest hash table
+	};
+
+	enum FilteringOption
+	{
+		filteringNone = 0,     // Each scanline is left as is
+		filteringAdaptive = 1, // A filter is chosen for each scanline
+		filteringSub = 2,      // Fixed filters, the same for all scanlines
+		filteringUp = 3,
+		filteringAverage = 4,
+		filteringPaeth = 5,
+		filteringCount = 6
 	};
 
 	uint8       zlibCompressionLevel; // [1..9], default = 6
@@ -81,7 +129,26 @@ public:
 	
 	// 0 = Adaptative filtering with "None" set for each scanline
 	// 1 = Adaptative filtering with various sub-method set for each scanline
-	uint8       filtering;    // Default = 1
+	// 2..5 = Adaptative filtering with the same sub-method set for each scanline
+	uint8       filtering;    // FilteringOption, default = 1
+
+	// 0 = One single deflate pass (default)
+	// Otherwise the scanlines are split in blocks of this size compressed on several threads.
+	// Faster on large images, but the result is a bit bigger.
+	// Ignored by zlibStrategyOptimal.
+	int32       deflateBlockSize;
+
+	// Threads compressing the blocks of deflateBlockSize, the calling thread included.
+	// 1 = the calling thread only (default)
+	int32       deflateThreadCount;
+
+	// Checked while compressing, the dump fails as soon as the limit is exceeded.
+	// nullptr = no limit (default)
+	PngDumpSizeLimit* pSizeLimit;
+
+	// Reused between dumps to save allocations, the result does not change.
+	// nullptr = allocate for this dump only (default)
+	PngDumpContext* pContext;
 
 	PngDumpSettings()
 	{
@@ -90,9 +157,35 @@ public:
 		zlibWindowBitsAndMem = zlibWindowBitsAndMemHigh;
 		
 		filtering = 1;
+		deflateBlockSize = 0;
+		deflateThreadCount = 1;
+		pSizeLimit = nullptr;
+		pContext = nullptr;
 	}
 };
 
+//////////////////////////////////////////////////////////////////////////////////////
+// Scanlines of an image ready to be compressed: each row starts with its filter byte.
+// There is one buffer for the IDAT and one for each fdAT, in the file order.
+// Prepared once for a filtering mode, they can be shared read-only by several dumps
+// using different compression settings.
+class PngScanlines
+{
+public:
+	uint8 GetFiltering() const { return m_filtering; }
+	int32 GetImageCount() const { return m_images.GetSize(); }
+	const ByteArray& GetImage(int32 index) const { return m_images[index]; }
+	void  Clear() { m_images.Clear(); }
+
+	PngScanlines() : m_filtering(0) {}
+
+private:
+	uint8 m_filtering;        // Same as PngDumpSettings::filtering
+	Array<ByteArray> m_images;
+
+	friend class PngDumper;
+};
+
 //////////////////////////////////////////////////////////////////////////////////////
 // Dumps a pixel buffer as a PNG file
 class PngDumper
@@ -101,6 +194,10 @@ public:
 	/////////////////////////////////////////////////////////////////////////////////////
 	static bool Dump(const String& filePath, const PngDumpData& dd, const PngDumpSettings& ds);
 	static bool Dump(IFile& file, const PngDumpData& dd, const PngDumpSettings& ds);
+	static bool Dump(IFile& file, const PngDumpData& dd, const PngDumpSettings& ds, const PngScanlines& scanlines);
+
+	static bool PrepareScanlines(const PngDumpData& dd, uint8 filtering, PngScanlines& scanlines);
+	static int64 EstimateCompressedSize(const PngScanlines& scanlines);
 
 	static bool WriteSignature(IFile& file);
 	static bool WriteChunk_bkGD(ChunkedFile& cf, uint8 colorType, const PngChunk_bkGD& content);
@@ -110,14 +207,32 @@ public:
 private:
 	static bool GetIHDRFeaturesFromPixelFormat(PixelFormat epf, uint8& colorType, uint8& bitDepthPerComponent);
 	static bool WriteFrameControlChunk(const ApngFrame* pFrame, int32 apngSequenceNumber, ChunkedFile& file);
-	static bool CreateImageData(const uint8* pSrc, int32 width, int32 height,
-		const PngDumpData& dd, const PngDumpSettings& ds, ByteArray& abImageData);
+	static bool DumpInternal(IFile& file, const PngDumpData& dd, const PngDumpSettings& ds,
+		const PngScanlines* pScanlines);
+	static bool WriteImageData(ChunkedFile& file, const uint8* pSrc, int32 width, int32 height,
+		const PngDumpData& dd, const PngDumpSettings& ds, const PngScanlines* pScanlines, int32 imageIndex,
+		int64 sizeBefore);
+	static bool StreamImageData(ChunkedFile& file, const uint8* pSrc, int32 width, int32 height,
+		const PngDumpData& dd, const PngDumpSettings& ds, const ByteArray* pScanlines, int64 sizeBefore);
+	static bool CreateScanlines(const uint8* pSrc, int32 width, int32 height,
+		const PngDumpData& dd, uint8 filtering, ByteArray& filteredRows, ByteArray& abScanlines);
+	static void GetDeflateParams(const PngDumpData& dd, const PngDumpSettings& ds,
+		DeflateStrategy& strategy, int& windowBits, int& memLevel);
+	static bool CompressScanlines(const ByteArray& abScanlines, const PngDumpData& dd,
+		const PngDumpSettings& ds, int64 sizeBefore, ByteArray& abImageData);
 	static bool InterlaceAndFilter(uint8* pDst, const uint8* pSrc,
 		const int32 srcWidth, const int32 srcHeight, const int32 srcPixelBytesPerRow,
-		int32 sizeofPixelInBits, bool bDoFiltering);
-	static bool FilterBlock(uint8* const pBlock, int32 rowCount, int32 pixelBytesPerRow, int32 bytesPerPixel);
-	static int Compress(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen, 
-		int level, DeflateStrategy strategy, int windowBits, int memLevel);
+		int32 sizeofPixelInBits, uint8 filtering, ByteArray& filteredRows);
+	static bool FilterBlock(uint8* const pBlock, int32 rowCount, int32 pixelBytesPerRow, int32 bytesPerPixel,
+		uint8 filtering, ByteArray& filteredRows);
+	static int InitCompressor(DeflateCompressor& compressor, int level, DeflateStrategy strategy,
+		int windowBits, int memLevel, PngDumpContext* pContext);
+	static int CompressBlocks(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+		int level, DeflateStrategy strategy, int windowBits, int memLevel, uint32 blockSize,
+		int threadCount, PngDumpSizeLimit* pSizeLimit, int64 sizeBefore);
+	static int CompressBlocksThreadProc(void* arg);
+	static int CompressOptimal(uint8* pDest, uint32* pDestLen, const uint8* pSource, uint32 sourceLen,
+		PngDumpSizeLimit* pSizeLimit, int64 sizeBefore);
 };
 
 } // namespace chustd;
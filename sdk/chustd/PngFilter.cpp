@@ -0,0 +1,504 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "PngFilter.h"
+#include "Png.h"
+#include "Memory.h"
+#include "System.h"
+
+// SSE2 is part of x64, and the default of VC++ for x86 since VS2012
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHUSTD_PNGFILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+using namespace chustd;
+///////////////////////////////////////////////////////////////////////////////
+
+// Unfilters one row. The pixel size is known by the kernel, the previous row is never nullptr.
+typedef void (*UnfilterFunc)(uint8* pDst, const uint8* pSrc, const uint8* pPrev, int32 byteWidth);
+
+struct UnfilterKernels
+{
+	UnfilterFunc sub;
+	UnfilterFunc up;
+	UnfilterFunc average;
+	UnfilterFunc paeth;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Scalar kernels
+//
+// pDst can be before pSrc in the same buffer: each byte of pSrc is read before the byte of pDst
+// at the same index is written.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void UnfilterUp(uint8* pDst, const uint8* pSrc, const uint8* pPrev, int32 byteWidth)
+{
+	for(int32 i = 0; i < byteWidth; ++i)
+	{
+		pDst[i] = uint8(pSrc[i] + pPrev[i]);
+	}
+}
+
+template <int t_bpp>
+static void UnfilterSub(uint8* pDst, const uint8* pSrc, const uint8*, int32 byteWidth)
+{
+	for(int32 i = 0; i < t_bpp; ++i)
+	{
+		pDst[i] = pSrc[i];
+	}
+	for(int32 i = t_bpp; i < byteWidth; ++i)
+	{
+		pDst[i] = uint8(pSrc[i] + pDst[i - t_bpp]);
+	}
+}
+
+template <int t_bpp>
+static void UnfilterAverage(uint8* pDst, const uint8* pSrc, const uint8* pPrev, int32 byteWidth)
+{
+	for(int32 i = 0; i < t_bpp; ++i)
+	{
+		pDst[i] = uint8(pSrc[i] + pPrev[i] / 2);
+	}
+	for(int32 i = t_bpp; i < byteWidth; ++i)
+	{
+		pDst[i] = uint8(pSrc[i] + (pDst[i - t_bpp] + pPrev[i]) / 2);
+	}
+}
+
+// Same result as Png::PaethPredictor, without branches
+static inline int PredictPaeth(int a, int b, int c)
+{
+	const int p = b - c;
+	const int q = a - c;
+	const int pa = (p < 0) ? -p : p;
+	const int pb = (q < 0) ? -q : q;
+	const int pc = (p + q < 0) ? -(p + q) : p + q;
+
+	// When equal, a is preferred to b, and b to c
+	const int pab = (pb < pa) ? pb : pa;
+	const int ab = (pb < pa) ? b : a;
+	return (pc < pab) ? c : ab;
+}
+
+template <int t_bpp>
+static void UnfilterPaeth(uint8* pDst, const uint8* pSrc, const uint8* pPrev, int32 byteWidth)
+{
+	for(int32 i = 0; i < t_bpp; ++i)
+	{
+		// Left and upper left are 0, so the predictor is the byte above
+		pDst[i] = uint8(pSrc[i] + pPrev[i]);
+	}
+	for(int32 i = t_bpp; i < byteWidth; ++i)
+	{
+		pDst[i] = uint8(pSrc[i] + PredictPaeth(pDst[i - t_bpp], pPrev[i], pPrev[i - t_bpp]));
+	}
+}
+
+#define SCALAR_KERNELS(bpp) { UnfilterSub<bpp>, UnfilterUp, UnfilterAverage<bpp>, UnfilterPaeth<bpp> }
+
+// Indexed by the pixel size in bytes
+static const UnfilterKernels k_scalarKernels[9] =
+{
+	{ nullptr, nullptr, nullptr, nullptr },
+	SCALAR_KERNELS(1),
+	SCALAR_KERNELS(2),
+	SCALAR_KERNELS(3),
+	SCALAR_KERNELS(4),
+	{ nullptr, nullptr, nullptr, nullptr },
+	SCALAR_KERNELS(6),
+	{ nullptr, nullptr, nullptr, nullptr },
+	SCALAR_KERNELS(8),
+};
+
+#if defined(CHUSTD_PNGFILTER_SSE2)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels
+//
+// Sub, Average and Paeth depend on the pixel on the left, so they compute a whole pixel at once.
+// Up computes 16 bytes at once.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Pixels are moved between memory and the low bytes of a register without going through the
+// stack, which would stall the loop on each pixel
+template <int t_bpp> static inline __m128i LoadPixel(const uint8* p);
+template <int t_bpp> static inline void StorePixel(uint8* p, __m128i pixel);
+
+template <> inline __m128i LoadPixel<3>(const uint8* p)
+{
+	return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+}
+
+template <> inline void StorePixel<3>(uint8* p, __m128i pixel)
+{
+	const uint32 value = uint32(_mm_cvtsi128_si32(pixel));
+	p[0] = uint8(value);
+	p[1] = uint8(value >> 8);
+	p[2] = uint8(value >> 16);
+}
+
+template <> inline __m128i LoadPixel<4>(const uint8* p)
+{
+	int32 value;
+	memcpy(&value, p, 4);
+	return _mm_cvtsi32_si128(value);
+}
+
+template <> inline void StorePixel<4>(uint8* p, __m128i pixel)
+{
+	const int32 value = _mm_cvtsi128_si32(pixel);
+	memcpy(p, &value, 4);
+}
+
+template <> inline __m128i LoadPixel<6>(const uint8* p)
+{
+	const __m128i low = LoadPixel<4>(p);
+	return _mm_insert_epi16(low, p[4] | (p[5] << 8), 2);
+}
+
+template <> inline void StorePixel<6>(uint8* p, __m128i pixel)
+{
+	StorePixel<4>(p, pixel);
+	const int32 high = _mm_extract_epi16(pixel, 2);
+	p[4] = uint8(high);
+	p[5] = uint8(high >> 8);
+}
+
+template <> inline __m128i LoadPixel<8>(const uint8* p)
+{
+	return _mm_loadl_epi64((const __m128i*)p);
+}
+
+template <> inline void StorePixel<8>(uint8* p, __m128i pixel)
+{
+	_mm_storel_epi64((__m128i*)p, pixel);
+}
+
+static void UnfilterUpSse2(uint8* pDst, const uint8* pSrc, const uint8* pPrev, int32 byteWidth)
+{
+	int32 i = 0;
+	for(; i + 16 <= byteWidth; i += 16)
+	{
+		const __m128i x = _mm_loadu_si128((const __m128i*)(pSrc + i));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(pPrev + i));
+		_mm_storeu_si128((__m128i*)(pDst + i), _mm_add_epi8(x, b));
+	}
+	for(; i < byteWidth; ++i)
+	{
+		pDst[i] = uint8(pSrc[i] + pPrev[i]);
+	}
+}
+
+template <int t_bpp>
+static void UnfilterSubSse2(uint8* pDst, const uint8* pSrc, const uint8*, int32 byteWidth)
+{
+	__m128i a = _mm_setzero_si128();
+	for(int32 i = 0; i < byteWidth; i += t_bpp)
+	{
+		a = _mm_add_epi8(a, LoadPixel<t_bpp>(pSrc + i));
+		StorePixel<t_bpp>(pDst + i, a);
+	}
+}
+
+template <int t_bpp>
+static void UnfilterAverageSse2(uint8* pDst, const uint8* pSrc, const uint8* pPrev, int32 byteWidth)
+{
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	for(int32 i = 0; i < byteWidth; i += t_bpp)
+	{
+		const __m128i b = LoadPixel<t_bpp>(pPrev + i);
+
+		// _mm_avg_epu8 rounds up, the PNG average rounds down
+		const __m128i roundUp = _mm_and_si128(_mm_xor_si128(a, b), one);
+		const __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), roundUp);
+
+		a = _mm_add_epi8(LoadPixel<t_bpp>(pSrc + i), average);
+		StorePixel<t_bpp>(pDst + i, a);
+	}
+}
+
+static inline __m128i Abs16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+// Returns mask ? x : y for each bit
+static inline __m128i Select(__m128i mask, __m128i x, __m128i y)
+{
+	return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+// Same as PredictPaeth, on 8 components of 16 bits
+static inline __m128i PredictPaeth16(__m128i a, __m128i b, __m128i c)
+{
+	const __m128i p = _mm_sub_epi16(b, c);
+	const __m128i q = _mm_sub_epi16(a, c);
+	const __m128i pa = Abs16(p);
+	const __m128i pb = Abs16(q);
+	const __m128i pc = Abs16(_mm_add_epi16(p, q));
+
+	const __m128i ab = Select(_mm_cmplt_epi16(pb, pa), b, a);
+	return Select(_mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb)), c, ab);
+}
+
+// The pixel components are extended to 16 bits, so a pixel of 8 bytes fits in a register
+template <int t_bpp>
+static void UnfilterPaethSse2(uint8* pDst, const uint8* pSrc, const uint8* pPrev, int32 byteWidth)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+	__m128i a = zero;
+	__m128i c = zero;
+	for(int32 i = 0; i < byteWidth; i += t_bpp)
+	{
+		const __m128i b = _mm_unpacklo_epi8(LoadPixel<t_bpp>(pPrev + i), zero);
+		const __m128i predictor = PredictPaeth16(a, b, c);
+		const __m128i x = _mm_unpacklo_epi8(LoadPixel<t_bpp>(pSrc + i), zero);
+		a = _mm_and_si128(_mm_add_epi16(x, predictor), lowBytes);
+		StorePixel<t_bpp>(pDst + i, _mm_packus_epi16(a, a));
+		c = b;
+	}
+}
+
+#define SSE2_KERNELS(bpp) { UnfilterSubSse2<bpp>, UnfilterUpSse2, UnfilterAverageSse2<bpp>, UnfilterPaethSse2<bpp> }
+
+// One or two bytes per pixel do not fill a register, the scalar kernels are better
+static const UnfilterKernels k_sse2Kernels[9] =
+{
+	{ nullptr, nullptr, nullptr, nullptr },
+	{ UnfilterSub<1>, UnfilterUpSse2, UnfilterAverage<1>, UnfilterPaeth<1> },
+	{ UnfilterSub<2>, UnfilterUpSse2, UnfilterAverage<2>, UnfilterPaeth<2> },
+	SSE2_KERNELS(3),
+	SSE2_KERNELS(4),
+	{ nullptr, nullptr, nullptr, nullptr },
+	SSE2_KERNELS(6),
+	{ nullptr, nullptr, nullptr, nullptr },
+	SSE2_KERNELS(8),
+};
+#endif // CHUSTD_PNGFILTER_SSE2
+
+static bool UseSse2()
+{
+#if defined(CHUSTD_PNGFILTER_SSE2)
+	static const bool s_useSse2 = System::HasCpuFeature(System::cpuSse2);
+	return s_useSse2;
+#else
+	return false;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Filter kernels
+//
+// Filtering does not depend on the result of the previous bytes, all the bytes of a row can be
+// computed at once.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Filters the bytes [begin, end) of a row
+static void FilterBytes(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+                        int32 begin, int32 end, int32 bytesPerPixel)
+{
+	for(int32 i = begin; i < end; ++i)
+	{
+		const bool hasLeft = i >= bytesPerPixel;
+		const uint8 left = hasLeft ? pSrc[i - bytesPerPixel] : 0;
+		const uint8 above = pPrev ? pPrev[i] : 0;
+		const uint8 upperLeft = (pPrev && hasLeft) ? pPrev[i - bytesPerPixel] : 0;
+
+		uint8 predictor = 0;
+		switch(type)
+		{
+		case PngFilter::typeSub:     predictor = left; break;
+		case PngFilter::typeUp:      predictor = above; break;
+		case PngFilter::typeAverage: predictor = uint8((left + above) / 2); break;
+		case PngFilter::typePaeth:   predictor = uint8(PredictPaeth(left, above, upperLeft)); break;
+		}
+		pDst[i] = uint8(pSrc[i] - predictor);
+	}
+}
+
+#if defined(CHUSTD_PNGFILTER_SSE2)
+// Same as FilterBytes, by 16 bytes, from begin >= bytesPerPixel. Returns the index of the first
+// byte not filtered.
+template <bool t_hasPrev>
+static int32 FilterBytesSse2(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+                             int32 begin, int32 end, int32 bytesPerPixel)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+
+	int32 i = begin;
+	for(; i + 16 <= end; i += 16)
+	{
+		const __m128i x = _mm_loadu_si128((const __m128i*)(pSrc + i));
+		const __m128i left = _mm_loadu_si128((const __m128i*)(pSrc + i - bytesPerPixel));
+		const __m128i above = t_hasPrev ? _mm_loadu_si128((const __m128i*)(pPrev + i)) : zero;
+		const __m128i upperLeft = t_hasPrev ? _mm_loadu_si128((const __m128i*)(pPrev + i - bytesPerPixel)) : zero;
+
+		__m128i predictor = zero;
+		switch(type)
+		{
+		case PngFilter::typeSub:
+			predictor = left;
+			break;
+		case PngFilter::typeUp:
+			predictor = above;
+			break;
+		case PngFilter::typeAverage:
+		{
+			// _mm_avg_epu8 rounds up, the PNG average rounds down
+			const __m128i roundUp = _mm_and_si128(_mm_xor_si128(left, above), one);
+			predictor = _mm_sub_epi8(_mm_avg_epu8(left, above), roundUp);
+			break;
+		}
+		case PngFilter::typePaeth:
+		{
+			const __m128i low = PredictPaeth16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(above, zero),
+			                                   _mm_unpacklo_epi8(upperLeft, zero));
+			const __m128i high = PredictPaeth16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(above, zero),
+			                                    _mm_unpackhi_epi8(upperLeft, zero));
+			predictor = _mm_packus_epi16(low, high);
+			break;
+		}
+		}
+		_mm_storeu_si128((__m128i*)(pDst + i), _mm_sub_epi8(x, predictor));
+	}
+	return i;
+}
+#endif // CHUSTD_PNGFILTER_SSE2
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the table of kernels for the CPU, indexed by the pixel size
+static const UnfilterKernels* GetKernelTable()
+{
+#if defined(CHUSTD_PNGFILTER_SSE2)
+	return UseSse2() ? k_sse2Kernels : k_scalarKernels;
+#else
+	return k_scalarKernels;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngFilter::UnfilterRow(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+                            int32 byteWidth, int32 bytesPerPixel)
+{
+	if( type >= typeCount )
+	{
+		return false;
+	}
+
+	if( pPrev == nullptr )
+	{
+		// The bytes above are 0 for the first row
+		if( type == typeUp )
+		{
+			type = typeNone;
+		}
+		else if( type == typePaeth )
+		{
+			type = typeSub;
+		}
+		else if( type == typeAverage )
+		{
+			return UnfilterRowGeneric(type, pDst, pSrc, pPrev, byteWidth, bytesPerPixel);
+		}
+	}
+
+	if( type == typeNone )
+	{
+		Memory::Move(pDst, pSrc, byteWidth);
+		return true;
+	}
+
+	// The kernels work on whole pixels
+	if( bytesPerPixel < 1 || bytesPerPixel > 8 || byteWidth % bytesPerPixel != 0 )
+	{
+		return UnfilterRowGeneric(type, pDst, pSrc, pPrev, byteWidth, bytesPerPixel);
+	}
+
+	const UnfilterKernels& kernels = GetKernelTable()[bytesPerPixel];
+	if( kernels.sub == nullptr )
+	{
+		return UnfilterRowGeneric(type, pDst, pSrc, pPrev, byteWidth, bytesPerPixel);
+	}
+
+	switch(type)
+	{
+	case typeSub:     kernels.sub(pDst, pSrc, pPrev, byteWidth); break;
+	case typeUp:      kernels.up(pDst, pSrc, pPrev, byteWidth); break;
+	case typeAverage: kernels.average(pDst, pSrc, pPrev, byteWidth); break;
+	case typePaeth:   kernels.paeth(pDst, pSrc, pPrev, byteWidth); break;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngFilter::UnfilterRowGeneric(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+                                   int32 byteWidth, int32 bytesPerPixel)
+{
+	if( type >= typeCount )
+	{
+		return false;
+	}
+
+	for(int32 iByte = 0; iByte < byteWidth; ++iByte)
+	{
+		const bool hasLeft = iByte >= bytesPerPixel;
+		const uint8 left = hasLeft ? pDst[iByte - bytesPerPixel] : 0;
+		const uint8 above = pPrev ? pPrev[iByte] : 0;
+		const uint8 upperLeft = (pPrev && hasLeft) ? pPrev[iByte - bytesPerPixel] : 0;
+
+		uint8 predictor = 0;
+		switch(type)
+		{
+		case typeSub:     predictor = left; break;
+		case typeUp:      predictor = above; break;
+		case typeAverage: predictor = uint8((left + above) / 2); break;
+		case typePaeth:   predictor = Png::PaethPredictor(left, above, upperLeft); break;
+		}
+		pDst[iByte] = uint8(pSrc[iByte] + predictor);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngFilter::FilterRow(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+                          int32 byteWidth, int32 bytesPerPixel)
+{
+	if( type >= typeCount )
+	{
+		return false;
+	}
+	if( type == typeNone )
+	{
+		Memory::Copy(pDst, pSrc, byteWidth);
+		return true;
+	}
+
+	// The first pixel has nothing on its left
+	const int32 head = (bytesPerPixel < byteWidth) ? bytesPerPixel : byteWidth;
+	FilterBytes(type, pDst, pSrc, pPrev, 0, head, bytesPerPixel);
+
+	int32 tail = head;
+#if defined(CHUSTD_PNGFILTER_SSE2)
+	if( UseSse2() )
+	{
+		tail = pPrev
+			? FilterBytesSse2<true>(type, pDst, pSrc, pPrev, head, byteWidth, bytesPerPixel)
+			: FilterBytesSse2<false>(type, pDst, pSrc, pPrev, head, byteWidth, bytesPerPixel);
+	}
+#endif
+	FilterBytes(type, pDst, pSrc, pPrev, tail, byteWidth, bytesPerPixel);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PngFilter::IsSimdUsed()
+{
+	return UseSse2();
+}
@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////////
+// This file is part of the chustd library
+// Copyright (C) ChuTeam
+// For conditions of distribution and use, see copyright notice in chustd.h
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef CHUSTD_PNGFILTER_H
+#define CHUSTD_PNGFILTER_H
+
+namespace chustd {
+
+///////////////////////////////////////////////////////////////////////////////
+// Row kernels for the PNG filter types (None, Sub, Up, Average, Paeth).
+// The unfilter kernels are specialized for each pixel size. When the CPU has SSE2,
+// the pixels of 3 bytes and more are computed in SIMD registers, and the filter
+// kernels compute 16 bytes at once. The choice is made once, at the first call.
+class PngFilter
+{
+public:
+	enum Type
+	{
+		typeNone = 0,
+		typeSub,
+		typeUp,
+		typeAverage,
+		typePaeth,
+		typeCount
+	};
+
+	// Unfilters one row
+	//
+	// [in]  type           Filter type of the row
+	// [out] pDst           Unfiltered row. Can be before pSrc in the same buffer, so a block
+	//                      can be unfiltered in place while the filter type bytes are removed
+	// [in]  pSrc           Filtered row, without its filter type byte
+	// [in]  pPrev          Previous unfiltered row, nullptr for the first row
+	// [in]  byteWidth      Bytes in a row
+	// [in]  bytesPerPixel  Rounded to 1 if the pixel depth is less than 8
+	//
+	// Returns false if the filter type is invalid
+	static bool UnfilterRow(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+	                        int32 byteWidth, int32 bytesPerPixel);
+
+	// Same as UnfilterRow, one byte after the other. This is the reference of the kernels.
+	static bool UnfilterRowGeneric(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+	                               int32 byteWidth, int32 bytesPerPixel);
+
+	// Filters one row
+	//
+	// [in]  type           Filter type of the row
+	// [out] pDst           Filtered row, cannot overlap pSrc
+	// [in]  pSrc           Row to filter
+	// [in]  pPrev          Row above, not filtered, nullptr for the first row
+	// [in]  byteWidth      Bytes in a row
+	// [in]  bytesPerPixel  Rounded to 1 if the pixel depth is less than 8
+	//
+	// Returns false if the filter type is invalid
+	static bool FilterRow(uint8 type, uint8* pDst, const uint8* pSrc, const uint8* pPrev,
+	                      int32 byteWidth, int32 bytesPerPixel);
+
+	// Returns true if the SSE2 kernels are used
+	static bool IsSimdUsed();
+};
+
+} // namespace chustd
+
+#endif // ndef CHUSTD_PNGFILTER_H
@@ -55,6 +55,7 @@ public:
 	int Add(const PtrArray<T>& arr) { return Array<T*>::Add(arr); }
 
 	PtrArray<T>& operator = (const PtrArray<T>& arr);
+	PtrArray<T>& operator = (PtrArray<T>&& arr);
 
 protected:
 	virtual void DeletePointedData(int startIndex, int count);
@@ -108,6 +109,19 @@ PtrArray<T>& PtrArray<T>::operator = (const PtrArray<T>& arr)
 	return *this;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Move assignment operator, the pointed data changes owner
+template <class T>
+PtrArray<T>& PtrArray<T>::operator = (PtrArray<T>&& arr)
+{
+	if( this != &arr )
+	{
+		DeletePointedData(0, this->m_count);
+		arr.MoveTo(*this);
+	}
+	return *this;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 template <class T>
 PtrArray<T>::~PtrArray()
@@ -10,6 +10,15 @@
 #include "String.h"
 #include "File.h"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CHUSTD_SYSTEM_X86
+#if defined(_MSC_VER)
+#include <intrin.h> // __cpuid
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 namespace chustd {\
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -82,5 +91,62 @@ String System::GetUserConfigDirectory()
 #endif
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Gets the number of processors available to run threads, 1 at least
+int System::GetProcessorCount()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+	::GetSystemInfo(&si);
+	int count = static_cast<int>(si.dwNumberOfProcessors);
+
+#elif defined(__linux__)
+	int count = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+	if( count < 1 )
+	{
+		return 1;
+	}
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the feature bits of the processor
+static uint32 GetCpuFeatures()
+{
+	uint32 features = 0;
+#if defined(CHUSTD_SYSTEM_X86)
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	const uint32 ecx = uint32(info[2]);
+	const uint32 edx = uint32(info[3]);
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+	{
+		return 0;
+	}
+#endif
+	if( edx & (1 << 26) )
+	{
+		features |= System::cpuSse2;
+	}
+	if( ecx & (1 << 1) )
+	{
+		features |= System::cpuPclmul;
+	}
+#endif
+	return features;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The processor is queried once, at the first call
+bool System::HasCpuFeature(CpuFeature feature)
+{
+	static const uint32 s_features = GetCpuFeatures();
+	return (s_features & feature) != 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 }
@@ -21,6 +21,19 @@ public:
 	// On Windows, typically : C:\Documents and Settings\Gwendoline\Application Data
 	// On Linux: ~/.config
 	static String GetUserConfigDirectory();
+
+	// Gets the number of processors available to run threads, 1 at least
+	static int GetProcessorCount();
+
+	// Instruction set extensions, to choose between code paths at run time
+	enum CpuFeature
+	{
+		cpuSse2   = 0x01,
+		cpuPclmul = 0x02, // Carry-less multiplication
+	};
+
+	// Returns true if the processor has the extension. Always false on non x86 processors.
+	static bool HasCpuFeature(CpuFeature feature);
 };
 
 } // namespace chustd
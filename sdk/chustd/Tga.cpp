@@ -157,6 +157,14 @@ bool Tga::LoadFromFile(IFile& file)
 	m_width = width;
 	m_height = height;
 
+	// 65535 x 65535 is possible, the buffers of the decoding have 4 bytes per pixel at most
+	int32 maxBufferSize = 0;
+	if( !ImageFormat::ComputeBufferSize(int64(m_width) * 4, m_height, maxBufferSize) )
+	{
+		m_lastError = imageTooBig;
+		return false;
+	}
+
 	TgaImageOrigin eImageOrigin = TgaImageOrigin (imageDescriptor >> 4);
 	uint8 alphaBitCount = imageDescriptor & 0x0f;
 
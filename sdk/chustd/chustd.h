@@ -47,9 +47,11 @@
 #include "Sort.h"
 #include "DeflateCompressor.h"
 #include "DeflateUncompressor.h"
+#include "Checksum.h"
 #include "File.h"
 #include "DynamicMemoryFile.h"
 #include "StaticMemoryFile.h"
+#include "MappedFile.h"
 #include "StdFile.h"
 #include "Console.h"
 #include "TextEncoding.h"
@@ -57,6 +59,7 @@
 
 #include "Png.h"
 #include "PngDumper.h"
+#include "PngFilter.h"
 #include "Jpeg.h"
 #include "Gif.h"
 #include "Bmp.h"
@@ -76,6 +79,7 @@
 #include "System.h"
 #include "events.h"
 #include "Buffer.h"
+#include "MemoryArena.h"
 #include "ArgvParser.h"
 
 #include "Semaphore.h"
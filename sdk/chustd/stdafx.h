@@ -115,6 +115,7 @@ typedef SOCKET SOCKET_ID; // HANDLE on Windows/VC++, int on Linux/G++
 #include <stdlib.h> // malloc
 #include <malloc.h> // malloc_useable_size
 #include <sys/stat.h> // fstat
+#include <sys/mman.h> // mmap
 #include <semaphore.h>
 #include <memory.h>
 #include <pthread.h>
@@ -61,6 +61,13 @@ local uLong adler32_combine_ OF((uLong adler1, uLong adler2, z_off64_t len2));
 #  define MOD63(a) a %= BASE
 #endif
 
+// <chustd>
+// Sums 16 bytes at once with SSE2, in Checksum.cpp. The code of zlib for 16 bytes and more is
+// left out.
+#define CHUSTD_ADLER32
+extern uLong chustd_adler32(uLong adler, const Bytef *buf, uInt len);
+// </chustd>
+
 /* ========================================================================= */
 uLong ZEXPORT adler32(adler, buf, len)
     uLong adler;
@@ -68,7 +75,13 @@ uLong ZEXPORT adler32(adler, buf, len)
     uInt len;
 {
     unsigned long sum2;
+    // <chustd>
+#ifndef CHUSTD_ADLER32
+    // </chustd>
     unsigned n;
+    // <chustd>
+#endif
+    // </chustd>
 
     /* split Adler-32 into component sums */
     sum2 = (adler >> 16) & 0xffff;
@@ -101,6 +114,12 @@ uLong ZEXPORT adler32(adler, buf, len)
         return adler | (sum2 << 16);
     }
 
+    // <chustd>
+#ifdef CHUSTD_ADLER32
+    return chustd_adler32(adler | (sum2 << 16), buf, len);
+#else
+    // </chustd>
+
     /* do length NMAX blocks -- requires just one modulo operation */
     while (len >= NMAX) {
         len -= NMAX;
@@ -130,6 +149,9 @@ uLong ZEXPORT adler32(adler, buf, len)
 
     /* return recombined sums */
     return adler | (sum2 << 16);
+    // <chustd>
+#endif
+    // </chustd>
 }
 
 /* ========================================================================= */
@@ -32,6 +32,12 @@
 
 #define local static
 
+// <chustd>
+// crc32() is computed by chustd_crc32, the code of zlib is left out
+#define CHUSTD_CRC32
+#define NOBYFOUR
+// </chustd>
+
 /* Definitions for doing the crc four data bytes at a time. */
 #if !defined(NOBYFOUR) && defined(Z_U4)
 #  define BYFOUR
@@ -200,6 +206,11 @@ const z_crc_t FAR * ZEXPORT get_crc_table()
 #define DO1 crc = crc_table[0][((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8)
 #define DO8 DO1; DO1; DO1; DO1; DO1; DO1; DO1; DO1
 
+// <chustd>
+// Slice-by-8 tables or CRC instructions, in Checksum.cpp
+extern unsigned long chustd_crc32(unsigned long crc, const unsigned char FAR *buf, uInt len);
+// </chustd>
+
 /* ========================================================================= */
 unsigned long ZEXPORT crc32(crc, buf, len)
     unsigned long crc;
@@ -208,6 +219,12 @@ unsigned long ZEXPORT crc32(crc, buf, len)
 {
     if (buf == Z_NULL) return 0UL;
 
+    // <chustd>
+#ifdef CHUSTD_CRC32
+    return chustd_crc32(crc, buf, len);
+#else
+    // </chustd>
+
 #ifdef DYNAMIC_CRC_TABLE
     if (crc_table_empty)
         make_crc_table();
@@ -233,6 +250,9 @@ unsigned long ZEXPORT crc32(crc, buf, len)
         DO1;
     } while (--len);
     return crc ^ 0xffffffffUL;
+    // <chustd>
+#endif
+    // </chustd>
 }
 
 #ifdef BYFOUR
@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////////////
+// This file is part of the poeng library, part of the PngOptimizer application
+// Copyright (C) Hadrien Nilsson - psydk.org
+// This library is distributed under the terms of the GNU LESSER GENERAL PUBLIC LICENSE
+// See License.txt for the full license.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "ColorIndexer.h"
+
+using namespace chustd;
+
+// Starts with an empty palette
+ColorIndexer::ColorIndexer(Palette& palette) : m_palette(palette)
+{
+	m_palette.m_count = 0;
+	Memory::Zero16(m_slots, k_slotCount);
+	m_lastIndex = -1;
+}
+
+int ColorIndexer::IndexColor(Color col)
+{
+	if( m_lastIndex >= 0 && col == m_lastColor )
+	{
+		// Same color as the previous pixel, the most frequent case
+		return m_lastIndex;
+	}
+
+	// Multiplicative hashing, the high bits being the best mixed
+	uint32 slot = (col.value32 * 0x9e3779b1u) >> (32 - k_slotBits);
+	for(;;)
+	{
+		const int entry = m_slots[slot];
+		if( entry == 0 )
+		{
+			break;
+		}
+		if( m_palette.m_colors[entry - 1] == col )
+		{
+			m_lastColor = col;
+			m_lastIndex = entry - 1;
+			return m_lastIndex;
+		}
+		// Linear probing, the table being at most 25% full
+		slot = (slot + 1) & (k_slotCount - 1);
+	}
+
+	// The color was not in the palette
+	if( m_palette.m_count == 256 )
+	{
+		// The palette is full
+		return -1;
+	}
+
+	// New entry in the palette
+	const int index = m_palette.m_count;
+	m_palette.m_colors[index] = col;
+	m_palette.m_count++;
+	m_slots[slot] = uint16(index + 1);
+
+	m_lastColor = col;
+	m_lastIndex = index;
+	return index;
+}
+
+bool ColorIndexer::IndexPixels(const uint8* pPixels, int32 pixelCount, bool alpha, uint8* pIndexes)
+{
+	const int32 pixelSize = alpha ? 4 : 3;
+	for(int32 i = 0; i < pixelCount; ++i)
+	{
+		const uint8 a = alpha ? pPixels[3] : uint8(255);
+		const int index = IndexColor( Color(pPixels[0], pPixels[1], pPixels[2], a) );
+		if( index < 0 )
+		{
+			// Too much colors
+			return false;
+		}
+		pIndexes[i] = uint8(index);
+		pPixels += pixelSize;
+	}
+	return true;
+}
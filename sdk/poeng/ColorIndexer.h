@@ -0,0 +1,48 @@
+/////////////////////////////////////////////////////////////////////////////////////
+// This file is part of the poeng library, part of the PngOptimizer application
+// Copyright (C) Hadrien Nilsson - psydk.org
+// This library is distributed under the terms of the GNU LESSER GENERAL PUBLIC LICENSE
+// See License.txt for the full license.
+/////////////////////////////////////////////////////////////////////////////////////
+#ifndef POENG_COLORINDEXER_H
+#define POENG_COLORINDEXER_H
+
+using namespace chustd;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Builds a palette from true color pixels. A color gets the next palette index when it
+// appears for the first time. The indexes already given are found back with a hash table
+// of the palette colors, the color of the previous pixel being checked first.
+class ColorIndexer
+{
+public:
+	ColorIndexer(Palette& palette);
+
+	// Returns the palette index of a color, adding it to the palette if it is new,
+	// or -1 if it is new and the palette is full
+	int IndexColor(Color col);
+
+	// Converts RGB or RGBA pixels to palette indexes
+	//
+	// [in]  pPixels     Pixels, 3 or 4 bytes each
+	// [in]  pixelCount  Number of pixels
+	// [in]  alpha       true for RGBA, false for RGB
+	// [out] pIndexes    One palette index per pixel
+	//
+	// Returns false when a 257th color is found, the conversion stopping there
+	bool IndexPixels(const uint8* pPixels, int32 pixelCount, bool alpha, uint8* pIndexes);
+
+private:
+	enum { k_slotBits = 10, k_slotCount = 1 << k_slotBits }; // 4 slots per palette entry
+
+	Palette& m_palette;
+	uint16   m_slots[k_slotCount]; // Palette index + 1, 0 for an empty slot
+	Color    m_lastColor;
+	int      m_lastIndex;          // -1 before the first color
+
+private:
+	ColorIndexer(const ColorIndexer&);
+	ColorIndexer& operator=(const ColorIndexer&);
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include "stdafx.h"
 #include "POEngine.h"
 #include "PaletteTranslator.h"
+#include "ColorIndexer.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 const char k_szCannotStartWorkerThreads[] = "Cannot start worker threads";
@@ -16,6 +17,7 @@ const char k_szCannotWriteOnDevice[]      = "Cannot write on device";
 const char k_szCannotWriteUncomplete[]    = "Write uncomplete, device may be full";
 const char k_szNotEnoughMemoryForInternalConversion[] = "Not enough memory for internal conversion";
 const char k_szUnsupportedPixelFormat[]   = "Unsupported pixel format";
+const char k_szImageTooBig[]              = "Image too big";
 
 const char k_szCannotLoadFile[]             = "Cannot load file";
 const char k_szFileTooLarge[]               = "File is too large";
@@ -23,6 +25,7 @@ const char k_szUnsupportedFileFormat[]      = "Unsupported file format";
 const char k_szNotEnoughMemoryToConvertTo24Bits[] = "Not enough memory to convert to 24 bits";
 
 const char k_szPathDoesNotExist[]        = "Path does not exist";
+const char k_szCannotReadDirectory[]     = "Cannot read directory";
 const char k_szFileIsReadOnly[]          = "File is read-only";
 const char k_szCannotPerformBackup[]     = "Cannot perform backup, previous backup deletion failed";
 const char k_szCannotPerformBackupRenameFailed[] = "Cannot perform backup, rename failed";
@@ -118,6 +121,17 @@ POEngine::POEngine()
 	// Default to false because of older versions of Windows
 	// that cannot display some unicode symbols
 	m_unicodeArrowEnabled = false;
+
+	m_jobCount = 1;
+	m_batchOrder = BO_None;
+	m_prefetchBudget = 0;
+	m_pPrefetcher = nullptr;
+	m_pPrefetchedFile = nullptr;
+	m_memoryBudget = 0;
+	m_lowMemory = false;
+
+	m_trialsEffort = m_settings.effort;
+	POTrial::GetEffortTrials(m_trialsEffort, m_trials);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -192,10 +206,65 @@ bool POEngine::IsGreyPalette(const Palette& pal)
 /////////////////////////////////////////////////////////////////////////////////////////////
 bool POEngine::WarmUp()
 {
-	const int count = ARRAY_SIZE(m_workerThreads);
-	for(int i = 0; i < count; ++i)
+	return EnsureWorkerThreads();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Rebuilds the registry of trials if the effort setting changed since the last image
+/////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::UpdateTrials()
+{
+	if( m_trialsEffort != m_settings.effort )
+	{
+		m_trialsEffort = m_settings.effort;
+		POTrial::GetEffortTrials(m_trialsEffort, m_trials);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the number of threads the engine may use for an image, from the settings or from
+// the processor count. The batch jobs share the processors through the settings.
+/////////////////////////////////////////////////////////////////////////////////////////////
+int POEngine::GetThreadBudget() const
+{
+	int count = m_settings.threadCount;
+	if( count <= 0 )
+	{
+		count = System::GetProcessorCount();
+	}
+	return Math::Max(count, 1);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the number of worker threads to use for the trials.
+// There is no point in having more threads than trials.
+/////////////////////////////////////////////////////////////////////////////////////////////
+int POEngine::GetWorkerThreadCount() const
+{
+	const int count = Math::Min(GetThreadBudget(), m_trials.GetSize());
+	return Math::Max(count, 1);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Creates or deletes worker threads to match the wanted count
+//
+// Returns true upon sucess
+/////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::EnsureWorkerThreads()
+{
+	// The thread count depends on the trials
+	UpdateTrials();
+
+	const int count = GetWorkerThreadCount();
+	while( m_workerThreads.GetSize() > count )
+	{
+		m_workerThreads.RemoveLast();
+	}
+	while( m_workerThreads.GetSize() < count )
 	{
-		if( !m_workerThreads[i].Create() )
+		POWorkerThread* pWorker = new POWorkerThread;
+		m_workerThreads.Add(pWorker);
+		if( !pWorker->Create() )
 		{
 			return false;
 		}
@@ -239,13 +308,51 @@ bool POEngine::PerformDumpTries(PngDumpData& dd)
 		}
 	}
 
-	// We perform the dumps asynchronously with 4 threads
+	if( m_lowMemory )
+	{
+		return PerformSingleDump(dd);
+	}
+
+	// We perform the dumps asynchronously, each thread taking the next trial to do
+	if( !EnsureWorkerThreads() )
+	{
+		AddError(k_szCannotStartWorkerThreads);
+		return false;
+	}
+
+	// The trials take the block-split compression of the settings if they do not set their
+	// own, on the threads of the budget left by the worker threads
+	const int deflateThreadCount = Math::Max(GetThreadBudget() / m_workerThreads.GetSize(), 1);
+	if( !m_runTrials.SetSize(m_trials.GetSize()) )
+	{
+		AddError(k_szCannotDumpTry);
+		return false;
+	}
+	for(int i = 0; i < m_trials.GetSize(); ++i)
+	{
+		m_runTrials[i] = m_trials[i];
+		m_runTrials[i].InheritDeflateSettings(m_settings.deflateBlockSize * 1024, deflateThreadCount);
+	}
+	// A result from a previous call, or the original file, is already known:
+	// the trials giving bigger files can be stopped early
+	int64 sizeBound = m_resultmgr.GetSmallest().GetPosition();
+	if( sizeBound == 0 )
+	{
+		sizeBound = MAX_INT64;
+	}
+	m_trialSet.Init(&dd, m_runTrials.GetPtr(), m_runTrials.GetSize(), sizeBound);
+	if( m_settings.fastMode && !m_trialSet.Prune() )
+	{
+		m_trialSet.Clear();
+		AddError(k_szCannotDumpTry);
+		return false;
+	}
 
-	const int beginCount = 4;
+	const int beginCount = m_workerThreads.GetSize();
 	int waitCount = beginCount;
 	for(int i = 0; i < beginCount; ++i)
 	{
-		if( !m_workerThreads[i].Begin(i, &dd) )
+		if( !m_workerThreads[i]->Begin(&m_trialSet) )
 		{
 			waitCount = i;
 			break;
@@ -253,8 +360,10 @@ bool POEngine::PerformDumpTries(PngDumpData& dd)
 	}
 	for(int i = 0; i < waitCount; ++i)
 	{
-		m_workerThreads[i].Wait();
+		m_workerThreads[i]->Wait();
 	}
+	m_trialSet.Clear();
+
 	// Check begin error
 	if( waitCount != beginCount )
 	{
@@ -264,36 +373,125 @@ bool POEngine::PerformDumpTries(PngDumpData& dd)
 	// Check job error
 	for(int i = 0; i < waitCount; ++i)
 	{
-		if( !m_workerThreads[i].Succeeded() )
+		if( !m_workerThreads[i]->Succeeded() )
 		{
 			AddError(k_szCannotDumpTry);
 			return false;
 		}
 	}
-	// Find smallest result
+	// Find smallest result. On equal sizes, the first trial of the registry wins,
+	// so the result does not depend on the thread count.
 	int64 smallest = MAX_INT64;
+	int smallestTrial = -1;
 	int smallestIndex = -1;
 	for(int i = 0; i < waitCount; ++i)
 	{
-		int64 resultSize = m_workerThreads[i].GetResult().GetPosition();
-
-		// If resultSize is 0, it means the job type gave no result
-		// Example: a job for 8 bpp on a 24 bpp image
-		if( 0 < resultSize && resultSize < smallest )
+		// If resultTrial is -1, it means the thread gave no result
+		// Example: only a trial for 8 bpp on a 24 bpp image
+		const int resultTrial = m_workerThreads[i]->GetResultTrial();
+		if( resultTrial < 0 )
+		{
+			continue;
+		}
+		int64 resultSize = m_workerThreads[i]->GetResult().GetPosition();
+		if( resultSize < smallest || (resultSize == smallest && resultTrial < smallestTrial) )
 		{
 			smallest = resultSize;
+			smallestTrial = resultTrial;
 			smallestIndex = i;
 		}
 	}
 
 	if( smallestIndex >= 0 )
 	{
-		// Move result to result manager in case we come back to this function
-		m_resultmgr.GetCandidate() = m_workerThreads[smallestIndex].GetResult();
+		// Move result to result manager in case we come back to this function.
+		// The worker gets the replaced buffer to write its next results.
+		m_resultmgr.GetCandidate().Swap(m_workerThreads[smallestIndex]->GetResult());
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Dumps an image with a single trial on the calling thread, for images too big for the
+// memory budget. The rows are filtered while they are compressed, no scanlines are kept.
+//
+// [in] dd     Dump data
+//
+// Returns true upon sucess
+/////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::PerformSingleDump(const PngDumpData& dd)
+{
+	// The trials of the lowest effort are exclusive: one of them matches the image
+	Array<POTrial> trials;
+	POTrial::GetEffortTrials(POTrial::EffortMin, trials);
+	for(int i = 0; i < trials.GetSize(); ++i)
+	{
+		if( !trials[i].IsApplicable(dd.pixelFormat) )
+		{
+			continue;
+		}
+		DynamicMemoryFile& dmf = m_resultmgr.GetCandidate();
+		dmf.SetPosition(0);
+		if( !PngDumper::Dump(dmf, dd, trials[i].GetDumpSettings()) )
+		{
+			dmf.SetPosition(0);
+			AddError(k_szCannotDumpTry);
+			return false;
+		}
+		break;
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Estimates the size of an image without compressing it, to rank several layouts of the same
+// image. The smallest estimate of the unfiltered and filtered scanlines is taken, plus the
+// palette chunks.
+//
+// [in]  dd        Dump data
+// [out] estimate  Estimated size in bytes
+//
+// Returns true upon sucess
+/////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::EstimateDumpSize(const PngDumpData& dd, int64& estimate)
+{
+	estimate = MAX_INT64;
+	for(int filtering = PngDumpSettings::filteringNone; filtering <= PngDumpSettings::filteringAdaptive; ++filtering)
+	{
+		PngScanlines scanlines;
+		if( !PngDumper::PrepareScanlines(dd, uint8(filtering), scanlines) )
+		{
+			return false;
+		}
+		const int64 size = PngDumper::EstimateCompressedSize(scanlines);
+		if( size < 0 )
+		{
+			return false;
+		}
+		if( size < estimate )
+		{
+			estimate = size;
+		}
+	}
+
+	if( ImageFormat::IsIndexed(dd.pixelFormat) )
+	{
+		// PLTE and tRNS chunks
+		const int chunkOverhead = 12;
+		estimate += dd.palette.m_count * 4 + 2 * chunkOverhead;
 	}
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// In fast mode, tells if a layout of an image is worth a full dump, compared to the best
+// estimate of the other layouts. The estimates are within 10% of the real sizes, so close
+// layouts are all dumped.
+static bool IsLayoutLikelyToWin(int64 estimate, int64 bestEstimate)
+{
+	return estimate <= bestEstimate + bestEstimate / 10;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Changes and pack pixels if the original 8bpp pixel buffer can be converted to 1bpp black and white
 // The palette must be sorted by alpha [0 to 255]
@@ -737,7 +935,19 @@ bool POEngine::OptimizePaletteMode(PngDumpData& dd)
 	luminanceTranslator.BuildSortLuminance(dd.palette, colCounts);
 	luminanceTranslator.TranslateAll(dd);
 	PackPixelFrames(dd);
-	if( !PerformDumpTries(dd) )
+
+	// In fast mode both orders are estimated first, and only the ones likely to win are dumped
+	Palette luminancePalette = dd.palette;
+	int64 luminanceEstimate = 0;
+	if( m_settings.fastMode )
+	{
+		if( !EstimateDumpSize(dd, luminanceEstimate) )
+		{
+			AddError(k_szCannotDumpTry);
+			return false;
+		}
+	}
+	else if( !PerformDumpTries(dd) )
 	{
 		return false;
 	}
@@ -757,7 +967,43 @@ bool POEngine::OptimizePaletteMode(PngDumpData& dd)
 	finalPopulationTranslator.TranslateAll(dd);
 
 	PackPixelFrames(dd);
-	if( !PerformDumpTries(dd) )
+
+	bool dumpPopulation = true;
+	if( m_settings.fastMode )
+	{
+		int64 populationEstimate = 0;
+		if( !EstimateDumpSize(dd, populationEstimate) )
+		{
+			AddError(k_szCannotDumpTry);
+			return false;
+		}
+		dumpPopulation = IsLayoutLikelyToWin(populationEstimate, luminanceEstimate);
+
+		if( IsLayoutLikelyToWin(luminanceEstimate, populationEstimate) )
+		{
+			// Back to the luminance order, dumped first as without fast mode
+			Palette populationPalette = dd.palette;
+			UnpackPixelFrames(dd);
+			PaletteTranslator::Invert(finalPopulationTranslator).TranslateAll(dd);
+			dd.palette = luminancePalette;
+			PackPixelFrames(dd);
+			if( !PerformDumpTries(dd) )
+			{
+				return false;
+			}
+			if( !dumpPopulation )
+			{
+				return true;
+			}
+
+			UnpackPixelFrames(dd);
+			finalPopulationTranslator.TranslateAll(dd);
+			dd.palette = populationPalette;
+			PackPixelFrames(dd);
+		}
+	}
+
+	if( dumpPopulation && !PerformDumpTries(dd) )
 	{
 		return false;
 	}
@@ -767,66 +1013,57 @@ bool POEngine::OptimizePaletteMode(PngDumpData& dd)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-// Find an unused color among the pixels
+// Find an unused color among the pixels, the first one after black, colors being ordered as
+// little endian uint32 RGB values. A bitmap tells which of the 16777216 colors are used.
 // Needs memory allocation, thus can fail
 bool POEngine::FindUnusedColorHardcoreMethod(const uint8* pRgba, int32 pixelCount,
                                              uint8& nRed, uint8& nGreen, uint8& nBlue)
 {
-	ByteArray aSorted;
-	if( !aSorted.SetSize(pixelCount * 4) )
+	// One bit per color, 2 MB
+	const int32 wordCount = (1 << 24) / 32;
+	Buffer aUsed;
+	if( !aUsed.SetSize(wordCount * 4, &m_arena) )
 	{
 		return false;
 	}
+	uint32* pUsed32 = (uint32*) aUsed.GetWritePtr();
+	Memory::Zero32(pUsed32, wordCount);
 
-	ByteArray aSorted2;
-	if( !aSorted2.SetSize(pixelCount * 4) )
+	for(int32 i = 0; i < pixelCount; ++i)
 	{
-		return false;
+		const uint32 nColor = pRgba[0] | (pRgba[1] << 8) | (pRgba[2] << 16);
+		pUsed32[nColor >> 5] |= uint32(1) << (nColor & 31);
+		pRgba += 4;
 	}
 
-	uint32* pRgba32 = (uint32*) pRgba;
-
-	// ByteSort function that works the same on both endian mode
-	chustd::Sort::ByteSortLittleEndian( pRgba32, (uint32*)aSorted.GetPtr(), (uint32*)aSorted2.GetPtr(), pixelCount);
+	// If we are in this function it's because black is not suitable, so we start after it
+	pUsed32[0] |= 1;
 
-	// This first entry is pure black with alpha set to 0,
-	// If we are in this function it's because it is not suitable so we start at 1
-
-	if( k_ePlatformByteOrder == boBigEndian )
+	for(int32 iWord = 0; iWord < wordCount; ++iWord)
 	{
-		// Convert uint32 to little endian
-		IFile::Swap32( (uint32*) aSorted.GetPtr(), pixelCount);
-	}
-
-	uint32* pSorted32 = (uint32*) aSorted.GetPtr();
+		const uint32 nUnused = ~pUsed32[iWord];
+		if( nUnused == 0 )
+		{
+			// 32 colors in a row are used
+			continue;
+		}
 
-	uint32 nA = 0x00000000; // ABGR in register
-	for(int32 i = 1; i < pixelCount; ++i)
-	{
-		uint32 nB = (0x00ffffff & pSorted32[i]);
-		uint32 nDif = nB - nA;
-		if( nDif > 1 )
+		int32 iBit = 0;
+		while( ((nUnused >> iBit) & 1) == 0 )
 		{
-			// Found a useable range of colors to be used as transparent
-			break;
+			++iBit;
 		}
-		nA = nB; // Next entry
-	}
+		const uint32 nColor = uint32(iWord) * 32 + iBit;
 
-	if( nA == 0x00ffffff )
-	{
-		// This can only occurs if all 16777216 colors are present in the picture
-		// Like a 4096*4096 picture
-		return false;
+		nRed = uint8(nColor & 0x000000ff);
+		nGreen = uint8((nColor & 0x0000ff00) >> 8);
+		nBlue = uint8((nColor & 0x00ff0000) >> 16);
+		return true;
 	}
 
-	uint32 nColor = nA + 1;
-
-	nRed = uint8(nColor & 0x000000ff);
-	nGreen = uint8((nColor & 0x0000ff00) >> 8);
-	nBlue = uint8((nColor & 0x00ff0000) >> 16);
-
-	return true;
+	// This can only occurs if all 16777216 colors are present in the picture
+	// Like a 4096*4096 picture
+	return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -965,7 +1202,7 @@ bool POEngine::Optimize32BitsMode(PngDumpData& dd)
 	const uint8* pSrcBuffer = pBuffer;
 
 	Buffer rbNewRgb; // 24 bits version of the image
-	if( !rbNewRgb.SetSize(pixelCount * 3) )
+	if( !rbNewRgb.SetSize(pixelCount * 3, &m_arena) )
 	{
 		AddError(k_szNotEnoughMemoryToConvertTo24Bits);
 		return false;
@@ -1066,11 +1303,20 @@ bool POEngine::Optimize32BitsMode(PngDumpData& dd)
 	}
 
 	///////////////////////////////////////////////////////////////////
-	// Dump to memory
-
-	//dd.pBuffer = pBuffer;
+	// Dump to memory, and as a palette with a tRNS chunk if there are 256 colors or less
 	dd.pixelFormat = PF_32bppRgba;
-	return PerformDumpTries(dd);
+
+	Palette palTest;
+	Buffer rbIndexes;
+	if( !rbIndexes.SetSize(pixelCount, &m_arena) )
+	{
+		// No memory for the palette version, see Optimize24BitsMode
+		return PerformDumpTries(dd);
+	}
+
+	ColorIndexer indexer(palTest);
+	const bool bTooMuchColors = !indexer.IndexPixels(dd.pixels.GetReadPtr(), pixelCount, true, rbIndexes.GetWritePtr());
+	return OptimizeTrueColorsWithPalette(dd, rbIndexes, palTest, bTooMuchColors);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1086,89 +1332,91 @@ bool POEngine::Optimize24BitsMode(PngDumpData& dd)
 	////////////////////////////////////////////////////////////////
 	// Some test to check if we can switch to palette mode
 	Palette palTest;
-	palTest.m_count = 0;
-
-	const uint8* pSrcBuffer = pBuffer;
 	const int32 pixelCount = width * height;
 
-	Buffer rbNew;
-	if( !rbNew.SetSize(pixelCount) )
+	Buffer rbIndexes;
+	if( !rbIndexes.SetSize(pixelCount, &m_arena) )
 	{
-		return false;
+		// The palette version is only one more layout to try, the image is still dumped as is
+		return PerformDumpTries(dd);
 	}
-	uint8* pNewBuffer = rbNew.GetWritePtr();
-
-	bool bTooMuchColors = false;
-	for(int32 i = 0; i < pixelCount; ++i)
-	{
-		uint8 r = pSrcBuffer[0];
-		uint8 g = pSrcBuffer[1];
-		uint8 b = pSrcBuffer[2];
-
-		// Find the color in the palette
-		int32 iCol = 0;
-		for(; iCol < palTest.m_count; ++iCol)
-		{
-			const Color& col = palTest.m_colors[iCol];
-			uint8 rp, gp, bp;
-			col.ToRgb(rp, gp, bp);
-
-			if( r == rp && g == gp && b == bp )
-			{
-				// Found !
-				break;
-			}
-		}
-
-		pNewBuffer[0] = uint8(iCol); // Fill the new buffer
 
-		if( iCol == palTest.m_count )
-		{
-			// The 24 bit color was not in the palette
-
-			// Add a new entry in the palette
-			if( palTest.m_count == 256 )
-			{
-				// The palette is full
-				bTooMuchColors = true;
-				break;
-			}
+	ColorIndexer indexer(palTest);
+	const bool bTooMuchColors = !indexer.IndexPixels(pBuffer, pixelCount, false, rbIndexes.GetWritePtr());
+	return OptimizeTrueColorsWithPalette(dd, rbIndexes, palTest, bTooMuchColors);
+}
 
-			// New entry in the palette
-			palTest.m_colors[ palTest.m_count].SetRgb(r, g, b);
-			palTest.m_count++;
-		}
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Dumps a 24 or 32 bits image, and its palette version if it has 256 colors or less
+//
+// [in,out] dd             True colors image, may be changed to its palette version
+// [in]     indexes        Pixels of the palette version, one index per pixel
+// [in]     palTest        Palette of the indexes
+// [in]     bTooMuchColors true if the image has more than 256 colors
+//
+// Returns true upon success
+bool POEngine::OptimizeTrueColorsWithPalette(PngDumpData& dd, const Buffer& indexes, Palette& palTest,
+                                             bool bTooMuchColors)
+{
+	ASSERT(dd.pixelFormat == PF_24bppRgb || dd.pixelFormat == PF_32bppRgba);
 
-		pSrcBuffer += 3;
-		pNewBuffer += 1;
-	}
+	const int32 width = dd.width;
+	const int32 height = dd.height;
+	const int32 pixelCount = width * height;
+	const int32 pixelSize = (dd.pixelFormat == PF_24bppRgb) ? 3 : 4;
 
 	// If the picture is very small, we may enlarge it if we switch to palette mode
-	const int32 nMaxSizeOrigin = pixelCount * 3;
-	const int32 nMaxSizeNew = pixelCount + palTest.m_count * 3 + 12; // 12 = min size chunk
+	const int32 nMaxSizeOrigin = pixelCount * pixelSize;
+	const int32 nMaxSizeNew = pixelCount + palTest.m_count * pixelSize + 12; // 12 = min size chunk
 	if( nMaxSizeOrigin < nMaxSizeNew )
 	{
 		bTooMuchColors = true;
 	}
 
 	///////////////////////////////////////////////////////////////////
-	//dd.pBuffer = pBuffer;
-	dd.pixelFormat = PF_24bppRgb;
-	if( !PerformDumpTries(dd) )
+	// In fast mode, the true colors and palette layouts are estimated first, and a full dump
+	// of a layout that obviously loses is skipped. The palette layout is estimated before
+	// its sorting, which changes its size much less than the switch from true colors.
+	bool dumpTrueColors = true;
+	bool tryPalette = !bTooMuchColors;
+	if( m_settings.fastMode && tryPalette && dd.frames.GetSize() == 0 )
+	{
+		PngDumpData ddPalette;
+		ddPalette.pixels = indexes;
+		ddPalette.palette = palTest;
+		ddPalette.width = width;
+		ddPalette.height = height;
+		ddPalette.pixelFormat = PF_8bppIndexed;
+		ddPalette.interlaced = dd.interlaced;
+		PackPixelFrames(ddPalette);
+
+		int64 estimateTrueColors = 0;
+		int64 estimatePalette = 0;
+		if( !EstimateDumpSize(dd, estimateTrueColors) || !EstimateDumpSize(ddPalette, estimatePalette) )
+		{
+			AddError(k_szCannotDumpTry);
+			return false;
+		}
+		dumpTrueColors = IsLayoutLikelyToWin(estimateTrueColors, estimatePalette);
+		tryPalette = IsLayoutLikelyToWin(estimatePalette, estimateTrueColors);
+	}
+
+	///////////////////////////////////////////////////////////////////
+	if( dumpTrueColors && !PerformDumpTries(dd) )
 	{
 		return false;
 	}
 
 	///////////////////////////////////////////////////////////////////
 
-	if( bTooMuchColors )
+	if( !tryPalette )
 	{
-		// Cannot convert to palette mode, we stop here
+		// Cannot or should not convert to palette mode, we stop here
 		return true;
 	}
 
-	// Add transparency to the palette
-	if( dd.useTransparentColor )
+	// Add transparency to the palette, the alpha of 32 bits images being in the palette already
+	if( dd.pixelFormat == PF_24bppRgb && dd.useTransparentColor )
 	{
 		// Find the transparent color
 		int32 iCol = 0;
@@ -1188,7 +1436,7 @@ bool POEngine::Optimize24BitsMode(PngDumpData& dd)
 	}
 
 	// Now we have a 8 bits indexed image, we can continue with the palette mode optimizer
-	dd.pixels = rbNew;
+	dd.pixels = indexes;
 	dd.palette = palTest;
 	dd.pixelFormat = PF_8bppIndexed;
 	return OptimizePaletteMode(dd);
@@ -1386,7 +1634,7 @@ bool POEngine::Rgb16ToRgb24(PngDumpData& dd)
 	int32 pixelCount = dd.width * dd.height;
 
 	Buffer newBuffer;
-	if( !newBuffer.SetSize(pixelCount * 3) )
+	if( !newBuffer.SetSize(pixelCount * 3, &m_arena) )
 	{
 		return false;
 	}
@@ -1464,9 +1712,31 @@ bool POEngine::OptimizeExternalBuffer(const PngDumpData& dd, const String& newFi
 	return Optimize(dd2, target, optiInfo);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Tells if an image can be optimized: its pixels converted to 32 bits must fit in a buffer.
+// Then the pixel counts, and the sizes of the converted buffers, fit in an int32 too.
+// The int32 pixel counts of the Optimize*Mode functions rely on this check.
+// Frames are inside the image, they do not need their own check.
+//
+// TODO: images over Buffer::MaxSize. It needs 64-bit buffer sizes and pixel counts from the
+// decoders to PngDumper, and a banded mode decoding, filtering and deflating the rows by parts
+// so that images larger than the memory can be recompressed.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool HasWorkableSize(int32 width, int32 height)
+{
+	int32 size = 0;
+	return ImageFormat::ComputeBufferSize(int64(width) * 4, height, size);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool POEngine::Optimize(PngDumpData& dd, const OptiTarget& target, OptiInfo& optiInfo)
 {
+	if( !HasWorkableSize(dd.width, dd.height) )
+	{
+		AddError(k_szImageTooBig);
+		return false;
+	}
+
 	if( dd.pixelFormat == PF_32bppBgra )
 	{
 		// Yuk ! Change this
@@ -1757,8 +2027,9 @@ bool POEngine::OptimizeFileDiskNoBackup(const String& filePath, const String& ne
 		AddError(k_szCannotLoadFile);
 		return false;
 	}
+	// Images are decoded whole into buffers limited to Buffer::MaxSize, see HasWorkableSize
 	int64 srcFileSize = fileImage.GetSize();
-	if( srcFileSize > MAX_INT32 )
+	if( srcFileSize > Buffer::MaxSize )
 	{
 		AddError(k_szFileTooLarge);
 		return false;
@@ -1773,7 +2044,7 @@ bool POEngine::OptimizeFileDiskNoBackup(const String& filePath, const String& ne
 
 	// The source data is a file, set the source information field of the target struct
 	target.srcInfo.filePath = filePath;
-	target.srcInfo.fileSize = static_cast<int>(srcFileSize);
+	target.srcInfo.fileSize = srcFileSize;
 
 	if( !OptimizeFileStreamNoBackup(fileImage, target, optiInfo) )
 	{
@@ -1813,7 +2084,7 @@ bool POEngine::OptimizeFileMem(const uint8* imgBuf, int imgSize, uint8* dst, int
 	OptiTarget target(dst, dstCapacity);
 	OptiInfo optiInfo;
 	bool ret = OptimizeFileStreamNoBackup(fileImage, target, optiInfo);
-	*pDstSize = optiInfo.sizeAfter;
+	*pDstSize = int(optiInfo.sizeAfter); // Not more than dstCapacity
 	return ret;
 }
 
@@ -1840,8 +2111,9 @@ bool POEngine::OptimizeFileStdio()
 // Closes fileImage.
 static bool LoadFileToMem(IFile& fileImage, DynamicMemoryFile& dmfAsIs)
 {
+	// The content is kept in a single buffer, see OptimizeFileDiskNoBackup
 	const int64 fileSize = fileImage.GetSize();
-	if( fileSize > MAX_INT32 )
+	if( fileSize > Buffer::MaxSize )
 	{
 		return false;
 	}
@@ -1888,16 +2160,35 @@ bool POEngine::OptimizeFileStreamNoBackup(IFile& fileImage, const OptiTarget& ta
 	m_astrErrors.Clear();
 
 	/////////////////////////////////////////////
-	// Load as-is in memory
-	DynamicMemoryFile dmfAsIs;
-	if( !LoadFileToMem(fileImage, dmfAsIs) )
+	// Load as-is in memory, unless the batch prefetcher already did it.
+	// A regular file is mapped instead of copied, only stdin and the like need the copy.
+	// The mapping is closed as soon as the image is decoded: on POSIX systems, another process
+	// truncating the file before that would end this one with SIGBUS, see MappedFile.
+	DynamicMemoryFile dmfLoaded;
+	MappedFile mappedFile;
+	IFile* pAsIs = m_pPrefetchedFile;
+	if( pAsIs != nullptr && pAsIs->GetSize() == fileImage.GetSize() )
 	{
-		AddError(k_szCannotLoadFile);
-		return false;
+		fileImage.Close();
 	}
+	else if( !target.srcInfo.filePath.IsEmpty() && mappedFile.Open(target.srcInfo.filePath) )
+	{
+		fileImage.Close();
+		pAsIs = &mappedFile;
+	}
+	else
+	{
+		if( !LoadFileToMem(fileImage, dmfLoaded) )
+		{
+			AddError(k_szCannotLoadFile);
+			return false;
+		}
+		pAsIs = &dmfLoaded;
+	}
+	IFile& dmfAsIs = *pAsIs;
 
 	// Needed for display
-	optiInfo.sizeBefore = static_cast<int>(dmfAsIs.GetSize());
+	optiInfo.sizeBefore = dmfAsIs.GetSize();
 
 	/////////////////////////////////////////////
 	ImageLoader imgloader;
@@ -1941,6 +2232,15 @@ bool POEngine::OptimizeFileStreamNoBackup(IFile& fileImage, const OptiTarget& ta
 		return false;
 	}
 
+	// Everything needed was copied, and the result may overwrite the source file
+	mappedFile.Close();
+
+	if( !HasWorkableSize(img.GetWidth(), img.GetHeight()) )
+	{
+		AddError(k_szImageTooBig);
+		return false;
+	}
+
 	const int32 width = img.GetWidth();
 	const int32 height = img.GetHeight();
 	const Buffer& pixels = img.GetPixels();
@@ -2064,6 +2364,9 @@ bool POEngine::OptimizeFileStreamNoBackup(IFile& fileImage, const OptiTarget& ta
 		{
 			return OptimizeAnimated(img, dd, target, optiInfo);
 		}
+		// The image is not needed anymore. dd gets the only reference to the pixels,
+		// so the conversions can work in place instead of copying them first.
+		dd.pixels = img.TakePixels();
 		return Optimize(dd, target, optiInfo);
 	}
 }
@@ -2124,6 +2427,20 @@ void POEngine::PrintSizeChange(int64 sizeBefore, int64 sizeAfter, bool sameConte
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the name of the backup of a PNG file
+static String GetBackupFileName(const String& fileName)
+{
+	return "_" + fileName;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the name of the PNG file converted from a file of another format
+static String GetConvertedFileName(const String& fileName)
+{
+	return FilePath::RemoveExtension(fileName) + ".png";
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Optimizes one single file
 //
@@ -2202,7 +2519,7 @@ bool POEngine::OptimizeFileDisk(const String& filePath, const String& displayDir
 
 		if( m_settings.backupOldPngFiles )
 		{
-			String backupFilePath = strDirOnly + "_" + strNameOnly;
+			String backupFilePath = strDirOnly + GetBackupFileName(strNameOnly);
 
 			// Delete a possible previous backup file
 			if( File::Exists(backupFilePath) )
@@ -2238,7 +2555,7 @@ bool POEngine::OptimizeFileDisk(const String& filePath, const String& displayDir
 	{
 		// Not a PNG file
 		oldFilePath = filePath;
-		newFilePath = strDirOnly + FilePath::RemoveExtension(strNameOnly) + ".png";
+		newFilePath = strDirOnly + GetConvertedFileName(strNameOnly);
 	}
 
 	// TMP DEBUG : to compare size before and after, uncomment the line above
@@ -2254,73 +2571,895 @@ bool POEngine::OptimizeFileDisk(const String& filePath, const String& displayDir
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-// Optimizes multiple files and directories (private)
+// Walks the files and directories given to OptimizeMultiFilesDisk, one file at a time.
+// Directories are walked depth first while being read, so only the directories being walked
+// are held in memory, whatever the size of the tree.
+// The optimization creates files in the directories being read: backups, optimized and
+// converted files. The system may list them or not, so each directory keeps the names of the
+// files created from the ones already given, and skips exactly those.
+class POEngine::BatchWalker
+{
+public:
+	BatchWalker(POEngine& engine, const StringArray& filePaths, const String& joker, BatchOrder order);
+	bool GetNext(BatchFile& batchFile);
+	bool HasNext();
+
+private:
+	// A directory being walked
+	struct Level
+	{
+		DirectoryReader reader;
+		String          dirPath;
+		String          displayDir;   // Directory name to display
+		StringArray     createdNames; // Sorted names of the files the optimization creates
+	};
+
+	POEngine&          m_engine;
+	const StringArray& m_filePaths; // Paths to walk
+	const String&      m_joker;     // Type of files managed
+	int                m_nextPath;  // Index in m_filePaths
+	PtrArray<Level>    m_levels;    // Directories being walked, the deepest last
+
+	BatchFile          m_nextFile;  // Read ahead by HasNext()
+	bool               m_hasNextFile;
+
+	BatchOrder         m_order;
+	bool               m_sorted;      // true once m_sortedFiles is filled
+	Array<BatchFile>   m_sortedFiles; // All the files, when an order is requested
+	int                m_nextSorted;  // Index in m_sortedFiles
+
+	bool Walk(BatchFile& batchFile);
+	bool WalkTree(BatchFile& batchFile);
+	void SortFiles();
+
+	bool IsCreatedFile(Level* pLevel, const String& fileName);
+	void AddCreatedFiles(Level* pLevel, const String& fileName);
+	static bool FindCreatedName(const Level* pLevel, const String& fileName, int& index);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// [in] engine     Engine receiving the errors
+// [in] filePaths  File path of files or directories to walk
+// [in] joker      Type of files managed
+// [in] order      Order of the files
+POEngine::BatchWalker::BatchWalker(POEngine& engine, const StringArray& filePaths, const String& joker,
+                                   BatchOrder order)
+	: m_engine(engine), m_filePaths(filePaths), m_joker(joker)
+{
+	m_nextPath = 0;
+	m_hasNextFile = false;
+	m_order = order;
+	m_sorted = false;
+	m_nextSorted = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the next file to optimize, in the order they must be reported
 //
-// [in] baseDir            Directory name containing the files
-// [in] fileNames          File path relative to base dir
-// [in] displayDir         Directory name to display
-// [in] joker              Type of files managed
-// [in,out] multiOptiInfo  Optimization information
+// [out] batchFile  File to optimize
+//
+// Returns false when all the files were walked
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void POEngine::OptimizeFilesInternal(const String& baseDir, const StringArray& fileNames, const String& displayDir,
-                                     const String& joker, MultiOptiInfo& multiOptiInfo)
+bool POEngine::BatchWalker::GetNext(BatchFile& batchFile)
 {
-	const int32 fileCount = fileNames.GetSize();
-	for(int32 iFile = 0; iFile < fileCount; ++iFile)
+	if( m_hasNextFile )
 	{
-		String filePath = FilePath::Combine(baseDir, fileNames[iFile]);
+		batchFile = m_nextFile;
+		m_hasNextFile = false;
+		return true;
+	}
+	return Walk(batchFile);
+}
 
-		bool srcIsDir = false;
-		bool srcIsReadOnly = false;
-		if( !File::GetFileAttributes(filePath, srcIsDir, srcIsReadOnly) )
-		{
-			// We cannot even read file attributes, so we just stop there for this file
-			AddError(k_szPathDoesNotExist);
-		}
-		else
-		{
-			// We need the name alone
-			String strDirOnly, strNameOnly;
-			FilePath::Split(filePath, strDirOnly, strNameOnly);
-			if( srcIsDir )
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Checks if there is a file left to optimize
+bool POEngine::BatchWalker::HasNext()
+{
+	if( !m_hasNextFile )
+	{
+		m_hasNextFile = Walk(m_nextFile);
+	}
+	return m_hasNextFile;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the next file in the requested order (private)
+//
+// [out] batchFile  File to optimize
+//
+// Returns false when all the files were given
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::BatchWalker::Walk(BatchFile& batchFile)
+{
+	if( m_order == BO_None )
+	{
+		return WalkTree(batchFile);
+	}
+	if( !m_sorted )
+	{
+		SortFiles();
+		m_sorted = true;
+	}
+	if( m_nextSorted >= m_sortedFiles.GetSize() )
+	{
+		return false;
+	}
+	batchFile = m_sortedFiles[m_nextSorted];
+	m_nextSorted++;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sort key of a file walked by a BatchWalker
+struct BatchSortKey
+{
+	const String* pFilePath;
+	int64         fileSize;
+	int           walkIndex; // Keeps the sort stable
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int CompareBatchNames(const void* p1, const void* p2)
+{
+	const BatchSortKey* pKey1 = reinterpret_cast<const BatchSortKey*>(p1);
+	const BatchSortKey* pKey2 = reinterpret_cast<const BatchSortKey*>(p2);
+	int cmp = pKey1->pFilePath->CompareBin(*pKey2->pFilePath);
+	if( cmp != 0 )
+	{
+		return cmp;
+	}
+	return pKey1->walkIndex - pKey2->walkIndex;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int CompareBatchSizes(const void* p1, const void* p2)
+{
+	const BatchSortKey* pKey1 = reinterpret_cast<const BatchSortKey*>(p1);
+	const BatchSortKey* pKey2 = reinterpret_cast<const BatchSortKey*>(p2);
+	if( pKey1->fileSize != pKey2->fileSize )
+	{
+		// Decreasing sizes
+		return (pKey1->fileSize > pKey2->fileSize) ? -1 : 1;
+	}
+	return pKey1->walkIndex - pKey2->walkIndex;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Walks all the files and sorts them in the requested order (private)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::BatchWalker::SortFiles()
+{
+	Array<BatchFile> files;
+	BatchFile batchFile;
+	while( WalkTree(batchFile) )
+	{
+		files.Add(batchFile);
+	}
+
+	const int fileCount = files.GetSize();
+	Array<BatchSortKey> keys;
+	keys.SetSize(fileCount);
+	for(int i = 0; i < fileCount; ++i)
+	{
+		BatchSortKey& key = keys[i];
+		key.pFilePath = &files[i].filePath;
+		key.fileSize = (m_order == BO_Size) ? File::GetSize(files[i].filePath) : 0;
+		key.walkIndex = i;
+	}
+	qsort(keys.GetPtr(), fileCount, sizeof(BatchSortKey),
+		(m_order == BO_Size) ? CompareBatchSizes : CompareBatchNames);
+
+	m_sortedFiles.SetSize(0);
+	m_sortedFiles.EnsureCapacity(fileCount);
+	for(int i = 0; i < fileCount; ++i)
+	{
+		m_sortedFiles.Add(files[keys[i].walkIndex]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Walks until the next file matching the joker (private)
+//
+// [out] batchFile  File to optimize
+//
+// Returns false when all the files were walked
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::BatchWalker::WalkTree(BatchFile& batchFile)
+{
+	for(;;)
+	{
+		String fileName;
+		String baseDir;
+		String displayDir;
+		if( m_levels.GetSize() > 0 )
+		{
+			Level* pLevel = m_levels.GetLast();
+			if( !pLevel->reader.GetNext(fileName) )
+			{
+				// Directory done, back to its parent
+				m_levels.RemoveLast();
+				continue;
+			}
+			baseDir = pLevel->dirPath;
+			displayDir = pLevel->displayDir;
+		}
+		else
+		{
+			if( m_nextPath >= m_filePaths.GetSize() )
 			{
-				// A directory, we optimize it before we continue
-				StringArray astrSubFileNames = Directory::GetFileNames(filePath, "*");
+				return false;
+			}
+			fileName = m_filePaths[m_nextPath];
+			m_nextPath++;
+		}
+
+		String filePath = FilePath::Combine(baseDir, fileName);
 
-				// Set the directory to display
-				String newDisplayDir;
-				if( !displayDir.IsEmpty() )
+		bool srcIsDir = false;
+		bool srcIsReadOnly = false;
+		if( !File::GetFileAttributes(filePath, srcIsDir, srcIsReadOnly) )
+		{
+			// We cannot even read file attributes, so we just stop there for this file
+			m_engine.AddError(k_szPathDoesNotExist);
+			continue;
+		}
+
+		// We need the name alone
+		String strDirOnly, strNameOnly;
+		FilePath::Split(filePath, strDirOnly, strNameOnly);
+		if( srcIsDir )
+		{
+			// A directory, we walk it before we continue
+			Level* pLevel = new Level;
+			if( !pLevel->reader.Open(filePath) )
+			{
+				delete pLevel;
+				m_engine.AddError(k_szCannotReadDirectory);
+				continue;
+			}
+			m_levels.Add(pLevel);
+			pLevel->dirPath = filePath;
+
+			// Set the directory to display
+			if( !displayDir.IsEmpty() )
+			{
+				pLevel->displayDir = displayDir + "/";
+			}
+			pLevel->displayDir = pLevel->displayDir + strNameOnly;
+		}
+		else
+		{
+			// A file. Filter by extension.
+			if( !IsFileExtensionSupported(FilePath::GetExtension(filePath), m_joker) )
+			{
+				continue;
+			}
+
+			if( m_levels.GetSize() > 0 )
+			{
+				Level* pLevel = m_levels.GetLast();
+				if( IsCreatedFile(pLevel, fileName) )
 				{
-					newDisplayDir = displayDir + "/";
+					// Created or renamed by the optimization of a file given before
+					continue;
 				}
-				newDisplayDir = newDisplayDir + strNameOnly;
-				OptimizeFilesInternal(filePath, astrSubFileNames, newDisplayDir, joker, multiOptiInfo);
+				AddCreatedFiles(pLevel, fileName);
 			}
-			else
+			batchFile.filePath = filePath;
+			batchFile.displayDir = displayDir;
+			return true;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Finds a name in the sorted names of the files created in a directory (private)
+//
+// [in]  pLevel    Directory being walked
+// [in]  fileName  Name to find
+// [out] index     Index of the name, or where to insert it
+//
+// Returns true if the name was found
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::BatchWalker::FindCreatedName(const Level* pLevel, const String& fileName, int& index)
+{
+	const StringArray& names = pLevel->createdNames;
+	int first = 0;
+	int last = names.GetSize();
+	while( first < last )
+	{
+		const int middle = (first + last) / 2;
+		const int cmp = names[middle].CompareBin(fileName);
+		if( cmp == 0 )
+		{
+			index = middle;
+			return true;
+		}
+		if( cmp < 0 )
+		{
+			first = middle + 1;
+		}
+		else
+		{
+			last = middle;
+		}
+	}
+	index = first;
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Checks if a file of a directory was created by the optimization of a file given before (private)
+// A name is listed at most once more, so it is forgotten once found.
+//
+// [in] pLevel    Directory being walked
+// [in] fileName  Name of the file, in that directory
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::BatchWalker::IsCreatedFile(Level* pLevel, const String& fileName)
+{
+	int index = 0;
+	if( !FindCreatedName(pLevel, fileName, index) )
+	{
+		return false;
+	}
+	pLevel->createdNames.RemoveAt(index);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Records the files the optimization of a file will create in its directory (private)
+// With a backup, the optimized file is a new file with the name of the original one.
+//
+// [in] pLevel    Directory being walked
+// [in] fileName  Name of the file given, in that directory
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::BatchWalker::AddCreatedFiles(Level* pLevel, const String& fileName)
+{
+	StringArray names;
+	const String fileExt = FilePath::GetExtension(fileName).ToLowerCase();
+	if( fileExt == "png" || fileExt == "apng" )
+	{
+		if( m_engine.m_settings.backupOldPngFiles )
+		{
+			names.Add(GetBackupFileName(fileName));
+			names.Add(fileName);
+		}
+	}
+	else
+	{
+		names.Add(GetConvertedFileName(fileName));
+	}
+
+	for(int i = 0; i < names.GetSize(); ++i)
+	{
+		int index = 0;
+		if( !FindCreatedName(pLevel, names[i], index) )
+		{
+			pLevel->createdNames.InsertAt(index, names[i]);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Optimizes one file of a batch and reports the progress (private)
+//
+// [in] batchFile          File to optimize
+// [in,out] multiOptiInfo  Optimization information
+// [in] workingSet         Estimated memory needed by the file, see GetBatchWorkingSet
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::OptimizeBatchFile(const BatchFile& batchFile, MultiOptiInfo& multiOptiInfo, int64 workingSet)
+{
+	// Call the single file optimization function
+	OptiInfo soi;
+	multiOptiInfo.optiCount++;
+	m_astrErrors.Clear();
+
+	// Too big for the budget: a single trial rather than an out of memory failure
+	m_lowMemory = (m_memoryBudget > 0 && workingSet > m_memoryBudget);
+
+	// Taken before any backup renaming, the prefetcher knows the original path only
+	if( m_pPrefetcher )
+	{
+		m_pPrefetchedFile = m_pPrefetcher->Take(batchFile.filePath);
+	}
+	bool ok = OptimizeFileDisk(batchFile.filePath, batchFile.displayDir, soi);
+	delete m_pPrefetchedFile;
+	m_pPrefetchedFile = nullptr;
+	m_lowMemory = false;
+
+	if( !ok )
+	{
+		multiOptiInfo.errorCount++;
+		String strLastError = GetLastErrorString();
+		PrintText(" (KO) ", TT_ActionFail);
+		PrintText(strLastError + "\n", TT_ErrorMsg);
+	}
+	else
+	{
+		multiOptiInfo.sizeBefore += soi.sizeBefore;
+		multiOptiInfo.sizeAfter += soi.sizeAfter;
+	}
+	m_astrErrors.Clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the memory needed to optimize a file of a batch, checked against the memory budget (private)
+//
+// [in] batchFile  File to optimize
+//
+// Returns the estimate in bytes, 0 if there is no budget
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int64 POEngine::GetBatchWorkingSet(const BatchFile& batchFile)
+{
+	if( m_memoryBudget <= 0 )
+	{
+		return 0;
+	}
+	return EstimateWorkingSet(batchFile.filePath);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// String reference counting is not atomic, so a string handed to another thread
+// must not share its data with the strings of the calling thread
+static String CopyStringData(const String& str)
+{
+	if( str.IsEmpty() )
+	{
+		return String();
+	}
+	return String(str.GetBuffer(), str.GetLength());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Outcome of one file optimized by a batch job
+struct POEngine::BatchResult
+{
+	BatchFile     batchFile;     // Private copy of the file to optimize
+	Semaphore     semDone;       // Incremented by the job when the file is optimized
+	int64         workingSet;    // Estimated memory needed by the file, set by the job
+	MultiOptiInfo multiOptiInfo; // Counters for this file only
+	Array<ProgressingArg> texts; // Progress messages, fired later in the file order
+
+	BatchResult() : workingSet(0) {}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Shared by all batch jobs
+struct POEngine::BatchContext
+{
+	Semaphore semWork; // Incremented for each file queued, then once for each job to exit
+	PtrArray<BatchResult> results; // Files not reported yet, in the walk order
+	CriticalSection cs;
+	int nextResult; // Index of the next file to be taken by a job, protected by cs
+
+	Semaphore semMemory;    // Incremented for each waiting job when memory is released
+	int64 memoryBudget;     // 0 = no limit
+	int64 memoryUsed;       // Protected by cs, sum of the files being optimized
+	int   memoryWaiterCount; // Protected by cs, jobs waiting for semMemory
+
+	BatchContext() : nextResult(0), memoryBudget(0), memoryUsed(0), memoryWaiterCount(0) {}
+
+	// Waits until a file fits in the memory budget, then takes its share. A file is always
+	// admitted when no other file is optimized, whatever its size.
+	// Returns the share taken, to give to ReleaseMemory
+	int64 AcquireMemory(int64 workingSet)
+	{
+		if( memoryBudget <= 0 )
+		{
+			return 0;
+		}
+		const int64 share = Math::Min(workingSet, memoryBudget);
+		for(;;)
+		{
 			{
-				// A file. Filter by extension.
-				if( IsFileExtensionSupported(FilePath::GetExtension(filePath), joker) )
+				TmpLock lock(cs);
+				if( memoryUsed == 0 || memoryUsed + share <= memoryBudget )
 				{
-					// Call the single file optimization function
-					OptiInfo soi;
-					multiOptiInfo.optiCount++;
-					m_astrErrors.Clear();
-					if( !OptimizeFileDisk(filePath, displayDir, soi) )
-					{
-						multiOptiInfo.errorCount++;
-						String strLastError = GetLastErrorString();
-						PrintText(" (KO) ", TT_ActionFail);
-						PrintText(strLastError + "\n", TT_ErrorMsg);
-					}
-					else
-					{
-						multiOptiInfo.sizeBefore += soi.sizeBefore;
-						multiOptiInfo.sizeAfter += soi.sizeAfter;
-					}
-					m_astrErrors.Clear();
+					memoryUsed += share;
+					return share;
 				}
+				memoryWaiterCount++;
+			}
+			semMemory.Wait();
+		}
+	}
+
+	void ReleaseMemory(int64 share)
+	{
+		TmpLock lock(cs);
+		memoryUsed -= share;
+
+		// Every waiting job checks again if its file fits
+		for(; memoryWaiterCount > 0; --memoryWaiterCount)
+		{
+			semMemory.Increment();
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A batch job optimizes files with its own engine, taking the next file not yet handled
+// until the walk is over
+class POEngine::BatchJob
+{
+public:
+	POEngine      m_engine;
+	Thread        m_thread;
+	BatchContext* m_pContext;
+	BatchResult*  m_pResult; // File being optimized
+
+	BatchJob() : m_pContext(nullptr), m_pResult(nullptr)
+	{
+		m_engine.Progressing.Connect(this, &BatchJob::OnEngineProgressing);
+	}
+
+	void OnEngineProgressing(const ProgressingArg& arg)
+	{
+		m_pResult->texts.Add(arg);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int POEngine::BatchThreadProc(void* arg)
+{
+	BatchJob* pJob = static_cast<BatchJob*>(arg);
+	BatchContext& context = *pJob->m_pContext;
+	for(;;)
+	{
+		if( context.semWork.Wait() != 0 )
+		{
+			break;
+		}
+		BatchResult* pResult = nullptr;
+		{
+			TmpLock lock(context.cs);
+			if( context.nextResult < context.results.GetSize() )
+			{
+				pResult = context.results[context.nextResult];
+				context.nextResult++;
+			}
+		}
+		if( pResult == nullptr )
+		{
+			// The walk is over
+			break;
+		}
+		// Known before the file is decoded, so the memory is taken before it is used
+		pResult->workingSet = pJob->m_engine.GetBatchWorkingSet(pResult->batchFile);
+		const int64 memoryShare = context.AcquireMemory(pResult->workingSet);
+
+		pJob->m_pResult = pResult;
+		pJob->m_engine.OptimizeBatchFile(pResult->batchFile, pResult->multiOptiInfo, pResult->workingSet);
+		pJob->m_pResult = nullptr;
+		context.ReleaseMemory(memoryShare);
+		pResult->semDone.Increment();
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Hands a file over to the batch jobs (private)
+//
+// [in] batchFile  File to optimize
+// [in] context    Context shared by the jobs
+//
+// Returns true upon success
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool POEngine::QueueBatchFile(const BatchFile& batchFile, BatchContext& context)
+{
+	BatchResult* pResult = new BatchResult;
+	pResult->batchFile.filePath = CopyStringData(batchFile.filePath);
+	pResult->batchFile.displayDir = CopyStringData(batchFile.displayDir);
+	if( !pResult->semDone.Create() )
+	{
+		delete pResult;
+		return false;
+	}
+	{
+		TmpLock lock(context.cs);
+		context.results.Add(pResult);
+	}
+	if( m_pPrefetcher )
+	{
+		m_pPrefetcher->Add(pResult->batchFile.filePath);
+	}
+	context.semWork.Increment();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Fires the messages of a file optimized by a batch job and accumulates its counters (private)
+//
+// [in] result             File optimized by a job
+// [in,out] multiOptiInfo  Optimization information
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::ReportBatchResult(const BatchResult& result, MultiOptiInfo& multiOptiInfo)
+{
+	const int textCount = result.texts.GetSize();
+	for(int i = 0; i < textCount; ++i)
+	{
+		Progressing.Fire(result.texts[i]);
+	}
+	multiOptiInfo.optiCount += result.multiOptiInfo.optiCount;
+	multiOptiInfo.errorCount += result.multiOptiInfo.errorCount;
+	multiOptiInfo.sizeBefore += result.multiOptiInfo.sizeBefore;
+	multiOptiInfo.sizeAfter += result.multiOptiInfo.sizeAfter;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Optimizes the files of a batch with several engines working in parallel (private)
+// Messages of each file are fired as a whole, in the same order as a serial run.
+// The walk stays a few files ahead of the reports, so the memory used does not depend
+// on the number of files.
+//
+// [in] walker             Gives the files to optimize
+// [in,out] multiOptiInfo  Optimization information
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::OptimizeBatchFilesParallel(BatchWalker& walker, MultiOptiInfo& multiOptiInfo)
+{
+	BatchFile batchFile;
+	if( !walker.GetNext(batchFile) )
+	{
+		return;
+	}
+
+	BatchContext context;
+	if( !walker.HasNext() || !context.semWork.Create() || !context.semMemory.Create() )
+	{
+		// A single file keeps all the processors for its trials, or fallback
+		// to a serial optimization
+		do
+		{
+			OptimizeBatchFile(batchFile, multiOptiInfo, GetBatchWorkingSet(batchFile));
+		}
+		while( walker.GetNext(batchFile) );
+		return;
+	}
+
+	// Files are started only while their estimated memory fits in the budget
+	context.memoryBudget = m_memoryBudget;
+
+	const int jobCount = m_jobCount;
+	PtrArray<BatchJob> jobs;
+	for(int i = 0; i < jobCount; ++i)
+	{
+		BatchJob* pJob = new BatchJob;
+		pJob->m_pContext = &context;
+
+		POEngineSettings& settings = pJob->m_engine.m_settings;
+		settings = m_settings;
+		settings.textKeyword = CopyStringData(m_settings.textKeyword);
+		settings.textData = CopyStringData(m_settings.textData);
+		if( settings.threadCount <= 0 )
+		{
+			// Share the processors between the jobs
+			settings.threadCount = Math::Max(System::GetProcessorCount() / jobCount, 1);
+		}
+		pJob->m_engine.m_unicodeArrowEnabled = m_unicodeArrowEnabled;
+		pJob->m_engine.m_pPrefetcher = m_pPrefetcher;
+		pJob->m_engine.m_memoryBudget = m_memoryBudget;
+		jobs.Add(pJob);
+	}
+
+	// Start the jobs. If a thread cannot be started, the other jobs handle its share.
+	int startedCount = 0;
+	for(int i = 0; i < jobCount; ++i)
+	{
+		if( jobs[i]->m_thread.Start(&BatchThreadProc, jobs[i]) )
+		{
+			startedCount++;
+		}
+	}
+
+	// Files queued but not reported yet
+	const int maxPendingCount = 4 * jobCount;
+
+	bool walkOver = (startedCount == 0);
+	bool serialFallback = walkOver; // batchFile and the next ones are optimized serially
+	bool hasFile = true;            // batchFile is to be queued
+	while( !walkOver )
+	{
+		if( !hasFile )
+		{
+			hasFile = walker.GetNext(batchFile);
+		}
+		if( !hasFile )
+		{
+			walkOver = true;
+		}
+		else if( QueueBatchFile(batchFile, context) )
+		{
+			hasFile = false;
+		}
+		else
+		{
+			// Once the queued files are reported
+			walkOver = true;
+			serialFallback = true;
+		}
+
+		// Report results as soon as they are available, in the file order
+		const int pendingMax = walkOver ? 1 : maxPendingCount;
+		while( context.results.GetSize() >= pendingMax )
+		{
+			BatchResult* pResult = context.results[0];
+			pResult->semDone.Wait();
+			ReportBatchResult(*pResult, multiOptiInfo);
+
+			TmpLock lock(context.cs);
+			context.results.RemoveAt(0);
+			context.nextResult--;
+		}
+	}
+
+	// Ask the jobs to exit
+	for(int i = 0; i < jobCount; ++i)
+	{
+		context.semWork.Increment();
+	}
+	for(int i = 0; i < jobCount; ++i)
+	{
+		jobs[i]->m_thread.WaitForExit();
+	}
+
+	if( serialFallback )
+	{
+		do
+		{
+			OptimizeBatchFile(batchFile, multiOptiInfo, GetBatchWorkingSet(batchFile));
+		}
+		while( walker.GetNext(batchFile) );
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sets the number of files OptimizeMultiFilesDisk can optimize at the same time
+//
+// [in] jobCount  Job count, 1 for a serial processing
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::SetJobCount(int jobCount)
+{
+	m_jobCount = Math::Max(jobCount, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sets the order in which OptimizeMultiFilesDisk handles the files. Messages are written
+// in that order too.
+//
+// [in] order  Order of the files. Except for BO_None, all the files are walked first.
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::SetBatchOrder(BatchOrder order)
+{
+	m_batchOrder = order;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sets the memory OptimizeMultiFilesDisk can use to read the next files in advance,
+// while the current ones are optimized
+//
+// [in] byteBudget  Maximum size of the files held in memory, 0 to disable
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::SetPrefetchBudget(int64 byteBudget)
+{
+	m_prefetchBudget = Math::Max(byteBudget, int64(0));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sets the memory OptimizeMultiFilesDisk can use for the images optimized at the same time.
+// A file is started only when its estimated memory fits in what the other files left.
+// A file bigger than the whole budget is optimized alone, with a single trial.
+//
+// [in] byteBudget  Maximum memory in bytes, 0 for no limit
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::SetMemoryBudget(int64 byteBudget)
+{
+	m_memoryBudget = Math::Max(byteBudget, int64(0));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Estimates the peak memory needed to optimize a file, before decoding it. For a PNG file,
+// the size and the pixel format come from the IHDR. Other formats are estimated from the
+// file size, as if each byte of the file gave a pixel.
+//
+// The estimate adds up the file, the decoded pixels, the image in the working layouts,
+// the scanlines shared by the trials for each filtering and the results of the workers.
+// A result is counted as half the filtered rows: measured on a noisy 4 megapixels RGBA
+// image, the estimate is 20% to 30% above the peak memory, depending on the thread count.
+//
+// [in] filePath  File to optimize
+//
+// Returns the estimate in bytes, 0 if the file cannot be read
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int64 POEngine::EstimateWorkingSet(const String& filePath)
+{
+	File file;
+	if( !file.Open(filePath) )
+	{
+		return 0;
+	}
+	const int64 fileSize = file.GetSize();
+	file.SetByteOrder(boBigEndian);
+
+	int64 pixelCount = fileSize;
+	int64 rowCount = 0;
+	int64 decodedBytes = 4 * fileSize;
+
+	PngChunk_IHDR ihdr;
+	int32 chunkSize = 0;
+	uint32 chunkName = 0;
+	if( Png::IsPng(file) && file.Read32(chunkSize) && file.Read32(chunkName)
+	 && chunkName == PngChunk_IHDR::Name && Png::Read_IHDR(file, chunkSize, ihdr) == 0 )
+	{
+		const int64 bitsPerPixel = ImageFormat::SizeofPixelInBits(Png::GetPixelFormat(ihdr));
+		pixelCount = int64(ihdr.width) * ihdr.height;
+		rowCount = ihdr.height;
+		decodedBytes = (ihdr.width * bitsPerPixel + 7) / 8 * rowCount;
+		if( ihdr.interlaceMethod != 0 )
+		{
+			// The passes are decoded in a buffer of their own
+			decodedBytes *= 2;
+		}
+	}
+
+	// An image in a working layout, 32 bits per pixel at most
+	const int64 layoutBytes = 4 * pixelCount;
+	// A filter byte for each row
+	const int64 scanlineBytes = layoutBytes + rowCount;
+	const int64 resultBytes = scanlineBytes / 2;
+	// Window, hash chains and pending symbols of a zlib stream
+	const int64 deflateStateBytes = 512 * 1024;
+
+	UpdateTrials();
+	uint32 filterings = 0;
+	int filteringCount = 0;
+	for(int i = 0; i < m_trials.GetSize(); ++i)
+	{
+		const uint32 bit = 1 << m_trials[i].filtering;
+		if( (filterings & bit) == 0 )
+		{
+			filterings |= bit;
+			filteringCount++;
+		}
+	}
+	const int threadCount = GetWorkerThreadCount();
+
+	// The image and a converted copy of it. The engine keeps the two best results, each
+	// worker its best result and the current one.
+	int64 total = fileSize + decodedBytes + 2 * layoutBytes;
+	total += filteringCount * scanlineBytes;
+	total += (2 + 2 * threadCount) * resultBytes + threadCount * deflateStateBytes;
+	return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Optimizes the files of a batch one after the other (private)
+// When prefetching, the walk stays a few files ahead so the next files are read in advance.
+//
+// [in] walker             Gives the files to optimize
+// [in,out] multiOptiInfo  Optimization information
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void POEngine::OptimizeBatchFilesSerial(BatchWalker& walker, MultiOptiInfo& multiOptiInfo)
+{
+	const int lookAheadCount = m_pPrefetcher ? k_prefetchFileCount : 1;
+
+	Array<BatchFile> batchFiles;
+	BatchFile batchFile;
+	for(;;)
+	{
+		while( batchFiles.GetSize() < lookAheadCount && walker.GetNext(batchFile) )
+		{
+			batchFiles.Add(batchFile);
+			if( m_pPrefetcher )
+			{
+				m_pPrefetcher->Add(batchFile.filePath);
 			}
 		}
+		if( batchFiles.GetSize() == 0 )
+		{
+			break;
+		}
+		OptimizeBatchFile(batchFiles[0], multiOptiInfo, GetBatchWorkingSet(batchFiles[0]));
+		batchFiles.RemoveAt(0);
 	}
 }
 
@@ -2337,7 +3476,26 @@ bool POEngine::OptimizeMultiFilesDisk(const StringArray& filePaths, const String
 {
 	uint32 startTime = System::GetTime();
 	MultiOptiInfo multiOptiInfo;
-	OptimizeFilesInternal("", filePaths, "", joker, multiOptiInfo);
+
+	// The next files are read while the current ones are optimized
+	POFilePrefetcher prefetcher;
+	if( m_prefetchBudget > 0 && prefetcher.Start(m_prefetchBudget) )
+	{
+		m_pPrefetcher = &prefetcher;
+	}
+
+	// Files are optimized while the directories are walked
+	BatchWalker walker(*this, filePaths, joker, m_batchOrder);
+	if( m_jobCount > 1 )
+	{
+		OptimizeBatchFilesParallel(walker, multiOptiInfo);
+	}
+	else
+	{
+		OptimizeBatchFilesSerial(walker, multiOptiInfo);
+	}
+	m_pPrefetcher = nullptr;
+	prefetcher.Stop();
 
 	bool success = (multiOptiInfo.errorCount == 0);
 	if( multiOptiInfo.optiCount > 1 )
@@ -2353,7 +3511,7 @@ bool POEngine::OptimizeMultiFilesDisk(const StringArray& filePaths, const String
 	}
 	else
 	{
-		// OptimizeFilesInternal will silently filter out files that are not supported.
+		// The walk will silently filter out files that are not supported.
 		// However, for a public function, when no file at all is optimized, this is
 		// considered as an error.
 		if( multiOptiInfo.optiCount == 0 && multiOptiInfo.errorCount == 0
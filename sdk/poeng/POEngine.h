@@ -11,6 +11,7 @@ using namespace chustd;
 
 #include "POEngineSettings.h"
 #include "POWorkerThread.h"
+#include "POFilePrefetcher.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // PNG optimizing engine class
@@ -46,6 +47,14 @@ public:
 
 	chustd::Event1<const ProgressingArg&> Progressing; // Fired during the optimization process
 
+	// Order in which OptimizeMultiFilesDisk handles the files
+	enum BatchOrder
+	{
+		BO_None, // Order of the walk, files are optimized while walking
+		BO_Name, // Sorted by path
+		BO_Size  // Biggest files first, so the small ones fill the gaps at the end
+	};
+
 	// General settings, freely accessible and used during optimization/conversion
 	POEngineSettings m_settings;
 
@@ -55,8 +64,8 @@ public:
 
 	struct OptiInfo
 	{
-		int sizeBefore;
-		int sizeAfter;
+		int64 sizeBefore;
+		int64 sizeAfter;
 
 		// Computed when inserting a clean version of the source file
 		PngSignature srcSignature;
@@ -87,6 +96,11 @@ public:
 
 	bool WarmUp();
 	void EnableUnicodeArrow();
+	void SetJobCount(int jobCount);
+	void SetBatchOrder(BatchOrder order);
+	void SetPrefetchBudget(int64 byteBudget);
+	void SetMemoryBudget(int64 byteBudget);
+	int64 EstimateWorkingSet(const chustd::String& filePath);
 
 	static chustd::Color ColorFromTextType(TextType tt, bool darkTheme = false);
 
@@ -111,19 +125,37 @@ private:
 
 	ResultManager m_resultmgr;
 
+	// Work buffers living no longer than the optimization of one image
+	MemoryArena m_arena;
+
 	// Last errors
 	StringArray m_astrErrors;
 	DateTime m_originalFileWriteTime;
 
-	POWorkerThread m_workerThreads[4];
+	Array<POTrial> m_trials;  // Registry of the trials performed on each image
+	Array<POTrial> m_runTrials; // m_trials with the engine settings they inherit, during PerformDumpTries
+	int            m_trialsEffort; // Effort level of m_trials
+	POTrialSet     m_trialSet; // Shared by the worker threads during PerformDumpTries
+	PtrArray<POWorkerThread> m_workerThreads;
 
 	bool m_unicodeArrowEnabled; // To have a nice arrow for ->
 
+	int m_jobCount; // Number of files optimized in parallel by OptimizeMultiFilesDisk
+	BatchOrder m_batchOrder; // Order of the files optimized by OptimizeMultiFilesDisk
+
+	int64 m_prefetchBudget;                // Memory for the files read in advance, 0 = no prefetch
+	POFilePrefetcher* m_pPrefetcher;       // Set during OptimizeMultiFilesDisk, shared with the jobs
+	DynamicMemoryFile* m_pPrefetchedFile;  // Content of the batch file being optimized, if read in advance
+	enum { k_prefetchFileCount = 8 };      // Files walked in advance by a serial batch when prefetching
+
+	int64 m_memoryBudget; // Memory for the images optimized at the same time by OptimizeMultiFilesDisk, 0 = no limit
+	bool  m_lowMemory;    // Set while optimizing an image too big for the memory budget
+
 	// Holds source information
 	struct SrcInfo
 	{
 		String filePath; // Input file to be optimized
-		int    fileSize; // Input file size
+		int64  fileSize; // Input file size
 
 		SrcInfo() : fileSize(0) {}
 	};
@@ -172,8 +204,24 @@ private:
 			sizeAfter = 0;
 		}
 	};
-	void OptimizeFilesInternal(const String& baseDir, const StringArray& filePaths, const String& displayDir,
-	                   const String& joker, MultiOptiInfo& optiInfo);
+	// A file to optimize, found when walking the paths given to OptimizeMultiFilesDisk
+	struct BatchFile
+	{
+		String filePath;
+		String displayDir;
+	};
+	class BatchWalker;
+	struct BatchResult;
+	struct BatchContext;
+	class BatchJob;
+
+	void OptimizeBatchFile(const BatchFile& batchFile, MultiOptiInfo& multiOptiInfo, int64 workingSet);
+	int64 GetBatchWorkingSet(const BatchFile& batchFile);
+	void OptimizeBatchFilesSerial(BatchWalker& walker, MultiOptiInfo& multiOptiInfo);
+	void OptimizeBatchFilesParallel(BatchWalker& walker, MultiOptiInfo& multiOptiInfo);
+	bool QueueBatchFile(const BatchFile& batchFile, BatchContext& context);
+	void ReportBatchResult(const BatchResult& result, MultiOptiInfo& multiOptiInfo);
+	static int BatchThreadProc(void* arg);
 
 	bool Optimize(PngDumpData& dd, const OptiTarget& target, OptiInfo&);
 	bool OptimizeFileStreamNoBackup(IFile& fileImage, const OptiTarget& target, OptiInfo&);
@@ -182,6 +230,8 @@ private:
 	bool OptimizePaletteMode(PngDumpData& dd);
 	bool Optimize24BitsMode(PngDumpData& dd);
 	bool Optimize32BitsMode(PngDumpData& dd);
+	bool OptimizeTrueColorsWithPalette(PngDumpData& dd, const Buffer& indexes, Palette& palTest,
+	                                   bool bTooMuchColors);
 	bool OptimizeGrayScale(PngDumpData& dd);
 	bool OptimizeGrayScaleAlpha(PngDumpData& dd);
 
@@ -203,7 +253,7 @@ private:
 
 	static void BgrToRgb(PngDumpData& dd);
 	static void BgraToRgba(PngDumpData& dd);
-	static bool Rgb16ToRgb24(PngDumpData& dd);
+	bool Rgb16ToRgb24(PngDumpData& dd);
 
 public:
 	// public for unit testing
@@ -211,12 +261,19 @@ public:
 private:
 	bool OptimizeAnimated(const ImageFormat& img, PngDumpData& dd, const OptiTarget& target, OptiInfo&);
 	bool PerformDumpTries(PngDumpData& ds);
+	bool PerformSingleDump(const PngDumpData& dd);
+	bool EstimateDumpSize(const PngDumpData& dd, int64& estimate);
+	void UpdateTrials();
+	int  GetThreadBudget() const;
+	int  GetWorkerThreadCount() const;
+	bool EnsureWorkerThreads();
 
 	static void UnpackPixelFrames(PngDumpData& dd);
 	static void PackPixelFrames(PngDumpData& dd);
 	static bool IsFileExtensionSupported(const String& ext, const String& joker="");
 
 	friend class POEngine_IsFileExtensionSupported_Test;
+	friend class POEngine_FindUnusedColorHardcoreMethod_Test;
 };
 
 #endif
@@ -33,6 +33,12 @@ static const char k_szKeepFrameControl[]       = "KeepFrameControl";
 static const char k_szForcedDelayNumerator[]   = "ForcedDelayNumerator";
 static const char k_szForcedDelayDenominator[] = "ForcedDelayDenominator";
 
+static const char k_szThreadCount[]            = "ThreadCount";
+static const char k_szDeflateBlockSize[]       = "DeflateBlockSize";
+static const char k_szEffort[]                 = "Effort";
+static const char k_szEffortFlagPrefix[]       = "O"; // -O1 .. -O7
+static const char k_szFastMode[]               = "FastMode";
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 POEngineSettings::POEngineSettings()
 {
@@ -53,6 +59,11 @@ POEngineSettings::POEngineSettings()
 	fctlOption = POChunk_Keep;
 	fctlDelayNum = 1;
 	fctlDelayDen = 10;
+
+	threadCount = 0;
+	deflateBlockSize = 0;
+	effort = 2;
+	fastMode = false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -130,6 +141,12 @@ void POEngineSettings::LoadFromIni(const MemIniFile& ini)
 
 	ini.GetInt(k_szForcedDelayNumerator, fctlDelayNum);
 	ini.GetInt(k_szForcedDelayDenominator, fctlDelayDen);
+
+	///////////////////////////////////////////
+	ini.GetInt(k_szThreadCount, threadCount);
+	ini.GetInt(k_szDeflateBlockSize, deflateBlockSize);
+	ini.GetInt(k_szEffort, effort);
+	ini.GetBool(k_szFastMode, fastMode);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -164,6 +181,11 @@ void POEngineSettings::SaveToIni(MemIniFile& ini) const
 	ini.SetInt(k_szKeepFrameControl, fctlOption);
 	ini.SetInt(k_szForcedDelayNumerator, fctlDelayNum);
 	ini.SetInt(k_szForcedDelayDenominator, fctlDelayDen);
+
+	ini.SetInt(k_szThreadCount, threadCount);
+	ini.SetInt(k_szDeflateBlockSize, deflateBlockSize);
+	ini.SetInt(k_szEffort, effort);
+	ini.SetBool(k_szFastMode, fastMode);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -243,6 +265,20 @@ void POEngineSettings::LoadFromArgv(const ArgvParser& ap)
 	fctlOption = GetChunkOption(ap, k_szKeepTextualData);
 	fctlDelayNum = ap.GetFlagInt(k_szForcedDelayNumerator);
 	fctlDelayDen = ap.GetFlagInt(k_szForcedDelayDenominator);
+
+	///////////////////////////////////////////
+	threadCount = ap.GetFlagInt(k_szThreadCount);
+	deflateBlockSize = ap.GetFlagInt(k_szDeflateBlockSize);
+
+	effort = 2;
+	for(int level = 1; level <= 7; ++level)
+	{
+		if( ap.HasFlag(k_szEffortFlagPrefix + String::FromInt(level)) )
+		{
+			effort = level;
+		}
+	}
+	fastMode = ap.HasFlag(k_szFastMode);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -265,6 +301,9 @@ void POEngineSettings::WriteArgvUsage(const String& indent)
 
 	Console::WriteLine(indent + "[-" + String(k_szKeepFrameControl) + "][:K|F]     [-" + String(k_szForcedDelayNumerator) + ":1] [-" 
 	                                                                                   + String(k_szForcedDelayDenominator) + ":30]");
+
+	Console::WriteLine(indent + "[-" + String(k_szThreadCount) + ":4] [-" + String(k_szDeflateBlockSize) + ":128]");
+	Console::WriteLine(indent + "[-" + String(k_szEffortFlagPrefix) + "1..-" + String(k_szEffortFlagPrefix) + "7] [-" + String(k_szFastMode) + "]");
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
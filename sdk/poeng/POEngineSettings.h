@@ -42,6 +42,11 @@ struct POEngineSettings
 	int            fctlDelayNum;
 	int            fctlDelayDen; // Seconds. If 0 then equals to 100
 
+	int            threadCount; // Threads performing the compression trials, 0 = one per processor
+	int            deflateBlockSize; // KiB. If not 0, deflate by blocks on several threads: faster but bigger
+	int            effort;           // [1..7] Number of compression trials on each image, default = 2
+	bool           fastMode;         // Skip the trials and layouts predicted to lose by a quick analysis of each image
+
 	POEngineSettings();
 	void LoadFromIni(const chustd::MemIniFile& ini);
 	void LoadFromArgv(const chustd::ArgvParser& ap);
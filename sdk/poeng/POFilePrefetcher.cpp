@@ -0,0 +1,258 @@
+/////////////////////////////////////////////////////////////////////////////////////
+// This file is part of the poeng library, part of the PngOptimizer application
+// Copyright (C) Hadrien Nilsson - psydk.org
+// This library is distributed under the terms of the GNU LESSER GENERAL PUBLIC LICENSE
+// See License.txt for the full license.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "POFilePrefetcher.h"
+
+/////////////////////////////////////////////////////////////////////////////////////
+POFilePrefetcher::POFilePrefetcher()
+{
+	m_byteBudget = 0;
+	m_bytesHeld = 0;
+	m_exit = false;
+	m_started = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+POFilePrefetcher::~POFilePrefetcher()
+{
+	Stop();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+int POFilePrefetcher::ThreadProcStatic(void* arg)
+{
+	POFilePrefetcher* that = (POFilePrefetcher*)arg;
+	return that->ThreadProc();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Reads a whole file in memory
+// [in] filePath  File to read
+// [in] fileSize  Expected size
+// Returns the content, or nullptr upon error
+DynamicMemoryFile* POFilePrefetcher::LoadFile(const String& filePath, int64 fileSize)
+{
+	File file;
+	if( !file.Open(filePath, File::modeRead) )
+	{
+		return nullptr;
+	}
+	const int size = static_cast<int>(fileSize);
+	DynamicMemoryFile* pContent = new DynamicMemoryFile;
+	if( !(pContent->Open(size) && pContent->WriteFromFile(file, size) == size && pContent->SetPosition(0)) )
+	{
+		delete pContent;
+		return nullptr;
+	}
+	return pContent;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Reads the files in the order they were added, waiting for room in the budget
+int POFilePrefetcher::ThreadProc()
+{
+	for(;;)
+	{
+		if( m_semWork.Wait() != 0 )
+		{
+			break;
+		}
+
+		// Find the first file not read yet
+		Entry* pEntry = nullptr;
+		String filePath;
+		{
+			TmpLock lock(m_cs);
+			if( m_exit )
+			{
+				break;
+			}
+			for(int i = 0; i < m_entries.GetSize(); ++i)
+			{
+				if( m_entries[i]->state == ES_Waiting )
+				{
+					pEntry = m_entries[i];
+					break;
+				}
+			}
+			if( pEntry == nullptr )
+			{
+				continue;
+			}
+			// String reference counting is not atomic, keep a private copy
+			filePath = String(pEntry->filePath.GetBuffer(), pEntry->filePath.GetLength());
+		}
+
+		const int64 fileSize = File::GetSize(filePath);
+		{
+			TmpLock lock(m_cs);
+			if( m_entries.Find(pEntry) < 0 || pEntry->state != ES_Waiting || pEntry->filePath != filePath )
+			{
+				// Taken in the meantime, look for the next one
+				m_semWork.Increment();
+				continue;
+			}
+			if( fileSize <= 0 || fileSize > m_byteBudget || fileSize > MAX_INT32 )
+			{
+				// The engine will read it by itself
+				pEntry->state = ES_Skipped;
+				m_semWork.Increment();
+				continue;
+			}
+			if( m_bytesHeld + fileSize > m_byteBudget )
+			{
+				// Wait for Take() to free some room
+				continue;
+			}
+			pEntry->state = ES_Loading;
+			pEntry->size = fileSize;
+			m_bytesHeld += fileSize;
+		}
+
+		DynamicMemoryFile* pContent = LoadFile(filePath, fileSize);
+		{
+			TmpLock lock(m_cs);
+			if( pContent )
+			{
+				pEntry->pContent = pContent;
+				pEntry->state = ES_Loaded;
+			}
+			else
+			{
+				m_bytesHeld -= pEntry->size;
+				pEntry->size = 0;
+				pEntry->state = ES_Skipped;
+			}
+			// Under the lock, as Take() deletes the entry once loaded
+			pEntry->semLoaded.Increment();
+		}
+		m_semWork.Increment();
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Starts the reading thread
+// [in] byteBudget  Maximum number of bytes held in memory by the files read in advance
+// Returns true upon success
+bool POFilePrefetcher::Start(int64 byteBudget)
+{
+	Stop();
+
+	m_byteBudget = byteBudget;
+	m_bytesHeld = 0;
+	m_exit = false;
+	if( !m_semWork.Create() )
+	{
+		return false;
+	}
+	if( !m_thread.Start(&ThreadProcStatic, this) )
+	{
+		m_semWork.Close();
+		return false;
+	}
+	m_started = true;
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Stops the reading thread and frees the files not taken
+void POFilePrefetcher::Stop()
+{
+	if( !m_started )
+	{
+		return;
+	}
+	{
+		TmpLock lock(m_cs);
+		m_exit = true;
+	}
+	m_semWork.Increment();
+	m_thread.WaitForExit();
+	m_semWork.Close();
+	m_entries.Clear();
+	m_started = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Adds a file to read in advance. Files must be added in the order they will be taken.
+// [in] filePath  File path
+void POFilePrefetcher::Add(const String& filePath)
+{
+	if( !m_started )
+	{
+		return;
+	}
+	Entry* pEntry = new Entry;
+	if( !pEntry->semLoaded.Create() )
+	{
+		delete pEntry;
+		return;
+	}
+	// String reference counting is not atomic, keep a private copy
+	pEntry->filePath = String(filePath.GetBuffer(), filePath.GetLength());
+	{
+		TmpLock lock(m_cs);
+		m_entries.Add(pEntry);
+	}
+	m_semWork.Increment();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Gets the content of a file added previously, waiting for it if it is being read.
+// The file is forgotten by the prefetcher after this call.
+// [in] filePath  File path, as given to Add()
+// Returns the content to be deleted by the caller, or nullptr if the file was not read
+// in advance
+DynamicMemoryFile* POFilePrefetcher::Take(const String& filePath)
+{
+	if( !m_started )
+	{
+		return nullptr;
+	}
+
+	Entry* pEntry = nullptr;
+	EntryState state;
+	{
+		TmpLock lock(m_cs);
+		for(int i = 0; i < m_entries.GetSize(); ++i)
+		{
+			if( m_entries[i]->filePath == filePath )
+			{
+				pEntry = m_entries[i];
+				break;
+			}
+		}
+		if( pEntry == nullptr )
+		{
+			return nullptr;
+		}
+		// The reading thread changes the state under the lock only
+		state = pEntry->state;
+		if( state == ES_Waiting || state == ES_Skipped )
+		{
+			m_entries.RemoveAt(m_entries.Find(pEntry));
+			return nullptr;
+		}
+	}
+
+	if( state == ES_Loading )
+	{
+		pEntry->semLoaded.Wait();
+	}
+
+	TmpLock lock(m_cs);
+	DynamicMemoryFile* pContent = pEntry->pContent;
+	pEntry->pContent = nullptr;
+	m_bytesHeld -= pEntry->size;
+	m_entries.RemoveAt(m_entries.Find(pEntry));
+
+	// Room for the next files
+	m_semWork.Increment();
+	return pContent;
+}
@@ -0,0 +1,61 @@
+/////////////////////////////////////////////////////////////////////////////////////
+// This file is part of the poeng library, part of the PngOptimizer application
+// Copyright (C) Hadrien Nilsson - psydk.org
+// This library is distributed under the terms of the GNU LESSER GENERAL PUBLIC LICENSE
+// See License.txt for the full license.
+/////////////////////////////////////////////////////////////////////////////////////
+#ifndef POENG_POFILEPREFETCHER_H
+#define POENG_POFILEPREFETCHER_H
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Reads the next files of a batch with a dedicated thread, so the engine finds them in memory
+// instead of waiting for the storage. Files are read in the order they are added, as long as
+// the bytes held stay within a budget. Add() and Take() can be called from several threads.
+class POFilePrefetcher
+{
+public:
+	bool Start(int64 byteBudget);
+	void Stop();
+	void Add(const String& filePath);
+	DynamicMemoryFile* Take(const String& filePath);
+
+	POFilePrefetcher();
+	~POFilePrefetcher();
+
+private:
+	enum EntryState
+	{
+		ES_Waiting, // Not read yet
+		ES_Loading, // Being read by the thread
+		ES_Loaded,  // Content available
+		ES_Skipped  // Too big or read error
+	};
+
+	struct Entry
+	{
+		String             filePath;  // Private copy
+		EntryState         state;
+		int64              size;      // Bytes counted in the budget
+		DynamicMemoryFile* pContent;  // Set when loaded
+		Semaphore          semLoaded; // Incremented when the state leaves ES_Loading
+
+		Entry() : state(ES_Waiting), size(0), pContent(nullptr) {}
+		~Entry() { delete pContent; }
+	};
+
+	Thread          m_thread;
+	Semaphore       m_semWork;    // Incremented when there may be something to read
+	CriticalSection m_cs;
+	PtrArray<Entry> m_entries;    // Protected by m_cs, in the order of use
+	int64           m_byteBudget;
+	int64           m_bytesHeld;  // Protected by m_cs
+	bool            m_exit;       // Protected by m_cs
+	bool            m_started;
+
+private:
+	static int ThreadProcStatic(void*);
+	int ThreadProc();
+	static DynamicMemoryFile* LoadFile(const String& filePath, int64 fileSize);
+};
+
+#endif
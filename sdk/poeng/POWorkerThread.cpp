@@ -8,13 +8,517 @@
 #include "stdafx.h"
 #include "POWorkerThread.h"
 
+/////////////////////////////////////////////////////////////////////////////////////
+POTrial::POTrial()
+{
+	zlibCompressionLevel = 9;
+	zlibStrategy = PngDumpSettings::zlibStrategyDefault;
+	zlibWindowBitsAndMem = PngDumpSettings::zlibWindowBitsAndMemHigh;
+	filtering = 0;
+	minBitsPerPixel = 0;
+	maxBitsPerPixel = 0;
+	deflateBlockSize = 0;
+	deflateThreadCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Checks if the trial can give a result for an image
+bool POTrial::IsApplicable(PixelFormat pixelFormat) const
+{
+	const int32 bitsPerPixel = ImageFormat::SizeofPixelInBits(pixelFormat);
+	if( minBitsPerPixel != 0 && bitsPerPixel < minBitsPerPixel )
+	{
+		return false;
+	}
+	if( maxBitsPerPixel != 0 && bitsPerPixel > maxBitsPerPixel )
+	{
+		return false;
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Checks if two trials give the same result on any image
+bool POTrial::IsSameAs(const POTrial& trial) const
+{
+	return zlibCompressionLevel == trial.zlibCompressionLevel
+		&& zlibStrategy == trial.zlibStrategy
+		&& zlibWindowBitsAndMem == trial.zlibWindowBitsAndMem
+		&& filtering == trial.filtering
+		&& minBitsPerPixel == trial.minBitsPerPixel
+		&& maxBitsPerPixel == trial.maxBitsPerPixel
+		&& deflateBlockSize == trial.deflateBlockSize;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Gets the PngDumper settings to use for this trial
+PngDumpSettings POTrial::GetDumpSettings() const
+{
+	PngDumpSettings ds;
+	ds.zlibCompressionLevel = zlibCompressionLevel;
+	ds.zlibStrategy = zlibStrategy;
+	ds.zlibWindowBitsAndMem = zlibWindowBitsAndMem;
+	ds.filtering = filtering;
+	ds.deflateBlockSize = Math::Max(deflateBlockSize, int32(0));
+	ds.deflateThreadCount = Math::Max(deflateThreadCount, int32(1));
+	return ds;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Fills the deflate settings left unset by the trial
+// [in] blockSize    See PngDumpSettings::deflateBlockSize
+// [in] threadCount  See PngDumpSettings::deflateThreadCount
+void POTrial::InheritDeflateSettings(int32 blockSize, int32 threadCount)
+{
+	if( deflateBlockSize == 0 )
+	{
+		deflateBlockSize = (blockSize > 0) ? blockSize : -1;
+	}
+	if( deflateThreadCount == 0 )
+	{
+		deflateThreadCount = threadCount;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Gets the trials performed by default on each image.
+// When two trials give the same size, the first one in the list wins.
+// [out] trials  Registry of trials
+void POTrial::GetDefaultTrials(Array<POTrial>& trials)
+{
+	trials.Clear();
+
+	// Test 1
+	// - No filtering
+	// - ZLib default strategy
+	// - ZLib normal memory load
+	POTrial trial;
+	trial.filtering = 0;
+	trial.zlibStrategy = PngDumpSettings::zlibStrategyDefault;
+	trial.zlibWindowBitsAndMem = PngDumpSettings::zlibWindowBitsAndMemHigh;
+	trials.Add(trial);
+
+	// Test 2, this can work for low bits per pixel
+	// - No filtering
+	// - ZLib default strategy
+	// - ZLib low memory load (yes, sometimes it can increase compression ! I don't know why... ZLib master, anyone ?
+	trial.zlibWindowBitsAndMem = PngDumpSettings::zlibWindowBitsAndMemLow;
+	trial.maxBitsPerPixel = 8;
+	trials.Add(trial);
+
+	// Test 3
+	// - Filtering
+	// - ZLib filter strategy
+	// - ZLib normal memory load
+	trial.filtering = 1;
+	trial.zlibStrategy = PngDumpSettings::zlibStrategyFilter;
+	trial.zlibWindowBitsAndMem = PngDumpSettings::zlibWindowBitsAndMemHigh;
+	trial.maxBitsPerPixel = 0;
+	trials.Add(trial);
+
+	// Test 4
+	// - Filtering
+	// - ZLib default strategy
+	// - ZLib normal memory load
+	trial.zlibStrategy = PngDumpSettings::zlibStrategyDefault;
+	trials.Add(trial);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Settings combined by the effort levels above the default one.
+// Bit i of a mask selects the value i of the matching list.
+struct POEffortMatrix
+{
+	uint8 filterings;        // PngDumpSettings::FilteringOption
+	uint8 strategies;        // k_effortStrategies
+	uint8 windowBitsAndMems; // k_effortWindowBitsAndMems
+};
+
+static const uint8 k_effortStrategies[] =
+{
+	PngDumpSettings::zlibStrategyDefault,
+	PngDumpSettings::zlibStrategyFilter,
+	PngDumpSettings::zlibStrategyRle,
+	PngDumpSettings::zlibStrategyHuffmanOnly
+};
+
+static const uint8 k_effortWindowBitsAndMems[] =
+{
+	PngDumpSettings::zlibWindowBitsAndMemHigh,
+	PngDumpSettings::zlibWindowBitsAndMemLow,
+	PngDumpSettings::zlibWindowBitsAndMemMax
+};
+
+static const POEffortMatrix k_effortMatrices[POTrial::EffortMax - POTrial::EffortDefault] =
+{
+	// No Paeth: the adaptive filtering gives the same scanlines, see PngDumper::FilterBlock
+	{ 0x1f, 0x01, 0x01 }, // 3: All filters
+	{ 0x1f, 0x03, 0x01 }, // 4: All filters, default and filtered strategies
+	{ 0x1f, 0x07, 0x01 }, // 5: + RLE strategy
+	{ 0x1f, 0x0f, 0x03 }, // 6: + Huffman only strategy, low memory
+	{ 0x1f, 0x0f, 0x07 }  // 7: + Maximum memory
+};
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Gets the trials performed on each image for an effort level.
+// Each level performs the trials of the level below, plus some more.
+//  1: One trial, the filtering depending on the bits per pixel
+//  2: The default trials, see GetDefaultTrials
+//  3 to 7: The default trials plus a growing matrix of filters, zlib strategies
+//          and zlib memory settings, up to 60 trials
+//  7: Also the optimal parsing encoder, without filtering and with adaptive filtering
+//
+// The filterings give only five different scanlines: the adaptive filtering uses Paeth on
+// every row. Levels 4 to 6 deflate those same scanlines with more zlib settings.
+//
+// Measured on PngSuite, the gtk icons, the unit test images and some system icons (271 files)
+// with one thread, size and median time of 5 runs compared to the default level:
+//  1: +15.6%, x0.40    3: -0.1%, x2.0    5: -0.2%, x3.4    7: -1.1%, x20
+//  2:      0%, x1      4: -0.1%, x3.3    6: -0.3%, x7.1
+// The runs of a level vary by 10 to 30%, levels 4 and 5 cost the same.
+// [in]  effort  Effort level, clamped to [EffortMin..EffortMax]
+// [out] trials  Registry of trials
+void POTrial::GetEffortTrials(int effort, Array<POTrial>& trials)
+{
+	effort = Math::Max(Math::Min(effort, int(EffortMax)), int(EffortMin));
+	if( effort == EffortMin )
+	{
+		trials.Clear();
+
+		// Filtering rarely helps low depths and palettes
+		POTrial trial;
+		trial.filtering = PngDumpSettings::filteringNone;
+		trial.maxBitsPerPixel = 8;
+		trials.Add(trial);
+
+		trial.filtering = PngDumpSettings::filteringAdaptive;
+		trial.minBitsPerPixel = 9;
+		trial.maxBitsPerPixel = 0;
+		trials.Add(trial);
+		return;
+	}
+
+	GetDefaultTrials(trials);
+	if( effort == EffortDefault )
+	{
+		return;
+	}
+
+	// Cheap settings first, so the trials that follow can be stopped early
+	const POEffortMatrix& matrix = k_effortMatrices[effort - EffortDefault - 1];
+	for(int iMem = 0; iMem < int(sizeof(k_effortWindowBitsAndMems)); ++iMem)
+	{
+		if( (matrix.windowBitsAndMems & (1 << iMem)) == 0 )
+		{
+			continue;
+		}
+		for(int iStrategy = 0; iStrategy < int(sizeof(k_effortStrategies)); ++iStrategy)
+		{
+			if( (matrix.strategies & (1 << iStrategy)) == 0 )
+			{
+				continue;
+			}
+			for(int filtering = 0; filtering < PngDumpSettings::filteringCount; ++filtering)
+			{
+				if( (matrix.filterings & (1 << filtering)) == 0 )
+				{
+					continue;
+				}
+				POTrial trial;
+				trial.filtering = uint8(filtering);
+				trial.zlibStrategy = k_effortStrategies[iStrategy];
+				trial.zlibWindowBitsAndMem = k_effortWindowBitsAndMems[iMem];
+
+				bool found = false;
+				for(int i = 0; i < trials.GetSize() && !found; ++i)
+				{
+					found = trials[i].IsSameAs(trial);
+				}
+				if( !found )
+				{
+					trials.Add(trial);
+				}
+			}
+		}
+	}
+
+	if( effort == EffortMax )
+	{
+		// Very slow, so last: most of the time it can stop as soon as it loses
+		POTrial trial;
+		trial.zlibStrategy = PngDumpSettings::zlibStrategyOptimal;
+		trial.filtering = PngDumpSettings::filteringNone;
+		trial.maxBitsPerPixel = 8;
+		trials.Add(trial);
+
+		trial.filtering = PngDumpSettings::filteringAdaptive;
+		trial.maxBitsPerPixel = 0;
+		trials.Add(trial);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Gets the size of the pixels of an image, the size of its scanlines give or take a byte a row
+static int64 GetPixelBytes(const PngDumpData& dd)
+{
+	return int64(dd.width) * dd.height * ImageFormat::SizeofPixelInBits(dd.pixelFormat) / 8;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+POTrialSet::POTrialSet()
+{
+	m_pPdd = nullptr;
+	m_pTrials = nullptr;
+	m_trialCount = 0;
+	m_nextTrial = 0;
+	m_sizeBound = MAX_INT64;
+	m_maxSharedSize = 64 * 1024 * 1024;
+	m_streamed = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Sets the size above which the scanlines of an image are not shared by the trials,
+// to be called before Init()
+// [in] maxSharedSize  Size of the image pixels, in bytes
+void POTrialSet::SetMaxSharedSize(int64 maxSharedSize)
+{
+	m_maxSharedSize = maxSharedSize;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Prepares a new set of trials, to be called before starting the workers
+// [in] pPdd        Image to work on
+// [in] pTrials     Trials to perform
+// [in] trialCount  Number of trials
+// [in] sizeBound   Size of a result already known, trials giving bigger files are stopped
+void POTrialSet::Init(const PngDumpData* pPdd, const POTrial* pTrials, int trialCount, int64 sizeBound)
+{
+	m_pPdd = pPdd;
+	m_pTrials = pTrials;
+	m_trialCount = trialCount;
+	m_nextTrial = 0;
+	m_sizeBound = sizeBound;
+
+	// Interlaced images have their scanlines built by each trial anyway, sharing them is better
+	m_streamed = !pPdd->interlaced && GetPixelBytes(*pPdd) > m_maxSharedSize;
+
+	m_skipped.SetSize(trialCount);
+	for(int i = 0; i < m_skipped.GetSize(); ++i)
+	{
+		m_skipped[i] = false;
+	}
+
+	// One slot for each filtering mode used by the trials
+	int slotCount = 0;
+	for(int i = 0; i < trialCount; ++i)
+	{
+		slotCount = Math::Max(slotCount, pTrials[i].filtering + 1);
+	}
+	while( m_scanlines.GetSize() < slotCount )
+	{
+		m_scanlines.Add(new SharedScanlines);
+	}
+	Clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Frees the shared scanlines, to be called when the workers are done
+void POTrialSet::Clear()
+{
+	for(int i = 0; i < m_scanlines.GetSize(); ++i)
+	{
+		SharedScanlines* pShared = m_scanlines[i];
+		pShared->prepared = false;
+		pShared->success = false;
+		pShared->scanlines.Clear();
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Skips the trials predicted to lose, to be called after Init() and before starting the workers.
+// The scanlines of each filtering are prepared and their compressed size is estimated. The
+// trials of the filterings estimated clearly bigger than the best one are skipped. When all
+// the estimates are close, nothing is skipped.
+//
+// Measured on PngSuite, the gtk icons, the unit test images and some system icons (271 files)
+// with the default trials and one thread: x1.7 faster, +0.06% total size, +18% on the worst
+// file, a 7 KB icon.
+//
+// Returns false upon memory error
+bool POTrialSet::Prune()
+{
+	// Small images are quick to compress anyway, and their estimates are less reliable
+	const int64 minPixelBytes = 16 * 1024;
+	if( GetPixelBytes(*m_pPdd) < minPixelBytes )
+	{
+		return true;
+	}
+
+	// The estimates need the scanlines of each filtering, not kept for big images
+	if( m_streamed )
+	{
+		return true;
+	}
+
+	int64 estimates[PngDumpSettings::filteringCount];
+	for(int i = 0; i < PngDumpSettings::filteringCount; ++i)
+	{
+		estimates[i] = -1;
+	}
+
+	int usedCount = 0;
+	for(int i = 0; i < m_trialCount; ++i)
+	{
+		const POTrial& trial = m_pTrials[i];
+		if( trial.IsApplicable(m_pPdd->pixelFormat) && estimates[trial.filtering] < 0 )
+		{
+			estimates[trial.filtering] = 0;
+			usedCount++;
+		}
+	}
+	if( usedCount < 2 )
+	{
+		return true;
+	}
+
+	int64 bestEstimate = MAX_INT64;
+	for(int filtering = 0; filtering < PngDumpSettings::filteringCount; ++filtering)
+	{
+		if( estimates[filtering] < 0 )
+		{
+			continue;
+		}
+		const PngScanlines* pScanlines = GetScanlines(uint8(filtering));
+		if( pScanlines == nullptr )
+		{
+			return false;
+		}
+		estimates[filtering] = PngDumper::EstimateCompressedSize(*pScanlines);
+		if( estimates[filtering] < 0 )
+		{
+			return false;
+		}
+		if( estimates[filtering] < bestEstimate )
+		{
+			bestEstimate = estimates[filtering];
+		}
+	}
+
+	// The estimates are within 10% of the real sizes, so only a big enough gap is trusted
+	const int64 maxEstimate = bestEstimate + bestEstimate / 10;
+	for(int filtering = 0; filtering < PngDumpSettings::filteringCount; ++filtering)
+	{
+		if( estimates[filtering] <= maxEstimate )
+		{
+			continue;
+		}
+		for(int i = 0; i < m_trialCount; ++i)
+		{
+			if( m_pTrials[i].filtering == filtering )
+			{
+				m_skipped[i] = true;
+			}
+		}
+		// Not needed anymore
+		SharedScanlines* pShared = m_scanlines[filtering];
+		pShared->prepared = false;
+		pShared->success = false;
+		pShared->scanlines.Clear();
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Checks if a trial filters the rows by bands while compressing them, rather than
+// compressing scanlines shared with the other trials. This is done for big images, so the
+// memory used does not depend on their height. The optimal encoder and the compression by
+// blocks need whole scanlines, see PngDumper::WriteImageData.
+// [in] trial  Trial of the set
+bool POTrialSet::IsStreamed(const POTrial& trial) const
+{
+	return m_streamed && trial.zlibStrategy != PngDumpSettings::zlibStrategyOptimal
+	    && trial.deflateBlockSize <= 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Gets the scanlines of the image for a filtering mode. The first caller filters the image,
+// other callers wait for it and share the result.
+// [in] filtering  Filtering mode, see PngDumpSettings::filtering
+// Returns the scanlines, or nullptr upon error
+const PngScanlines* POTrialSet::GetScanlines(uint8 filtering)
+{
+	if( filtering >= m_scanlines.GetSize() )
+	{
+		return nullptr;
+	}
+	SharedScanlines* pShared = m_scanlines[filtering];
+
+	TmpLock lock(pShared->cs);
+	if( !pShared->prepared )
+	{
+		pShared->success = PngDumper::PrepareScanlines(*m_pPdd, filtering, pShared->scanlines);
+		pShared->prepared = true;
+	}
+	if( !pShared->success )
+	{
+		return nullptr;
+	}
+	return &pShared->scanlines;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Takes the next trial to perform
+// [out] trialIndex  Index of the trial
+// Returns false if all the trials are already taken
+bool POTrialSet::TakeNext(int& trialIndex)
+{
+	TmpLock lock(m_cs);
+	while( m_nextTrial < m_trialCount && m_skipped[m_nextTrial] )
+	{
+		m_nextTrial++;
+	}
+	if( m_nextTrial >= m_trialCount )
+	{
+		return false;
+	}
+	trialIndex = m_nextTrial++;
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Lowers the size bound after a trial completed
+// [in] size  Size of the result
+void POTrialSet::ReportSize(int64 size)
+{
+	TmpLock lock(m_cs);
+	if( size < m_sizeBound )
+	{
+		m_sizeBound = size;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Checks if a trial cannot give the smallest result anymore.
+// A trial giving the same size as the bound is not stopped: it may come first in the
+// registry and win the tie.
+// [in] size  Lower bound of the final size of the trial result
+// Returns true if the trial should stop
+bool POTrialSet::IsSizeExceeded(int64 size)
+{
+	TmpLock lock(m_cs);
+	return size > m_sizeBound;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
 POWorkerThread::POWorkerThread()
 {
-	m_jobType = -1;
+	m_working = false;
 	m_success = false;
 	m_created = false;
-	m_pPdd = nullptr;
+	m_resultSlot = 0;
+	m_resultTrial = -1;
+	m_pTrialSet = nullptr;
+	m_sizeLimitExceeded = false;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
@@ -31,79 +535,74 @@ int POWorkerThread::ThreadProcStatic(void* arg)
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
-bool POWorkerThread::DoJob()
+// Called by PngDumper while compressing, possibly from several threads
+bool POWorkerThread::IsExceeded(int64 size)
 {
-	const PngDumpData& dd = *m_pPdd;
+	if( !m_pTrialSet->IsSizeExceeded(size) )
+	{
+		return false;
+	}
+	m_sizeLimitExceeded = true;
+	return true;
+}
 
-	PngDumpSettings ds;
-	ds.zlibCompressionLevel = 9;
+/////////////////////////////////////////////////////////////////////////////////////
+// Performs trials until the trial set is exhausted, keeping the smallest result
+bool POWorkerThread::DoJob()
+{
+	const PngDumpData& dd = m_pTrialSet->GetDumpData();
 
-	if( m_jobType == 0 )
+	int trialIndex = 0;
+	while( m_pTrialSet->TakeNext(trialIndex) )
 	{
-		// Test 1
-		// - No filtering
-		// - ZLib default strategy
-		// - ZLib normal memory load
-		ds.filtering = 0;
-		ds.zlibStrategy = PngDumpSettings::zlibStrategyDefault;
-		ds.zlibWindowBitsAndMem = 0;
+		const POTrial& trial = m_pTrialSet->GetTrial(trialIndex);
+		if( !trial.IsApplicable(dd.pixelFormat) )
+		{
+			continue;
+		}
+
+		PngDumpSettings ds = trial.GetDumpSettings();
+		ds.pSizeLimit = this;
+		ds.pContext = &m_dumpContext;
+		m_sizeLimitExceeded = false;
+
+		DynamicMemoryFile& dmf = m_dmfs[1 - m_resultSlot];
+		dmf.SetPosition(0);
 
-		if( !PngDumper::Dump(m_dmf, *m_pPdd, ds) )
+		bool dumped = false;
+		if( m_pTrialSet->IsStreamed(trial) )
 		{
-			return false;
+			dumped = PngDumper::Dump(dmf, dd, ds);
 		}
-	}
-	else if( m_jobType == 1 )
-	{
-		// This can work for low bits per pixel
-		int bitsPerPix = ImageFormat::SizeofPixelInBits(dd.pixelFormat);
-		if( bitsPerPix <= 8 )
+		else
 		{
-			// Test 2
-			// - No filtering
-			// - ZLib default strategy
-			// - ZLib low memory load (yes, sometimes it can increase compression ! I don't know why... ZLib master, anyone ?
-			ds.filtering = 0;
-			ds.zlibStrategy = PngDumpSettings::zlibStrategyDefault;
-			ds.zlibWindowBitsAndMem = PngDumpSettings::zlibWindowBitsAndMemLow;
-			if( !PngDumper::Dump(m_dmf, dd, ds) )
+			const PngScanlines* pScanlines = m_pTrialSet->GetScanlines(trial.filtering);
+			if( pScanlines == nullptr )
 			{
 				return false;
 			}
+			dumped = PngDumper::Dump(dmf, dd, ds, *pScanlines);
 		}
-	}
-	else if( m_jobType == 2 )
-	{
-		// Test 3
-		// - Filtering
-		// - ZLib filter strategy
-		// - ZLib normal memory load
-		ds.filtering = 1;
-		ds.zlibStrategy = PngDumpSettings::zlibStrategyFilter;
-		ds.zlibWindowBitsAndMem = 0;
-		if( !PngDumper::Dump(m_dmf, dd, ds) )
+		if( !dumped )
 		{
+			if( m_sizeLimitExceeded )
+			{
+				// Already bigger than another result, this trial cannot win
+				continue;
+			}
 			return false;
 		}
-	}
-	else if( m_jobType == 3 )
-	{
-		// Test 4
-		// - Filtering
-		// - ZLib default strategy
-		// - ZLib normal memory load
-		ds.filtering = 1;
-		ds.zlibStrategy = PngDumpSettings::zlibStrategyDefault;
-		ds.zlibWindowBitsAndMem = 0;
-		if( !PngDumper::Dump(m_dmf, dd, ds) )
+
+		// Trials are taken in increasing order, so on equal sizes the kept result
+		// comes from the first trial
+		int64 size = dmf.GetPosition();
+		m_pTrialSet->ReportSize(size);
+		if( m_resultTrial < 0 || size < m_dmfs[m_resultSlot].GetPosition() )
 		{
-			return false;
+			m_resultSlot = 1 - m_resultSlot;
+			m_resultTrial = trialIndex;
 		}
 	}
-	else
-	{
-		return false;
-	}
 	return true;
 }
 
@@ -117,7 +616,7 @@ int POWorkerThread::ThreadProc()
 			break;
 		}
 		// Perform job
-		if( m_jobType < 0 )
+		if( m_pTrialSet == nullptr )
 		{
 			// Exit requested
 			break;
@@ -134,7 +633,8 @@ int POWorkerThread::ThreadProc()
 bool POWorkerThread::Create()
 {
 	const int firstAlloc = 256 * 1024 - 64;
-	m_dmf.Open(firstAlloc);
+	m_dmfs[0].Open(firstAlloc);
+	m_dmfs[1].Open(firstAlloc);
 	if( !m_semBegin.Create() )
 	{
 		return false;
@@ -153,23 +653,23 @@ bool POWorkerThread::Create()
 
 /////////////////////////////////////////////////////////////////////////////////////
 // Begins working. Creates the worker if Create() was not previously called.
-// [in] jobType   Kind of job to do. [0..3]
-// [in] pPds      Input image to work on
+// [in] pTrialSet  Trials to perform, shared with other workers
 // Returns true upon success. If success, a call to Wait() will be needed to get the result.
-bool POWorkerThread::Begin(int jobType, const PngDumpData* pPds)
+bool POWorkerThread::Begin(POTrialSet* pTrialSet)
 {
 	if( !m_created && !Create() )
 	{
 		return false;
 	}
-	if( !(0 <= jobType && jobType <= 3) )
+	if( pTrialSet == nullptr )
 	{
 		return false;
 	}
-	m_pPdd = pPds;
-	m_jobType = jobType;
+	m_pTrialSet = pTrialSet;
+	m_working = true;
 	m_success = false;
-	m_dmf.SetPosition(0);
+	m_resultTrial = -1;
+	m_dmfs[m_resultSlot].SetPosition(0);
 	m_semBegin.Increment();
 	return true;
 }
@@ -179,13 +679,13 @@ bool POWorkerThread::Begin(int jobType, const PngDumpData* pPds)
 /////////////////////////////////////////////////////////////////////////////////////
 void POWorkerThread::Wait()
 {
-	if( m_jobType < 0 )
+	if( !m_working )
 	{
 		return;
 	}
 	m_semWait.Wait();
-	m_jobType = -1;
-	m_pPdd = nullptr;
+	m_working = false;
+	m_pTrialSet = nullptr;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
@@ -197,8 +697,7 @@ void POWorkerThread::Exit()
 	{
 		return;
 	}
-	m_pPdd = nullptr;
-	m_jobType = -1; // Ask for exit
+	m_pTrialSet = nullptr; // Ask for exit
 	m_success = false;
 	m_semBegin.Increment();
 	m_thread.WaitForExit();
@@ -214,8 +713,16 @@ bool POWorkerThread::Succeeded() const
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
-// Gets the job product: an optimized PNG in a memory buffer.
+// Gets the job product: the smallest optimized PNG in a memory buffer.
+// The position is 0 if no trial could give a result.
 DynamicMemoryFile& POWorkerThread::GetResult()
 {
-	return m_dmf;
+	return m_dmfs[m_resultSlot];
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Gets the index of the trial that gave the result, -1 if none
+int POWorkerThread::GetResultTrial() const
+{
+	return m_resultTrial;
 }
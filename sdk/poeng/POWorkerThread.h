@@ -7,16 +7,96 @@
 #ifndef POENG_POWORKERTHREAD_H
 #define POENG_POWORKERTHREAD_H
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Describes a compression trial: one set of dump settings to test on an image.
+// The engine keeps the smallest result of all its trials.
+struct POTrial
+{
+	uint8 zlibCompressionLevel; // [1..9]
+	uint8 zlibStrategy;         // PngDumpSettings::ZLibOption
+	uint8 zlibWindowBitsAndMem; // PngDumpSettings::ZLibOption
+	uint8 filtering;            // See PngDumpSettings::filtering
+	uint8 minBitsPerPixel;      // The trial is skipped for images with less bits per pixel, 0 = no limit
+	uint8 maxBitsPerPixel;      // The trial is skipped for images with more bits per pixel, 0 = no limit
+	int32 deflateBlockSize;     // See PngDumpSettings::deflateBlockSize. 0 = engine setting, -1 = no blocks
+	int32 deflateThreadCount;   // See PngDumpSettings::deflateThreadCount, 0 = engine share. Does not change the result
+
+	// Effort levels, from one trial per image to the whole matrix of settings
+	enum
+	{
+		EffortMin = 1,
+		EffortDefault = 2,
+		EffortMax = 7
+	};
+
+	POTrial();
+	bool IsApplicable(PixelFormat pixelFormat) const;
+	bool IsSameAs(const POTrial& trial) const;
+	PngDumpSettings GetDumpSettings() const;
+	void InheritDeflateSettings(int32 blockSize, int32 threadCount);
+
+	static void GetDefaultTrials(Array<POTrial>& trials);
+	static void GetEffortTrials(int effort, Array<POTrial>& trials);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Trials to perform on a same image, shared by several worker threads.
+// Each worker takes the next trial not yet performed until there is no more.
+// The smallest size found so far is shared too, so losing trials can stop early.
+class POTrialSet
+{
+public:
+	void Init(const PngDumpData* pPdd, const POTrial* pTrials, int trialCount, int64 sizeBound);
+	void Clear();
+	bool Prune();
+	bool TakeNext(int& trialIndex);
+	bool IsStreamed(const POTrial& trial) const;
+	const PngScanlines* GetScanlines(uint8 filtering);
+	void SetMaxSharedSize(int64 maxSharedSize);
+
+	void ReportSize(int64 size);
+	bool IsSizeExceeded(int64 size);
+
+	const PngDumpData& GetDumpData() const { return *m_pPdd; }
+	const POTrial& GetTrial(int trialIndex) const { return m_pTrials[trialIndex]; }
+
+	POTrialSet();
+
+private:
+	// Scanlines filtered once and shared by all the trials using the same filtering
+	struct SharedScanlines
+	{
+		CriticalSection cs;
+		bool            prepared; // Protected by cs
+		bool            success;  // Protected by cs
+		PngScanlines    scanlines;
+
+		SharedScanlines() : prepared(false), success(false) {}
+	};
+
+	CriticalSection    m_cs;
+	const PngDumpData* m_pPdd;
+	const POTrial*     m_pTrials;
+	int                m_trialCount;
+	int                m_nextTrial; // Protected by m_cs
+	Array<bool>        m_skipped;   // Trials removed by Prune()
+	int64              m_sizeBound; // Protected by m_cs, smallest result size known
+	int64              m_maxSharedSize; // Bigger images have their rows filtered by each trial
+	bool               m_streamed;  // The image is bigger than m_maxSharedSize
+	PtrArray<SharedScanlines> m_scanlines; // Indexed by filtering mode
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Use to perform a threaded asynchronous optimization.
-class POWorkerThread
+class POWorkerThread : private PngDumpSizeLimit
 {
 public:
 	bool Create();
-	bool Begin(int jobType, const PngDumpData* pPdd);
+	bool Begin(POTrialSet* pTrialSet);
 	void Wait();
 	bool Succeeded() const;
 	DynamicMemoryFile& GetResult();
+	int GetResultTrial() const;
 
 	POWorkerThread();
 	~POWorkerThread();
@@ -25,12 +105,17 @@ private:
 	Thread    m_thread;        // The thread that works and waits for a command
 	Semaphore m_semBegin;      // Incremented by the caller to notify the thread that it needs to work
 	Semaphore m_semWait;       // Incremented by the thread to notify it finished working
-	int  m_jobType;            // Parameter for the thread (type of optimization)
+	bool m_working;            // true between Begin() and Wait()
 	bool m_success;            // Work status when the thread finished
 	bool m_created;            // true if Create() was called
-	DynamicMemoryFile m_dmf;   // Work result buffer
-	const PngDumpData* m_pPdd; // Parameter for the thread (image data)
+	DynamicMemoryFile m_dmfs[2]; // Work buffers: the best result so far and the current trial
+	int  m_resultSlot;         // Index in m_dmfs of the best result
+	int  m_resultTrial;        // Index of the trial that gave the best result, -1 if none
+	POTrialSet* m_pTrialSet;   // Parameter for the thread (trials and image data)
+	bool m_sizeLimitExceeded;  // true if the current trial was stopped by the size limit
+	PngDumpContext m_dumpContext; // Compression state reused from one trial to the next
 private:
+	virtual bool IsExceeded(int64 size);
 	static int ThreadProcStatic(void*);
 	int ThreadProc();
 	bool DoJob();
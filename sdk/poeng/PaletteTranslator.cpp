@@ -344,6 +344,18 @@ PaletteTranslator PaletteTranslator::Combine(const PaletteTranslator& pt0, const
 	return result;
 }
 
+// Builds the translator that undoes a palette reorganization
+// pt : Translator to undo, must not merge colors
+PaletteTranslator PaletteTranslator::Invert(const PaletteTranslator& pt)
+{
+	PaletteTranslator result;
+	for(int i = 0; i < 256; ++i)
+	{
+		result.conv[ pt.conv[i] ] = uint8(i);
+	}
+	return result;
+}
+
 // Update color count according to this translator
 void PaletteTranslator::UpdateCounts(uint32* pCounts) const
 {
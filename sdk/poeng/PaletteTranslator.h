@@ -29,6 +29,7 @@ struct PaletteTranslator
 	void BuildGreyscale(const Palette& pal);
 
 	static PaletteTranslator Combine(const PaletteTranslator& pt0, const PaletteTranslator& pt1);
+	static PaletteTranslator Invert(const PaletteTranslator& pt);
 
 private:
 	// Update color count according to this translator
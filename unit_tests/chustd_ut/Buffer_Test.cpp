@@ -115,3 +115,54 @@ TEST(Buffer, AssignmentOperator)
 	ASSERT_TRUE(p1[1] == 'y');
 }
 
+
+TEST(Buffer, Move)
+{
+	Buffer buf1;
+	ASSERT_TRUE(buf1.SetSize(2));
+	uint8* p1 = buf1.GetWritePtr();
+	p1[0] = 'x';
+	p1[1] = 'y';
+
+	// Move construction
+	Buffer buf2(static_cast<Buffer&&>(buf1));
+	ASSERT_TRUE(buf1.GetReadPtr() == nullptr);
+	ASSERT_EQ(0, buf1.GetSize());
+	ASSERT_EQ(2, buf2.GetSize());
+
+	// Not shared, so writing does not copy
+	ASSERT_TRUE(buf2.GetWritePtr() == p1);
+
+	// Move assignment
+	Buffer buf3;
+	ASSERT_TRUE(buf3.SetSize(5));
+	buf3 = static_cast<Buffer&&>(buf2);
+	ASSERT_TRUE(buf2.GetReadPtr() == nullptr);
+	ASSERT_EQ(2, buf3.GetSize());
+	ASSERT_TRUE(buf3.GetWritePtr() == p1);
+	ASSERT_TRUE(p1[0] == 'x');
+	ASSERT_TRUE(p1[1] == 'y');
+}
+
+TEST(Buffer, Swap)
+{
+	Buffer buf1;
+	ASSERT_TRUE(buf1.SetSize(2));
+	const uint8* p1 = buf1.GetReadPtr();
+
+	Buffer buf2;
+	buf1.Swap(buf2);
+	ASSERT_TRUE(buf1.GetReadPtr() == nullptr);
+	ASSERT_TRUE(buf2.GetReadPtr() == p1);
+	ASSERT_EQ(2, buf2.GetSize());
+
+	// A shared content stays shared with the same buffers
+	Buffer buf3 = buf2;
+	Buffer buf4;
+	ASSERT_TRUE(buf4.SetSize(7));
+	buf3.Swap(buf4);
+	ASSERT_EQ(7, buf3.GetSize());
+	ASSERT_TRUE(buf4.GetReadPtr() == p1);
+	ASSERT_TRUE(buf4.GetWritePtr() != p1);
+	ASSERT_TRUE(buf2.GetReadPtr() == p1);
+}
@@ -0,0 +1,111 @@
+#include "stdafx.h"
+
+// One bit after the other, as in the PNG specification
+static uint32 ReferenceCrc32(uint32 crc, const uint8* pBuffer, uint32 length)
+{
+	crc = ~crc;
+	for(uint32 i = 0; i < length; ++i)
+	{
+		crc ^= pBuffer[i];
+		for(int k = 0; k < 8; ++k)
+		{
+			crc = (crc & 1) ? (0xedb88320 ^ (crc >> 1)) : (crc >> 1);
+		}
+	}
+	return ~crc;
+}
+
+// One byte after the other, as in RFC 1950
+static uint32 ReferenceAdler32(uint32 adler, const uint8* pBuffer, uint32 length)
+{
+	uint32 s1 = adler & 0xffff;
+	uint32 s2 = adler >> 16;
+	for(uint32 i = 0; i < length; ++i)
+	{
+		s1 = (s1 + pBuffer[i]) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+	return (s2 << 16) | s1;
+}
+
+TEST(Checksum, KnownValues)
+{
+	const char* pText = "123456789";
+	ASSERT_EQ( 0xcbf43926u, Checksum::Crc32(0, pText, 9) );
+	ASSERT_EQ( 0u, Checksum::Crc32(0, pText, 0) );
+
+	ASSERT_EQ( 0x11e60398u, Checksum::Adler32(1, "Wikipedia", 9) );
+	ASSERT_EQ( 1u, Checksum::Adler32(1, pText, 0) );
+
+	// CRC of the IEND chunk type, the last 4 bytes of each PNG file
+	ASSERT_EQ( 0xae426082u, Checksum::Crc32(0, "IEND", 4) );
+}
+
+// Random buffers of each length around the SIMD block sizes, at each alignment, checked in
+// one call and in two calls
+TEST(Checksum, RandomBuffers)
+{
+	Random rnd;
+	ByteArray bytes;
+	ASSERT_TRUE( bytes.SetSize(12000) );
+	for(int32 i = 0; i < bytes.GetSize(); ++i)
+	{
+		bytes[i] = uint8(rnd.GetNext(0, 255));
+	}
+
+	const uint32 lengths[] = { 1, 7, 15, 16, 17, 63, 64, 65, 79, 80, 127, 128, 129, 200, 1000,
+	                           5551, 5552, 5553, 5568, 11103, 11104, 11105 };
+	for(int iLength = 0; iLength < ARRAY_SIZE(lengths); ++iLength)
+	{
+		for(int32 offset = 0; offset < 16; ++offset)
+		{
+			const uint32 length = lengths[iLength];
+			const uint8* p = bytes.GetPtr() + offset;
+			SCOPED_TRACE( length );
+			SCOPED_TRACE( offset );
+
+			const uint32 crc = ReferenceCrc32(0, p, length);
+			ASSERT_EQ( crc, Checksum::Crc32(0, p, length) );
+
+			const uint32 adler = ReferenceAdler32(1, p, length);
+			ASSERT_EQ( adler, Checksum::Adler32(1, p, length) );
+
+			const uint32 split = length / 3;
+			ASSERT_EQ( crc, Checksum::Crc32(Checksum::Crc32(0, p, split), p + split, length - split) );
+			ASSERT_EQ( adler, Checksum::Adler32(Checksum::Adler32(1, p, split), p + split, length - split) );
+		}
+	}
+}
+
+// The largest sums are reached with bytes all set to 255
+TEST(Checksum, AdlerOverflow)
+{
+	ByteArray bytes;
+	ASSERT_TRUE( bytes.SetSize(100000) );
+	Memory::Set(bytes.GetPtr(), 0xff, bytes.GetSize());
+
+	// Start with the largest sums too
+	const uint32 adler = (65520u << 16) | 65520u;
+	ASSERT_EQ( ReferenceAdler32(adler, bytes.GetPtr(), bytes.GetSize()),
+	           Checksum::Adler32(adler, bytes.GetPtr(), bytes.GetSize()) );
+}
+
+// The checksums of the PNG chunks and of the zlib streams go through Checksum
+TEST(Checksum, SameAsZlib)
+{
+	ByteArray bytes;
+	ASSERT_TRUE( bytes.SetSize(3000) );
+	for(int32 i = 0; i < bytes.GetSize(); ++i)
+	{
+		bytes[i] = uint8(i * 7 + (i >> 5));
+	}
+	ASSERT_EQ( DeflateCompressor::Adler32(1, bytes.GetPtr(), bytes.GetSize()),
+	           ReferenceAdler32(1, bytes.GetPtr(), bytes.GetSize()) );
+
+	uint32 crc;
+	ChunkedFile::InitCrc(crc);
+	ChunkedFile::UpdateCrc(crc, bytes.GetPtr(), 1000);
+	ChunkedFile::UpdateCrc(crc, bytes.GetPtr() + 1000, 2000);
+	ChunkedFile::FinalizeCrc(crc);
+	ASSERT_EQ( ReferenceCrc32(0, bytes.GetPtr(), bytes.GetSize()), crc );
+}
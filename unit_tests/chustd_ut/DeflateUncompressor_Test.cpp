@@ -0,0 +1,190 @@
+#include "stdafx.h"
+
+// Uncompresses with zlib in one Uncompress call, returns true if the stream ends
+static bool UncompressStreaming(ByteArray& out, const uint8* pSource, uint32 sourceLen, uint32 outSize)
+{
+	if( !out.SetSize(outSize) )
+	{
+		return false;
+	}
+	DeflateUncompressor du;
+	du.SetBuffers(pSource, sourceLen, out.GetPtr(), outSize);
+	if( du.Init() != DF_RET_OK )
+	{
+		return false;
+	}
+	const DeflateRet ret = du.Uncompress(DF_FLUSH_FINISH);
+	out.SetSize(outSize - du.GetOutAvailable());
+	du.End();
+	return ret == DF_RET_STREAM_END;
+}
+
+// Compresses with a zlib strategy
+static bool CompressStrategy(ByteArray& out, const ByteArray& data, int level, DeflateStrategy strategy)
+{
+	const uint32 bound = DeflateCompressor::Bound(data.GetSize());
+	if( !out.SetSize(bound) )
+	{
+		return false;
+	}
+	DeflateCompressor dc;
+	dc.SetBuffers(data.GetPtr(), data.GetSize(), out.GetPtr(), bound);
+	if( dc.Init2(level, DF_METHOD_DEFLATED, 15, 9, strategy) != DF_RET_OK )
+	{
+		return false;
+	}
+	const DeflateRet ret = dc.Compress(DF_FLUSH_FINISH);
+	out.SetSize(bound - dc.GetOutAvailable());
+	dc.End();
+	return ret == DF_RET_STREAM_END;
+}
+
+// Rows of pixels looking like a filtered image: runs, repeated pixels and noise
+static void MakeImageLikeData(ByteArray& data, int32 size, Random& rnd)
+{
+	data.SetSize(size);
+	int32 i = 0;
+	while( i < size )
+	{
+		const int32 runLength = Math::Min(size - i, rnd.GetNext(1, 600));
+		const int mode = rnd.GetNext(0, 3);
+		for(int32 k = 0; k < runLength; ++k, ++i)
+		{
+			if( mode == 0 )
+			{
+				data[i] = 0;
+			}
+			else if( mode == 1 && i >= 4 )
+			{
+				data[i] = data[i - 4];
+			}
+			else if( mode == 2 )
+			{
+				data[i] = uint8(rnd.GetNext(0, 7));
+			}
+			else
+			{
+				data[i] = uint8(rnd.GetNext(0, 255));
+			}
+		}
+	}
+}
+
+// The streams of each zlib strategy and of the optimal encoder give the data back
+TEST(DeflateUncompressor, UncompressBuffer)
+{
+	Random rnd;
+	const int32 sizes[] = { 0, 1, 100, 5000, 70000, 300000 };
+	for(int iSize = 0; iSize < ARRAY_SIZE(sizes); ++iSize)
+	{
+		ByteArray data;
+		MakeImageLikeData(data, sizes[iSize], rnd);
+
+		const DeflateStrategy strategies[] = { DF_STRATEGY_DEFAULT, DF_STRATEGY_FILTERED,
+		                                       DF_STRATEGY_HUFFMAN_ONLY, DF_STRATEGY_RLE, DF_STRATEGY_FIXED };
+		for(int level = 0; level <= 9; level += 3)
+		{
+			for(int iStrategy = 0; iStrategy < ARRAY_SIZE(strategies); ++iStrategy)
+			{
+				SCOPED_TRACE( sizes[iSize] );
+				SCOPED_TRACE( level );
+				SCOPED_TRACE( iStrategy );
+
+				ByteArray compressed;
+				ASSERT_TRUE( CompressStrategy(compressed, data, level, strategies[iStrategy]) );
+
+				ByteArray out;
+				ASSERT_TRUE( out.SetSize(data.GetSize() + 10) );
+				uint32 outLen = out.GetSize();
+				ASSERT_EQ( DF_RET_OK, DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+				                          compressed.GetPtr(), compressed.GetSize()) );
+				ASSERT_EQ( uint32(data.GetSize()), outLen );
+				ASSERT_TRUE( Memory::Equals(data.GetPtr(), out.GetPtr(), outLen) );
+			}
+		}
+
+		if( sizes[iSize] <= 70000 )
+		{
+			ByteArray compressed;
+			ASSERT_TRUE( compressed.SetSize(DeflateCompressor::Bound(data.GetSize())) );
+			uint32 compressedLen = compressed.GetSize();
+			ASSERT_EQ( DF_RET_OK, DeflateCompressor::CompressOptimal(compressed.GetPtr(), &compressedLen,
+			                          data.GetPtr(), data.GetSize(), 2, nullptr) );
+
+			ByteArray out;
+			ASSERT_TRUE( out.SetSize(data.GetSize()) );
+			uint32 outLen = out.GetSize();
+			ASSERT_EQ( DF_RET_OK, DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+			                          compressed.GetPtr(), compressedLen) );
+			ASSERT_EQ( uint32(data.GetSize()), outLen );
+			ASSERT_TRUE( Memory::Equals(data.GetPtr(), out.GetPtr(), outLen) );
+		}
+	}
+}
+
+TEST(DeflateUncompressor, UncompressBufferErrors)
+{
+	Random rnd;
+	ByteArray data;
+	MakeImageLikeData(data, 20000, rnd);
+
+	ByteArray compressed;
+	ASSERT_TRUE( CompressStrategy(compressed, data, 6, DF_STRATEGY_DEFAULT) );
+
+	ByteArray out;
+	ASSERT_TRUE( out.SetSize(data.GetSize()) );
+
+	// Destination too small
+	uint32 outLen = out.GetSize() - 1;
+	ASSERT_EQ( DF_RET_BUF_ERROR, DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+	                                 compressed.GetPtr(), compressed.GetSize()) );
+
+	// Truncated source, the checksum included
+	for(int32 cut = 1; cut <= 5; ++cut)
+	{
+		outLen = out.GetSize();
+		ASSERT_EQ( DF_RET_BUF_ERROR, DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+		                                 compressed.GetPtr(), compressed.GetSize() - cut) );
+	}
+
+	// Bad checksum
+	compressed[compressed.GetSize() - 1] ^= 1;
+	outLen = out.GetSize();
+	ASSERT_EQ( DF_RET_DATA_ERROR, DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+	                                  compressed.GetPtr(), compressed.GetSize()) );
+	compressed[compressed.GetSize() - 1] ^= 1;
+
+	// Preset dictionary
+	const uint8 dictHeader[] = { 0x78, 0xbb, 0, 0, 0, 1 };
+	outLen = out.GetSize();
+	ASSERT_EQ( DF_RET_NEED_DICT, DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+	                                 dictHeader, sizeof(dictHeader)) );
+
+	// Fixed block starting with a match of distance 1
+	const uint8 tooFarBack[] = { 0x78, 0x01, 0x03, 0x02, 0x00, 0, 0, 0, 1 };
+	outLen = out.GetSize();
+	ASSERT_EQ( DF_RET_DATA_ERROR, DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+	                                  tooFarBack, sizeof(tooFarBack)) );
+
+	// Damaged streams are accepted or rejected the same way as zlib does
+	for(int i = 0; i < 2000; ++i)
+	{
+		ByteArray damaged = compressed;
+		const int flipCount = rnd.GetNext(1, 3);
+		for(int k = 0; k < flipCount; ++k)
+		{
+			damaged[rnd.GetNext(2, damaged.GetSize() - 1)] ^= uint8(1 << rnd.GetNext(0, 7));
+		}
+		outLen = out.GetSize();
+		const bool ok = DeflateUncompressor::UncompressBuffer(out.GetPtr(), &outLen,
+		                    damaged.GetPtr(), damaged.GetSize()) == DF_RET_OK;
+
+		ByteArray expected;
+		ASSERT_EQ( UncompressStreaming(expected, damaged.GetPtr(), damaged.GetSize(), out.GetSize()), ok );
+		if( ok )
+		{
+			ASSERT_EQ( uint32(expected.GetSize()), outLen );
+			ASSERT_TRUE( Memory::Equals(expected.GetPtr(), out.GetPtr(), outLen) );
+		}
+	}
+}
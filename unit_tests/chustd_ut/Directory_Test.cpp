@@ -85,6 +85,35 @@ TEST(Directory, GetFileNames)
 	ASSERT_TRUE( Directory::Delete("mydir") );
 }
 
+TEST(Directory, Reader)
+{
+	Directory::Delete("./readerdir");
+	ASSERT_TRUE( Directory::Create("readerdir") );
+	ASSERT_TRUE( File::WriteTextUtf8("readerdir/file1.txt", "") );
+	ASSERT_TRUE( File::WriteTextUtf8("readerdir/file2.xml", "") );
+
+	DirectoryReader reader;
+	String fileName;
+	ASSERT_FALSE( reader.GetNext(fileName) );
+	ASSERT_FALSE( reader.Open("readerdir/nothere") );
+
+	// Same entries and order as GetFileNames
+	StringArray expected = Directory::GetFileNames("readerdir", "*");
+	ASSERT_EQ( 2, expected.GetSize() );
+	ASSERT_TRUE( reader.Open("readerdir") );
+	foreach(expected, i)
+	{
+		ASSERT_TRUE( reader.GetNext(fileName) );
+		ASSERT_TRUE( expected[i] == fileName );
+	}
+	ASSERT_FALSE( reader.GetNext(fileName) );
+	reader.Close();
+
+	ASSERT_TRUE( File::Delete("readerdir/file1.txt") );
+	ASSERT_TRUE( File::Delete("readerdir/file2.xml") );
+	ASSERT_TRUE( Directory::Delete("readerdir") );
+}
+
 TEST(Joker, Matches)
 {
 	{
@@ -35,6 +35,38 @@ TEST(DynamicMemoryFile, ReadWrite)
 	ASSERT_EQ(3, dmf.GetPosition());
 }
 
+TEST(DynamicMemoryFile, Swap)
+{
+	const uint8 inbuf[] = { 1, 2, 3 };
+	uint8 buf[10];
+
+	DynamicMemoryFile dmf1;
+	ASSERT_TRUE(dmf1.Open(0));
+	ASSERT_EQ(3, dmf1.Write(inbuf, 3));
+	dmf1.SetByteOrder(boLittleEndian);
+	const uint8* pContent1 = dmf1.GetContent().GetReadPtr();
+
+	DynamicMemoryFile dmf2;
+	ASSERT_TRUE(dmf2.Open(100));
+	dmf1.Swap(dmf2);
+	ASSERT_EQ(0, dmf1.GetPosition());
+	ASSERT_EQ(boBigEndian, dmf1.GetByteOrder());
+	ASSERT_EQ(3, dmf2.GetPosition());
+	ASSERT_EQ(boLittleEndian, dmf2.GetByteOrder());
+	ASSERT_TRUE(dmf2.GetContent().GetReadPtr() == pContent1);
+
+	// Move, the source is left closed
+	DynamicMemoryFile dmf3(static_cast<DynamicMemoryFile&&>(dmf2));
+	ASSERT_EQ(0, dmf2.GetSize());
+	ASSERT_EQ(3, dmf3.GetPosition());
+	dmf1 = static_cast<DynamicMemoryFile&&>(dmf3);
+	ASSERT_EQ(0, dmf3.GetSize());
+	ASSERT_TRUE(dmf1.GetContent().GetReadPtr() == pContent1);
+	ASSERT_TRUE(dmf1.SetPosition(0));
+	ASSERT_EQ(3, dmf1.Read(buf, 10));
+	ASSERT_TRUE(Memory::Equals(inbuf, buf, 3));
+}
+
 TEST(DynamicMemoryFile, WriteFromFile)
 {
 	const uint8 inbuf[] = { 10, 11, 12 };
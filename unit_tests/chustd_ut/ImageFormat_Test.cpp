@@ -65,3 +65,21 @@ TEST(ImageFormat, PackAndUnpackPixels2bpp)
 	ASSERT_TRUE( memcmp(buf.GetReadPtr(), raw1, sizeof(raw1)) == 0 );
 }
 
+
+TEST(ImageFormat, ComputeBufferSize)
+{
+	int32 size = -1;
+	ASSERT_TRUE( ImageFormat::ComputeBufferSize(4 * 1000, 1000, size) );
+	ASSERT_EQ( 4000000, size );
+
+	ASSERT_TRUE( ImageFormat::ComputeBufferSize(0, 1000, size) );
+	ASSERT_EQ( 0, size );
+
+	// 30000x30000 in RGBA does not fit
+	ASSERT_FALSE( ImageFormat::ComputeBufferSize(4 * 30000, 30000, size) );
+	ASSERT_FALSE( ImageFormat::ComputeBufferSize(MAX_INT32, MAX_INT32, size) );
+	ASSERT_FALSE( ImageFormat::ComputeBufferSize(-4, 10, size) );
+	ASSERT_FALSE( ImageFormat::ComputeBufferSize(4, -10, size) );
+
+	ASSERT_EQ( -1, ImageFormat::ComputeByteWidth(PF_32bppRgba, MAX_INT32) );
+}
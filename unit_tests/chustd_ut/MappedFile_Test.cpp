@@ -0,0 +1,52 @@
+#include "stdafx.h"
+
+TEST(MappedFile, Open)
+{
+	const String filePath = "utfiles/PngSuite/basn2c08.png";
+	ByteArray content = File::GetContent(filePath);
+	ASSERT_TRUE( content.GetSize() > 100 );
+
+	MappedFile mf;
+	ASSERT_TRUE( mf.Open(filePath) );
+	ASSERT_EQ( content.GetSize(), mf.GetSize() );
+	ASSERT_TRUE( Memory::Equals(content.GetPtr(), mf.GetPtr(), content.GetSize()) );
+
+	// Same reading as a regular file
+	uint8 buf[8];
+	ASSERT_EQ( 8, mf.Read(buf, 8) );
+	ASSERT_TRUE( Memory::Equals(content.GetPtr(), buf, 8) );
+	ASSERT_EQ( 8, mf.GetPosition() );
+	uint32 chunkSize = 0;
+	ASSERT_TRUE( mf.Read32(chunkSize) );
+	ASSERT_EQ( uint32(13), chunkSize );
+	ASSERT_TRUE( mf.SetPosition(content.GetSize()) );
+	ASSERT_EQ( 0, mf.Read(buf, 8) );
+	ASSERT_FALSE( mf.SetPosition(content.GetSize() + 1) );
+
+	// Read-only
+	ASSERT_TRUE( mf.SetPosition(0) );
+	ASSERT_TRUE( mf.Write(buf, 8) < 0 );
+
+	// Decoded like a copy in memory
+	ASSERT_TRUE( mf.SetPosition(0) );
+	Png png;
+	ASSERT_TRUE( png.LoadFromFile(mf) );
+	ASSERT_EQ( 32, png.GetWidth() );
+
+	mf.Close();
+	ASSERT_TRUE( mf.GetPtr() == nullptr );
+	ASSERT_EQ( 0, mf.GetSize() );
+}
+
+TEST(MappedFile, OpenFailures)
+{
+	MappedFile mf;
+	ASSERT_FALSE( mf.Open("utfiles/PngSuite/doesnotexist.png") );
+	ASSERT_FALSE( mf.Open("utfiles/PngSuite") );
+
+	// Empty file
+	String filePath = FilePath::Combine(Process::GetCurrentDirectory(), "testfile.bin");
+	ASSERT_TRUE( File::SetContent(filePath, ByteArray()) );
+	ASSERT_FALSE( mf.Open(filePath) );
+	File::Delete(filePath);
+}
@@ -0,0 +1,87 @@
+#include "stdafx.h"
+
+TEST(MemoryArena, AllocFree)
+{
+	MemoryArena arena(1024, 1024 * 1024);
+	ASSERT_EQ(0, arena.GetBlockCount());
+
+	uint8* p0 = (uint8*)arena.Alloc(10);
+	uint8* p1 = (uint8*)arena.Alloc(100);
+	ASSERT_TRUE(p0 != nullptr);
+	ASSERT_TRUE(p1 != nullptr);
+	ASSERT_TRUE(Memory::Is64BitsAligned(p0));
+	ASSERT_TRUE(Memory::Is64BitsAligned(p1));
+	ASSERT_TRUE(arena.GetSize(p0) >= 10);
+	ASSERT_TRUE(arena.GetSize(p1) >= 100);
+	ASSERT_TRUE(p1 >= p0 + 10);
+	ASSERT_EQ(2, arena.GetBlockCount());
+	Memory::Set(p0, 0xaa, 10);
+	Memory::Set(p1, 0xbb, 100);
+
+	// The last block is reused at once
+	arena.Free(p1);
+	uint8* p2 = (uint8*)arena.Alloc(50);
+	ASSERT_EQ(p1, p2);
+	ASSERT_EQ(0xaa, p0[9]);
+
+	// Bigger than a chunk
+	uint8* pBig = (uint8*)arena.Alloc(5000);
+	ASSERT_TRUE(pBig != nullptr);
+	Memory::Set(pBig, 0xcc, 5000);
+	ASSERT_EQ(0xaa, p0[9]);
+	ASSERT_TRUE(arena.GetPeakSize() >= 1024 + 5000);
+
+	arena.Free(p0);
+	arena.Free(p2);
+	arena.Free(pBig);
+	ASSERT_EQ(0, arena.GetBlockCount());
+
+	// Rewound: the next round of the same size fits in one chunk, the peak does not grow
+	int64 peakSize = arena.GetPeakSize();
+	for(int round = 0; round < 3; ++round)
+	{
+		p0 = (uint8*)arena.Alloc(10);
+		pBig = (uint8*)arena.Alloc(5000);
+		ASSERT_TRUE(p0 != nullptr);
+		ASSERT_TRUE(pBig != nullptr);
+		ASSERT_EQ(p0 + arena.GetSize(p0) + 8, pBig);
+		arena.Free(pBig);
+		arena.Free(p0);
+	}
+	ASSERT_EQ(peakSize, arena.GetPeakSize());
+}
+
+TEST(MemoryArena, Buffer)
+{
+	MemoryArena arena(1024, 1024 * 1024);
+	{
+		Buffer buf;
+		ASSERT_TRUE(buf.SetSize(3, &arena));
+		ASSERT_EQ(1, arena.GetBlockCount());
+		uint8* pBytes = buf.GetWritePtr();
+		pBytes[0] = 'a';
+		pBytes[1] = 'b';
+		pBytes[2] = 'c';
+
+		// Grows in the arena
+		ASSERT_TRUE(buf.SetSize(3000));
+		ASSERT_EQ(3000, buf.GetSize());
+		ASSERT_EQ(1, arena.GetBlockCount());
+		ASSERT_EQ('c', buf.GetReadPtr()[2]);
+
+		// A shared buffer is copied in the arena when written
+		Buffer buf2 = buf;
+		buf2.GetWritePtr()[0] = 'z';
+		ASSERT_EQ(2, arena.GetBlockCount());
+		ASSERT_EQ('a', buf.GetReadPtr()[0]);
+		ASSERT_EQ('z', buf2.GetReadPtr()[0]);
+		ASSERT_EQ('c', buf2.GetReadPtr()[2]);
+
+		// Already allocated on the heap: stays there
+		Buffer buf3;
+		ASSERT_TRUE(buf3.SetSize(10));
+		ASSERT_TRUE(buf3.SetSize(20, &arena));
+		ASSERT_EQ(2, arena.GetBlockCount());
+	}
+	ASSERT_EQ(0, arena.GetBlockCount());
+}
@@ -0,0 +1,453 @@
+#include "stdafx.h"
+
+// Gets the PngSuite images that can be loaded and dumped again
+static StringArray GetDumpableSuiteFiles()
+{
+	StringArray fileNames = Directory::GetFileNames("utfiles/PngSuite", "*.png");
+	StringArray filePaths;
+	foreach(fileNames, i)
+	{
+		if( fileNames[i].StartsWith("x") )
+		{
+			// Corrupted files
+			continue;
+		}
+		filePaths.Add(FilePath::Combine("utfiles/PngSuite", fileNames[i]));
+	}
+	return filePaths;
+}
+
+// Fills dump data from a loaded PNG
+static void DumpDataFromPng(const Png& png, PngDumpData& dd)
+{
+	dd.pixels = png.GetPixels();
+	dd.palette = png.GetPalette();
+	dd.width = png.GetWidth();
+	dd.height = png.GetHeight();
+	dd.pixelFormat = png.GetPixelFormat();
+	dd.interlaced = png.IsInterlaced();
+}
+
+// Dumps to memory, returns the file content
+static Buffer DumpToMem(const PngDumpData& dd, const PngDumpSettings& ds, const PngScanlines* pScanlines)
+{
+	DynamicMemoryFile dmf;
+	dmf.Open(1024);
+	bool ok = pScanlines ? PngDumper::Dump(dmf, dd, ds, *pScanlines) : PngDumper::Dump(dmf, dd, ds);
+	if( !ok )
+	{
+		return Buffer();
+	}
+	Buffer content = dmf.GetContent();
+	content.SetSize(int32(dmf.GetPosition()));
+	return content;
+}
+
+// Test that dumping with prepared scanlines gives the same file as a regular dump
+TEST(PngDumper, PreparedScanlines)
+{
+	StringArray filePaths = GetDumpableSuiteFiles();
+	ASSERT_TRUE( filePaths.GetSize() > 100 );
+
+	int dumpCount = 0;
+	foreach(filePaths, i)
+	{
+		SCOPED_TRACE( filePaths[i].GetBuffer() );
+
+		Png png;
+		ASSERT_TRUE( png.Load(filePaths[i]) );
+		PngDumpData dd;
+		DumpDataFromPng(png, dd);
+
+		for(uint8 filtering = 0; filtering <= 1; ++filtering)
+		{
+			PngDumpSettings ds;
+			ds.filtering = filtering;
+			Buffer expected = DumpToMem(dd, ds, nullptr);
+			if( expected.IsEmpty() )
+			{
+				// Pixel format not handled by the dumper
+				continue;
+			}
+
+			PngScanlines scanlines;
+			ASSERT_TRUE( PngDumper::PrepareScanlines(dd, filtering, scanlines) );
+			ASSERT_EQ( 1, scanlines.GetImageCount() );
+
+			// Several compression settings on the same scanlines
+			for(int level = 1; level <= 9; level += 8)
+			{
+				ds.zlibCompressionLevel = uint8(level);
+				expected = DumpToMem(dd, ds, nullptr);
+				Buffer result = DumpToMem(dd, ds, &scanlines);
+				ASSERT_EQ( expected.GetSize(), result.GetSize() );
+				ASSERT_TRUE( Memory::Equals(expected.GetReadPtr(), result.GetReadPtr(), result.GetSize()) );
+				dumpCount++;
+			}
+		}
+	}
+	ASSERT_TRUE( dumpCount > 200 );
+}
+
+// Test that the fixed filters and the extra zlib settings give files with the same pixels
+TEST(PngDumper, FixedFiltersAndStrategies)
+{
+	StringArray filePaths = GetDumpableSuiteFiles();
+	ASSERT_TRUE( filePaths.GetSize() > 100 );
+
+	const uint8 strategies[] = {
+		PngDumpSettings::zlibStrategyDefault,
+		PngDumpSettings::zlibStrategyRle,
+		PngDumpSettings::zlibStrategyHuffmanOnly
+	};
+
+	int dumpCount = 0;
+	foreach(filePaths, i)
+	{
+		SCOPED_TRACE( filePaths[i].GetBuffer() );
+
+		Png png;
+		ASSERT_TRUE( png.Load(filePaths[i]) );
+		PngDumpData dd;
+		DumpDataFromPng(png, dd);
+
+		for(uint8 filtering = PngDumpSettings::filteringSub; filtering < PngDumpSettings::filteringCount; ++filtering)
+		{
+			for(int iStrategy = 0; iStrategy < int(ARRAY_SIZE(strategies)); ++iStrategy)
+			{
+				PngDumpSettings ds;
+				ds.filtering = filtering;
+				ds.zlibStrategy = strategies[iStrategy];
+				ds.zlibWindowBitsAndMem = PngDumpSettings::zlibWindowBitsAndMemMax;
+				Buffer result = DumpToMem(dd, ds, nullptr);
+				if( result.IsEmpty() )
+				{
+					// Pixel format not handled by the dumper
+					continue;
+				}
+
+				StaticMemoryFile smf;
+				ASSERT_TRUE( smf.OpenRead(result.GetReadPtr(), result.GetSize()) );
+				Png pngResult;
+				ASSERT_TRUE( pngResult.LoadFromFile(smf) );
+				ASSERT_EQ( dd.pixels.GetSize(), pngResult.GetPixels().GetSize() );
+				ASSERT_TRUE( Memory::Equals(dd.pixels.GetReadPtr(), pngResult.GetPixels().GetReadPtr(),
+					dd.pixels.GetSize()) );
+				dumpCount++;
+			}
+		}
+	}
+	ASSERT_TRUE( dumpCount > 1000 );
+}
+
+// Creates a 24 bits image that does not compress too well
+static void CreateNoisyImage(PngDumpData& dd)
+{
+	dd.pixelFormat = PF_24bppRgb;
+	dd.width = 300;
+	dd.height = 200;
+	dd.pixels.SetSize(dd.width * dd.height * 3);
+	uint8* pPixels = dd.pixels.GetWritePtr();
+	uint32 noise = 1;
+	for(int i = 0; i < dd.pixels.GetSize(); ++i)
+	{
+		// Gradient with some noise
+		noise = noise * 1103515245 + 12345;
+		pPixels[i] = uint8((i % 900) / 4 + ((noise >> 16) & 7));
+	}
+}
+
+// Test that the size estimate ranks the filterings like a real compression
+TEST(PngDumper, EstimateCompressedSize)
+{
+	PngDumpData dd;
+	CreateNoisyImage(dd);
+
+	int64 estimates[2];
+	int64 sizes[2];
+	for(uint8 filtering = 0; filtering <= 1; ++filtering)
+	{
+		PngScanlines scanlines;
+		ASSERT_TRUE( PngDumper::PrepareScanlines(dd, filtering, scanlines) );
+		estimates[filtering] = PngDumper::EstimateCompressedSize(scanlines);
+
+		PngDumpSettings ds;
+		Buffer result = DumpToMem(dd, ds, &scanlines);
+		ASSERT_FALSE( result.IsEmpty() );
+		sizes[filtering] = result.GetSize();
+
+		// Not far from the real size
+		ASSERT_TRUE( estimates[filtering] > sizes[filtering] / 2 );
+		ASSERT_TRUE( estimates[filtering] < sizes[filtering] * 2 );
+	}
+	ASSERT_TRUE( sizes[1] < sizes[0] );
+	ASSERT_TRUE( estimates[1] < estimates[0] );
+
+	// A plain image is mostly matches
+	Memory::Zero(dd.pixels.GetWritePtr(), dd.pixels.GetSize());
+	PngScanlines scanlines;
+	ASSERT_TRUE( PngDumper::PrepareScanlines(dd, 0, scanlines) );
+	ASSERT_TRUE( PngDumper::EstimateCompressedSize(scanlines) < 1000 );
+}
+
+// Test that the optimal parsing encoder gives files with the same pixels, smaller than zlib ones
+TEST(PngDumper, OptimalStrategy)
+{
+	StringArray filePaths = GetDumpableSuiteFiles();
+	ASSERT_TRUE( filePaths.GetSize() > 100 );
+
+	int64 zlibTotal = 0;
+	int64 optimalTotal = 0;
+	foreach(filePaths, i)
+	{
+		SCOPED_TRACE( filePaths[i].GetBuffer() );
+
+		Png png;
+		ASSERT_TRUE( png.Load(filePaths[i]) );
+		PngDumpData dd;
+		DumpDataFromPng(png, dd);
+
+		for(uint8 filtering = 0; filtering <= 1; ++filtering)
+		{
+			PngDumpSettings ds;
+			ds.filtering = filtering;
+			ds.zlibCompressionLevel = 9;
+			Buffer expected = DumpToMem(dd, ds, nullptr);
+			if( expected.IsEmpty() )
+			{
+				// Pixel format not handled by the dumper
+				continue;
+			}
+
+			ds.zlibStrategy = PngDumpSettings::zlibStrategyOptimal;
+			Buffer result = DumpToMem(dd, ds, nullptr);
+			ASSERT_FALSE( result.IsEmpty() );
+
+			StaticMemoryFile smf;
+			ASSERT_TRUE( smf.OpenRead(result.GetReadPtr(), result.GetSize()) );
+			Png pngResult;
+			ASSERT_TRUE( pngResult.LoadFromFile(smf) );
+			ASSERT_EQ( dd.pixels.GetSize(), pngResult.GetPixels().GetSize() );
+			ASSERT_TRUE( Memory::Equals(dd.pixels.GetReadPtr(), pngResult.GetPixels().GetReadPtr(),
+				dd.pixels.GetSize()) );
+
+			zlibTotal += expected.GetSize();
+			optimalTotal += result.GetSize();
+		}
+	}
+	ASSERT_TRUE( optimalTotal < zlibTotal );
+}
+
+// Test that a block-split compression gives a valid stream with the same pixels
+TEST(PngDumper, DeflateBlocks)
+{
+	PngDumpData dd;
+	CreateNoisyImage(dd);
+
+	for(int interlaced = 0; interlaced <= 1; ++interlaced)
+	{
+		dd.interlaced = (interlaced != 0);
+
+		PngDumpSettings ds;
+		Buffer single = DumpToMem(dd, ds, nullptr);
+		ASSERT_FALSE( single.IsEmpty() );
+
+		ds.deflateBlockSize = 32 * 1024;
+		Buffer blocks = DumpToMem(dd, ds, nullptr);
+		ASSERT_FALSE( blocks.IsEmpty() );
+
+		// Priming with the previous block keeps the cost low
+		ASSERT_TRUE( blocks.GetSize() < single.GetSize() + single.GetSize() / 20 );
+
+		// The thread count does not change the stream
+		ds.deflateThreadCount = 4;
+		Buffer threaded = DumpToMem(dd, ds, nullptr);
+		ASSERT_EQ( blocks.GetSize(), threaded.GetSize() );
+		ASSERT_TRUE( Memory::Equals(blocks.GetReadPtr(), threaded.GetReadPtr(), blocks.GetSize()) );
+
+		StaticMemoryFile smf;
+		ASSERT_TRUE( smf.OpenRead(blocks.GetReadPtr(), blocks.GetSize()) );
+		Png png;
+		ASSERT_TRUE( png.LoadFromFile(smf) );
+		ASSERT_EQ( dd.width, png.GetWidth() );
+		ASSERT_EQ( dd.height, png.GetHeight() );
+		ASSERT_EQ( dd.pixels.GetSize(), png.GetPixels().GetSize() );
+		ASSERT_TRUE( Memory::Equals(dd.pixels.GetReadPtr(), png.GetPixels().GetReadPtr(), dd.pixels.GetSize()) );
+	}
+}
+
+// Test that filtering and compressing the rows by bands gives the same file as compressing
+// whole prepared scanlines
+TEST(PngDumper, StreamedBands)
+{
+	PngDumpData ddRgb;
+	CreateNoisyImage(ddRgb);
+
+	// Same noise with an alpha channel, to check the BGRA swap of each band
+	PngDumpData ddBgra;
+	ddBgra.pixelFormat = PF_32bppBgra;
+	ddBgra.width = ddRgb.width;
+	ddBgra.height = ddRgb.height;
+	ddBgra.pixels.SetSize(ddBgra.width * ddBgra.height * 4);
+	const uint8* pRgb = ddRgb.pixels.GetReadPtr();
+	uint8* pBgra = ddBgra.pixels.GetWritePtr();
+	for(int i = 0; i < ddBgra.width * ddBgra.height; ++i)
+	{
+		pBgra[4 * i + 0] = pRgb[3 * i + 2];
+		pBgra[4 * i + 1] = pRgb[3 * i + 1];
+		pBgra[4 * i + 2] = pRgb[3 * i + 0];
+		pBgra[4 * i + 3] = uint8(i / 7);
+	}
+
+	const PngDumpData* apDumpData[2] = { &ddRgb, &ddBgra };
+	for(int iData = 0; iData < 2; ++iData)
+	{
+		const PngDumpData& dd = *apDumpData[iData];
+
+		// Several bands of rows
+		ASSERT_TRUE( dd.pixels.GetSize() > 2 * 64 * 1024 );
+
+		for(uint8 filtering = 0; filtering < PngDumpSettings::filteringCount; ++filtering)
+		{
+			PngDumpSettings ds;
+			ds.filtering = filtering;
+			Buffer streamed = DumpToMem(dd, ds, nullptr);
+			ASSERT_FALSE( streamed.IsEmpty() );
+
+			PngScanlines scanlines;
+			ASSERT_TRUE( PngDumper::PrepareScanlines(dd, filtering, scanlines) );
+			Buffer whole = DumpToMem(dd, ds, &scanlines);
+			ASSERT_EQ( whole.GetSize(), streamed.GetSize() );
+			ASSERT_TRUE( Memory::Equals(whole.GetReadPtr(), streamed.GetReadPtr(), whole.GetSize()) );
+		}
+	}
+
+	// Pixels read back
+	PngDumpSettings ds;
+	Buffer streamed = DumpToMem(ddRgb, ds, nullptr);
+	StaticMemoryFile smf;
+	ASSERT_TRUE( smf.OpenRead(streamed.GetReadPtr(), streamed.GetSize()) );
+	Png png;
+	ASSERT_TRUE( png.LoadFromFile(smf) );
+	ASSERT_EQ( ddRgb.pixels.GetSize(), png.GetPixels().GetSize() );
+	ASSERT_TRUE( Memory::Equals(ddRgb.pixels.GetReadPtr(), png.GetPixels().GetReadPtr(), ddRgb.pixels.GetSize()) );
+}
+
+// Size limit that records the sizes it is asked about
+class TestSizeLimit : public PngDumpSizeLimit
+{
+public:
+	int64 limit;
+	int64 maxChecked;
+
+	virtual bool IsExceeded(int64 size)
+	{
+		maxChecked = Math::Max(maxChecked, size);
+		return size > limit;
+	}
+	TestSizeLimit(int64 limit_) : limit(limit_), maxChecked(0) {}
+};
+
+// Test that a dump stops once bigger than the size limit, and is unchanged otherwise
+TEST(PngDumper, SizeLimit)
+{
+	PngDumpData dd;
+	CreateNoisyImage(dd);
+
+	for(int blocks = 0; blocks <= 1; ++blocks)
+	{
+		PngDumpSettings ds;
+		ds.deflateBlockSize = blocks ? 32 * 1024 : 0;
+		Buffer expected = DumpToMem(dd, ds, nullptr);
+		// Bigger than the output steps of the compression, so the limit is checked on the way
+		ASSERT_TRUE( expected.GetSize() > 64 * 1024 );
+
+		// Same size as the limit: not exceeded
+		TestSizeLimit sameLimit(expected.GetSize());
+		ds.pSizeLimit = &sameLimit;
+		Buffer result = DumpToMem(dd, ds, nullptr);
+		ASSERT_EQ( expected.GetSize(), result.GetSize() );
+		ASSERT_TRUE( Memory::Equals(expected.GetReadPtr(), result.GetReadPtr(), result.GetSize()) );
+		ASSERT_TRUE( sameLimit.maxChecked > 0 );
+		ASSERT_TRUE( sameLimit.maxChecked <= expected.GetSize() );
+
+		// Stopped before the end
+		TestSizeLimit lowLimit(expected.GetSize() / 4);
+		ds.pSizeLimit = &lowLimit;
+		result = DumpToMem(dd, ds, nullptr);
+		ASSERT_TRUE( result.IsEmpty() );
+		ASSERT_TRUE( lowLimit.maxChecked > lowLimit.limit );
+		ASSERT_TRUE( lowLimit.maxChecked < expected.GetSize() );
+	}
+}
+
+// Test that dumps sharing a context give the same files as dumps without one,
+// including after a dump stopped by the size limit
+TEST(PngDumper, Context)
+{
+	StringArray filePaths = GetDumpableSuiteFiles();
+	ASSERT_TRUE( filePaths.GetSize() > 100 );
+
+	const uint8 windowBitsAndMems[] = {
+		PngDumpSettings::zlibWindowBitsAndMemHigh,
+		PngDumpSettings::zlibWindowBitsAndMemLow,
+		PngDumpSettings::zlibWindowBitsAndMemMax
+	};
+
+	// Big enough for the size limit to be checked during the compression
+	PngDumpData ddNoisy;
+	CreateNoisyImage(ddNoisy);
+
+	PngDumpContext context;
+	int dumpCount = 0;
+	foreach(filePaths, i)
+	{
+		SCOPED_TRACE( filePaths[i].GetBuffer() );
+
+		Png png;
+		ASSERT_TRUE( png.Load(filePaths[i]) );
+		PngDumpData dd;
+		DumpDataFromPng(png, dd);
+
+		// Settings changing from one file to the next
+		PngDumpSettings ds;
+		ds.filtering = uint8(i % PngDumpSettings::filteringCount);
+		ds.zlibCompressionLevel = uint8(1 + i % 9);
+		ds.zlibStrategy = uint8(i % PngDumpSettings::zlibStrategyOptimal);
+		ds.zlibWindowBitsAndMem = windowBitsAndMems[(i / 2) % ARRAY_SIZE(windowBitsAndMems)];
+		Buffer expected = DumpToMem(dd, ds, nullptr);
+		if( expected.IsEmpty() )
+		{
+			// Pixel format not handled by the dumper
+			continue;
+		}
+
+		// Leaves the compressor in the middle of a stream
+		ds.pContext = &context;
+		TestSizeLimit lowLimit(0);
+		ds.pSizeLimit = &lowLimit;
+		ASSERT_TRUE( DumpToMem(ddNoisy, ds, nullptr).IsEmpty() );
+
+		ds.pSizeLimit = nullptr;
+		Buffer result = DumpToMem(dd, ds, nullptr);
+		ASSERT_EQ( expected.GetSize(), result.GetSize() );
+		ASSERT_TRUE( Memory::Equals(expected.GetReadPtr(), result.GetReadPtr(), result.GetSize()) );
+		dumpCount++;
+	}
+	ASSERT_TRUE( dumpCount > 100 );
+
+	// Interlaced and block-split dumps
+	for(int interlaced = 0; interlaced <= 1; ++interlaced)
+	{
+		ddNoisy.interlaced = (interlaced != 0);
+		PngDumpSettings ds;
+		ds.deflateBlockSize = interlaced ? 32 * 1024 : 0;
+		Buffer expected = DumpToMem(ddNoisy, ds, nullptr);
+		ASSERT_FALSE( expected.IsEmpty() );
+
+		ds.pContext = &context;
+		Buffer result = DumpToMem(ddNoisy, ds, nullptr);
+		ASSERT_EQ( expected.GetSize(), result.GetSize() );
+		ASSERT_TRUE( Memory::Equals(expected.GetReadPtr(), result.GetReadPtr(), result.GetSize()) );
+	}
+}
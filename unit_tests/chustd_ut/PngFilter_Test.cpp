@@ -0,0 +1,170 @@
+#include "stdafx.h"
+
+// Unfilters a block in place the way Png does: each row starts with its filter type byte
+static bool UnfilterBlock(uint8* pBlock, int32 rowCount, int32 byteWidth, int32 bytesPerPixel, bool generic)
+{
+	const uint8* pRow = pBlock;
+	uint8* pDst = pBlock;
+	const uint8* pPrev = nullptr;
+	for(int32 iRow = 0; iRow < rowCount; ++iRow)
+	{
+		const uint8 type = pRow[0];
+		pRow++;
+		const bool ok = generic
+			? PngFilter::UnfilterRowGeneric(type, pDst, pRow, pPrev, byteWidth, bytesPerPixel)
+			: PngFilter::UnfilterRow(type, pDst, pRow, pPrev, byteWidth, bytesPerPixel);
+		if( !ok )
+		{
+			return false;
+		}
+		pPrev = pDst;
+		pDst += byteWidth;
+		pRow += byteWidth;
+	}
+	return true;
+}
+
+// Unfilters with the kernels and with the generic code, returns true if the results are the same
+static bool UnfilterAndCompare(const uint8* pBlock, int32 rowCount, int32 byteWidth, int32 bytesPerPixel)
+{
+	const int32 blockSize = rowCount * (byteWidth + 1);
+	Buffer expected;
+	Buffer result;
+	expected.Assign(pBlock, blockSize);
+	result.Assign(pBlock, blockSize);
+
+	if( !UnfilterBlock(expected.GetWritePtr(), rowCount, byteWidth, bytesPerPixel, true)
+	 || !UnfilterBlock(result.GetWritePtr(), rowCount, byteWidth, bytesPerPixel, false) )
+	{
+		return false;
+	}
+	return Memory::Equals(expected.GetReadPtr(), result.GetReadPtr(), rowCount * byteWidth);
+}
+
+// Random rows of each filter type for each pixel size, the first row included
+TEST(PngFilter, RandomRows)
+{
+	Random rnd;
+	const int32 rowCount = 12;
+	for(int32 bytesPerPixel = 1; bytesPerPixel <= 8; ++bytesPerPixel)
+	{
+		for(int32 pixelCount = 1; pixelCount < 40; pixelCount += 3)
+		{
+			SCOPED_TRACE( bytesPerPixel );
+			SCOPED_TRACE( pixelCount );
+
+			const int32 byteWidth = pixelCount * bytesPerPixel;
+			ByteArray block;
+			ASSERT_TRUE( block.SetSize(rowCount * (byteWidth + 1)) );
+			for(int32 i = 0; i < block.GetSize(); ++i)
+			{
+				block[i] = uint8(rnd.GetNext(0, 255));
+			}
+			for(int32 iRow = 0; iRow < rowCount; ++iRow)
+			{
+				block[iRow * (byteWidth + 1)] = uint8((iRow + pixelCount) % PngFilter::typeCount);
+			}
+			ASSERT_TRUE( UnfilterAndCompare(block.GetPtr(), rowCount, byteWidth, bytesPerPixel) );
+		}
+	}
+
+	// The row width is not always a multiple of the pixel size
+	ByteArray block;
+	ASSERT_TRUE( block.SetSize(2 * 8) );
+	Memory::Set(block.GetPtr(), 0x55, block.GetSize());
+	block[0] = PngFilter::typePaeth;
+	block[8] = PngFilter::typeAverage;
+	ASSERT_TRUE( UnfilterAndCompare(block.GetPtr(), 2, 7, 3) );
+}
+
+TEST(PngFilter, BadType)
+{
+	uint8 row[4] = { 1, 2, 3, 4 };
+	ASSERT_FALSE( PngFilter::UnfilterRow(PngFilter::typeCount, row, row, nullptr, 4, 1) );
+	ASSERT_FALSE( PngFilter::UnfilterRowGeneric(PngFilter::typeCount, row, row, nullptr, 4, 1) );
+}
+
+// Filtered rows unfiltered by the reference code give the source rows again
+TEST(PngFilter, FilterRoundTrip)
+{
+	Random rnd;
+	const int32 rowCount = 4;
+	for(int32 bytesPerPixel = 1; bytesPerPixel <= 8; ++bytesPerPixel)
+	{
+		for(int32 byteWidth = 1; byteWidth < 80; byteWidth += 7)
+		{
+			SCOPED_TRACE( bytesPerPixel );
+			SCOPED_TRACE( byteWidth );
+
+			ByteArray rows;
+			ASSERT_TRUE( rows.SetSize(rowCount * byteWidth) );
+			for(int32 i = 0; i < rows.GetSize(); ++i)
+			{
+				rows[i] = uint8(rnd.GetNext(0, 255));
+			}
+
+			ByteArray filtered, unfiltered;
+			ASSERT_TRUE( filtered.SetSize(byteWidth) );
+			ASSERT_TRUE( unfiltered.SetSize(byteWidth) );
+
+			for(int32 iRow = 0; iRow < rowCount; ++iRow)
+			{
+				const uint8* pSrc = rows.GetPtr() + iRow * byteWidth;
+				const uint8* pPrev = (iRow > 0) ? pSrc - byteWidth : nullptr;
+
+				for(uint8 type = 0; type < PngFilter::typeCount; ++type)
+				{
+					ASSERT_TRUE( PngFilter::FilterRow(type, filtered.GetPtr(), pSrc, pPrev, byteWidth, bytesPerPixel) );
+					ASSERT_TRUE( PngFilter::UnfilterRowGeneric(type, unfiltered.GetPtr(), filtered.GetPtr(), pPrev,
+					                                           byteWidth, bytesPerPixel) );
+					ASSERT_TRUE( Memory::Equals(pSrc, unfiltered.GetPtr(), byteWidth) );
+				}
+			}
+		}
+	}
+}
+
+// The scanlines of the PngSuite images, with each filter type
+TEST(PngFilter, SuiteScanlines)
+{
+	StringArray fileNames = Directory::GetFileNames("utfiles/PngSuite", "*.png");
+	ASSERT_TRUE( fileNames.GetSize() > 100 );
+
+	int checkCount = 0;
+	foreach(fileNames, i)
+	{
+		if( fileNames[i].StartsWith("x") )
+		{
+			// Corrupted files
+			continue;
+		}
+		SCOPED_TRACE( fileNames[i].GetBuffer() );
+
+		Png png;
+		ASSERT_TRUE( png.Load(FilePath::Combine("utfiles/PngSuite", fileNames[i])) );
+
+		PngDumpData dd;
+		dd.pixels = png.GetPixels();
+		dd.palette = png.GetPalette();
+		dd.width = png.GetWidth();
+		dd.height = png.GetHeight();
+		dd.pixelFormat = png.GetPixelFormat();
+		dd.interlaced = false;
+
+		const int32 bytesPerPixel = Math::Max(1, ImageFormat::SizeofPixelInBits(dd.pixelFormat) / 8);
+		for(uint8 filtering = PngDumpSettings::filteringSub; filtering < PngDumpSettings::filteringCount; ++filtering)
+		{
+			PngScanlines scanlines;
+			if( !PngDumper::PrepareScanlines(dd, filtering, scanlines) )
+			{
+				// Pixel format not handled by the dumper
+				break;
+			}
+			const ByteArray& image = scanlines.GetImage(0);
+			const int32 byteWidth = image.GetSize() / dd.height - 1;
+			ASSERT_TRUE( UnfilterAndCompare(image.GetPtr(), dd.height, byteWidth, bytesPerPixel) );
+			checkCount++;
+		}
+	}
+	ASSERT_TRUE( checkCount > 100 );
+}
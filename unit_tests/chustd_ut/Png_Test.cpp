@@ -116,4 +116,71 @@ TEST(Png, Burp)
 	ds.pBuffer = png.GetBuffer();
 	Png::Dump("PngSuite/xcsn0g01.png", ds);
 }
-*/
\ No newline at end of file
+*/
+///////////////////////////////////////////////////////////////////////////////
+// Writes a PNG file made of an IHDR, the chunks optionally given and an empty IEND
+static void WriteSmallPng(IFile& file, int32 width, int32 height, const Buffer& moreChunks)
+{
+	PngDumper::WriteSignature(file);
+
+	ChunkedFile cf(file);
+	cf.BeginChunkWrite(PngChunk_IHDR::Name);
+	cf.Write32(width);
+	cf.Write32(height);
+	const uint8 rest[] = { 8, 6, 0, 0, 0 }; // RGBA 8 bits, not interlaced
+	cf.Write(rest, sizeof(rest));
+	cf.EndChunkWrite();
+
+	file.Write(moreChunks.GetReadPtr(), moreChunks.GetSize());
+
+	cf.BeginChunkWrite(MAKE32('I','E','N','D'));
+	cf.EndChunkWrite();
+}
+
+TEST(Png, ImageTooBig)
+{
+	// The pixels would take 3.6 GB, the IHDR must be rejected before anything is allocated
+	DynamicMemoryFile dmf;
+	ASSERT_TRUE( dmf.Open(1024) );
+	WriteSmallPng(dmf, 30000, 30000, Buffer());
+
+	StaticMemoryFile smf;
+	ASSERT_TRUE( smf.OpenRead(dmf.GetContent().GetReadPtr(), dmf.GetContent().GetSize()) );
+	Png png;
+	ASSERT_FALSE( png.LoadFromFile(smf) );
+	ASSERT_EQ( int(ImageFormat::imageTooBig), png.GetLastError() );
+}
+
+TEST(Png, FrameOutsideImage)
+{
+	// One frame of 8x8 at (4,0) in a 10x10 image
+	DynamicMemoryFile chunks;
+	ASSERT_TRUE( chunks.Open(1024) );
+	{
+		ChunkedFile cf(chunks);
+		cf.BeginChunkWrite(PngChunk_acTL::Name);
+		cf.Write32(uint32(1)); // Frame count
+		cf.Write32(uint32(0)); // Loop forever
+		cf.EndChunkWrite();
+
+		cf.BeginChunkWrite(PngChunk_fcTL::Name);
+		const uint32 fields[] = { 0, 8, 8, 4, 0 }; // Sequence, size and offset
+		for(uint32 field : fields)
+		{
+			cf.Write32(field);
+		}
+		const uint8 rest[] = { 0, 1, 0, 100, 0, 0 }; // Delay, dispose and blend
+		cf.Write(rest, sizeof(rest));
+		cf.EndChunkWrite();
+	}
+
+	DynamicMemoryFile dmf;
+	ASSERT_TRUE( dmf.Open(1024) );
+	WriteSmallPng(dmf, 10, 10, chunks.GetContent());
+
+	StaticMemoryFile smf;
+	ASSERT_TRUE( smf.OpenRead(dmf.GetContent().GetReadPtr(), dmf.GetContent().GetSize()) );
+	Png png;
+	ASSERT_FALSE( png.LoadFromFile(smf) );
+	ASSERT_EQ( int(Png::errFrameOutsideImage), png.GetLastError() );
+}
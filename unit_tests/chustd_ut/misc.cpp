@@ -402,3 +402,27 @@ TEST(PtrArray, CopyConstructor)
 	ASSERT_EQ( 1, newCars[0]->color );
 	ASSERT_EQ( 2, newCars[1]->color );
 }
+
+TEST(PtrArray, MoveAssignment)
+{
+	PtrArray<Car> cars;
+	cars.Add( new Car(1) );
+	cars.Add( new Car(2) );
+	Car* pCar1 = cars[0];
+
+	PtrArray<Car> newCars;
+	newCars.Add( new Car(3) );
+	newCars = static_cast<PtrArray<Car>&&>(cars);
+	ASSERT_EQ( 0, cars.GetSize() );
+	ASSERT_EQ( 2, newCars.GetSize() );
+	ASSERT_TRUE( newCars[0] == pCar1 );
+	ASSERT_EQ( 2, newCars[1]->color );
+
+	Array<int> a;
+	a.Add(4);
+	Array<int> b;
+	b = static_cast<Array<int>&&>(a);
+	ASSERT_EQ( 0, a.GetSize() );
+	ASSERT_EQ( 1, b.GetSize() );
+	ASSERT_EQ( 4, b[0] );
+}
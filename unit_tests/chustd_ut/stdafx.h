@@ -13,10 +13,13 @@
 
 using namespace chustd;
 
+// Declared in chustd so gtest finds it through argument-dependent lookup
+namespace chustd {
 inline std::ostream& operator<<(std::ostream& stream, const String& str)
 {
     char tmp[200];
     str.ToUtf8Z(tmp);
     return stream << tmp;
 }
+}
 #endif
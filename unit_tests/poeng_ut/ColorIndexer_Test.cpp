@@ -0,0 +1,63 @@
+#include "stdafx.h"
+
+// Colors are indexed in the order they first appear
+TEST(ColorIndexer, FirstSeenOrder)
+{
+	const uint8 rgba[] = {
+		10, 20, 30, 255,
+		10, 20, 30, 255,
+		 0,  0,  0,   0,
+		10, 20, 30, 128,
+		 0,  0,  0,   0,
+		10, 20, 30, 255,
+		 5,  5,  5, 255,
+	};
+	uint8 indexes[7];
+
+	Palette pal;
+	ColorIndexer indexer(pal);
+	ASSERT_TRUE( indexer.IndexPixels(rgba, 7, true, indexes) );
+
+	ASSERT_EQ( 4, pal.m_count );
+	ASSERT_TRUE( Color(10, 20, 30, 255) == pal[0] );
+	ASSERT_TRUE( Color(0, 0, 0, 0) == pal[1] );
+	ASSERT_TRUE( Color(10, 20, 30, 128) == pal[2] );
+	ASSERT_TRUE( Color(5, 5, 5, 255) == pal[3] );
+
+	const uint8 expected[] = { 0, 0, 1, 2, 1, 0, 3 };
+	for(int i = 0; i < 7; ++i)
+	{
+		ASSERT_EQ( expected[i], indexes[i] );
+	}
+}
+
+// 256 colors fit, the 257th stops the conversion. Colors close to each other
+// end up in the same hash slots.
+TEST(ColorIndexer, TooMuchColors)
+{
+	const int pixelCount = 600;
+	uint8 rgb[pixelCount * 3];
+	for(int i = 0; i < pixelCount; ++i)
+	{
+		const int col = i % 257;
+		rgb[3 * i + 0] = uint8(col >> 8);
+		rgb[3 * i + 1] = 0;
+		rgb[3 * i + 2] = uint8(col);
+	}
+	uint8 indexes[pixelCount];
+
+	Palette pal;
+	ColorIndexer indexer(pal);
+	ASSERT_TRUE( indexer.IndexPixels(rgb, 256, false, indexes) );
+	ASSERT_EQ( 256, pal.m_count );
+	for(int i = 0; i < 256; ++i)
+	{
+		ASSERT_EQ( uint8(i), indexes[i] );
+		ASSERT_TRUE( Color(0, 0, i) == pal[i] );
+		ASSERT_EQ( i, indexer.IndexColor(Color(0, 0, i)) );
+	}
+
+	ASSERT_FALSE( indexer.IndexPixels(rgb, pixelCount, false, indexes) );
+	ASSERT_EQ( 256, pal.m_count );
+	ASSERT_EQ( -1, indexer.IndexColor(Color(1, 0, 0)) );
+}
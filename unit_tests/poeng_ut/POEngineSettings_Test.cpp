@@ -20,6 +20,11 @@ bool operator==(const POEngineSettings& s1, const POEngineSettings& s2)
 	ret &= s1.physPpmX == s2.physPpmX;
 	ret &= s1.physPpmY == s2.physPpmY;
 
+	ret &= s1.threadCount == s2.threadCount;
+	ret &= s1.deflateBlockSize == s2.deflateBlockSize;
+	ret &= s1.effort == s2.effort;
+	ret &= s1.fastMode == s2.fastMode;
+
 	return ret;
 }
 
@@ -242,3 +247,71 @@ TEST(POEngineSettings, ForcePixelsPerInchArgv)
 }
 
 
+
+TEST(POEngineSettings, ThreadCountArgv)
+{
+	const char* argv[] = {
+		"app.exe",
+		"-ThreadCount:3",
+		"-DeflateBlockSize:256"
+	};
+	ArgvParser ap(ARRAY_SIZE(argv), argv);
+
+	POEngineSettings settings;
+	settings.LoadFromArgv(ap);
+
+	POEngineSettings exp;
+	exp.backupOldPngFiles = false;
+	exp.threadCount = 3;
+	exp.deflateBlockSize = 256;
+	ASSERT_TRUE(settings == exp);
+
+	// Test with INI
+	ToIni(settings);
+	POEngineSettings settings2 = FromIni();
+	ASSERT_TRUE(settings2 == exp);
+}
+
+TEST(POEngineSettings, EffortArgv)
+{
+	const char* argv[] = {
+		"app.exe",
+		"-O5"
+	};
+	ArgvParser ap(ARRAY_SIZE(argv), argv);
+
+	POEngineSettings settings;
+	settings.LoadFromArgv(ap);
+
+	POEngineSettings exp;
+	exp.backupOldPngFiles = false;
+	exp.effort = 5;
+	ASSERT_TRUE(settings == exp);
+
+	// Test with INI
+	ToIni(settings);
+	POEngineSettings settings2 = FromIni();
+	ASSERT_TRUE(settings2 == exp);
+}
+
+TEST(POEngineSettings, FastModeArgv)
+{
+	const char* argv[] = {
+		"app.exe",
+		"-FastMode"
+	};
+	ArgvParser ap(ARRAY_SIZE(argv), argv);
+
+	POEngineSettings settings;
+	settings.LoadFromArgv(ap);
+
+	POEngineSettings exp;
+	exp.backupOldPngFiles = false;
+	exp.fastMode = true;
+	ASSERT_TRUE(settings == exp);
+
+	// Test with INI
+	ToIni(settings);
+	POEngineSettings settings2 = FromIni();
+	ASSERT_TRUE(settings2 == exp);
+}
@@ -547,6 +547,40 @@ TEST(POEngine, IsFileExtensionSupported)
 	ASSERT_TRUE( POEngine::IsFileExtensionSupported("APNG") );
 }
 
+// Transparent pixels are black, and opaque pixels use black and the colors after it,
+// red changing first. The unused color must come right after them.
+TEST(POEngine, FindUnusedColorHardcoreMethod)
+{
+	POEngine engine;
+	const int32 usedCounts[] = { 1, 31, 32, 33, 300, 70000 };
+	for(int iCount = 0; iCount < ARRAY_SIZE(usedCounts); ++iCount)
+	{
+		const int32 usedCount = usedCounts[iCount];
+		SCOPED_TRACE( usedCount );
+
+		Buffer pixels;
+		ASSERT_TRUE( pixels.SetSize((usedCount + 1) * 4) );
+		uint8* pPixels = pixels.GetWritePtr();
+
+		// Colors in reverse order, and a transparent pixel
+		for(int32 i = 0; i < usedCount; ++i)
+		{
+			const int32 color = usedCount - 1 - i;
+			pPixels[4 * i + 0] = uint8(color);
+			pPixels[4 * i + 1] = uint8(color >> 8);
+			pPixels[4 * i + 2] = uint8(color >> 16);
+			pPixels[4 * i + 3] = 255;
+		}
+		Memory::Zero(pPixels + usedCount * 4, 4);
+
+		uint8 r = 0, g = 0, b = 0;
+		ASSERT_TRUE( engine.FindUnusedColorHardcoreMethod(pPixels, usedCount + 1, r, g, b) );
+		ASSERT_EQ( uint8(usedCount), r );
+		ASSERT_EQ( uint8(usedCount >> 8), g );
+		ASSERT_EQ( uint8(usedCount >> 16), b );
+	}
+}
+
 bool BuildTestImage(IFile& dstFile)
 {
 	// Build test image
@@ -729,3 +763,490 @@ TEST(POEngine, PaletteSameGrayDifferentAlpha)
 	};
 	ASSERT_TRUE(memcmp(pixels.GetReadPtr(), expected, 9) == 0);
 }
+
+// Gathers the messages fired by an engine
+class ProgressingRecorder
+{
+public:
+	StringBuilder m_text;
+	void OnEngineProgressing(const POEngine::ProgressingArg& arg)
+	{
+		m_text += arg.text;
+	}
+};
+
+// Dumps a few files for a batch optimization, one of them being invalid
+static StringArray CreateBatchFiles()
+{
+	StringArray filePaths;
+	for(int i = 0; i < 6; ++i)
+	{
+		PngDumpData dd;
+		dd.pixelFormat = PF_24bppRgb;
+		dd.width = 8 + i * 5;
+		dd.height = 8 + i * 3;
+		dd.pixels.SetSize(dd.width * dd.height * 3);
+		uint8* pPixels = dd.pixels.GetWritePtr();
+		for(int j = 0; j < dd.pixels.GetSize(); ++j)
+		{
+			pPixels[j] = uint8((j * (i + 1)) / 7);
+		}
+		String filePath = "batch" + String::FromInt(i) + ".png";
+		File::Delete(filePath);
+		PngDumpSettings ds;
+		ds.zlibCompressionLevel = 1;
+		EXPECT_TRUE( PngDumper::Dump(filePath, dd, ds) );
+		filePaths.Add(filePath);
+	}
+	String badFilePath = "batchbad.png";
+	File::Delete(badFilePath);
+	EXPECT_TRUE( File::WriteTextUtf8(badFilePath, "not a png") );
+	filePaths.InsertAt(2, badFilePath);
+	return filePaths;
+}
+
+// Removes the duration from the batch summary
+static String RemoveBatchTime(const String& text)
+{
+	int start = text.Find("-- Done --", 0);
+	int end = text.Find(" ms ", start);
+	if( start < 0 || end < 0 )
+	{
+		return text;
+	}
+	return text.Left(start) + text.Mid(end);
+}
+
+// Test that a parallel batch gives the same messages and files as a serial one
+TEST(POEngine, OptimizeMultiFilesDisk_Jobs)
+{
+	StringArray filePaths = CreateBatchFiles();
+	ProgressingRecorder serialRecorder;
+	POEngine serialEngine;
+	serialEngine.m_settings.backupOldPngFiles = false;
+	serialEngine.Progressing.Connect(&serialRecorder, &ProgressingRecorder::OnEngineProgressing);
+	ASSERT_FALSE( serialEngine.OptimizeMultiFilesDisk(filePaths) );
+
+	Array<ByteArray> serialContents;
+	for(int i = 0; i < filePaths.GetSize(); ++i)
+	{
+		serialContents.Add(File::GetContent(filePaths[i]));
+	}
+
+	filePaths = CreateBatchFiles();
+	ProgressingRecorder parallelRecorder;
+	POEngine parallelEngine;
+	parallelEngine.m_settings.backupOldPngFiles = false;
+	parallelEngine.SetJobCount(3);
+	parallelEngine.Progressing.Connect(&parallelRecorder, &ProgressingRecorder::OnEngineProgressing);
+	ASSERT_FALSE( parallelEngine.OptimizeMultiFilesDisk(filePaths) );
+
+	String serialText = RemoveBatchTime(serialRecorder.m_text.ToString());
+	String parallelText = RemoveBatchTime(parallelRecorder.m_text.ToString());
+	ASSERT_TRUE( serialText.Find("(KO)", 0) > 0 );
+	ASSERT_TRUE( serialText == parallelText );
+
+	for(int i = 0; i < filePaths.GetSize(); ++i)
+	{
+		ASSERT_TRUE( File::GetContent(filePaths[i]) == serialContents[i] );
+		File::Delete(filePaths[i]);
+	}
+}
+
+// Test that the backups and optimized files written in a directory being walked are not walked
+TEST(POEngine, OptimizeMultiFilesDisk_Directory)
+{
+	const String dirPath = "batchdir";
+	StringArray oldNames = Directory::GetFileNames(dirPath, "*", true);
+	for(int i = 0; i < oldNames.GetSize(); ++i)
+	{
+		File::Delete(oldNames[i]);
+	}
+	Directory::Create(dirPath);
+
+	// Enough entries for the system to read the directory in several steps, so it may
+	// list the files created meanwhile
+	for(int i = 0; i < 3000; ++i)
+	{
+		String filePath = FilePath::Combine(dirPath, "filler" + String::FromInt(i) + ".txt");
+		EXPECT_TRUE( File::WriteTextUtf8(filePath, "") );
+	}
+
+	const int fileCount = 20;
+	for(int i = 0; i < fileCount; ++i)
+	{
+		PngDumpData dd;
+		dd.pixelFormat = PF_24bppRgb;
+		dd.width = 8;
+		dd.height = 8 + i;
+		dd.pixels.SetSize(dd.width * dd.height * 3);
+		dd.pixels.Fill(uint8(i));
+		String filePath = FilePath::Combine(dirPath, "file" + String::FromInt(i) + ".png");
+		EXPECT_TRUE( PngDumper::Dump(filePath, dd, PngDumpSettings()) );
+	}
+
+	ProgressingRecorder recorder;
+	POEngine engine;
+	engine.m_settings.backupOldPngFiles = true;
+	engine.Progressing.Connect(&recorder, &ProgressingRecorder::OnEngineProgressing);
+	StringArray filePaths;
+	filePaths.Add(dirPath);
+	ASSERT_TRUE( engine.OptimizeMultiFilesDisk(filePaths) );
+
+	// Each file optimized once, with one backup
+	String text = recorder.m_text.ToString();
+	int okCount = 0;
+	for(int pos = text.Find("(OK)", 0); pos >= 0; pos = text.Find("(OK)", pos + 1))
+	{
+		okCount++;
+	}
+	ASSERT_EQ( fileCount, okCount );
+
+	StringArray names = Directory::GetFileNames(dirPath, "*.png");
+	ASSERT_EQ( fileCount * 2, names.GetSize() );
+	for(int i = 0; i < names.GetSize(); ++i)
+	{
+		ASSERT_FALSE( names[i].StartsWith("__") );
+	}
+
+	names = Directory::GetFileNames(dirPath, "*", true);
+	for(int i = 0; i < names.GetSize(); ++i)
+	{
+		File::Delete(names[i]);
+	}
+	Directory::Delete(dirPath);
+}
+
+// Test that the files of a batch are handled in the requested order
+TEST(POEngine, OptimizeMultiFilesDisk_Order)
+{
+	for(int jobCount = 1; jobCount <= 2; ++jobCount)
+	{
+		// By name, from paths given in reverse order
+		StringArray filePaths = CreateBatchFiles();
+		StringArray reversed;
+		for(int i = filePaths.GetSize() - 1; i >= 0; --i)
+		{
+			reversed.Add(filePaths[i]);
+		}
+		ProgressingRecorder nameRecorder;
+		POEngine nameEngine;
+		nameEngine.m_settings.backupOldPngFiles = false;
+		nameEngine.SetJobCount(jobCount);
+		nameEngine.SetBatchOrder(POEngine::BO_Name);
+		nameEngine.Progressing.Connect(&nameRecorder, &ProgressingRecorder::OnEngineProgressing);
+		ASSERT_FALSE( nameEngine.OptimizeMultiFilesDisk(reversed) );
+
+		String nameText = nameRecorder.m_text.ToString();
+		StringArray sorted = filePaths.Sort();
+		for(int i = 1; i < sorted.GetSize(); ++i)
+		{
+			ASSERT_TRUE( nameText.Find(sorted[i - 1], 0) < nameText.Find(sorted[i], 0) );
+		}
+
+		// By decreasing size
+		filePaths = CreateBatchFiles();
+		Array<int64> sizes;
+		for(int i = 0; i < filePaths.GetSize(); ++i)
+		{
+			sizes.Add(File::GetSize(filePaths[i]));
+		}
+		ProgressingRecorder sizeRecorder;
+		POEngine sizeEngine;
+		sizeEngine.m_settings.backupOldPngFiles = false;
+		sizeEngine.SetJobCount(jobCount);
+		sizeEngine.SetBatchOrder(POEngine::BO_Size);
+		sizeEngine.Progressing.Connect(&sizeRecorder, &ProgressingRecorder::OnEngineProgressing);
+		ASSERT_FALSE( sizeEngine.OptimizeMultiFilesDisk(filePaths) );
+
+		String sizeText = sizeRecorder.m_text.ToString();
+		for(int i = 0; i < filePaths.GetSize(); ++i)
+		{
+			for(int j = 0; j < filePaths.GetSize(); ++j)
+			{
+				if( sizes[i] > sizes[j] )
+				{
+					ASSERT_TRUE( sizeText.Find(filePaths[i], 0) < sizeText.Find(filePaths[j], 0) );
+				}
+			}
+		}
+
+		for(int i = 0; i < filePaths.GetSize(); ++i)
+		{
+			File::Delete(filePaths[i]);
+		}
+	}
+}
+
+// Test that reading the files in advance gives the same messages and files
+TEST(POEngine, OptimizeMultiFilesDisk_Prefetch)
+{
+	StringArray filePaths = CreateBatchFiles();
+	ProgressingRecorder refRecorder;
+	POEngine refEngine;
+	refEngine.m_settings.backupOldPngFiles = false;
+	refEngine.Progressing.Connect(&refRecorder, &ProgressingRecorder::OnEngineProgressing);
+	ASSERT_FALSE( refEngine.OptimizeMultiFilesDisk(filePaths) );
+
+	Array<ByteArray> refContents;
+	for(int i = 0; i < filePaths.GetSize(); ++i)
+	{
+		refContents.Add(File::GetContent(filePaths[i]));
+	}
+	String refText = RemoveBatchTime(refRecorder.m_text.ToString());
+
+	// A small budget cannot hold all the files at once
+	const int64 budgets[] = { 600, 1024 * 1024 };
+	for(int jobCount = 1; jobCount <= 2; ++jobCount)
+	{
+		for(int budgetIndex = 0; budgetIndex < 2; ++budgetIndex)
+		{
+			filePaths = CreateBatchFiles();
+			ProgressingRecorder recorder;
+			POEngine engine;
+			engine.m_settings.backupOldPngFiles = false;
+			engine.SetJobCount(jobCount);
+			engine.SetPrefetchBudget(budgets[budgetIndex]);
+			engine.Progressing.Connect(&recorder, &ProgressingRecorder::OnEngineProgressing);
+			ASSERT_FALSE( engine.OptimizeMultiFilesDisk(filePaths) );
+
+			ASSERT_TRUE( RemoveBatchTime(recorder.m_text.ToString()) == refText );
+			for(int i = 0; i < filePaths.GetSize(); ++i)
+			{
+				ASSERT_TRUE( File::GetContent(filePaths[i]) == refContents[i] );
+			}
+		}
+	}
+
+	for(int i = 0; i < filePaths.GetSize(); ++i)
+	{
+		File::Delete(filePaths[i]);
+	}
+}
+
+// Test the memory estimate and that a batch under a memory budget still optimizes all the files
+TEST(POEngine, OptimizeMultiFilesDisk_MemoryBudget)
+{
+	StringArray filePaths = CreateBatchFiles();
+	POEngine refEngine;
+	refEngine.m_settings.backupOldPngFiles = false;
+
+	// Grows with the image, known for an invalid file too
+	ASSERT_TRUE( refEngine.EstimateWorkingSet(filePaths[0]) > 0 );
+	ASSERT_TRUE( refEngine.EstimateWorkingSet(filePaths[0]) < refEngine.EstimateWorkingSet(filePaths[6]) );
+	ASSERT_TRUE( refEngine.EstimateWorkingSet(filePaths[2]) > 0 );
+	ASSERT_EQ( 0, refEngine.EstimateWorkingSet("batchmissing.png") );
+
+	ProgressingRecorder refRecorder;
+	refEngine.Progressing.Connect(&refRecorder, &ProgressingRecorder::OnEngineProgressing);
+	ASSERT_FALSE( refEngine.OptimizeMultiFilesDisk(filePaths) );
+
+	Array<ByteArray> refContents;
+	for(int i = 0; i < filePaths.GetSize(); ++i)
+	{
+		refContents.Add(File::GetContent(filePaths[i]));
+	}
+	String refText = RemoveBatchTime(refRecorder.m_text.ToString());
+
+	for(int jobCount = 1; jobCount <= 3; jobCount += 2)
+	{
+		// A budget big enough for all the files changes nothing
+		filePaths = CreateBatchFiles();
+		ProgressingRecorder recorder;
+		POEngine engine;
+		engine.m_settings.backupOldPngFiles = false;
+		engine.SetJobCount(jobCount);
+		engine.SetMemoryBudget(1024 * 1024 * 1024);
+		engine.Progressing.Connect(&recorder, &ProgressingRecorder::OnEngineProgressing);
+		ASSERT_FALSE( engine.OptimizeMultiFilesDisk(filePaths) );
+
+		ASSERT_TRUE( RemoveBatchTime(recorder.m_text.ToString()) == refText );
+		for(int i = 0; i < filePaths.GetSize(); ++i)
+		{
+			ASSERT_TRUE( File::GetContent(filePaths[i]) == refContents[i] );
+		}
+
+		// Every file is too big: optimized one at a time, with a single trial
+		filePaths = CreateBatchFiles();
+		ProgressingRecorder lowRecorder;
+		POEngine lowEngine;
+		lowEngine.m_settings.backupOldPngFiles = false;
+		lowEngine.SetJobCount(jobCount);
+		lowEngine.SetMemoryBudget(1);
+		lowEngine.Progressing.Connect(&lowRecorder, &ProgressingRecorder::OnEngineProgressing);
+		ASSERT_FALSE( lowEngine.OptimizeMultiFilesDisk(filePaths) );
+
+		String lowText = lowRecorder.m_text.ToString();
+		ASSERT_EQ( refText.Find("(KO)", 0) >= 0, lowText.Find("(KO)", 0) >= 0 );
+		for(int i = 0; i < filePaths.GetSize(); ++i)
+		{
+			if( i == 2 )
+			{
+				continue; // Invalid file
+			}
+			// The layout may differ, the trials are not the same
+			Png refPng, lowPng;
+			StaticMemoryFile smf;
+			ASSERT_TRUE( smf.OpenRead(refContents[i].GetPtr(), refContents[i].GetSize()) );
+			ASSERT_TRUE( refPng.LoadFromFile(smf) );
+			ASSERT_TRUE( lowPng.Load(filePaths[i]) );
+			ASSERT_EQ( refPng.GetWidth(), lowPng.GetWidth() );
+			ASSERT_EQ( refPng.GetHeight(), lowPng.GetHeight() );
+		}
+	}
+
+	for(int i = 0; i < filePaths.GetSize(); ++i)
+	{
+		File::Delete(filePaths[i]);
+	}
+}
+
+// Test that the result does not depend on the number of threads performing the trials
+TEST(POEngine, ThreadCount)
+{
+	PngDumpData dd;
+	dd.pixelFormat = PF_24bppRgb;
+	dd.width = 40;
+	dd.height = 30;
+	dd.pixels.SetSize(dd.width * dd.height * 3);
+	uint8* pPixels = dd.pixels.GetWritePtr();
+	for(int i = 0; i < dd.pixels.GetSize(); ++i)
+	{
+		pPixels[i] = uint8((i * 7) / 13);
+	}
+
+	ByteArray expected;
+	for(int threadCount = 1; threadCount <= 5; ++threadCount)
+	{
+		POEngine engine;
+		engine.m_settings.threadCount = threadCount;
+		File::Delete("result.png");
+		ASSERT_TRUE( engine.OptimizeExternalBuffer(dd, "result.png") );
+
+		ByteArray content = File::GetContent("result.png");
+		ASSERT_TRUE( content.GetSize() > 0 );
+		if( threadCount == 1 )
+		{
+			expected = content;
+		}
+		ASSERT_TRUE( content == expected );
+	}
+}
+
+// Test that the fast mode skips trials without losing much
+TEST(POEngine, FastMode)
+{
+	PngDumpData dd;
+	dd.pixelFormat = PF_24bppRgb;
+	dd.width = 200;
+	dd.height = 150;
+	dd.pixels.SetSize(dd.width * dd.height * 3);
+	uint8* pPixels = dd.pixels.GetWritePtr();
+	uint32 noise = 1;
+	for(int i = 0; i < dd.pixels.GetSize(); ++i)
+	{
+		// Gradient with some noise, adaptive filtering wins
+		noise = noise * 1103515245 + 12345;
+		pPixels[i] = uint8((i % 600) / 3 + ((noise >> 16) & 3));
+	}
+
+	int64 sizes[2];
+	for(int fastMode = 0; fastMode <= 1; ++fastMode)
+	{
+		POEngine engine;
+		engine.m_settings.fastMode = (fastMode != 0);
+		File::Delete("result.png");
+		ASSERT_TRUE( engine.OptimizeExternalBuffer(dd, "result.png") );
+		sizes[fastMode] = File::GetContent("result.png").GetSize();
+		ASSERT_TRUE( sizes[fastMode] > 0 );
+	}
+	ASSERT_TRUE( sizes[1] >= sizes[0] );
+	ASSERT_TRUE( sizes[1] <= sizes[0] + sizes[0] / 20 );
+}
+
+// Test that the fast mode still finds the palette layout of a 24 bits image with few colors
+TEST(POEngine, FastMode_FewColors)
+{
+	PngDumpData dd;
+	dd.pixelFormat = PF_24bppRgb;
+	dd.width = 200;
+	dd.height = 150;
+	dd.pixels.SetSize(dd.width * dd.height * 3);
+	uint8* pPixels = dd.pixels.GetWritePtr();
+	uint32 noise = 1;
+	for(int i = 0; i < dd.width * dd.height; ++i)
+	{
+		// 8 colors
+		noise = noise * 1103515245 + 12345;
+		const uint8 value = uint8(((noise >> 16) & 7) * 32);
+		pPixels[i * 3 + 0] = value;
+		pPixels[i * 3 + 1] = value;
+		pPixels[i * 3 + 2] = 255 - value;
+	}
+
+	int64 sizes[2];
+	for(int fastMode = 0; fastMode <= 1; ++fastMode)
+	{
+		POEngine engine;
+		engine.m_settings.fastMode = (fastMode != 0);
+		File::Delete("result.png");
+		ASSERT_TRUE( engine.OptimizeExternalBuffer(dd, "result.png") );
+		sizes[fastMode] = File::GetContent("result.png").GetSize();
+		ASSERT_TRUE( sizes[fastMode] > 0 );
+	}
+	ASSERT_EQ( sizes[0], sizes[1] );
+}
+
+// Test that a RGBA image with few colors and partial alpha becomes indexed, with its alphas in tRNS
+TEST(POEngine, FewColorsRgbaToPalette)
+{
+	static const uint8 colors[5][4] = {
+		{ 0, 0, 0, 0 },
+		{ 255, 0, 0, 255 },
+		{ 0, 128, 255, 128 },
+		{ 30, 60, 90, 200 },
+		{ 255, 255, 255, 64 }
+	};
+
+	PngDumpData dd;
+	dd.pixelFormat = PF_32bppRgba;
+	dd.width = 100;
+	dd.height = 80;
+	dd.pixels.SetSize(dd.width * dd.height * 4);
+	uint8* pPixels = dd.pixels.GetWritePtr();
+	for(int y = 0; y < dd.height; ++y)
+	{
+		for(int x = 0; x < dd.width; ++x)
+		{
+			const uint8* pColor = colors[((x / 7) + (y / 5)) % 5];
+			Memory::Copy(pPixels + (y * dd.width + x) * 4, pColor, 4);
+		}
+	}
+
+	POEngine engine;
+	File::Delete("result.png");
+	ASSERT_TRUE( engine.OptimizeExternalBuffer(dd, "result.png") );
+
+	Png png;
+	ASSERT_TRUE( png.Load("result.png") );
+	ASSERT_EQ( dd.width, png.GetWidth() );
+	ASSERT_EQ( dd.height, png.GetHeight() );
+	ASSERT_TRUE( ImageFormat::IsIndexed(png.GetPixelFormat()) );
+	ASSERT_TRUE( png.HasSimpleTransparency() );
+
+	Buffer indexes = png.GetPixels();
+	ASSERT_TRUE( ImageFormat::UnpackPixels(indexes, dd.width, dd.height, png.GetPixelFormat()) );
+	const Palette& palette = png.GetPalette();
+	const uint8* pIndexes = indexes.GetReadPtr();
+	for(int i = 0; i < dd.width * dd.height; ++i)
+	{
+		ASSERT_TRUE( pIndexes[i] < palette.m_count );
+		uint8 r, g, b, a;
+		palette[pIndexes[i]].ToRgba(r, g, b, a);
+		const uint8* pExpected = pPixels + i * 4;
+		ASSERT_EQ( pExpected[0], r );
+		ASSERT_EQ( pExpected[1], g );
+		ASSERT_EQ( pExpected[2], b );
+		ASSERT_EQ( pExpected[3], a );
+	}
+}
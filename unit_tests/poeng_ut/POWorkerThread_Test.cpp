@@ -0,0 +1,129 @@
+#include "stdafx.h"
+
+// Performs trials on an image with one worker thread
+// [in]  dd             Image
+// [in]  pTrials        Trials to perform
+// [in]  trialCount     Number of trials
+// [in]  maxSharedSize  See POTrialSet::SetMaxSharedSize
+// [out] result         Smallest file
+// [out] resultTrial    Index of the trial that gave it
+static void PerformTrials(const PngDumpData& dd, const POTrial* pTrials, int trialCount, int64 maxSharedSize,
+                          Buffer& result, int& resultTrial)
+{
+	POTrialSet trialSet;
+	trialSet.SetMaxSharedSize(maxSharedSize);
+	trialSet.Init(&dd, pTrials, trialCount, MAX_INT64);
+
+	POWorkerThread worker;
+	ASSERT_TRUE( worker.Create() );
+	ASSERT_TRUE( worker.Begin(&trialSet) );
+	worker.Wait();
+	ASSERT_TRUE( worker.Succeeded() );
+	trialSet.Clear();
+
+	DynamicMemoryFile& dmf = worker.GetResult();
+	const int32 size = int32(dmf.GetPosition());
+	ASSERT_TRUE( result.SetSize(size) );
+	Memory::Copy(result.GetWritePtr(), dmf.GetContent().GetReadPtr(), size);
+	resultTrial = worker.GetResultTrial();
+}
+
+// Trials filtering the rows by bands give the same file as trials sharing the scanlines
+TEST(POWorkerThread, StreamedTrials)
+{
+	PngDumpData dd;
+	dd.pixelFormat = PF_32bppRgba;
+	dd.width = 200;
+	dd.height = 150;
+	dd.pixels.SetSize(dd.width * dd.height * 4);
+	uint8* pPixels = dd.pixels.GetWritePtr();
+	uint32 seed = 1;
+	for(int i = 0; i < dd.width * dd.height; ++i)
+	{
+		// Gradients with a little noise, so the filterings give different sizes
+		seed = seed * 1103515245 + 12345;
+		const int x = i % dd.width;
+		const int y = i / dd.width;
+		pPixels[4 * i + 0] = uint8(x + (seed >> 29));
+		pPixels[4 * i + 1] = uint8(y);
+		pPixels[4 * i + 2] = uint8(x + y);
+		pPixels[4 * i + 3] = uint8(255 - (seed >> 30));
+	}
+
+	Array<POTrial> trials;
+	POTrial::GetDefaultTrials(trials);
+
+	Buffer shared;
+	int sharedTrial = -1;
+	PerformTrials(dd, trials.GetPtr(), trials.GetSize(), MAX_INT64, shared, sharedTrial);
+
+	Buffer streamed;
+	int streamedTrial = -1;
+	PerformTrials(dd, trials.GetPtr(), trials.GetSize(), 0, streamed, streamedTrial);
+
+	ASSERT_TRUE( sharedTrial >= 0 );
+	ASSERT_EQ( sharedTrial, streamedTrial );
+	ASSERT_EQ( shared.GetSize(), streamed.GetSize() );
+	ASSERT_TRUE( Memory::Equals(shared.GetReadPtr(), streamed.GetReadPtr(), shared.GetSize()) );
+}
+
+// Trials of the same run keep their own block size, the unset ones take the inherited one
+TEST(POWorkerThread, PerTrialBlockSize)
+{
+	PngDumpData dd;
+	dd.pixelFormat = PF_24bppRgb;
+	dd.width = 256;
+	dd.height = 256;
+	dd.pixels.SetSize(dd.width * dd.height * 3);
+	uint8* pPixels = dd.pixels.GetWritePtr();
+	uint32 seed = 7;
+	for(int i = 0; i < dd.pixels.GetSize(); ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		pPixels[i] = uint8(seed >> 29);
+	}
+
+	Array<POTrial> trials;
+	POTrial trial;
+	trial.deflateBlockSize = 32 * 1024;
+	trials.Add(trial);
+	trial.deflateBlockSize = 0;
+	trials.Add(trial);
+	for(int i = 0; i < trials.GetSize(); ++i)
+	{
+		trials[i].InheritDeflateSettings(0, 2);
+	}
+	ASSERT_EQ( 32 * 1024, trials[0].GetDumpSettings().deflateBlockSize );
+	ASSERT_EQ( 0, trials[1].GetDumpSettings().deflateBlockSize );
+	ASSERT_EQ( 2, trials[1].GetDumpSettings().deflateThreadCount );
+
+	// The files each trial gives on its own, and performed alone
+	Buffer expected[2];
+	for(int i = 0; i < 2; ++i)
+	{
+		DynamicMemoryFile dmf;
+		ASSERT_TRUE( dmf.Open(0) );
+		ASSERT_TRUE( PngDumper::Dump(dmf, dd, trials[i].GetDumpSettings()) );
+		const int32 size = int32(dmf.GetPosition());
+		ASSERT_TRUE( expected[i].SetSize(size) );
+		Memory::Copy(expected[i].GetWritePtr(), dmf.GetContent().GetReadPtr(), size);
+
+		Buffer result;
+		int resultTrial = -1;
+		PerformTrials(dd, trials.GetPtr() + i, 1, MAX_INT64, result, resultTrial);
+		ASSERT_EQ( 0, resultTrial );
+		ASSERT_EQ( expected[i].GetSize(), result.GetSize() );
+		ASSERT_TRUE( Memory::Equals(expected[i].GetReadPtr(), result.GetReadPtr(), result.GetSize()) );
+	}
+	ASSERT_FALSE( expected[0].GetSize() == expected[1].GetSize()
+	              && Memory::Equals(expected[0].GetReadPtr(), expected[1].GetReadPtr(), expected[0].GetSize()) );
+
+	// Both trials in one run: the smallest file wins
+	const int best = (expected[1].GetSize() < expected[0].GetSize()) ? 1 : 0;
+	Buffer result;
+	int resultTrial = -1;
+	PerformTrials(dd, trials.GetPtr(), trials.GetSize(), MAX_INT64, result, resultTrial);
+	ASSERT_EQ( best, resultTrial );
+	ASSERT_EQ( expected[best].GetSize(), result.GetSize() );
+	ASSERT_TRUE( Memory::Equals(expected[best].GetReadPtr(), result.GetReadPtr(), result.GetSize()) );
+}
@@ -260,3 +260,31 @@ TEST(PaletteTranslator, BuildDuplicatedColors)
 	
 	ASSERT_TRUE( memcmp(pixels, expectedPixels, sizeof(pixels)) == 0 );
 }
+
+TEST(PaletteTranslator, Invert)
+{
+	uint32 colCounts[256];
+	Memory::Zero(colCounts, sizeof(colCounts));
+	colCounts[0] = 100;
+	colCounts[1] = 101;
+	colCounts[2] = 102;
+
+	Palette pal;
+	pal.m_count = 3;
+	pal[0] = Color(1, 0, 1);
+	pal[1] = Color(0, 1, 0);
+	pal[2] = Color(0, 0, 1);
+
+	PaletteTranslator pt;
+	pt.BuildSortPopulation(pal, colCounts);
+	PaletteTranslator inverse = PaletteTranslator::Invert(pt);
+
+	uint8 pixels[] = { 0, 1, 2, 2, 1, 0 };
+	pt.Translate(pixels, ARRAY_SIZE(pixels));
+	ASSERT_EQ( 2, pixels[0] );
+	ASSERT_EQ( 0, pixels[2] );
+
+	inverse.Translate(pixels, ARRAY_SIZE(pixels));
+	const uint8 expected[] = { 0, 1, 2, 2, 1, 0 };
+	ASSERT_TRUE( Memory::Equals(expected, pixels, ARRAY_SIZE(pixels)) );
+}
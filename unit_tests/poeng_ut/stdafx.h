@@ -11,6 +11,7 @@
 #include <chustd/chustd.h>
 #include <poeng/poeng.h>
 #include <poeng/PaletteTranslator.h>
+#include <poeng/ColorIndexer.h>
 
 using namespace chustd;
 